@@ -202,6 +202,22 @@ int fdfs_client_init(const char *filename)
 			break;
 		}
 
+		g_topology_check_interval = iniGetIntValue( \
+				"topology_check_interval", items, nItemCount, \
+				FDFS_DEF_TOPOLOGY_CHECK_INTERVAL);
+		if (g_topology_check_interval < 0)
+		{
+			g_topology_check_interval = 0;
+		}
+		memset(&g_topology, 0, sizeof(g_topology));
+
+		g_proto_version = iniGetIntValue("proto_version", \
+				items, nItemCount, FDFS_PROTO_VERSION_1);
+		if (g_proto_version != FDFS_PROTO_VERSION_2)
+		{
+			g_proto_version = FDFS_PROTO_VERSION_1;
+		}
+
 		g_tracker_servers = (TrackerServerInfo *)malloc( \
 			sizeof(TrackerServerInfo) * g_tracker_server_count);
 		if (g_tracker_servers == NULL)
@@ -223,9 +239,12 @@ int fdfs_client_init(const char *filename)
 #ifdef __DEBUG__
 		fprintf(stderr, "base_path=%s, " \
 			"network_timeout=%d, "\
-			"tracker_server_count=%d\n", \
+			"tracker_server_count=%d, " \
+			"topology_check_interval=%d, " \
+			"proto_version=%d\n", \
 			g_base_path, g_network_timeout, \
-			g_tracker_server_count);
+			g_tracker_server_count, g_topology_check_interval, \
+			g_proto_version);
 #endif
 
 		break;
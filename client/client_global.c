@@ -6,9 +6,12 @@
 * Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
 **/
 
+#include "tracker_proto.h"
 #include "client_global.h"
 
 int g_tracker_server_count = 0;
 TrackerServerInfo *g_tracker_servers = NULL;
 int g_tracker_server_index = 0;
-
+int g_topology_check_interval = FDFS_DEF_TOPOLOGY_CHECK_INTERVAL;
+FDFSTopology g_topology;
+int g_proto_version = FDFS_PROTO_VERSION_1;
@@ -13,6 +13,26 @@
 
 #include "tracker_types.h"
 
+#define FDFS_DEF_TOPOLOGY_CHECK_INTERVAL  60
+
+typedef struct
+{
+	char group_name[FDFS_GROUP_NAME_MAX_LEN + 1];
+	int storage_port;
+	int server_count;  //active server count
+	int current_read_server;
+	char server_ips[FDFS_MAX_SERVERS_EACH_GROUP][FDFS_IPADDR_SIZE];
+} FDFSGroupTopology;
+
+typedef struct
+{
+	bool loaded;
+	int version;  //topology version of the tracker server
+	time_t last_check_time;
+	int group_count;
+	FDFSGroupTopology groups[FDFS_MAX_GROUPS];  //order by group_name
+} FDFSTopology;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -21,6 +41,14 @@ extern int g_tracker_server_count;
 extern int g_tracker_server_index;  //server index for roundrobin
 extern TrackerServerInfo *g_tracker_servers;
 
+extern int g_topology_check_interval;  //seconds, 0 for no cache
+/* cached groups and active servers, accessed by tracker_client.c only
+   under its topology lock */
+extern FDFSTopology g_topology;
+
+//the protocol version of the upload and download requests
+extern int g_proto_version;
+
 #ifdef __cplusplus
 }
 #endif
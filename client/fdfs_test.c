@@ -30,12 +30,24 @@ int main(int argc, char *argv[])
 	int meta_count;
 	int i;
 	FDFSMetaData *pMetaList;
-	char buff[13];
+	char buff[64];
 	int len;
-        char *file_buff;
-	int file_size;
+	int64_t file_size;
+	int64_t download_size;
+	unsigned int crc32;
 	char *operation;
 	char *meta_buff;
+	char *pBaseName;
+	char *keys[STORAGE_MAX_BATCH_META_KEYS];
+	FDFSFileMetaData file_metas[STORAGE_MAX_BATCH_META_COUNT];
+	int key_count;
+	int file_count;
+	int k;
+	char **filenames;
+	FDFSDownloadResult *download_results;
+	char session_id[FDFS_UPLOAD_SESSION_ID_LEN + 1];
+	int thread_count;
+	int64_t offset;
 
 	base64_init_ex(0, '.', '_', '-');
 	printf("This is FastDFS client test program v%d.%d\n" \
@@ -49,8 +61,11 @@ int main(int argc, char *argv[])
 	if (argc < 3)
 	{
 		printf("Usage: %s <config_file> <operation>\n" \
-			"\toperation: upload, download, getmeta, setmeta " \
-			"and delete\n", argv[0]);
+			"\toperation: upload, upload_parts, " \
+			"upload_appender, append, download, " \
+			"downloads, getmeta, getmetas, setmeta, query " \
+			"and delete\n", \
+			argv[0]);
 		return 1;
 	}
 
@@ -130,12 +145,401 @@ int main(int argc, char *argv[])
 		}
 
 		memset(buff, 0, sizeof(buff));
-		base64_decode(remote_filename + 6, strlen(remote_filename) - 6, buff, &len);
+		pBaseName = strrchr(remote_filename, '/');
+		pBaseName = pBaseName != NULL ? pBaseName + 1 : remote_filename;
+		base64_decode(pBaseName, strlen(pBaseName), buff, &len);
 		printf("group_name=%s, remote_filename=%s\n", \
 			group_name, remote_filename);
 		printf("file timestamp=%d\n", buff2int(buff));
-		printf("file size=%d\n", buff2int(buff+4));
+		if (storage_get_file_checksum(remote_filename, \
+			&file_size, &crc32) == 0)
+		{
+			printf("file size="INT64_PRINTF_FORMAT"\n", \
+				file_size);
+			printf("file crc32=%08X\n", crc32);
+		}
+		else
+		{
+			printf("file size=%u\n", \
+				(unsigned int)buff2int(buff+4));
+		}
+
+	}
+	else if (strcmp(operation, "upload_parts") == 0)
+	{
+		if (argc < 4)
+		{
+			printf("Usage: %s <config_file> upload_parts " \
+				"<local_filename> [thread_count] " \
+				"[session_id <storage_ip:port>]\n" \
+				"\tsession_id: the session to resume on " \
+				"the storage server\n", argv[0]);
+			fdfs_client_destroy();
+			return EINVAL;
+		}
+
+		local_filename = argv[3];
+		thread_count = argc >= 5 ? atoi(argv[4]) : 4;
+		snprintf(session_id, sizeof(session_id), "%s", \
+			argc >= 6 ? argv[5] : "");
+		if ((result=tracker_query_storage_store(pTrackerServer, \
+		                &storageServer)) != 0)
+		{
+			fdfs_client_destroy();
+			printf("tracker_query_storage fail, " \
+				"error no: %d, error info: %s\n", \
+				result, strerror(result));
+			return result;
+		}
+
+		/* the session is on the storage server which began it */
+		if (argc >= 7 && (meta_buff=strchr(argv[6], ':')) != NULL)
+		{
+			*meta_buff = '\0';
+			snprintf(storageServer.ip_addr, \
+				sizeof(storageServer.ip_addr), "%s", argv[6]);
+			storageServer.port = atoi(meta_buff + 1);
+		}
+
+		printf("group_name=%s, ip_addr=%s, port=%d\n", \
+			storageServer.group_name, \
+			storageServer.ip_addr, \
+			storageServer.port);
+
+		if ((result=tracker_connect_server(&storageServer)) != 0)
+		{
+			fdfs_client_destroy();
+			return result;
+		}
+
+		memset(&meta_list, 0, sizeof(meta_list));
+		meta_count = 0;
+		strcpy(meta_list[meta_count].name, "ext_name");
+		strcpy(meta_list[meta_count].value, "bin");
+		meta_count++;
+		result = storage_upload_by_parts(pTrackerServer, \
+				&storageServer, local_filename, \
+				meta_list, meta_count, thread_count, \
+				session_id, group_name, remote_filename);
+		if (result != 0)
+		{
+			printf("storage_upload_by_parts fail, " \
+				"session_id=%s, " \
+				"error no: %d, error info: %s\n", \
+				session_id, result, strerror(result));
+		}
+		else
+		{
+			printf("group_name=%s, remote_filename=%s\n", \
+				group_name, remote_filename);
+			if (storage_get_file_checksum(remote_filename, \
+				&file_size, &crc32) == 0)
+			{
+				printf("file crc32=%08X\n", crc32);
+			}
+		}
+	}
+	else if (strcmp(operation, "upload_appender") == 0)
+	{
+		if (argc < 4)
+		{
+			printf("Usage: %s <config_file> upload_appender " \
+				"<local_filename>\n", argv[0]);
+			fdfs_client_destroy();
+			return EINVAL;
+		}
+
+		local_filename = argv[3];
+		if ((result=tracker_query_storage_store(pTrackerServer, \
+		                &storageServer)) != 0)
+		{
+			fdfs_client_destroy();
+			printf("tracker_query_storage fail, " \
+				"error no: %d, error info: %s\n", \
+				result, strerror(result));
+			return result;
+		}
+
+		printf("group_name=%s, ip_addr=%s, port=%d\n", \
+			storageServer.group_name, \
+			storageServer.ip_addr, \
+			storageServer.port);
+
+		if ((result=tracker_connect_server(&storageServer)) != 0)
+		{
+			fdfs_client_destroy();
+			return result;
+		}
 
+		result = storage_upload_appender_by_filename(pTrackerServer, \
+				&storageServer, local_filename, NULL, 0, \
+				group_name, remote_filename);
+		if (result != 0)
+		{
+			printf("storage_upload_appender_by_filename fail, " \
+				"error no: %d, error info: %s\n", \
+				result, strerror(result));
+		}
+		else
+		{
+			printf("group_name=%s, remote_filename=%s\n", \
+				group_name, remote_filename);
+			if (storage_get_appender_source(remote_filename, \
+				buff) == 0)
+			{
+				printf("source storage=%s\n", buff);
+			}
+		}
+	}
+	else if (strcmp(operation, "append") == 0)
+	{
+		if (argc < 6)
+		{
+			printf("Usage: %s <config_file> append " \
+				"<group_name> <remote_filename> " \
+				"<local_filename>\n", argv[0]);
+			fdfs_client_destroy();
+			return EINVAL;
+		}
+
+		snprintf(group_name, sizeof(group_name), "%s", argv[3]);
+		snprintf(remote_filename, sizeof(remote_filename), \
+				"%s", argv[4]);
+		local_filename = argv[5];
+		if ((result=tracker_query_storage_fetch(pTrackerServer, \
+       	       		&storageServer, group_name, remote_filename)) != 0)
+		{
+			fdfs_client_destroy();
+			printf("tracker_query_storage_fetch fail, " \
+				"error no: %d, error info: %s\n", \
+				result, strerror(result));
+			return result;
+		}
+
+		/* the appender file is appended on its source storage */
+		if ((result=storage_get_appender_source(remote_filename, \
+			storageServer.ip_addr)) != 0)
+		{
+			fdfs_client_destroy();
+			printf("%s is not an appender file\n", \
+				remote_filename);
+			return result;
+		}
+
+		printf("storage=%s:%d\n", storageServer.ip_addr, \
+			storageServer.port);
+
+		if ((result=tracker_connect_server(&storageServer)) != 0)
+		{
+			fdfs_client_destroy();
+			return result;
+		}
+
+		result = storage_append_by_filename(pTrackerServer, \
+				&storageServer, local_filename, group_name, \
+				remote_filename, &offset);
+		if (result != 0)
+		{
+			printf("storage_append_by_filename fail, " \
+				"error no: %d, error info: %s\n", \
+				result, strerror(result));
+		}
+		else
+		{
+			printf("append file success, offset=" \
+				INT64_PRINTF_FORMAT"\n", offset);
+		}
+	}
+	else if (strcmp(operation, "getmetas") == 0)
+	{
+		if (argc < 6)
+		{
+			printf("Usage: %s <config_file> getmetas " \
+				"<group_name> <keys> <remote_filename> " \
+				"[remote_filename ...]\n" \
+				"\tkeys: key names seperated by comma, " \
+				"* for all keys\n", argv[0]);
+			fdfs_client_destroy();
+			return EINVAL;
+		}
+
+		snprintf(group_name, sizeof(group_name), "%s", argv[3]);
+		key_count = 0;
+		if (strcmp(argv[4], "*") != 0)
+		{
+			key_count = splitEx(argv[4], ',', keys, \
+					STORAGE_MAX_BATCH_META_KEYS);
+		}
+		file_count = argc - 5;
+		if (file_count > STORAGE_MAX_BATCH_META_COUNT)
+		{
+			file_count = STORAGE_MAX_BATCH_META_COUNT;
+		}
+
+		if ((result=tracker_query_storage_fetch(pTrackerServer, \
+       	       		&storageServer, group_name, argv[5])) != 0)
+		{
+			fdfs_client_destroy();
+			printf("tracker_query_storage_fetch fail, " \
+				"group_name=%s, filename=%s, " \
+				"error no: %d, error info: %s\n", \
+				group_name, argv[5], \
+				result, strerror(result));
+			return result;
+		}
+
+		printf("storage=%s:%d\n", storageServer.ip_addr, \
+			storageServer.port);
+
+		if ((result=tracker_connect_server(&storageServer)) != 0)
+		{
+			fdfs_client_destroy();
+			return result;
+		}
+
+		if ((result=storage_get_metadata_batch(pTrackerServer, \
+			&storageServer, group_name, \
+			(const char **)(argv + 5), file_count, \
+			(const char **)keys, key_count, file_metas)) == 0)
+		{
+			for (i=0; i<file_count; i++)
+			{
+				printf("%s: status=%d, meta count=%d\n", \
+					argv[5 + i], file_metas[i].status, \
+					file_metas[i].meta_count);
+				for (k=0; k<file_metas[i].meta_count; k++)
+				{
+					printf("\t%s=%s\n", \
+					file_metas[i].meta_list[k].name, \
+					file_metas[i].meta_list[k].value);
+				}
+			}
+
+			storage_free_metadata_batch(file_metas, file_count);
+		}
+		else
+		{
+			printf("getmetas fail, " \
+				"error no: %d, error info: %s\n", \
+				result, strerror(result));
+		}
+	}
+	else if (strcmp(operation, "downloads") == 0)
+	{
+		if (argc < 5)
+		{
+			printf("Usage: %s <config_file> downloads " \
+				"<group_name> <remote_filename> " \
+				"[remote_filename ...]\n", argv[0]);
+			fdfs_client_destroy();
+			return EINVAL;
+		}
+
+		snprintf(group_name, sizeof(group_name), "%s", argv[3]);
+		file_count = argc - 4;
+		download_results = (FDFSDownloadResult *)malloc( \
+				sizeof(FDFSDownloadResult) * file_count);
+		if (download_results == NULL)
+		{
+			fdfs_client_destroy();
+			return errno != 0 ? errno : ENOMEM;
+		}
+
+		if ((result=tracker_query_storage_fetch(pTrackerServer, \
+       	       		&storageServer, group_name, argv[4])) != 0)
+		{
+			free(download_results);
+			fdfs_client_destroy();
+			printf("tracker_query_storage_fetch fail, " \
+				"group_name=%s, filename=%s, " \
+				"error no: %d, error info: %s\n", \
+				group_name, argv[4], \
+				result, strerror(result));
+			return result;
+		}
+
+		printf("storage=%s:%d\n", storageServer.ip_addr, \
+			storageServer.port);
+
+		if ((result=tracker_connect_server(&storageServer)) != 0)
+		{
+			free(download_results);
+			fdfs_client_destroy();
+			return result;
+		}
+
+		result = storage_download_files(pTrackerServer, \
+			&storageServer, group_name, \
+			(const char **)(argv + 4), file_count, \
+			download_results);
+		for (i=0; i<file_count; i++)
+		{
+			printf("%s: result=%d, file size=%d\n", \
+				argv[4 + i], download_results[i].result, \
+				download_results[i].file_size);
+		}
+		if (result != 0)
+		{
+			printf("downloads fail, " \
+				"error no: %d, error info: %s\n", \
+				result, strerror(result));
+		}
+
+		storage_free_download_results(download_results, file_count);
+		free(download_results);
+	}
+	else if (strcmp(operation, "query") == 0)
+	{
+		if (argc < 6)
+		{
+			printf("Usage: %s <config_file> query " \
+				"<group_name> <meta_name> <meta_value> " \
+				"[cursor]\n" \
+				"\tcursor: the last filename of the " \
+				"previous page\n", argv[0]);
+			fdfs_client_destroy();
+			return EINVAL;
+		}
+
+		snprintf(group_name, sizeof(group_name), "%s", argv[3]);
+		if ((result=tracker_query_storage_fetch(pTrackerServer, \
+       	       		&storageServer, group_name, argv[4])) != 0)
+		{
+			fdfs_client_destroy();
+			printf("tracker_query_storage_fetch fail, " \
+				"group_name=%s, " \
+				"error no: %d, error info: %s\n", \
+				group_name, result, strerror(result));
+			return result;
+		}
+
+		printf("storage=%s:%d\n", storageServer.ip_addr, \
+			storageServer.port);
+
+		if ((result=tracker_connect_server(&storageServer)) != 0)
+		{
+			fdfs_client_destroy();
+			return result;
+		}
+
+		if ((result=storage_query_by_metadata(pTrackerServer, \
+			&storageServer, group_name, argv[4], argv[5], \
+			argc >= 7 ? argv[6] : NULL, 100, \
+			&filenames, &file_count)) == 0)
+		{
+			printf("file count=%d\n", file_count);
+			for (i=0; i<file_count; i++)
+			{
+				printf("\t%s\n", filenames[i]);
+			}
+			free(filenames);
+		}
+		else
+		{
+			printf("query fail, " \
+				"error no: %d, error info: %s\n", \
+				result, strerror(result));
+		}
 	}
 	else if (strcmp(operation, "download") == 0 || 
 		strcmp(operation, "getmeta") == 0 ||
@@ -177,37 +581,32 @@ int main(int argc, char *argv[])
 
 		if (strcmp(operation, "download") == 0)
 		{
-			if ((result=storage_download_file(pTrackerServer, \
-				&storageServer, group_name, remote_filename, \
-				&file_buff, &file_size)) == 0)
+			if (argc >= 6)
+			{
+				local_filename = argv[5];
+			}
+			else
 			{
-				if (argc >= 6)
+				local_filename = strrchr(remote_filename, '/');
+				if (local_filename != NULL)
 				{
-					local_filename = argv[5];
+					local_filename++;  //skip /
 				}
 				else
 				{
-					local_filename = strrchr( \
-							remote_filename, '/');
-					if (local_filename != NULL)
-					{
-						local_filename++;  //skip /
-					}
-					else
-					{
-						local_filename=remote_filename;
-					}
+					local_filename=remote_filename;
 				}
+			}
 
-				if (writeToFile(local_filename, file_buff, \
-						file_size) == 0)
-				{
-					printf("download file success, " \
-						"file size=%d, " \
-						"file save to %s\n", \
-						 file_size, local_filename);
-				}
-				free(file_buff);
+			if ((result=storage_download_file_to_file( \
+				pTrackerServer, &storageServer, group_name, \
+				remote_filename, local_filename, \
+				&download_size)) == 0)
+			{
+				printf("download file success, " \
+					"file size="INT64_PRINTF_FORMAT", " \
+					"file save to %s\n", \
+					 download_size, local_filename);
 			}
 			else
 			{
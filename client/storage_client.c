@@ -8,6 +8,7 @@
 
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -16,6 +17,10 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include "fdfs_define.h"
 #include "logger.h"
 #include "fdfs_global.h"
@@ -27,6 +32,125 @@
 #include "storage_client.h"
 #include "client_global.h"
 #include "fdfs_base64.h"
+#include "crc32.h"
+
+/* pack the request header just before the body, the buffer before the
+   body should >= FDFS_PROTO_MAX_HEADER_SIZE, return the start of the header */
+static char *storage_pack_header_ex(const char version, const char cmd, \
+		const int request_id, const int64_t pkg_len, char *pBody)
+{
+	char buff[FDFS_PROTO_MAX_HEADER_SIZE];
+	FDFSProtoHeader header;
+	int header_len;
+
+	header.pkg_len = pkg_len;
+	header.request_id = request_id;
+	header.cmd = cmd;
+	header.status = 0;
+	header.flags = 0;
+	header.version = version;
+	header_len = fdfs_pack_header(&header, buff);
+	memcpy(pBody - header_len, buff, header_len);
+	return pBody - header_len;
+}
+
+/* the single request waits for its response, the request id is not used */
+#define storage_pack_header(cmd, pkg_len, pBody) \
+	storage_pack_header_ex(g_proto_version, cmd, 0, pkg_len, pBody)
+
+int storage_get_file_checksum(const char *remote_filename, \
+		int64_t *file_size, unsigned int *crc32)
+{
+	const char *pBaseName;
+	char buff[64];
+	int len;
+
+	pBaseName = strrchr(remote_filename, '/');
+	pBaseName = (pBaseName == NULL) ? remote_filename : pBaseName + 1;
+	len = strlen(pBaseName);
+	if (len != FDFS_FILENAME_ID_BYTES * 4 / 3 || \
+		strstr(remote_filename, "/"FDFS_TRUNK_DIR_NAME"/") != NULL)
+	{
+		return ENOENT;  //old filename or packed in a trunk file
+	}
+
+	base64_decode((char *)pBaseName, len, buff, &len);
+	if (len != FDFS_FILENAME_ID_BYTES)
+	{
+		return ENOENT;
+	}
+
+	*file_size = (unsigned int)buff2int((unsigned char *)buff + \
+				sizeof(int));
+	if (((unsigned char)buff[sizeof(int) * 3]) & \
+		FDFS_FILENAME_SIZE_HIGH_FLAG)
+	{
+		*file_size |= ((int64_t)(buff[sizeof(int) * 3] & 0x7F) << 40) \
+			| ((int64_t)(unsigned char)buff[sizeof(int) * 3 + 1] \
+				<< 32);
+	}
+	*crc32 = buff2int((unsigned char *)buff + sizeof(int) * 2);
+	return 0;
+}
+
+int storage_get_appender_source(const char *remote_filename, char *ip_addr)
+{
+	const char *pBaseName;
+	char buff[64];
+	struct in_addr ip;
+	int len;
+
+	pBaseName = strrchr(remote_filename, '/');
+	pBaseName = (pBaseName == NULL) ? remote_filename : pBaseName + 1;
+	len = strlen(pBaseName);
+	if (len != FDFS_FILENAME_ID_BYTES * 4 / 3 + \
+		sizeof(FDFS_APPENDER_FILE_EXT) - 1 || \
+		strcmp(pBaseName + FDFS_FILENAME_ID_BYTES * 4 / 3, \
+			FDFS_APPENDER_FILE_EXT) != 0)
+	{
+		return EINVAL;
+	}
+
+	base64_decode((char *)pBaseName, FDFS_FILENAME_ID_BYTES * 4 / 3, \
+			buff, &len);
+	if (len != FDFS_FILENAME_ID_BYTES)
+	{
+		return EINVAL;
+	}
+
+	ip.s_addr = htonl(buff2int((unsigned char *)buff + sizeof(int) * 2));
+	snprintf(ip_addr, FDFS_IPADDR_SIZE, "%s", inet_ntoa(ip));
+	return 0;
+}
+
+/* compare the file content with the checksum in the filename */
+static int storage_check_file_checksum(TrackerServerInfo *pStorageServer, \
+		const char *remote_filename, const int64_t file_size, \
+		const unsigned int crc32)
+{
+	int64_t expect_size;
+	unsigned int expect_crc32;
+
+	if (storage_get_file_checksum(remote_filename, \
+		&expect_size, &expect_crc32) != 0)
+	{
+		return 0;
+	}
+
+	if (file_size != expect_size || crc32 != expect_crc32)
+	{
+		logError("file %s of storage server %s:%d, " \
+			"file size: "INT64_PRINTF_FORMAT", crc32: %08X, " \
+			"not match the checksum, " \
+			"file size: "INT64_PRINTF_FORMAT", crc32: %08X", \
+			remote_filename, pStorageServer->ip_addr, \
+			pStorageServer->port, file_size, crc32, \
+			expect_size, expect_crc32);
+		return EIO;
+	}
+
+	return 0;
+}
 
 int storage_get_metadata(TrackerServerInfo *pTrackerServer, \
 			TrackerServerInfo *pStorageServer,  \
@@ -130,81 +254,376 @@ int storage_get_metadata(TrackerServerInfo *pTrackerServer, \
 	return result;
 }
 
-int storage_delete_file(TrackerServerInfo *pTrackerServer, \
-			TrackerServerInfo *pStorageServer, \
-			const char *group_name, const char *filename)
+static int storage_parse_metadata_batch(TrackerServerInfo *pStorageServer, \
+		char *in_buff, const int in_bytes, const int count, \
+		FDFSFileMetaData *results)
 {
-	TrackerHeader header;
+	char szValue[TRACKER_PROTO_PKG_LEN_SIZE + 1];
+	char *p;
+	char *pEnd;
+	char saved;
+	int meta_bytes;
 	int result;
+	int i;
+
+	p = in_buff;
+	pEnd = in_buff + in_bytes;
+	for (i=0; i<count; i++)
+	{
+		if (pEnd - p < STORAGE_BATCH_META_FIXED_LEN)
+		{
+			break;
+		}
+
+		results[i].status = *p++;
+		memcpy(szValue, p, TRACKER_PROTO_PKG_LEN_SIZE);
+		szValue[TRACKER_PROTO_PKG_LEN_SIZE] = '\0';
+		meta_bytes = strtol(szValue, NULL, 16);
+		p += TRACKER_PROTO_PKG_LEN_SIZE;
+		if (meta_bytes < 0 || meta_bytes > pEnd - p)
+		{
+			break;
+		}
+
+		if (meta_bytes > 0)
+		{
+			saved = p[meta_bytes];
+			p[meta_bytes] = '\0';
+			results[i].meta_list = fdfs_split_metadata(p, \
+					&results[i].meta_count, &result);
+			p[meta_bytes] = saved;
+			if (results[i].meta_list == NULL)
+			{
+				return result;
+			}
+		}
+		p += meta_bytes;
+	}
+
+	if (i != count || p != pEnd)
+	{
+		logError("storage server %s:%d response data " \
+			"length: %d is invalid.", \
+			pStorageServer->ip_addr, \
+			pStorageServer->port, in_bytes);
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+int storage_get_metadata_batch(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *group_name, const char **filenames, \
+			const int count, const char **keys, \
+			const int key_count, FDFSFileMetaData *results)
+{
+	TrackerHeader *pHeader;
 	TrackerServerInfo storageServer;
-	char out_buff[sizeof(TrackerHeader)+FDFS_GROUP_NAME_MAX_LEN+32];
-	char in_buff[1];
-	char *pBuff;
-	int in_bytes;
+	char *out_buff;
+	char *in_buff;
+	char *pKeysLen;
+	char *p;
 	int filename_len;
+	int key_len;
+	int in_bytes;
+	int result;
+	int i;
+
+	memset(results, 0, sizeof(FDFSFileMetaData) * \
+		(count > 0 ? count : 0));
+	if (count <= 0 || count > STORAGE_MAX_BATCH_META_COUNT || \
+		key_count < 0 || key_count > STORAGE_MAX_BATCH_META_KEYS)
+	{
+		return EINVAL;
+	}
+
+	out_buff = (char *)malloc(sizeof(TrackerHeader) + \
+		FDFS_GROUP_NAME_MAX_LEN + 2 * TRACKER_PROTO_PKG_LEN_SIZE + \
+		key_count * (FDFS_MAX_META_NAME_LEN + 1) + count * \
+		(TRACKER_PROTO_PKG_LEN_SIZE + MAX_PATH_SIZE));
+	if (out_buff == NULL)
+	{
+		return errno != 0 ? errno : ENOMEM;
+	}
+
+	/**
+	send pkg format:
+	FDFS_GROUP_NAME_MAX_LEN bytes: group_name
+	TRACKER_PROTO_PKG_LEN_SIZE bytes: file count (hex string)
+	TRACKER_PROTO_PKG_LEN_SIZE bytes: key list length (hex string)
+	key list length bytes: key names seperated by FDFS_RECORD_SEPERATOR
+	file count items:
+		TRACKER_PROTO_PKG_LEN_SIZE bytes: filename length (hex string)
+		filename length bytes: filename
+	**/
+	p = out_buff + sizeof(TrackerHeader);
+	memset(p, 0, FDFS_GROUP_NAME_MAX_LEN + 2 * TRACKER_PROTO_PKG_LEN_SIZE);
+	snprintf(p, FDFS_GROUP_NAME_MAX_LEN + 1, "%s", group_name);
+	p += FDFS_GROUP_NAME_MAX_LEN;
+	sprintf(p, "%x", count);
+	p += TRACKER_PROTO_PKG_LEN_SIZE;
+
+	pKeysLen = p;  //the key list length is set after the keys packed
+	p += TRACKER_PROTO_PKG_LEN_SIZE;
+	for (i=0; i<key_count; i++)
+	{
+		key_len = strlen(keys[i]);
+		if (key_len > FDFS_MAX_META_NAME_LEN)
+		{
+			key_len = FDFS_MAX_META_NAME_LEN;
+		}
+		if (i > 0)
+		{
+			*p++ = FDFS_RECORD_SEPERATOR;
+		}
+		memcpy(p, keys[i], key_len);
+		p += key_len;
+	}
+	sprintf(pKeysLen, "%x", (int)(p - pKeysLen - \
+		TRACKER_PROTO_PKG_LEN_SIZE));
+
+	for (i=0; i<count; i++)
+	{
+		memset(p, 0, TRACKER_PROTO_PKG_LEN_SIZE);
+		filename_len = strlen(filenames[i]);
+		if (filename_len >= MAX_PATH_SIZE)
+		{
+			filename_len = MAX_PATH_SIZE - 1;
+		}
+		sprintf(p, "%x", filename_len);
+		p += TRACKER_PROTO_PKG_LEN_SIZE;
+		memcpy(p, filenames[i], filename_len);
+		p += filename_len;
+	}
+
+	pHeader = (TrackerHeader *)out_buff;
+	sprintf(pHeader->pkg_len, "%x", \
+		(int)(p - out_buff - sizeof(TrackerHeader)));
+	pHeader->cmd = STORAGE_PROTO_CMD_BATCH_GET_METADATA;
+	pHeader->status = 0;
 
 	if (pStorageServer == NULL)
 	{
 		if ((result=tracker_query_storage_fetch(pTrackerServer, \
-		                &storageServer, group_name, filename)) != 0)
-			
+		                &storageServer, group_name, filenames[0])) != 0)
 		{
+			free(out_buff);
 			return result;
 		}
 
 		if ((result=tracker_connect_server(&storageServer)) != 0)
 		{
+			free(out_buff);
 			return result;
 		}
 
 		pStorageServer = &storageServer;
 	}
 
+	in_buff = NULL;
 	while (1)
 	{
+	if (tcpsenddata(pStorageServer->sock, out_buff, \
+			p - out_buff, g_network_timeout) != 1)
+	{
+		logError("send data to storage server %s:%d fail, " \
+			"errno: %d, error info: %s", \
+			pStorageServer->ip_addr, \
+			pStorageServer->port, \
+			errno, strerror(errno));
+
+		result = errno != 0 ? errno : EPIPE;
+		break;
+	}
+
+	if ((result=tracker_recv_response(pStorageServer, \
+		&in_buff, 0, &in_bytes)) != 0)
+	{
+		break;
+	}
+
+	result = storage_parse_metadata_batch(pStorageServer, \
+			in_buff, in_bytes, count, results);
+	break;
+	}
+
+	free(out_buff);
+	if (in_buff != NULL)
+	{
+		free(in_buff);
+	}
+
+	if (pStorageServer == &storageServer)
+	{
+		tracker_quit(pStorageServer);
+		tracker_disconnect_server(pStorageServer);
+	}
+
+	if (result != 0)
+	{
+		storage_free_metadata_batch(results, count);
+	}
+	return result;
+}
+
+void storage_free_metadata_batch(FDFSFileMetaData *results, const int count)
+{
+	int i;
+
+	for (i=0; i<count; i++)
+	{
+		if (results[i].meta_list != NULL)
+		{
+			free(results[i].meta_list);
+			results[i].meta_list = NULL;
+		}
+		results[i].meta_count = 0;
+	}
+}
+
+/* split the filenames seperated by FDFS_RECORD_SEPERATOR */
+static int storage_split_filenames(const char *in_buff, const int in_bytes, \
+		char ***filenames, int *count)
+{
+	char *p;
+	char *pEnd;
+
+	*filenames = (char **)malloc(sizeof(char *) * (in_bytes / 2 + 1) + \
+				in_bytes + 1);
+	if (*filenames == NULL)
+	{
+		return errno != 0 ? errno : ENOMEM;
+	}
+
+	p = (char *)(*filenames + in_bytes / 2 + 1);
+	if (in_bytes > 0)
+	{
+		memcpy(p, in_buff, in_bytes);
+	}
+	pEnd = p + in_bytes;
+	*pEnd = '\0';
+	*count = 0;
+	while (p < pEnd)
+	{
+		(*filenames)[(*count)++] = p;
+		p = strchr(p, FDFS_RECORD_SEPERATOR);
+		if (p == NULL)
+		{
+			break;
+		}
+		*p++ = '\0';
+	}
+
+	return 0;
+}
+
+int storage_query_by_metadata(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *group_name, const char *name, \
+			const char *value, const char *cursor, \
+			const int max_count, char ***filenames, int *count)
+{
+	TrackerHeader *pHeader;
+	TrackerServerInfo storageServer;
+	char out_buff[sizeof(TrackerHeader) + FDFS_GROUP_NAME_MAX_LEN + \
+		2 * TRACKER_PROTO_PKG_LEN_SIZE + 128 + \
+		FDFS_MAX_META_NAME_LEN + FDFS_MAX_META_VALUE_LEN + 2];
+	char *in_buff;
+	char *p;
+	int cursor_len;
+	int in_bytes;
+	int result;
+
+	*filenames = NULL;
+	*count = 0;
+	if (cursor == NULL)
+	{
+		cursor = "";
+	}
+	cursor_len = strlen(cursor);
+	if (max_count <= 0 || max_count > STORAGE_MAX_META_QUERY_COUNT || \
+		cursor_len >= 128 || strlen(name) > FDFS_MAX_META_NAME_LEN \
+		|| strlen(value) > FDFS_MAX_META_VALUE_LEN)
+	{
+		return EINVAL;
+	}
+
 	/**
 	send pkg format:
 	FDFS_GROUP_NAME_MAX_LEN bytes: group_name
-	remain bytes: filename
+	TRACKER_PROTO_PKG_LEN_SIZE bytes: max count (hex string)
+	TRACKER_PROTO_PKG_LEN_SIZE bytes: cursor length (hex string)
+	cursor length bytes: cursor
+	remain bytes: name FDFS_FIELD_SEPERATOR value
 	**/
+	p = out_buff + sizeof(TrackerHeader);
+	memset(p, 0, FDFS_GROUP_NAME_MAX_LEN + 2 * TRACKER_PROTO_PKG_LEN_SIZE);
+	snprintf(p, FDFS_GROUP_NAME_MAX_LEN + 1, "%s", group_name);
+	p += FDFS_GROUP_NAME_MAX_LEN;
+	sprintf(p, "%x", max_count);
+	p += TRACKER_PROTO_PKG_LEN_SIZE;
+	sprintf(p, "%x", cursor_len);
+	p += TRACKER_PROTO_PKG_LEN_SIZE;
+	memcpy(p, cursor, cursor_len);
+	p += cursor_len;
+	p += sprintf(p, "%s%c%s", name, FDFS_FIELD_SEPERATOR, value);
 
-	memset(out_buff, 0, sizeof(out_buff));
-	snprintf(out_buff + sizeof(TrackerHeader), sizeof(out_buff) - \
-		sizeof(TrackerHeader),  "%s", group_name);
-	filename_len = snprintf(out_buff + sizeof(TrackerHeader) + \
-			FDFS_GROUP_NAME_MAX_LEN, \
-			sizeof(out_buff) - sizeof(TrackerHeader) - \
-			FDFS_GROUP_NAME_MAX_LEN,  "%s", filename);
+	pHeader = (TrackerHeader *)out_buff;
+	sprintf(pHeader->pkg_len, "%x", \
+		(int)(p - out_buff - sizeof(TrackerHeader)));
+	pHeader->cmd = STORAGE_PROTO_CMD_QUERY_BY_METADATA;
+	pHeader->status = 0;
 
-	sprintf(header.pkg_len, "%x", FDFS_GROUP_NAME_MAX_LEN + \
-			filename_len);
-	header.cmd = STORAGE_PROTO_CMD_DELETE_FILE;
-	header.status = 0;
-	memcpy(out_buff, &header, sizeof(TrackerHeader));
+	if (pStorageServer == NULL)
+	{
+		/* the filename is not used to select the server of the group */
+		if ((result=tracker_query_storage_fetch(pTrackerServer, \
+		                &storageServer, group_name, name)) != 0)
+		{
+			return result;
+		}
+
+		if ((result=tracker_connect_server(&storageServer)) != 0)
+		{
+			return result;
+		}
+
+		pStorageServer = &storageServer;
+	}
 
+	in_buff = NULL;
+	while (1)
+	{
 	if (tcpsenddata(pStorageServer->sock, out_buff, \
-		sizeof(TrackerHeader) + FDFS_GROUP_NAME_MAX_LEN + \
-		filename_len, g_network_timeout) != 1)
+			p - out_buff, g_network_timeout) != 1)
 	{
 		logError("send data to storage server %s:%d fail, " \
 			"errno: %d, error info: %s", \
 			pStorageServer->ip_addr, \
 			pStorageServer->port, \
 			errno, strerror(errno));
+
 		result = errno != 0 ? errno : EPIPE;
 		break;
 	}
 
-	pBuff = in_buff;
 	if ((result=tracker_recv_response(pStorageServer, \
-		&pBuff, 0, &in_bytes)) != 0)
+		&in_buff, 0, &in_bytes)) != 0)
 	{
 		break;
 	}
 
+	result = storage_split_filenames(in_buff, in_bytes, \
+			filenames, count);
 	break;
 	}
 
+	if (in_buff != NULL)
+	{
+		free(in_buff);
+	}
+
 	if (pStorageServer == &storageServer)
 	{
 		tracker_quit(pStorageServer);
@@ -214,20 +633,19 @@ int storage_delete_file(TrackerServerInfo *pTrackerServer, \
 	return result;
 }
 
-int storage_download_file(TrackerServerInfo *pTrackerServer, \
+int storage_delete_file(TrackerServerInfo *pTrackerServer, \
 			TrackerServerInfo *pStorageServer, \
-			const char *group_name, const char *filename, \
-			char **file_buff, int *file_size)
+			const char *group_name, const char *filename)
 {
 	TrackerHeader header;
 	int result;
 	TrackerServerInfo storageServer;
 	char out_buff[sizeof(TrackerHeader)+FDFS_GROUP_NAME_MAX_LEN+32];
+	char in_buff[1];
+	char *pBuff;
 	int in_bytes;
 	int filename_len;
 
-	*file_buff = NULL;
-	*file_size = 0;
 	if (pStorageServer == NULL)
 	{
 		if ((result=tracker_query_storage_fetch(pTrackerServer, \
@@ -263,7 +681,7 @@ int storage_download_file(TrackerServerInfo *pTrackerServer, \
 
 	sprintf(header.pkg_len, "%x", FDFS_GROUP_NAME_MAX_LEN + \
 			filename_len);
-	header.cmd = STORAGE_PROTO_CMD_DOWNLOAD_FILE;
+	header.cmd = STORAGE_PROTO_CMD_DELETE_FILE;
 	header.status = 0;
 	memcpy(out_buff, &header, sizeof(TrackerHeader));
 
@@ -280,13 +698,13 @@ int storage_download_file(TrackerServerInfo *pTrackerServer, \
 		break;
 	}
 
+	pBuff = in_buff;
 	if ((result=tracker_recv_response(pStorageServer, \
-		file_buff, 0, &in_bytes)) != 0)
+		&pBuff, 0, &in_bytes)) != 0)
 	{
 		break;
 	}
 
-	*file_size = in_bytes;
 	break;
 	}
 
@@ -299,40 +717,26 @@ int storage_download_file(TrackerServerInfo *pTrackerServer, \
 	return result;
 }
 
-/**
-9 bytes: meta data bytes
-9 bytes: file size
-meta data bytes: each meta data seperated by \x01,
-                 name and value seperated by \x02
-1 bytes: pad byte, should be \0
-file size bytes: file content
-**/
-int storage_upload_by_filebuff(TrackerServerInfo *pTrackerServer, \
+int storage_download_file(TrackerServerInfo *pTrackerServer, \
 			TrackerServerInfo *pStorageServer, \
-			const char *file_buff, const int file_size, \
-			const FDFSMetaData *meta_list, \
-			const int meta_count, \
-			char *group_name, \
-			char *remote_filename)
+			const char *group_name, const char *filename, \
+			char **file_buff, int *file_size)
 {
-#define MAX_STATIC_META_DATA_COUNT 32
-	TrackerHeader header;
 	int result;
-	char meta_buff[2 * TRACKER_PROTO_PKG_LEN_SIZE + \
-			sizeof(FDFSMetaData) * MAX_STATIC_META_DATA_COUNT + 2];
-	char *pMetaData;
-	int meta_bytes;
-	int in_bytes;
-	char in_buff[128];
-	char *pInBuff;
 	TrackerServerInfo storageServer;
+	char out_buff[FDFS_PROTO_MAX_HEADER_SIZE+FDFS_GROUP_NAME_MAX_LEN+32];
+	char *pBody;
+	char *pHeader;
+	int in_bytes;
+	int filename_len;
 
-	group_name[0] = '\0';
-	remote_filename[0] = '\0';
+	*file_buff = NULL;
+	*file_size = 0;
 	if (pStorageServer == NULL)
 	{
-		if ((result=tracker_query_storage_store(pTrackerServer, \
-		                &storageServer)) != 0)
+		if ((result=tracker_query_storage_fetch(pTrackerServer, \
+		                &storageServer, group_name, filename)) != 0)
+			
 		{
 			return result;
 		}
@@ -345,77 +749,184 @@ int storage_upload_by_filebuff(TrackerServerInfo *pTrackerServer, \
 		pStorageServer = &storageServer;
 	}
 
-	/*
-	//printf("upload to storage %s:%d\n", \
-		pStorageServer->ip_addr, pStorageServer->port);
-	*/
-
 	while (1)
 	{
 	/**
-	9 bytes: meta data bytes
-	meta data bytes: each meta data seperated by \x01,
-			 name and value seperated by \x02
-	file size bytes: file content
+	send pkg format:
+	FDFS_GROUP_NAME_MAX_LEN bytes: group_name
+	remain bytes: filename
 	**/
-	if (meta_count <= MAX_STATIC_META_DATA_COUNT)
+
+	memset(out_buff, 0, sizeof(out_buff));
+	pBody = out_buff + FDFS_PROTO_MAX_HEADER_SIZE;
+	snprintf(pBody, sizeof(out_buff) - FDFS_PROTO_MAX_HEADER_SIZE, \
+		"%s", group_name);
+	filename_len = snprintf(pBody + FDFS_GROUP_NAME_MAX_LEN, \
+			sizeof(out_buff) - FDFS_PROTO_MAX_HEADER_SIZE - \
+			FDFS_GROUP_NAME_MAX_LEN,  "%s", filename);
+
+	pHeader = storage_pack_header(STORAGE_PROTO_CMD_DOWNLOAD_FILE, \
+			FDFS_GROUP_NAME_MAX_LEN + filename_len, pBody);
+	if (tcpsenddata(pStorageServer->sock, pHeader, \
+		(pBody - pHeader) + FDFS_GROUP_NAME_MAX_LEN + \
+		filename_len, g_network_timeout) != 1)
 	{
-		pMetaData = meta_buff;
+		logError("send data to storage server %s:%d fail, " \
+			"errno: %d, error info: %s", \
+			pStorageServer->ip_addr, \
+			pStorageServer->port, \
+			errno, strerror(errno));
+		result = errno != 0 ? errno : EPIPE;
+		break;
 	}
-	else
+
+	if ((result=tracker_recv_response(pStorageServer, \
+		file_buff, 0, &in_bytes)) != 0)
 	{
-		pMetaData = (char *)malloc(2 * TRACKER_PROTO_PKG_LEN_SIZE + \
-                        sizeof(FDFSMetaData) * meta_count + 2);
-		if (pMetaData == NULL)
-		{
-			result= errno != 0 ? errno : ENOMEM;
-			break;
-		}
+		break;
 	}
 
-	if (meta_count > 0)
+	if ((result=storage_check_file_checksum(pStorageServer, \
+		filename, in_bytes, crc32c(*file_buff, in_bytes))) != 0)
 	{
-		fdfs_pack_metadata(meta_list, meta_count, \
-                        pMetaData + 2 * TRACKER_PROTO_PKG_LEN_SIZE, &meta_bytes);
+		free(*file_buff);
+		*file_buff = NULL;
+		break;
 	}
-	else
+
+	*file_size = in_bytes;
+	break;
+	}
+
+	if (pStorageServer == &storageServer)
 	{
-		meta_bytes = 0;
+		tracker_quit(pStorageServer);
+		tracker_disconnect_server(pStorageServer);
 	}
-	sprintf(pMetaData, "%x", meta_bytes);
-	sprintf(pMetaData + TRACKER_PROTO_PKG_LEN_SIZE, "%x", file_size);
 
-	sprintf(header.pkg_len, "%x", 2 * TRACKER_PROTO_PKG_LEN_SIZE + \
-			meta_bytes + 1 + file_size);
-	header.cmd = STORAGE_PROTO_CMD_UPLOAD_FILE;
-	header.status = 0;
-	if (tcpsenddata(pStorageServer->sock, &header, sizeof(header), \
-				g_network_timeout) != 1)
+	return result;
+}
+
+/* recv the file content by chunks to the local file, the content is always
+   received to keep the connection usable */
+static int storage_recv_file_by_fd(TrackerServerInfo *pStorageServer, \
+		const int fd, const int64_t file_size, unsigned int *crc32)
+{
+	char *buff;
+	int64_t remain_bytes;
+	int recv_bytes;
+	int written;
+	int bytes;
+	int result;
+
+	*crc32 = CRC32C_INIT_VALUE;
+	buff = (char *)malloc(FDFS_STREAM_BUFF_SIZE);
+	if (buff == NULL)
 	{
-		logError("send data to storage server %s:%d fail, " \
-			"errno: %d, error info: %s", \
-			pStorageServer->ip_addr, \
-			pStorageServer->port, \
-			errno, strerror(errno));
-		result = errno != 0 ? errno : EPIPE;
-		break;
+		return errno != 0 ? errno : ENOMEM;
 	}
 
-	if (tcpsenddata(pStorageServer->sock, pMetaData, \
-			2 * TRACKER_PROTO_PKG_LEN_SIZE + meta_bytes + 1, \
+	result = 0;
+	remain_bytes = file_size;
+	while (remain_bytes > 0)
+	{
+		recv_bytes = remain_bytes > FDFS_STREAM_BUFF_SIZE ? \
+				FDFS_STREAM_BUFF_SIZE : remain_bytes;
+		if (tcprecvdata(pStorageServer->sock, buff, recv_bytes, \
 			g_network_timeout) != 1)
+		{
+			result = errno != 0 ? errno : EPIPE;
+			logError("recv data from storage server %s:%d fail, " \
+				"errno: %d, error info: %s", \
+				pStorageServer->ip_addr, \
+				pStorageServer->port, \
+				result, strerror(result));
+			break;
+		}
+		remain_bytes -= recv_bytes;
+		*crc32 = crc32c_ex(*crc32, buff, recv_bytes);
+
+		written = 0;
+		while (result == 0 && written < recv_bytes)
+		{
+			if ((bytes=write(fd, buff + written, \
+				recv_bytes - written)) <= 0)
+			{
+				if (bytes < 0 && errno == EINTR)
+				{
+					continue;
+				}
+
+				result = errno != 0 ? errno : EIO;
+				logError("write local file fail, " \
+					"errno: %d, error info: %s", \
+					result, strerror(result));
+				break;
+			}
+			written += bytes;
+		}
+	}
+
+	*crc32 = CRC32C_FINAL(*crc32);
+	free(buff);
+	return result;
+}
+
+int storage_download_file_to_file(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *group_name, const char *filename, \
+			const char *local_filename, int64_t *file_size)
+{
+	int result;
+	TrackerServerInfo storageServer;
+	char out_buff[FDFS_PROTO_MAX_HEADER_SIZE+FDFS_GROUP_NAME_MAX_LEN+32];
+	char *pBody;
+	char *pHeader;
+	int64_t in_bytes;
+	unsigned int crc32;
+	int filename_len;
+	int fd;
+
+	*file_size = 0;
+	if ((fd=open(local_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
 	{
-		logError("send data to storage server %s:%d fail, " \
+		logError("open file %s fail, " \
 			"errno: %d, error info: %s", \
-			pStorageServer->ip_addr, \
-			pStorageServer->port, \
-			errno, strerror(errno));
-		result = errno != 0 ? errno : EPIPE;
-		break;
+			local_filename, errno, strerror(errno));
+		return errno != 0 ? errno : ENOENT;
 	}
 
-	if (tcpsenddata(pStorageServer->sock, (char *)file_buff, \
-				file_size, g_network_timeout) != 1)
+	if (pStorageServer == NULL)
+	{
+		if ((result=tracker_query_storage_fetch(pTrackerServer, \
+		                &storageServer, group_name, filename)) != 0 \
+			|| (result=tracker_connect_server(&storageServer)) != 0)
+		{
+			close(fd);
+			unlink(local_filename);
+			return result;
+		}
+
+		pStorageServer = &storageServer;
+	}
+
+	while (1)
+	{
+	memset(out_buff, 0, sizeof(out_buff));
+	pBody = out_buff + FDFS_PROTO_MAX_HEADER_SIZE;
+	snprintf(pBody, sizeof(out_buff) - FDFS_PROTO_MAX_HEADER_SIZE, \
+		"%s", group_name);
+	filename_len = snprintf(pBody + FDFS_GROUP_NAME_MAX_LEN, \
+			sizeof(out_buff) - FDFS_PROTO_MAX_HEADER_SIZE - \
+			FDFS_GROUP_NAME_MAX_LEN,  "%s", filename);
+
+	/* the v1 response can't carry the file larger than 2GB */
+	pHeader = storage_pack_header_ex(FDFS_PROTO_VERSION_2, \
+			STORAGE_PROTO_CMD_DOWNLOAD_FILE, 0, \
+			FDFS_GROUP_NAME_MAX_LEN + filename_len, pBody);
+	if (tcpsenddata(pStorageServer->sock, pHeader, \
+		(pBody - pHeader) + FDFS_GROUP_NAME_MAX_LEN + \
+		filename_len, g_network_timeout) != 1)
 	{
 		logError("send data to storage server %s:%d fail, " \
 			"errno: %d, error info: %s", \
@@ -426,27 +937,24 @@ int storage_upload_by_filebuff(TrackerServerInfo *pTrackerServer, \
 		break;
 	}
 
-	pInBuff = in_buff;
-	if ((result=tracker_recv_response(pStorageServer, \
-		&pInBuff, sizeof(in_buff), &in_bytes)) != 0)
+	if ((result=tracker_recv_header(pStorageServer, &in_bytes)) != 0)
 	{
 		break;
 	}
 
-	if (in_bytes == 0 || in_bytes >= sizeof(in_buff))
+	if ((result=storage_recv_file_by_fd(pStorageServer, fd, \
+			in_bytes, &crc32)) != 0)
 	{
-		logError("storage server %s:%d response data " \
-			"length: %d is invalid.", \
-			pStorageServer->ip_addr, \
-			pStorageServer->port, in_bytes);
-		result = EINVAL;
 		break;
 	}
 
-	in_buff[in_bytes] = '\0';
-	strcpy(group_name, pStorageServer->group_name);
-	memcpy(remote_filename, in_buff, in_bytes+1);
+	if ((result=storage_check_file_checksum(pStorageServer, \
+		filename, in_bytes, crc32)) != 0)
+	{
+		break;
+	}
 
+	*file_size = in_bytes;
 	break;
 	}
 
@@ -455,44 +963,1297 @@ int storage_upload_by_filebuff(TrackerServerInfo *pTrackerServer, \
 		tracker_quit(pStorageServer);
 		tracker_disconnect_server(pStorageServer);
 	}
-	if (pMetaData != NULL && pMetaData != meta_buff)
+
+	close(fd);
+	if (result != 0)
 	{
-		free(pMetaData);
+		unlink(local_filename);
 	}
-
 	return result;
 }
 
-int storage_upload_by_filename(TrackerServerInfo *pTrackerServer, \
-			TrackerServerInfo *pStorageServer, \
-			const char *local_filename, \
-			const FDFSMetaData *meta_list, \
-			const int meta_count, \
-			char *group_name, \
-			char *remote_filename)
+/* recv the pipelined responses of the requests [start, end) in any order */
+static int storage_recv_download_window(TrackerServerInfo *pStorageServer, \
+		const char **filenames, const int start, const int end, \
+		FDFSDownloadResult *results)
+{
+	char header_buff[FDFS_PROTO_MAX_HEADER_SIZE];
+	FDFSProtoHeader resp;
+	FDFSDownloadResult *pResult;
+	int result;
+	int i;
+
+	for (i=start; i<end; i++)
+	{
+		if (tcprecvdata(pStorageServer->sock, header_buff, \
+			sizeof(TrackerHeader), g_network_timeout) != 1 || \
+			(result=fdfs_parse_header(pStorageServer->sock, \
+				header_buff, &resp)) != 0)
+		{
+			logError("recv data from storage server %s:%d fail, " \
+				"errno: %d, error info: %s", \
+				pStorageServer->ip_addr, \
+				pStorageServer->port, \
+				errno, strerror(errno));
+			return errno != 0 ? errno : EPIPE;
+		}
+
+		if (resp.version != FDFS_PROTO_VERSION_2 || \
+			resp.request_id < start || resp.request_id >= end || \
+			results[resp.request_id].result != EAGAIN || \
+			resp.pkg_len < 0 || resp.pkg_len > INT_MAX)
+		{
+			logError("storage server %s:%d, invalid response, " \
+				"request id: %d, package size: " \
+				INT64_PRINTF_FORMAT, pStorageServer->ip_addr, \
+				pStorageServer->port, resp.request_id, \
+				resp.pkg_len);
+			return EINVAL;
+		}
+
+		pResult = results + resp.request_id;
+		if (resp.status != 0)
+		{
+			pResult->result = resp.status;
+			if (resp.status != ENOENT)
+			{
+				return resp.status;  //the connection is closed
+			}
+			continue;
+		}
+
+		pResult->file_buff = (char *)malloc(resp.pkg_len + 1);
+		if (pResult->file_buff == NULL)
+		{
+			return errno != 0 ? errno : ENOMEM;
+		}
+		if (tcprecvdata(pStorageServer->sock, pResult->file_buff, \
+			(int)resp.pkg_len, g_network_timeout) != 1)
+		{
+			logError("recv data from storage server %s:%d fail, " \
+				"errno: %d, error info: %s", \
+				pStorageServer->ip_addr, \
+				pStorageServer->port, \
+				errno, strerror(errno));
+			return errno != 0 ? errno : EPIPE;
+		}
+
+		pResult->file_size = (int)resp.pkg_len;
+		pResult->result = storage_check_file_checksum(pStorageServer, \
+				filenames[resp.request_id], pResult->file_size, \
+				crc32c(pResult->file_buff, pResult->file_size));
+		if (pResult->result != 0)
+		{
+			free(pResult->file_buff);
+			pResult->file_buff = NULL;
+			pResult->file_size = 0;
+		}
+	}
+
+	return 0;
+}
 
+int storage_download_files(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *group_name, const char **filenames, \
+			const int count, FDFSDownloadResult *results)
 {
-	char *file_buff;
-	int file_size;
+	TrackerServerInfo storageServer;
+	char *out_buff;
+	char *pBody;
+	char *p;
+	int filename_len;
 	int result;
+	int start;
+	int end;
+	int i;
 
-	if ((result=getFileContent(local_filename, \
-			&file_buff, &file_size)) != 0)
+	memset(results, 0, sizeof(FDFSDownloadResult) * \
+		(count > 0 ? count : 0));
+	if (count <= 0)
 	{
-		group_name[0] = '\0';
-		remote_filename[0] = '\0';
-		return result;
+		return EINVAL;
+	}
+	for (i=0; i<count; i++)
+	{
+		results[i].result = EAGAIN;  //not downloaded
 	}
 
-	result = storage_upload_by_filebuff(pTrackerServer, \
-			pStorageServer, file_buff, file_size, \
-			meta_list, meta_count, \
-			group_name, remote_filename);
-	free(file_buff);
+	out_buff = (char *)malloc(STORAGE_PIPELINE_WINDOW * \
+		(sizeof(TrackerHeaderV2) + FDFS_GROUP_NAME_MAX_LEN + \
+		MAX_PATH_SIZE));
+	if (out_buff == NULL)
+	{
+		return errno != 0 ? errno : ENOMEM;
+	}
+
+	if (pStorageServer == NULL)
+	{
+		if ((result=tracker_query_storage_fetch(pTrackerServer, \
+		                &storageServer, group_name, filenames[0])) != 0)
+		{
+			free(out_buff);
+			return result;
+		}
+
+		if ((result=tracker_connect_server(&storageServer)) != 0)
+		{
+			free(out_buff);
+			return result;
+		}
+
+		pStorageServer = &storageServer;
+	}
+
+	/**
+	send the download requests of a window in one package, each with
+	the v2 header, the request id is the index of the file,
+	the storage server keeps the connection when a file not exist
+	**/
+	result = 0;
+	for (start=0; start<count; start=end)
+	{
+		end = start + STORAGE_PIPELINE_WINDOW;
+		if (end > count)
+		{
+			end = count;
+		}
+
+		p = out_buff;
+		for (i=start; i<end; i++)
+		{
+			filename_len = strlen(filenames[i]);
+			if (filename_len >= MAX_PATH_SIZE)
+			{
+				filename_len = MAX_PATH_SIZE - 1;
+			}
+
+			pBody = p + sizeof(TrackerHeaderV2);
+			memset(pBody, 0, FDFS_GROUP_NAME_MAX_LEN);
+			snprintf(pBody, FDFS_GROUP_NAME_MAX_LEN + 1, \
+				"%s", group_name);
+			memcpy(pBody + FDFS_GROUP_NAME_MAX_LEN, filenames[i], \
+				filename_len);
+			storage_pack_header_ex(FDFS_PROTO_VERSION_2, \
+				STORAGE_PROTO_CMD_DOWNLOAD_FILE, i, \
+				FDFS_GROUP_NAME_MAX_LEN + filename_len, pBody);
+			p = pBody + FDFS_GROUP_NAME_MAX_LEN + filename_len;
+		}
+
+		if (tcpsenddata(pStorageServer->sock, out_buff, \
+			p - out_buff, g_network_timeout) != 1)
+		{
+			logError("send data to storage server %s:%d fail, " \
+				"errno: %d, error info: %s", \
+				pStorageServer->ip_addr, \
+				pStorageServer->port, \
+				errno, strerror(errno));
+			result = errno != 0 ? errno : EPIPE;
+			break;
+		}
+
+		if ((result=storage_recv_download_window(pStorageServer, \
+			filenames, start, end, results)) != 0)
+		{
+			break;
+		}
+	}
+
+	free(out_buff);
+	if (pStorageServer == &storageServer)
+	{
+		if (result == 0)
+		{
+			tracker_quit(pStorageServer);
+		}
+		tracker_disconnect_server(pStorageServer);
+	}
 
 	return result;
 }
 
+void storage_free_download_results(FDFSDownloadResult *results, \
+		const int count)
+{
+	int i;
+
+	for (i=0; i<count; i++)
+	{
+		if (results[i].file_buff != NULL)
+		{
+			free(results[i].file_buff);
+			results[i].file_buff = NULL;
+		}
+		results[i].file_size = 0;
+	}
+}
+
+/**
+9 bytes: meta data bytes
+9 bytes: file size
+meta data bytes: each meta data seperated by \x01,
+                 name and value seperated by \x02
+1 bytes: pad byte, should be \0
+file size bytes: file content
+**/
+/* send the file content by chunks and compute the crc32 of it */
+static int storage_send_file_by_fd(TrackerServerInfo *pStorageServer, \
+		const int fd, const int64_t file_size, unsigned int *crc32)
+{
+	char *buff;
+	int64_t remain_bytes;
+	int bytes;
+	int result;
+
+	*crc32 = CRC32C_INIT_VALUE;
+	buff = (char *)malloc(FDFS_STREAM_BUFF_SIZE);
+	if (buff == NULL)
+	{
+		return errno != 0 ? errno : ENOMEM;
+	}
+
+	result = 0;
+	remain_bytes = file_size;
+	while (remain_bytes > 0)
+	{
+		bytes = read(fd, buff, remain_bytes > FDFS_STREAM_BUFF_SIZE ? \
+				FDFS_STREAM_BUFF_SIZE : remain_bytes);
+		if (bytes <= 0)
+		{
+			if (bytes < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			result = (bytes < 0 && errno != 0) ? errno : EIO;
+			logError("read local file fail, " \
+				"errno: %d, error info: %s", \
+				result, strerror(result));
+			break;
+		}
+
+		*crc32 = crc32c_ex(*crc32, buff, bytes);
+		if (tcpsenddata(pStorageServer->sock, buff, bytes, \
+			g_network_timeout) != 1)
+		{
+			result = errno != 0 ? errno : EPIPE;
+			logError("send data to storage server %s:%d fail, " \
+				"errno: %d, error info: %s", \
+				pStorageServer->ip_addr, \
+				pStorageServer->port, \
+				result, strerror(result));
+			break;
+		}
+		remain_bytes -= bytes;
+	}
+
+	*crc32 = CRC32C_FINAL(*crc32);
+	free(buff);
+	return result;
+}
+
+/*
+upload the content of file_buff, or of the fd by chunks when file_buff is
+NULL, the file sent by chunks may be larger than 2GB so the v2 protocol
+is always used for it
+*/
+static int storage_do_upload_file(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, const char cmd, \
+			const char *file_buff, const int fd, \
+			const int64_t file_size, \
+			const FDFSMetaData *meta_list, \
+			const int meta_count, \
+			char *group_name, \
+			char *remote_filename)
+{
+#define MAX_STATIC_META_DATA_COUNT 32
+	char header_buff[FDFS_PROTO_MAX_HEADER_SIZE];
+	char *pHeader;
+	char version;
+	int field_size;
+	unsigned int crc32;
+	int result;
+	char meta_buff[2 * TRACKER_PROTO_PKG_LEN_SIZE + \
+			sizeof(FDFSMetaData) * MAX_STATIC_META_DATA_COUNT + 2];
+	char *pMetaData;
+	int meta_bytes;
+	int in_bytes;
+	char in_buff[128];
+	char *pInBuff;
+	TrackerServerInfo storageServer;
+
+	group_name[0] = '\0';
+	remote_filename[0] = '\0';
+	if (pStorageServer == NULL)
+	{
+		if ((result=tracker_query_storage_store(pTrackerServer, \
+		                &storageServer)) != 0)
+		{
+			return result;
+		}
+
+		if ((result=tracker_connect_server(&storageServer)) != 0)
+		{
+			return result;
+		}
+
+		pStorageServer = &storageServer;
+	}
+
+	/*
+	//printf("upload to storage %s:%d\n", \
+		pStorageServer->ip_addr, pStorageServer->port);
+	*/
+
+	while (1)
+	{
+	/**
+	9 bytes: meta data bytes
+	meta data bytes: each meta data seperated by \x01,
+			 name and value seperated by \x02
+	file size bytes: file content
+	**/
+	if (meta_count <= MAX_STATIC_META_DATA_COUNT)
+	{
+		pMetaData = meta_buff;
+	}
+	else
+	{
+		pMetaData = (char *)malloc(2 * TRACKER_PROTO_PKG_LEN_SIZE + \
+                        sizeof(FDFSMetaData) * meta_count + 2);
+		if (pMetaData == NULL)
+		{
+			result= errno != 0 ? errno : ENOMEM;
+			break;
+		}
+	}
+
+	version = file_buff == NULL ? FDFS_PROTO_VERSION_2 : g_proto_version;
+	field_size = FDFS_PROTO_FIELD_SIZE(version);
+	if (meta_count > 0)
+	{
+		fdfs_pack_metadata(meta_list, meta_count, \
+                        pMetaData + 2 * field_size, &meta_bytes);
+	}
+	else
+	{
+		meta_bytes = 0;
+		*(pMetaData + 2 * field_size) = '\0';
+	}
+	fdfs_pack_size_field(version, meta_bytes, pMetaData);
+	fdfs_pack_size_field(version, file_size, pMetaData + field_size);
+
+	pHeader = storage_pack_header_ex(version, cmd, 0, \
+			2 * field_size + meta_bytes + 1 + file_size, \
+			header_buff + sizeof(header_buff));
+	if (tcpsenddata(pStorageServer->sock, pHeader, \
+			(header_buff + sizeof(header_buff)) - pHeader, \
+			g_network_timeout) != 1)
+	{
+		logError("send data to storage server %s:%d fail, " \
+			"errno: %d, error info: %s", \
+			pStorageServer->ip_addr, \
+			pStorageServer->port, \
+			errno, strerror(errno));
+		result = errno != 0 ? errno : EPIPE;
+		break;
+	}
+
+	if (tcpsenddata(pStorageServer->sock, pMetaData, \
+			2 * field_size + meta_bytes + 1, \
+			g_network_timeout) != 1)
+	{
+		logError("send data to storage server %s:%d fail, " \
+			"errno: %d, error info: %s", \
+			pStorageServer->ip_addr, \
+			pStorageServer->port, \
+			errno, strerror(errno));
+		result = errno != 0 ? errno : EPIPE;
+		break;
+	}
+
+	if (file_buff == NULL)
+	{
+		if ((result=storage_send_file_by_fd(pStorageServer, fd, \
+				file_size, &crc32)) != 0)
+		{
+			break;
+		}
+	}
+	else if (tcpsenddata(pStorageServer->sock, (char *)file_buff, \
+				file_size, g_network_timeout) != 1)
+	{
+		logError("send data to storage server %s:%d fail, " \
+			"errno: %d, error info: %s", \
+			pStorageServer->ip_addr, \
+			pStorageServer->port, \
+			errno, strerror(errno));
+		result = errno != 0 ? errno : EPIPE;
+		break;
+	}
+	else
+	{
+		crc32 = crc32c(file_buff, file_size);
+	}
+
+	pInBuff = in_buff;
+	if ((result=tracker_recv_response(pStorageServer, \
+		&pInBuff, sizeof(in_buff), &in_bytes)) != 0)
+	{
+		break;
+	}
+
+	if (in_bytes == 0 || in_bytes >= sizeof(in_buff))
+	{
+		logError("storage server %s:%d response data " \
+			"length: %d is invalid.", \
+			pStorageServer->ip_addr, \
+			pStorageServer->port, in_bytes);
+		result = EINVAL;
+		break;
+	}
+
+	in_buff[in_bytes] = '\0';
+	if ((result=storage_check_file_checksum(pStorageServer, \
+		in_buff, file_size, crc32)) != 0)
+	{
+		storage_delete_file(pTrackerServer, pStorageServer, \
+			pStorageServer->group_name, in_buff);
+		break;
+	}
+
+	strcpy(group_name, pStorageServer->group_name);
+	memcpy(remote_filename, in_buff, in_bytes+1);
+
+	break;
+	}
+
+	if (pStorageServer == &storageServer)
+	{
+		tracker_quit(pStorageServer);
+		tracker_disconnect_server(pStorageServer);
+	}
+	if (pMetaData != NULL && pMetaData != meta_buff)
+	{
+		free(pMetaData);
+	}
+
+	return result;
+}
+
+int storage_upload_by_filebuff(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *file_buff, const int file_size, \
+			const FDFSMetaData *meta_list, \
+			const int meta_count, \
+			char *group_name, \
+			char *remote_filename)
+{
+	return storage_do_upload_file(pTrackerServer, pStorageServer, \
+			STORAGE_PROTO_CMD_UPLOAD_FILE, file_buff, -1, \
+			file_size, meta_list, meta_count, \
+			group_name, remote_filename);
+}
+
+int storage_upload_appender_by_filebuff(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *file_buff, const int file_size, \
+			const FDFSMetaData *meta_list, \
+			const int meta_count, \
+			char *group_name, \
+			char *remote_filename)
+{
+	return storage_do_upload_file(pTrackerServer, pStorageServer, \
+			STORAGE_PROTO_CMD_UPLOAD_APPENDER_FILE, file_buff, -1, \
+			file_size, meta_list, meta_count, \
+			group_name, remote_filename);
+}
+
+static int storage_do_upload_by_filename(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, const char cmd, \
+			const char *local_filename, \
+			const FDFSMetaData *meta_list, \
+			const int meta_count, \
+			char *group_name, \
+			char *remote_filename)
+
+{
+	struct stat stat_buf;
+	char *file_buff;
+	int file_size;
+	int fd;
+	int result;
+
+	if (stat(local_filename, &stat_buf) == 0 && \
+		stat_buf.st_size >= FDFS_STREAM_FILE_SIZE)
+	{
+		if ((fd=open(local_filename, O_RDONLY)) < 0)
+		{
+			group_name[0] = '\0';
+			remote_filename[0] = '\0';
+			return errno != 0 ? errno : ENOENT;
+		}
+
+		result = storage_do_upload_file(pTrackerServer, \
+				pStorageServer, cmd, NULL, fd, \
+				stat_buf.st_size, meta_list, meta_count, \
+				group_name, remote_filename);
+		close(fd);
+		return result;
+	}
+
+	if ((result=getFileContent(local_filename, \
+			&file_buff, &file_size)) != 0)
+	{
+		group_name[0] = '\0';
+		remote_filename[0] = '\0';
+		return result;
+	}
+
+	result = storage_do_upload_file(pTrackerServer, pStorageServer, \
+			cmd, file_buff, -1, file_size, meta_list, meta_count, \
+			group_name, remote_filename);
+	free(file_buff);
+
+	return result;
+}
+
+int storage_upload_by_filename(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *local_filename, \
+			const FDFSMetaData *meta_list, \
+			const int meta_count, \
+			char *group_name, \
+			char *remote_filename)
+{
+	return storage_do_upload_by_filename(pTrackerServer, pStorageServer, \
+			STORAGE_PROTO_CMD_UPLOAD_FILE, local_filename, \
+			meta_list, meta_count, group_name, remote_filename);
+}
+
+int storage_upload_appender_by_filename(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *local_filename, \
+			const FDFSMetaData *meta_list, \
+			const int meta_count, \
+			char *group_name, \
+			char *remote_filename)
+{
+	return storage_do_upload_by_filename(pTrackerServer, pStorageServer, \
+			STORAGE_PROTO_CMD_UPLOAD_APPENDER_FILE, local_filename, \
+			meta_list, meta_count, group_name, remote_filename);
+}
+
+/**
+FDFS_PROTO_FIELD_SIZE bytes: filename bytes
+FDFS_PROTO_FIELD_SIZE bytes: the bytes to append
+FDFS_GROUP_NAME_MAX_LEN bytes: group_name
+filename bytes : the appender filename
+remain bytes: the content to append
+the content of file_buff, or of the fd by chunks when file_buff is NULL
+**/
+static int storage_do_append_file(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *file_buff, const int fd, \
+			const int64_t file_size, const char *group_name, \
+			const char *appender_filename, int64_t *offset)
+{
+	TrackerServerInfo storageServer;
+	char out_buff[FDFS_PROTO_MAX_HEADER_SIZE + \
+			2 * TRACKER_PROTO_PKG_LEN_SIZE + \
+			FDFS_GROUP_NAME_MAX_LEN + 128];
+	char in_buff[TRACKER_PROTO_PKG_LEN_SIZE];
+	char *pInBuff;
+	char *pBody;
+	char *pHeader;
+	char *p;
+	char version;
+	int field_size;
+	int filename_len;
+	int in_bytes;
+	unsigned int crc32;
+	int result;
+
+	*offset = -1;
+	filename_len = strlen(appender_filename);
+	if (filename_len >= 128)
+	{
+		return EINVAL;
+	}
+
+	if (pStorageServer == NULL)
+	{
+		/* the port of the group from the tracker */
+		if ((result=tracker_query_storage_fetch(pTrackerServer, \
+		                &storageServer, group_name, \
+				appender_filename)) != 0)
+		{
+			return result;
+		}
+
+		if ((result=storage_get_appender_source(appender_filename, \
+				storageServer.ip_addr)) != 0)
+		{
+			return result;
+		}
+
+		if ((result=tracker_connect_server(&storageServer)) != 0)
+		{
+			return result;
+		}
+
+		pStorageServer = &storageServer;
+	}
+
+	while (1)
+	{
+	version = file_buff == NULL ? FDFS_PROTO_VERSION_2 : g_proto_version;
+	field_size = FDFS_PROTO_FIELD_SIZE(version);
+	memset(out_buff, 0, sizeof(out_buff));
+	pBody = out_buff + FDFS_PROTO_MAX_HEADER_SIZE;
+	p = pBody;
+	fdfs_pack_size_field(version, filename_len, p);
+	p += field_size;
+	fdfs_pack_size_field(version, file_size, p);
+	p += field_size;
+	snprintf(p, FDFS_GROUP_NAME_MAX_LEN + 1, "%s", group_name);
+	p += FDFS_GROUP_NAME_MAX_LEN;
+	memcpy(p, appender_filename, filename_len);
+	p += filename_len;
+
+	pHeader = storage_pack_header_ex(version, \
+			STORAGE_PROTO_CMD_APPEND_FILE, 0, \
+			(p - pBody) + file_size, pBody);
+	if (tcpsenddata(pStorageServer->sock, pHeader, p - pHeader, \
+			g_network_timeout) != 1)
+	{
+		logError("send data to storage server %s:%d fail, " \
+			"errno: %d, error info: %s", \
+			pStorageServer->ip_addr, \
+			pStorageServer->port, \
+			errno, strerror(errno));
+		result = errno != 0 ? errno : EPIPE;
+		break;
+	}
+
+	if (file_buff == NULL)
+	{
+		if ((result=storage_send_file_by_fd(pStorageServer, fd, \
+				file_size, &crc32)) != 0)
+		{
+			break;
+		}
+	}
+	else if (file_size > 0 && tcpsenddata(pStorageServer->sock, \
+			(char *)file_buff, file_size, g_network_timeout) != 1)
+	{
+		logError("send data to storage server %s:%d fail, " \
+			"errno: %d, error info: %s", \
+			pStorageServer->ip_addr, \
+			pStorageServer->port, \
+			errno, strerror(errno));
+		result = errno != 0 ? errno : EPIPE;
+		break;
+	}
+
+	pInBuff = in_buff;
+	if ((result=tracker_recv_response(pStorageServer, \
+		&pInBuff, sizeof(in_buff), &in_bytes)) != 0)
+	{
+		break;
+	}
+
+	if (in_bytes != field_size)
+	{
+		logError("storage server %s:%d response data " \
+			"length: %d is invalid, should be %d.", \
+			pStorageServer->ip_addr, \
+			pStorageServer->port, in_bytes, field_size);
+		result = EINVAL;
+		break;
+	}
+
+	*offset = fdfs_unpack_size_field(version, in_buff);
+	break;
+	}
+
+	if (pStorageServer == &storageServer)
+	{
+		tracker_quit(pStorageServer);
+		tracker_disconnect_server(pStorageServer);
+	}
+
+	return result;
+}
+
+int storage_append_by_filebuff(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *file_buff, const int file_size, \
+			const char *group_name, \
+			const char *appender_filename, \
+			int64_t *offset)
+{
+	return storage_do_append_file(pTrackerServer, pStorageServer, \
+			file_buff, -1, file_size, group_name, \
+			appender_filename, offset);
+}
+
+int storage_append_by_filename(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *local_filename, \
+			const char *group_name, \
+			const char *appender_filename, \
+			int64_t *offset)
+{
+	struct stat stat_buf;
+	int fd;
+	int result;
+
+	*offset = -1;
+	if ((fd=open(local_filename, O_RDONLY)) < 0)
+	{
+		return errno != 0 ? errno : ENOENT;
+	}
+
+	if (fstat(fd, &stat_buf) != 0)
+	{
+		result = errno != 0 ? errno : EIO;
+		close(fd);
+		return result;
+	}
+
+	result = storage_do_append_file(pTrackerServer, pStorageServer, \
+			NULL, fd, stat_buf.st_size, group_name, \
+			appender_filename, offset);
+	close(fd);
+	return result;
+}
+
+/**
+FDFS_PROTO_FIELD_SIZE bytes: file size
+FDFS_PROTO_FIELD_SIZE bytes: part size
+FDFS_PROTO_FIELD_SIZE bytes: meta data bytes
+meta data bytes: each meta data seperated by \x01,
+		 name and value seperated by \x02
+**/
+int storage_upload_begin(TrackerServerInfo *pStorageServer, \
+			const int64_t file_size, const int part_size, \
+			const FDFSMetaData *meta_list, \
+			const int meta_count, char *session_id)
+{
+	char header_buff[FDFS_PROTO_MAX_HEADER_SIZE];
+	char in_buff[FDFS_UPLOAD_SESSION_ID_LEN];
+	char *pHeader;
+	char *pBuff;
+	char *pInBuff;
+	int field_size;
+	int meta_bytes;
+	int in_bytes;
+	int result;
+
+	*session_id = '\0';
+	field_size = FDFS_PROTO_FIELD_SIZE(FDFS_PROTO_VERSION_2);
+	pBuff = (char *)malloc(3 * field_size + \
+			sizeof(FDFSMetaData) * meta_count + 1);
+	if (pBuff == NULL)
+	{
+		return errno != 0 ? errno : ENOMEM;
+	}
+
+	meta_bytes = 0;
+	if (meta_count > 0)
+	{
+		fdfs_pack_metadata(meta_list, meta_count, \
+			pBuff + 3 * field_size, &meta_bytes);
+	}
+	fdfs_pack_size_field(FDFS_PROTO_VERSION_2, file_size, pBuff);
+	fdfs_pack_size_field(FDFS_PROTO_VERSION_2, part_size, \
+			pBuff + field_size);
+	fdfs_pack_size_field(FDFS_PROTO_VERSION_2, meta_bytes, \
+			pBuff + 2 * field_size);
+
+	pHeader = storage_pack_header_ex(FDFS_PROTO_VERSION_2, \
+			STORAGE_PROTO_CMD_UPLOAD_BEGIN, 0, \
+			3 * field_size + meta_bytes, \
+			header_buff + sizeof(header_buff));
+	if (tcpsenddata(pStorageServer->sock, pHeader, \
+		(header_buff + sizeof(header_buff)) - pHeader, \
+		g_network_timeout) != 1 || tcpsenddata(pStorageServer->sock, \
+		pBuff, 3 * field_size + meta_bytes, g_network_timeout) != 1)
+	{
+		result = errno != 0 ? errno : EPIPE;
+		logError("send data to storage server %s:%d fail, " \
+			"errno: %d, error info: %s", \
+			pStorageServer->ip_addr, pStorageServer->port, \
+			result, strerror(result));
+		free(pBuff);
+		return result;
+	}
+	free(pBuff);
+
+	pInBuff = in_buff;
+	if ((result=tracker_recv_response(pStorageServer, \
+		&pInBuff, sizeof(in_buff), &in_bytes)) != 0)
+	{
+		return result;
+	}
+
+	if (in_bytes != FDFS_UPLOAD_SESSION_ID_LEN)
+	{
+		logError("storage server %s:%d response data " \
+			"length: %d is invalid, expect length: %d.", \
+			pStorageServer->ip_addr, pStorageServer->port, \
+			in_bytes, FDFS_UPLOAD_SESSION_ID_LEN);
+		return EINVAL;
+	}
+
+	memcpy(session_id, in_buff, in_bytes);
+	*(session_id + in_bytes) = '\0';
+	return 0;
+}
+
+/* send the request only carries the session id, then recv the response */
+static int storage_send_session_request(TrackerServerInfo *pStorageServer, \
+		const char cmd, const char *session_id, char **in_buff, \
+		const int buff_size, int *in_bytes)
+{
+	char out_buff[FDFS_PROTO_MAX_HEADER_SIZE + FDFS_UPLOAD_SESSION_ID_LEN];
+	char *pHeader;
+	int result;
+
+	*in_bytes = 0;
+	if (strlen(session_id) != FDFS_UPLOAD_SESSION_ID_LEN)
+	{
+		return EINVAL;
+	}
+
+	memcpy(out_buff + FDFS_PROTO_MAX_HEADER_SIZE, session_id, \
+		FDFS_UPLOAD_SESSION_ID_LEN);
+	pHeader = storage_pack_header_ex(FDFS_PROTO_VERSION_2, cmd, 0, \
+			FDFS_UPLOAD_SESSION_ID_LEN, \
+			out_buff + FDFS_PROTO_MAX_HEADER_SIZE);
+	if (tcpsenddata(pStorageServer->sock, pHeader, \
+		(out_buff + sizeof(out_buff)) - pHeader, \
+		g_network_timeout) != 1)
+	{
+		result = errno != 0 ? errno : EPIPE;
+		logError("send data to storage server %s:%d fail, " \
+			"errno: %d, error info: %s", \
+			pStorageServer->ip_addr, pStorageServer->port, \
+			result, strerror(result));
+		return result;
+	}
+
+	return tracker_recv_response(pStorageServer, \
+			in_buff, buff_size, in_bytes);
+}
+
+/**
+FDFS_UPLOAD_SESSION_ID_LEN bytes: session id
+FDFS_PROTO_FIELD_SIZE bytes: part index
+FDFS_PROTO_FIELD_SIZE bytes: the crc32 of the part content
+part bytes: the part content
+**/
+int storage_upload_part(TrackerServerInfo *pStorageServer, \
+			const char *session_id, const int part_index, \
+			const char *part_buff, const int part_bytes)
+{
+	char out_buff[FDFS_PROTO_MAX_HEADER_SIZE + \
+			FDFS_UPLOAD_SESSION_ID_LEN + \
+			2 * TRACKER_PROTO_PKG_LEN_SIZE];
+	char *pBody;
+	char *pHeader;
+	char *pInBuff;
+	int field_size;
+	int in_bytes;
+	int result;
+
+	if (strlen(session_id) != FDFS_UPLOAD_SESSION_ID_LEN)
+	{
+		return EINVAL;
+	}
+
+	field_size = FDFS_PROTO_FIELD_SIZE(FDFS_PROTO_VERSION_2);
+	pBody = out_buff + FDFS_PROTO_MAX_HEADER_SIZE;
+	memcpy(pBody, session_id, FDFS_UPLOAD_SESSION_ID_LEN);
+	fdfs_pack_size_field(FDFS_PROTO_VERSION_2, part_index, \
+			pBody + FDFS_UPLOAD_SESSION_ID_LEN);
+	fdfs_pack_size_field(FDFS_PROTO_VERSION_2, \
+			crc32c((char *)part_buff, part_bytes), \
+			pBody + FDFS_UPLOAD_SESSION_ID_LEN + field_size);
+	pHeader = storage_pack_header_ex(FDFS_PROTO_VERSION_2, \
+			STORAGE_PROTO_CMD_UPLOAD_PART, 0, \
+			FDFS_UPLOAD_SESSION_ID_LEN + 2 * field_size + \
+			part_bytes, pBody);
+	if (tcpsenddata(pStorageServer->sock, pHeader, (pBody + \
+		FDFS_UPLOAD_SESSION_ID_LEN + 2 * field_size) - pHeader, \
+		g_network_timeout) != 1 || tcpsenddata(pStorageServer->sock, \
+		(char *)part_buff, part_bytes, g_network_timeout) != 1)
+	{
+		result = errno != 0 ? errno : EPIPE;
+		logError("send data to storage server %s:%d fail, " \
+			"errno: %d, error info: %s", \
+			pStorageServer->ip_addr, pStorageServer->port, \
+			result, strerror(result));
+		return result;
+	}
+
+	pInBuff = out_buff;
+	return tracker_recv_response(pStorageServer, \
+			&pInBuff, sizeof(out_buff), &in_bytes);
+}
+
+int storage_upload_query(TrackerServerInfo *pStorageServer, \
+			const char *session_id, int64_t *file_size, \
+			int *part_size, char **part_map, int *part_count)
+{
+	char *in_buff;
+	int field_size;
+	int in_bytes;
+	int result;
+
+	*part_map = NULL;
+	*part_count = 0;
+	in_buff = NULL;
+	if ((result=storage_send_session_request(pStorageServer, \
+		STORAGE_PROTO_CMD_UPLOAD_QUERY, session_id, \
+		&in_buff, 0, &in_bytes)) != 0)
+	{
+		return result;
+	}
+
+	field_size = FDFS_PROTO_FIELD_SIZE(FDFS_PROTO_VERSION_2);
+	if (in_bytes <= 2 * field_size)
+	{
+		logError("storage server %s:%d response data " \
+			"length: %d is invalid.", \
+			pStorageServer->ip_addr, pStorageServer->port, \
+			in_bytes);
+		if (in_buff != NULL)
+		{
+			free(in_buff);
+		}
+		return EINVAL;
+	}
+
+	*file_size = fdfs_unpack_size_field(FDFS_PROTO_VERSION_2, in_buff);
+	*part_size = (int)fdfs_unpack_size_field(FDFS_PROTO_VERSION_2, \
+			in_buff + field_size);
+	*part_count = in_bytes - 2 * field_size;
+	memmove(in_buff, in_buff + 2 * field_size, *part_count);
+	*part_map = in_buff;
+	return 0;
+}
+
+int storage_upload_commit(TrackerServerInfo *pStorageServer, \
+			const char *session_id, char *group_name, \
+			char *remote_filename)
+{
+	char in_buff[128];
+	char *pInBuff;
+	int in_bytes;
+	int result;
+
+	group_name[0] = '\0';
+	remote_filename[0] = '\0';
+	pInBuff = in_buff;
+	if ((result=storage_send_session_request(pStorageServer, \
+		STORAGE_PROTO_CMD_UPLOAD_COMMIT, session_id, \
+		&pInBuff, sizeof(in_buff), &in_bytes)) != 0)
+	{
+		return result;
+	}
+
+	if (in_bytes == 0 || in_bytes >= sizeof(in_buff))
+	{
+		logError("storage server %s:%d response data " \
+			"length: %d is invalid.", \
+			pStorageServer->ip_addr, pStorageServer->port, \
+			in_bytes);
+		return EINVAL;
+	}
+
+	strcpy(group_name, pStorageServer->group_name);
+	memcpy(remote_filename, in_buff, in_bytes);
+	remote_filename[in_bytes] = '\0';
+	return 0;
+}
+
+int storage_upload_abort(TrackerServerInfo *pStorageServer, \
+			const char *session_id)
+{
+	char in_buff[1];
+	char *pInBuff;
+	int in_bytes;
+
+	pInBuff = in_buff;
+	return storage_send_session_request(pStorageServer, \
+			STORAGE_PROTO_CMD_UPLOAD_ABORT, session_id, \
+			&pInBuff, 0, &in_bytes);
+}
+
+typedef struct
+{
+	TrackerServerInfo *pStorageServer;  //the server of the session
+	const char *session_id;
+	int fd;
+	int64_t file_size;
+	int part_size;
+	int part_count;
+	const char *part_map;  //the parts uploaded before
+	int next_part;
+	int result;  //the first error of the threads
+	pthread_mutex_t lock;
+} UploadPartsContext;
+
+/* read the part from the local file at its offset */
+static int storage_read_part(const int fd, const int64_t offset, \
+		char *buff, const int bytes)
+{
+	int read_bytes;
+	int done;
+
+	done = 0;
+	while (done < bytes)
+	{
+		read_bytes = pread(fd, buff + done, bytes - done, \
+				offset + done);
+		if (read_bytes <= 0)
+		{
+			if (read_bytes < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			return (read_bytes < 0 && errno != 0) ? errno : EIO;
+		}
+		done += read_bytes;
+	}
+
+	return 0;
+}
+
+/* each thread takes the next part not uploaded on its own connection */
+static void *storage_upload_parts_entrance(void *arg)
+{
+	UploadPartsContext *pContext;
+	TrackerServerInfo storageServer;
+	char *buff;
+	int part_index;
+	int part_bytes;
+	int result;
+
+	pContext = (UploadPartsContext *)arg;
+	memcpy(&storageServer, pContext->pStorageServer, \
+		sizeof(TrackerServerInfo));
+	storageServer.sock = -1;
+	buff = NULL;
+	if ((result=tracker_connect_server(&storageServer)) == 0 && \
+		(buff=(char *)malloc(pContext->part_size)) == NULL)
+	{
+		result = errno != 0 ? errno : ENOMEM;
+	}
+
+	while (result == 0)
+	{
+		pthread_mutex_lock(&pContext->lock);
+		while (pContext->next_part < pContext->part_count && \
+			pContext->part_map != NULL && \
+			pContext->part_map[pContext->next_part])
+		{
+			pContext->next_part++;
+		}
+		part_index = pContext->result == 0 ? \
+				pContext->next_part++ : pContext->part_count;
+		pthread_mutex_unlock(&pContext->lock);
+		if (part_index >= pContext->part_count)
+		{
+			break;
+		}
+
+		if (part_index < pContext->part_count - 1)
+		{
+			part_bytes = pContext->part_size;
+		}
+		else
+		{
+			part_bytes = (int)(pContext->file_size - \
+				(int64_t)pContext->part_size * part_index);
+		}
+
+		if ((result=storage_read_part(pContext->fd, \
+			(int64_t)pContext->part_size * part_index, \
+			buff, part_bytes)) != 0)
+		{
+			logError("read local file fail, " \
+				"errno: %d, error info: %s", \
+				result, strerror(result));
+			break;
+		}
+
+		result = storage_upload_part(&storageServer, \
+			pContext->session_id, part_index, buff, part_bytes);
+	}
+
+	if (result != 0)
+	{
+		pthread_mutex_lock(&pContext->lock);
+		if (pContext->result == 0)
+		{
+			pContext->result = result;
+		}
+		pthread_mutex_unlock(&pContext->lock);
+	}
+
+	if (buff != NULL)
+	{
+		free(buff);
+	}
+	if (storageServer.sock >= 0)
+	{
+		tracker_quit(&storageServer);
+		tracker_disconnect_server(&storageServer);
+	}
+	return NULL;
+}
+
+int storage_upload_by_parts(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *local_filename, \
+			const FDFSMetaData *meta_list, \
+			const int meta_count, \
+			const int thread_count, \
+			char *session_id, \
+			char *group_name, \
+			char *remote_filename)
+{
+	UploadPartsContext context;
+	pthread_t tids[FDFS_MAX_UPLOAD_THREADS];
+	struct stat stat_buf;
+	char *part_map;
+	int64_t file_size;
+	int part_size;
+	int part_count;
+	int count;
+	int result;
+	int i;
+
+	group_name[0] = '\0';
+	remote_filename[0] = '\0';
+	if (thread_count <= 0 || thread_count > FDFS_MAX_UPLOAD_THREADS)
+	{
+		return EINVAL;
+	}
+
+	if (stat(local_filename, &stat_buf) != 0)
+	{
+		return errno != 0 ? errno : ENOENT;
+	}
+
+	/* resume the session, the uploaded parts are skipped */
+	part_map = NULL;
+	if (*session_id != '\0')
+	{
+		if ((result=storage_upload_query(pStorageServer, \
+			session_id, &file_size, &part_size, \
+			&part_map, &part_count)) != 0)
+		{
+			return result;
+		}
+
+		if (file_size != stat_buf.st_size)
+		{
+			logError("the size of the local file %s: " \
+				INT64_PRINTF_FORMAT" != the size of " \
+				"upload session %s: "INT64_PRINTF_FORMAT, \
+				local_filename, (int64_t)stat_buf.st_size, \
+				session_id, file_size);
+			free(part_map);
+			return EINVAL;
+		}
+	}
+	else
+	{
+		part_size = FDFS_UPLOAD_PART_SIZE;
+		part_count = (int)((stat_buf.st_size + part_size - 1) / \
+				part_size);
+		if ((result=storage_upload_begin(pStorageServer, \
+			stat_buf.st_size, part_size, meta_list, \
+			meta_count, session_id)) != 0)
+		{
+			return result;
+		}
+	}
+
+	memset(&context, 0, sizeof(context));
+	context.pStorageServer = pStorageServer;
+	context.session_id = session_id;
+	context.file_size = stat_buf.st_size;
+	context.part_size = part_size;
+	context.part_count = part_count;
+	context.part_map = part_map;
+	if ((context.fd=open(local_filename, O_RDONLY)) < 0)
+	{
+		result = errno != 0 ? errno : ENOENT;
+		if (part_map != NULL)
+		{
+			free(part_map);
+		}
+		return result;
+	}
+
+	if ((result=pthread_mutex_init(&context.lock, NULL)) != 0)
+	{
+		close(context.fd);
+		if (part_map != NULL)
+		{
+			free(part_map);
+		}
+		return result;
+	}
+
+	count = thread_count < part_count ? thread_count : part_count;
+	for (i=0; i<count; i++)
+	{
+		if ((result=pthread_create(tids + i, NULL, \
+			storage_upload_parts_entrance, &context)) != 0)
+		{
+			logError("create thread failed, errno: %d, " \
+				"error info: %s", result, strerror(result));
+			pthread_mutex_lock(&context.lock);
+			context.result = result;
+			pthread_mutex_unlock(&context.lock);
+			break;
+		}
+	}
+	count = i;
+	for (i=0; i<count; i++)
+	{
+		pthread_join(tids[i], NULL);
+	}
+
+	pthread_mutex_destroy(&context.lock);
+	close(context.fd);
+	if (part_map != NULL)
+	{
+		free(part_map);
+	}
+
+	/* the session is kept for resuming when some parts fail */
+	if (context.result != 0)
+	{
+		return context.result;
+	}
+
+	if ((result=storage_upload_commit(pStorageServer, session_id, \
+		group_name, remote_filename)) != 0)
+	{
+		return result;
+	}
+
+	*session_id = '\0';
+	return 0;
+}
+
 /**
 9 bytes: filename length
 9 bytes: meta data size
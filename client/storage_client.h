@@ -11,12 +11,54 @@
 
 #include "tracker_types.h"
 
+/* the file id in the filename: base64 of timestamp(4), file size(4),
+   crc32(4) and random(3), the id of the file of 4GB and more sets the
+   high bit of the byte after the crc32 and the next 15 bits hold the
+   bits 32 - 46 of the file size */
+#define FDFS_FILENAME_ID_BYTES	15
+#define FDFS_FILENAME_SIZE_HIGH_FLAG	0x80
+
+/* the small files packed in the trunk files are under this dir */
+#define FDFS_TRUNK_DIR_NAME	"TK"
+
+/* the local files >= this size are uploaded by chunks, they may be
+   larger than 2GB */
+#define FDFS_STREAM_FILE_SIZE	(64 * 1024 * 1024)
+#define FDFS_STREAM_BUFF_SIZE	(256 * 1024)
+
+/* the upload session of the large file, refer to storage_upload_by_parts */
+#define FDFS_UPLOAD_SESSION_ID_LEN	16
+#define FDFS_UPLOAD_PART_SIZE		(8 * 1024 * 1024)
+#define FDFS_MAX_UPLOAD_THREADS		16
+
+/* the appender filename ends with this ext, the ip address of its source
+   storage server is in the place of the crc32 */
+#define FDFS_APPENDER_FILE_EXT	"~"
+
+typedef struct
+{
+	int status;  //0 for success, ENOENT for the file not exist
+	FDFSMetaData *meta_list;  //meta info array, NULL for no metadata
+	int meta_count;
+} FDFSFileMetaData;
+
+/* the max download requests sent before reading the responses */
+#define STORAGE_PIPELINE_WINDOW	32
+
+typedef struct
+{
+	int result;  //0 for success, ENOENT for the file not exist
+	char *file_buff;  //file content, NULL when fail
+	int file_size;
+} FDFSDownloadResult;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 /**
-* upload file to storage server (by file name)
+* upload file to storage server (by file name), the file >=
+* FDFS_STREAM_FILE_SIZE is read and sent by chunks
 * params:
 *       pTrackerServer: tracker server
 *       pStorageServer: storage server
@@ -56,6 +98,167 @@ int storage_upload_by_filebuff(TrackerServerInfo *pTrackerServer, \
 			char *group_name, \
 			char *remote_filename);
 
+/**
+* upload the appender file to storage server (by file buff), the content
+* can be appended later by storage_append_by_filebuff
+* params: the same as storage_upload_by_filebuff
+* return: 0 success, !=0 fail, return the error code
+**/
+int storage_upload_appender_by_filebuff(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *file_buff, const int file_size, \
+			const FDFSMetaData *meta_list, \
+			const int meta_count, \
+			char *group_name, \
+			char *remote_filename);
+
+/**
+* upload the appender file to storage server (by file name)
+* params: the same as storage_upload_by_filename
+* return: 0 success, !=0 fail, return the error code
+**/
+int storage_upload_appender_by_filename(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *local_filename, \
+			const FDFSMetaData *meta_list, \
+			const int meta_count, \
+			char *group_name, \
+			char *remote_filename);
+
+/**
+* append the content to the end of the appender file (by file buff), the
+* appender file is appended on its source storage server only
+* params:
+*       pTrackerServer: tracker server
+*       pStorageServer: the source storage server of the appender file,
+*		NULL for connecting to it
+*       file_buff: the content to append
+*       file_size: the content size (bytes)
+*	group_name: the group name of the appender file
+*	appender_filename: the appender filename on storage server
+*	offset: return the offset of the appended content in the file
+* return: 0 success, EPERM for not the source storage server,
+*	!=0 fail, return the error code
+**/
+int storage_append_by_filebuff(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *file_buff, const int file_size, \
+			const char *group_name, \
+			const char *appender_filename, \
+			int64_t *offset);
+
+/**
+* append the local file to the end of the appender file (by file name)
+* params: the same as storage_append_by_filebuff except
+*       local_filename: local filename to append
+* return: 0 success, !=0 fail, return the error code
+**/
+int storage_append_by_filename(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *local_filename, \
+			const char *group_name, \
+			const char *appender_filename, \
+			int64_t *offset);
+
+/**
+* upload the local file by parts in parallel through the upload session,
+* each thread uploads the parts on its own connection to the storage
+* server, the session is kept when fail so the upload can be resumed
+* params:
+*       pTrackerServer: tracker server
+*       pStorageServer: the connected storage server
+*       local_filename: local filename to upload
+*	meta_list: meta info array
+*       meta_count: meta item count
+*	thread_count: the thread count, <= FDFS_MAX_UPLOAD_THREADS
+*	session_id: empty to begin a new session, or the session id on the
+*		storage server to resume, return the session id when fail,
+*		FDFS_UPLOAD_SESSION_ID_LEN + 1 bytes
+*	group_name: return the group name to store the file
+*	remote_filename: return the new created filename
+* return: 0 success, !=0 fail, return the error code
+**/
+int storage_upload_by_parts(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *local_filename, \
+			const FDFSMetaData *meta_list, \
+			const int meta_count, \
+			const int thread_count, \
+			char *session_id, \
+			char *group_name, \
+			char *remote_filename);
+
+/**
+* begin the upload session, the space of the file is allocated
+* params:
+*       pStorageServer: the connected storage server
+*       file_size: file size (bytes)
+*       part_size: the size of each part except the last one
+*	meta_list: meta info array
+*       meta_count: meta item count
+*	session_id: return the session id, FDFS_UPLOAD_SESSION_ID_LEN + 1
+*		bytes
+* return: 0 success, !=0 fail, return the error code
+**/
+int storage_upload_begin(TrackerServerInfo *pStorageServer, \
+			const int64_t file_size, const int part_size, \
+			const FDFSMetaData *meta_list, \
+			const int meta_count, char *session_id);
+
+/**
+* upload the part of the session, the parts can be uploaded in any order
+* by many connections to the same storage server
+* params:
+*       pStorageServer: the connected storage server
+*	session_id: the session id
+*	part_index: the part index, based 0
+*	part_buff: the part content at part_index * part_size of the file
+*	part_bytes: the part size, less than part_size for the last part
+* return: 0 success, EIO for the part corrupted in transit and not stored,
+*	!=0 fail, return the error code
+**/
+int storage_upload_part(TrackerServerInfo *pStorageServer, \
+			const char *session_id, const int part_index, \
+			const char *part_buff, const int part_bytes);
+
+/**
+* query the parts uploaded of the session
+* params:
+*       pStorageServer: the connected storage server
+*	session_id: the session id
+*       file_size: return file size (bytes)
+*       part_size: return the part size
+*	part_map: return the part map, 1 for the part uploaded, must be freed
+*	part_count: return the part count
+* return: 0 success, ENOENT for the session not exist, !=0 fail
+**/
+int storage_upload_query(TrackerServerInfo *pStorageServer, \
+			const char *session_id, int64_t *file_size, \
+			int *part_size, char **part_map, int *part_count);
+
+/**
+* commit the session when all of the parts are uploaded
+* params:
+*       pStorageServer: the connected storage server
+*	session_id: the session id
+*	group_name: return the group name to store the file
+*	remote_filename: return the new created filename
+* return: 0 success, EAGAIN for some parts not uploaded, !=0 fail
+**/
+int storage_upload_commit(TrackerServerInfo *pStorageServer, \
+			const char *session_id, char *group_name, \
+			char *remote_filename);
+
+/**
+* abort the session, the uploaded parts are removed
+* params:
+*       pStorageServer: the connected storage server
+*	session_id: the session id
+* return: 0 success, !=0 fail, return the error code
+**/
+int storage_upload_abort(TrackerServerInfo *pStorageServer, \
+			const char *session_id);
+
 /**
 * delete file from storage server
 * params:
@@ -85,6 +288,74 @@ int storage_download_file(TrackerServerInfo *pTrackerServer, \
 			const char *group_name, const char *filename, \
 			char **file_buff, int *file_size);
 
+/**
+* download file from storage server to the local file, the content is
+* received and written by chunks, so the file may be larger than 2GB
+* params:
+*       pTrackerServer: tracker server
+*       pStorageServer: storage server
+*	group_name: the group name of storage server
+*	filename: filename on storage server
+*	local_filename: the local filename to write, removed when fail
+*       file_size: return file size (bytes)
+* return: 0 success, !=0 fail, return the error code
+**/
+int storage_download_file_to_file(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *group_name, const char *filename, \
+			const char *local_filename, int64_t *file_size);
+
+/**
+* download many files from storage server on one connection, the requests
+* are pipelined, STORAGE_PIPELINE_WINDOW requests are sent before reading
+* their responses
+* params:
+*       pTrackerServer: tracker server
+*       pStorageServer: storage server, NULL to query the storage server
+*		of the first file
+*	group_name: the group name of storage server
+*	filenames: filenames on storage server
+*	count: file count
+*	results: return the content of each file, the result of each file
+*		should be checked, free it by storage_free_download_results
+* return: 0 success, !=0 fail, return the error code
+**/
+int storage_download_files(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *group_name, const char **filenames, \
+			const int count, FDFSDownloadResult *results);
+
+/**
+* free the file contents returned by storage_download_files
+* params:
+*	results: the contents of the files
+*	count: file count
+* return:
+**/
+void storage_free_download_results(FDFSDownloadResult *results, \
+		const int count);
+
+/**
+* get the file size and the CRC32C of the file content from the filename,
+* the checksum is verified by upload and download
+* params:
+*	remote_filename: filename on storage server
+*       file_size: return the file size (bytes)
+*       crc32: return the CRC32C of the file content
+* return: 0 success, ENOENT for no checksum in the filename
+**/
+int storage_get_file_checksum(const char *remote_filename, \
+		int64_t *file_size, unsigned int *crc32);
+
+/**
+* get the source storage server of the appender file from the filename
+* params:
+*	remote_filename: the appender filename on storage server
+*	ip_addr: return the ip address of the source storage server
+* return: 0 success, EINVAL for not an appender file
+**/
+int storage_get_appender_source(const char *remote_filename, char *ip_addr);
+
 /**
 * get all metadata items from storage server
 * params:
@@ -102,6 +373,61 @@ int storage_get_metadata(TrackerServerInfo *pTrackerServer, \
 			FDFSMetaData **meta_list, \
 			int *meta_count);
 
+/**
+* get the metadata items of many files from storage server in one request
+* params:
+*       pTrackerServer: tracker server
+*       pStorageServer: storage server, NULL to query the storage server
+*		of the first file
+*	group_name: the group name of storage server
+*	filenames: filenames on storage server
+*	count: file count, <= STORAGE_MAX_BATCH_META_COUNT
+*	keys: the names of the metadata items to get, NULL for all items
+*	key_count: key count, <= STORAGE_MAX_BATCH_META_KEYS
+*	results: return the metadata of each file, the status of each file
+*		should be checked, free it by storage_free_metadata_batch
+* return: 0 success, !=0 fail, return the error code
+**/
+int storage_get_metadata_batch(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *group_name, const char **filenames, \
+			const int count, const char **keys, \
+			const int key_count, FDFSFileMetaData *results);
+
+/**
+* free the meta info arrays returned by storage_get_metadata_batch
+* params:
+*	results: the metadata of the files
+*	count: file count
+* return:
+**/
+void storage_free_metadata_batch(FDFSFileMetaData *results, const int count);
+
+/**
+* query the files whose metadata item has the value, the name should be
+* one of the meta_index_keys of the storage servers
+* params:
+*       pTrackerServer: tracker server
+*       pStorageServer: storage server, NULL to query any storage server
+*		of the group
+*	group_name: the group name of storage server
+*	name: the metadata name
+*	value: the metadata value
+*	cursor: the last filename of the previous page, NULL or empty for
+*		the first page
+*	max_count: the max count of the filenames,
+*		<= STORAGE_MAX_META_QUERY_COUNT
+*	filenames: return the filename array sorted by filename, must be
+*		freed, the filenames are in the same buffer
+*	count: return the filename count, < max_count for the last page
+* return: 0 success, !=0 fail, return the error code
+**/
+int storage_query_by_metadata(TrackerServerInfo *pTrackerServer, \
+			TrackerServerInfo *pStorageServer, \
+			const char *group_name, const char *name, \
+			const char *value, const char *cursor, \
+			const int max_count, char ***filenames, int *count);
+
 /**
 * set metadata items to storage server
 * params:
@@ -16,6 +16,7 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <pthread.h>
 #include "fdfs_define.h"
 #include "logger.h"
 #include "shared_func.h"
@@ -26,6 +27,9 @@
 #include "tracker_client.h"
 #include "client_global.h"
 
+/* g_topology is shared by the threads of the client */
+static pthread_mutex_t topology_lock = PTHREAD_MUTEX_INITIALIZER;
+
 void tracker_disconnect_server(TrackerServerInfo *pTrackerServer)
 {
 	if (pTrackerServer->sock > 0)
@@ -436,3 +440,458 @@ int tracker_query_storage_store(TrackerServerInfo *pTrackerServer, \
 	return 0;
 }
 
+
+static int tracker_parse_placements(TrackerServerInfo *pTrackerServer, \
+		char *in_buff, const int in_bytes, \
+		FDFSStoragePlacement *placements, const int max_count, \
+		int *count)
+{
+	char szValue[TRACKER_PROTO_PKG_LEN_SIZE];
+	char *p;
+	char *pEnd;
+	FDFSStoragePlacement *pDest;
+	int i;
+
+	*count = 0;
+	p = in_buff;
+	pEnd = in_buff + in_bytes;
+	pDest = placements;
+	while (p < pEnd)
+	{
+		if (*count >= max_count || \
+			pEnd - p < TRACKER_BATCH_PLACEMENT_FIXED_LEN)
+		{
+			logError("tracker server %s:%d response data " \
+				"length: %d is invalid.", \
+				pTrackerServer->ip_addr, \
+				pTrackerServer->port, in_bytes);
+			return EINVAL;
+		}
+
+		memset(pDest, 0, sizeof(FDFSStoragePlacement));
+		pDest->status = *p++;
+		memcpy(pDest->group_name, p, FDFS_GROUP_NAME_MAX_LEN);
+		p += FDFS_GROUP_NAME_MAX_LEN;
+		memcpy(pDest->ip_addr, p, FDFS_IPADDR_SIZE - 1);
+		p += FDFS_IPADDR_SIZE - 1;
+		memcpy(szValue, p, TRACKER_PROTO_PKG_LEN_SIZE - 1);
+		szValue[TRACKER_PROTO_PKG_LEN_SIZE - 1] = '\0';
+		pDest->port = strtol(szValue, NULL, 16);
+		p += TRACKER_PROTO_PKG_LEN_SIZE;
+		memcpy(szValue, p, TRACKER_PROTO_PKG_LEN_SIZE - 1);
+		szValue[TRACKER_PROTO_PKG_LEN_SIZE - 1] = '\0';
+		pDest->server_count = strtol(szValue, NULL, 16);
+		p += TRACKER_PROTO_PKG_LEN_SIZE;
+
+		if (pDest->server_count < 0 || pDest->server_count > \
+			FDFS_MAX_SERVERS_EACH_GROUP || pEnd - p < \
+			pDest->server_count * (FDFS_IPADDR_SIZE - 1))
+		{
+			logError("tracker server %s:%d response data " \
+				"length: %d is invalid.", \
+				pTrackerServer->ip_addr, \
+				pTrackerServer->port, in_bytes);
+			return EINVAL;
+		}
+
+		for (i=0; i<pDest->server_count; i++)
+		{
+			memcpy(pDest->server_ips[i], p, FDFS_IPADDR_SIZE - 1);
+			p += FDFS_IPADDR_SIZE - 1;
+		}
+
+		pDest++;
+		(*count)++;
+	}
+
+	return 0;
+}
+
+int tracker_query_storage_store_batch(TrackerServerInfo *pTrackerServer, \
+		FDFSStoragePlacement *placements, const int max_count, \
+		int *count)
+{
+	char out_buff[sizeof(TrackerHeader) + TRACKER_PROTO_PKG_LEN_SIZE];
+	TrackerHeader *pHeader;
+	char *pInBuff;
+	int in_bytes;
+	int result;
+
+	*count = 0;
+	if (max_count <= 0 || max_count > TRACKER_MAX_BATCH_QUERY_COUNT)
+	{
+		return EINVAL;
+	}
+
+	memset(out_buff, 0, sizeof(out_buff));
+	pHeader = (TrackerHeader *)out_buff;
+	sprintf(pHeader->pkg_len, "%x", TRACKER_PROTO_PKG_LEN_SIZE);
+	pHeader->cmd = TRACKER_PROTO_CMD_SERVICE_QUERY_STORE_BATCH;
+	pHeader->status = 0;
+	sprintf(out_buff + sizeof(TrackerHeader), "%x", max_count);
+	if (tcpsenddata(pTrackerServer->sock, out_buff, \
+			sizeof(out_buff), g_network_timeout) != 1)
+	{
+		logError("send data to tracker server %s:%d fail, " \
+			"errno: %d, error info: %s", \
+			pTrackerServer->ip_addr, \
+			pTrackerServer->port, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+
+	pInBuff = NULL;
+	if ((result=tracker_recv_response(pTrackerServer, \
+		&pInBuff, 0, &in_bytes)) != 0)
+	{
+		return result;
+	}
+
+	result = tracker_parse_placements(pTrackerServer, pInBuff, \
+			in_bytes, placements, max_count, count);
+	if (pInBuff != NULL)
+	{
+		free(pInBuff);
+	}
+	return result;
+}
+
+int tracker_query_storage_fetch_batch(TrackerServerInfo *pTrackerServer, \
+		const char **group_names, const char **filenames, \
+		const int count, FDFSStoragePlacement *placements)
+{
+	TrackerHeader *pHeader;
+	char *out_buff;
+	char *p;
+	char *pInBuff;
+	int filename_len;
+	int in_bytes;
+	int result;
+	int result_count;
+	int i;
+
+	if (count <= 0 || count > TRACKER_MAX_BATCH_QUERY_COUNT)
+	{
+		return EINVAL;
+	}
+
+	out_buff = (char *)malloc(sizeof(TrackerHeader) + \
+		TRACKER_PROTO_PKG_LEN_SIZE + count * (FDFS_GROUP_NAME_MAX_LEN \
+		+ TRACKER_PROTO_PKG_LEN_SIZE + MAX_PATH_SIZE));
+	if (out_buff == NULL)
+	{
+		return errno != 0 ? errno : ENOMEM;
+	}
+
+	p = out_buff + sizeof(TrackerHeader);
+	memset(p, 0, TRACKER_PROTO_PKG_LEN_SIZE);
+	sprintf(p, "%x", count);
+	p += TRACKER_PROTO_PKG_LEN_SIZE;
+	for (i=0; i<count; i++)
+	{
+		memset(p, 0, FDFS_GROUP_NAME_MAX_LEN + \
+				TRACKER_PROTO_PKG_LEN_SIZE);
+		filename_len = strlen(group_names[i]);
+		memcpy(p, group_names[i], filename_len < \
+			FDFS_GROUP_NAME_MAX_LEN ? filename_len : \
+			FDFS_GROUP_NAME_MAX_LEN);
+		p += FDFS_GROUP_NAME_MAX_LEN;
+
+		filename_len = strlen(filenames[i]);
+		if (filename_len >= MAX_PATH_SIZE)
+		{
+			filename_len = MAX_PATH_SIZE - 1;
+		}
+		sprintf(p, "%x", filename_len);
+		p += TRACKER_PROTO_PKG_LEN_SIZE;
+		memcpy(p, filenames[i], filename_len);
+		p += filename_len;
+	}
+
+	pHeader = (TrackerHeader *)out_buff;
+	sprintf(pHeader->pkg_len, "%x", \
+		(int)(p - out_buff - sizeof(TrackerHeader)));
+	pHeader->cmd = TRACKER_PROTO_CMD_SERVICE_QUERY_FETCH_BATCH;
+	pHeader->status = 0;
+	if (tcpsenddata(pTrackerServer->sock, out_buff, \
+			p - out_buff, g_network_timeout) != 1)
+	{
+		logError("send data to tracker server %s:%d fail, " \
+			"errno: %d, error info: %s", \
+			pTrackerServer->ip_addr, \
+			pTrackerServer->port, \
+			errno, strerror(errno));
+		free(out_buff);
+		return errno != 0 ? errno : EPIPE;
+	}
+	free(out_buff);
+
+	pInBuff = NULL;
+	if ((result=tracker_recv_response(pTrackerServer, \
+		&pInBuff, 0, &in_bytes)) != 0)
+	{
+		return result;
+	}
+
+	result = tracker_parse_placements(pTrackerServer, pInBuff, \
+			in_bytes, placements, count, &result_count);
+	if (pInBuff != NULL)
+	{
+		free(pInBuff);
+	}
+	if (result == 0 && result_count != count)
+	{
+		logError("tracker server %s:%d response placement " \
+			"count: %d != %d", pTrackerServer->ip_addr, \
+			pTrackerServer->port, result_count, count);
+		return EINVAL;
+	}
+	return result;
+}
+
+int tracker_get_topology_version(TrackerServerInfo *pTrackerServer, \
+		int *version)
+{
+	TrackerHeader header;
+	char in_buff[4];
+	char *pInBuff;
+	int in_bytes;
+	int result;
+
+	*version = 0;
+	header.pkg_len[0] = '0';
+	header.pkg_len[1] = '\0';
+	header.cmd = TRACKER_PROTO_CMD_SERVER_TOPOLOGY_VERSION;
+	header.status = 0;
+	if (tcpsenddata(pTrackerServer->sock, &header, sizeof(header), \
+			g_network_timeout) != 1)
+	{
+		logError("send data to tracker server %s:%d fail, " \
+			"errno: %d, error info: %s", \
+			pTrackerServer->ip_addr, \
+			pTrackerServer->port, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+
+	pInBuff = in_buff;
+	if ((result=tracker_recv_response(pTrackerServer, \
+		&pInBuff, sizeof(in_buff), &in_bytes)) != 0)
+	{
+		return result;
+	}
+
+	if (in_bytes != sizeof(in_buff))
+	{
+		logError("tracker server %s:%d response data " \
+			"length: %d is invalid, expect length: %d.", \
+			pTrackerServer->ip_addr, \
+			pTrackerServer->port, in_bytes, (int)sizeof(in_buff));
+		return EINVAL;
+	}
+
+	*version = buff2int((unsigned char *)in_buff);
+	return 0;
+}
+
+static int topology_cmp_by_group_name(const void *p1, const void *p2)
+{
+	return strcmp(((FDFSGroupTopology *)p1)->group_name, \
+			((FDFSGroupTopology *)p2)->group_name);
+}
+
+int tracker_load_topology(TrackerServerInfo *pTrackerServer)
+{
+	FDFSGroupStat group_stats[FDFS_MAX_GROUPS];
+	FDFSStorageInfo storage_infos[FDFS_MAX_SERVERS_EACH_GROUP];
+	FDFSTopology *pTopology;
+	FDFSGroupTopology *pGroup;
+	FDFSStorageInfo *pStorage;
+	FDFSStorageInfo *pStorageEnd;
+	int group_count;
+	int storage_count;
+	int result;
+	int i;
+
+	pTopology = (FDFSTopology *)malloc(sizeof(FDFSTopology));
+	if (pTopology == NULL)
+	{
+		return errno != 0 ? errno : ENOMEM;
+	}
+	memset(pTopology, 0, sizeof(FDFSTopology));
+
+	while (1)
+	{
+		/* get version first, the changes during loading will be
+		   found by the next check */
+		if ((result=tracker_get_topology_version(pTrackerServer, \
+				&pTopology->version)) != 0)
+		{
+			break;
+		}
+
+		if ((result=tracker_list_groups(pTrackerServer, \
+			group_stats, FDFS_MAX_GROUPS, &group_count)) != 0)
+		{
+			break;
+		}
+
+		for (i=0; i<group_count; i++)
+		{
+			if ((result=tracker_list_servers(pTrackerServer, \
+				group_stats[i].group_name, storage_infos, \
+				FDFS_MAX_SERVERS_EACH_GROUP, \
+				&storage_count)) != 0)
+			{
+				break;
+			}
+
+			pGroup = pTopology->groups + i;
+			strcpy(pGroup->group_name, group_stats[i].group_name);
+			pGroup->storage_port = group_stats[i].storage_port;
+			pStorageEnd = storage_infos + storage_count;
+			for (pStorage=storage_infos; pStorage<pStorageEnd; \
+				pStorage++)
+			{
+				if (pStorage->status == \
+					FDFS_STORAGE_STATUS_ACTIVE)
+				{
+					strcpy(pGroup->server_ips[ \
+						pGroup->server_count++], \
+						pStorage->ip_addr);
+				}
+			}
+		}
+
+		if (result != 0)
+		{
+			break;
+		}
+
+		/* the groups are searched by bsearch */
+		qsort(pTopology->groups, group_count, \
+			sizeof(FDFSGroupTopology), topology_cmp_by_group_name);
+		pTopology->group_count = group_count;
+		pTopology->loaded = true;
+		pTopology->last_check_time = time(NULL);
+
+		pthread_mutex_lock(&topology_lock);
+		memcpy(&g_topology, pTopology, sizeof(FDFSTopology));
+		pthread_mutex_unlock(&topology_lock);
+		break;
+	}
+
+	free(pTopology);
+	return result;
+}
+
+void tracker_invalidate_topology()
+{
+	pthread_mutex_lock(&topology_lock);
+	g_topology.loaded = false;
+	pthread_mutex_unlock(&topology_lock);
+}
+
+static int tracker_check_topology(TrackerServerInfo *pTrackerServer)
+{
+	bool loaded;
+	time_t last_check_time;
+	int cached_version;
+	int version;
+	int result;
+
+	pthread_mutex_lock(&topology_lock);
+	loaded = g_topology.loaded;
+	last_check_time = g_topology.last_check_time;
+	cached_version = g_topology.version;
+	pthread_mutex_unlock(&topology_lock);
+
+	if (loaded && time(NULL) - last_check_time < \
+			g_topology_check_interval)
+	{
+		return 0;
+	}
+
+	if (pTrackerServer == NULL)
+	{
+		if ((pTrackerServer=tracker_get_connection()) == NULL)
+		{
+			return errno != 0 ? errno : ECONNREFUSED;
+		}
+	}
+
+	if (loaded)
+	{
+		if ((result=tracker_get_topology_version(pTrackerServer, \
+				&version)) != 0)
+		{
+			return result;
+		}
+
+		if (version == cached_version)
+		{
+			pthread_mutex_lock(&topology_lock);
+			if (g_topology.loaded && g_topology.version == version)
+			{
+				g_topology.last_check_time = time(NULL);
+			}
+			pthread_mutex_unlock(&topology_lock);
+			return 0;
+		}
+	}
+
+	return tracker_load_topology(pTrackerServer);
+}
+
+int tracker_query_storage_fetch_cached(TrackerServerInfo *pTrackerServer, \
+		TrackerServerInfo *pStorageServer, \
+		const char *group_name, const char *filename)
+{
+	FDFSGroupTopology target;
+	FDFSGroupTopology *pGroup;
+	int result;
+
+	if (g_topology_check_interval <= 0)
+	{
+		if (pTrackerServer == NULL && \
+			(pTrackerServer=tracker_get_connection()) == NULL)
+		{
+			return errno != 0 ? errno : ECONNREFUSED;
+		}
+
+		return tracker_query_storage_fetch(pTrackerServer, \
+				pStorageServer, group_name, filename);
+	}
+
+	if ((result=tracker_check_topology(pTrackerServer)) != 0)
+	{
+		return result;
+	}
+
+	memset(pStorageServer, 0, sizeof(TrackerServerInfo));
+	snprintf(target.group_name, sizeof(target.group_name), \
+			"%s", group_name);
+
+	pthread_mutex_lock(&topology_lock);
+	pGroup = (FDFSGroupTopology *)bsearch(&target, g_topology.groups, \
+			g_topology.group_count, sizeof(FDFSGroupTopology), \
+			topology_cmp_by_group_name);
+	if (pGroup == NULL || pGroup->server_count == 0)
+	{
+		pthread_mutex_unlock(&topology_lock);
+		return ENOENT;
+	}
+
+	if (pGroup->current_read_server >= pGroup->server_count)
+	{
+		pGroup->current_read_server = 0;
+	}
+
+	strcpy(pStorageServer->group_name, pGroup->group_name);
+	strcpy(pStorageServer->ip_addr, \
+		pGroup->server_ips[pGroup->current_read_server]);
+	pStorageServer->port = pGroup->storage_port;
+	pGroup->current_read_server++;
+	pthread_mutex_unlock(&topology_lock);
+	return 0;
+}
@@ -24,6 +24,16 @@ typedef struct
         FDFSStorageStat stat;
 } FDFSStorageInfo;
 
+typedef struct
+{
+	char status;  //0 for success, otherwise the error code
+	char group_name[FDFS_GROUP_NAME_MAX_LEN + 1];
+	char ip_addr[FDFS_IPADDR_SIZE];  //the selected storage server
+	int port;
+	int server_count;  //active server count of the group
+	char server_ips[FDFS_MAX_SERVERS_EACH_GROUP][FDFS_IPADDR_SIZE];
+} FDFSStoragePlacement;
+
 /**
 * close all connections to tracker servers
 * params:
@@ -105,6 +115,77 @@ int tracker_query_storage_fetch(TrackerServerInfo *pTrackerServer, \
 		TrackerServerInfo *pStorageServer, \
 		const char *group_name, const char *filename);
 
+/**
+* query storage servers to upload many files in one request
+* params:
+*	pTrackerServer: tracker server
+*	placements: return placement array, the active servers of the
+*		group can be used for fail over
+*	max_count: placement count to query (placement array capacity)
+*	count: return placement count
+* return: 0 success, !=0 fail, return the error code
+**/
+int tracker_query_storage_store_batch(TrackerServerInfo *pTrackerServer, \
+		FDFSStoragePlacement *placements, const int max_count, \
+		int *count);
+
+/**
+* query storage servers to download many files in one request
+* params:
+*	pTrackerServer: tracker server
+*	group_names: the group names of the files
+*	filenames: the filenames on storage server
+*	count: file count
+*	placements: return placement array, the status of each item
+*		should be checked
+* return: 0 success, !=0 fail, return the error code
+**/
+int tracker_query_storage_fetch_batch(TrackerServerInfo *pTrackerServer, \
+		const char **group_names, const char **filenames, \
+		const int count, FDFSStoragePlacement *placements);
+
+/**
+* get the topology version of the tracker server, the version changes
+* when any group or active storage server changes
+* params:
+*	pTrackerServer: tracker server
+*	version: return the topology version
+* return: 0 success, !=0 fail, return the error code
+**/
+int tracker_get_topology_version(TrackerServerInfo *pTrackerServer, \
+		int *version);
+
+/**
+* load the groups and active storage servers into g_topology
+* params:
+*	pTrackerServer: tracker server
+* return: 0 success, !=0 fail, return the error code
+**/
+int tracker_load_topology(TrackerServerInfo *pTrackerServer);
+
+/**
+* mark the cached topology as stale, should be called when connect to
+* a storage server fail, the next cached query will reload it
+* params:
+* return:
+**/
+void tracker_invalidate_topology();
+
+/**
+* query storage server to download file by the cached topology,
+* the tracker server is asked only when the topology version should be
+* checked (every topology_check_interval seconds) or the cache is stale
+* params:
+*	pTrackerServer: tracker server, NULL to get a connection when needed
+*	pStorageServer: return storage server
+*       group_name: the group name of storage server
+*       filename: filename on storage server
+* return: 0 success, !=0 fail, return the error code
+**/
+int tracker_query_storage_fetch_cached(TrackerServerInfo *pTrackerServer, \
+		TrackerServerInfo *pStorageServer, \
+		const char *group_name, const char *filename);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,36 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//crc32.h
+
+#ifndef _CRC32_H_
+#define _CRC32_H_
+
+#define CRC32C_INIT_VALUE	0xFFFFFFFF
+#define CRC32C_FINAL(crc)	((crc) ^ 0xFFFFFFFF)
+
+#define crc32c(buff, size) \
+	CRC32C_FINAL(crc32c_ex(CRC32C_INIT_VALUE, buff, size))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+update the CRC32C of the data, call it more than once for the data
+in pieces, pass CRC32C_INIT_VALUE for the first piece and
+CRC32C_FINAL the result of the last piece
+*/
+unsigned int crc32c_ex(const unsigned int crc, const void *buff, \
+		const int size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
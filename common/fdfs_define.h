@@ -12,6 +12,7 @@
 #define _DEFINE_H_
 
 #include <pthread.h>
+#include <inttypes.h>
 
 #ifdef WIN32
 
@@ -64,6 +65,8 @@ extern int pthread_mutexattr_settype(pthread_mutexattr_t *attr, int kind);
 #define FDFS_RECORD_SEPERATOR	'\x01'
 #define FDFS_FIELD_SEPERATOR	'\x02'
 
+#define INT64_PRINTF_FORMAT	"%"PRId64
+
 #ifndef true
 typedef char  bool;
 #define true  1
@@ -838,6 +838,26 @@ int buff2int(const unsigned char *buff)
 		(*(buff+2) << 8) | *(buff+3);
 }
 
+void long2buff(const int64_t n, char *buff)
+{
+	unsigned char *p;
+	p = (unsigned char *)buff;
+	*p++ = (n >> 56) & 0xFF;
+	*p++ = (n >> 48) & 0xFF;
+	*p++ = (n >> 40) & 0xFF;
+	*p++ = (n >> 32) & 0xFF;
+	*p++ = (n >> 24) & 0xFF;
+	*p++ = (n >> 16) & 0xFF;
+	*p++ = (n >> 8) & 0xFF;
+	*p++ = n & 0xFF;
+}
+
+int64_t buff2long(const unsigned char *buff)
+{
+	return  (((int64_t)buff2int(buff)) << 32) | \
+		(unsigned int)buff2int(buff + 4);
+}
+
 int fd_gets(int fd, char *buff, const int size, int once_bytes)
 {
 	char *pDest;
@@ -32,6 +32,14 @@
 #include "storage_func.h"
 #include "storage_sync.h"
 #include "storage_service.h"
+#include "storage_trunk.h"
+#include "storage_fd_cache.h"
+#include "storage_hot_cache.h"
+#include "storage_dedup.h"
+#include "storage_scrub.h"
+#include "storage_fsync.h"
+#include "storage_meta.h"
+#include "storage_upload_session.h"
 #include "fdfs_base64.h"
 
 bool bReloadFlag = false;
@@ -98,6 +106,54 @@ int main(int argc, char *argv[])
 		return result;
 	}
 
+	if ((result=storage_trunk_init()) != 0)
+	{
+		g_continue_flag = false;
+		return result;
+	}
+
+	if ((result=storage_fd_cache_init()) != 0)
+	{
+		g_continue_flag = false;
+		return result;
+	}
+
+	if ((result=storage_hot_cache_init()) != 0)
+	{
+		g_continue_flag = false;
+		return result;
+	}
+
+	if ((result=storage_dedup_init()) != 0)
+	{
+		g_continue_flag = false;
+		return result;
+	}
+
+	if ((result=storage_fsync_init()) != 0)
+	{
+		g_continue_flag = false;
+		return result;
+	}
+
+	if ((result=storage_meta_init()) != 0)
+	{
+		g_continue_flag = false;
+		return result;
+	}
+
+	if ((result=storage_upload_session_init()) != 0)
+	{
+		g_continue_flag = false;
+		return result;
+	}
+
+	if ((result=storage_append_init()) != 0)
+	{
+		g_continue_flag = false;
+		return result;
+	}
+
 	if ((result=init_pthread_lock(&g_storage_thread_lock)) != 0)
 	{
 		g_continue_flag = false;
@@ -131,6 +187,27 @@ int main(int argc, char *argv[])
 		return result;
 	}
 
+	if ((result=storage_scrub_start()) != 0)
+	{
+		g_continue_flag = false;
+		storage_close_storage_stat();
+		return result;
+	}
+
+	if ((result=storage_fsync_thread_start()) != 0)
+	{
+		g_continue_flag = false;
+		storage_close_storage_stat();
+		return result;
+	}
+
+	if ((result=storage_upload_session_thread_start()) != 0)
+	{
+		g_continue_flag = false;
+		storage_close_storage_stat();
+		return result;
+	}
+
 	signal(SIGHUP, sigHupHandler);
 	signal(SIGUSR1, sigUsrHandler);
 	signal(SIGUSR2, sigUsrHandler);
@@ -222,7 +299,10 @@ int main(int argc, char *argv[])
 
 	while (g_storage_thread_count != 0 || \
 		g_tracker_reporter_count > 0 || \
-		g_storage_sync_thread_count > 0)
+		g_storage_sync_thread_count > 0 || \
+		g_scrub_thread_count > 0 || \
+		g_fsync_thread_count > 0 || \
+		g_upload_session_thread_count > 0)
 	{
 		sleep(1);
 	}
@@ -240,7 +320,13 @@ int main(int argc, char *argv[])
 	pthread_attr_destroy(&pattr);
 	pthread_mutex_destroy(&g_storage_thread_lock);
 	
+	storage_fsync_destroy();
 	storage_sync_destroy();
+	storage_trunk_destroy();
+	storage_fd_cache_destroy();
+	storage_hot_cache_destroy();
+	storage_dedup_destroy();
+	storage_meta_destroy();
 	storage_close_storage_stat();
 
 	logInfo(STORAGE_ERROR_LOG_FILENAME, "exit nomally.\n");
@@ -0,0 +1,357 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//storage_dedup.c
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "fdfs_define.h"
+#include "logger.h"
+#include "fdfs_global.h"
+#include "shared_func.h"
+#include "hash.h"
+#include "storage_global.h"
+#include "storage_func.h"
+#include "storage_trunk.h"
+#include "storage_dedup.h"
+
+/* each line: key filename */
+#define DEDUP_INDEX_FILENAME	"dedup.dat"
+#define DEDUP_FILENAME_SIZE	64
+
+static pthread_mutex_t dedup_lock;
+static HashArray dedup_hash;
+static FILE *fp_dedup_index = NULL;
+static bool dedup_inited = false;
+
+static char *get_dedup_index_filename(char *full_filename, const int size)
+{
+	snprintf(full_filename, size, "%s/data/"DEDUP_INDEX_FILENAME, \
+		g_base_path);
+	return full_filename;
+}
+
+/* the later line of the same key overwrites the former one */
+static int dedup_set_entry(const char *key, const char *filename)
+{
+	char *pFilename;
+	char *pOld;
+
+	pFilename = (char *)malloc(DEDUP_FILENAME_SIZE);
+	if (pFilename == NULL)
+	{
+		return errno != 0 ? errno : ENOMEM;
+	}
+	snprintf(pFilename, DEDUP_FILENAME_SIZE, "%s", filename);
+
+	pOld = (char *)hash_find(&dedup_hash, key, strlen(key));
+	if (hash_insert(&dedup_hash, key, strlen(key), pFilename) < 0)
+	{
+		free(pFilename);
+		return ENOMEM;
+	}
+
+	if (pOld != NULL)
+	{
+		free(pOld);
+	}
+	return 0;
+}
+
+static void dedup_remove_entry(const char *key)
+{
+	char *pFilename;
+
+	pFilename = (char *)hash_find(&dedup_hash, key, strlen(key));
+	if (pFilename != NULL)
+	{
+		hash_delete(&dedup_hash, key, strlen(key));
+		free(pFilename);
+	}
+}
+
+static int dedup_load_index(const char *index_filename, int *line_count)
+{
+	char *file_buff;
+	char *pLine;
+	char *pLineEnd;
+	char *pSpace;
+	int file_size;
+	int result;
+
+	*line_count = 0;
+	if (!fileExists(index_filename))
+	{
+		return 0;
+	}
+
+	if ((result=getFileContent(index_filename, &file_buff, \
+			&file_size)) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"read file \"%s\" fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, index_filename, result, strerror(result));
+		return result;
+	}
+
+	pLine = file_buff;
+	while (*pLine != '\0')
+	{
+		pLineEnd = strchr(pLine, '\n');
+		if (pLineEnd == NULL)  //the last line is incomplete
+		{
+			break;
+		}
+		*pLineEnd = '\0';
+
+		pSpace = strchr(pLine, ' ');
+		if (pSpace != NULL)
+		{
+			*pSpace = '\0';
+			if ((result=dedup_set_entry(pLine, pSpace + 1)) != 0)
+			{
+				free(file_buff);
+				return result;
+			}
+			(*line_count)++;
+		}
+
+		pLine = pLineEnd + 1;
+	}
+
+	free(file_buff);
+	return 0;
+}
+
+static void dedup_write_entry(const int index, const HashData *data, \
+		void *args)
+{
+	fprintf((FILE *)args, "%.*s %s\n", data->key_len, \
+		(char *)data->key, (char *)data->value);
+}
+
+/* rewrite the index file without the overwritten lines */
+static int dedup_compact_index(const char *index_filename)
+{
+	char tmp_filename[MAX_PATH_SIZE + 64];
+	FILE *fp;
+	int result;
+
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s%s", \
+		index_filename, STORAGE_TEMP_FILE_EXT);
+	if ((fp=fopen(tmp_filename, "wb")) == NULL)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"open file \"%s\" fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, tmp_filename, errno, strerror(errno));
+		return errno != 0 ? errno : ENOENT;
+	}
+
+	hash_walk(&dedup_hash, dedup_write_entry, fp);
+	if (fclose(fp) != 0)
+	{
+		result = errno != 0 ? errno : EIO;
+		unlink(tmp_filename);
+		return result;
+	}
+
+	if (rename(tmp_filename, index_filename) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"rename file \"%s\" to \"%s\" fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, tmp_filename, index_filename, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : ENOENT;
+	}
+
+	return 0;
+}
+
+int storage_dedup_init()
+{
+	char index_filename[MAX_PATH_SIZE+32];
+	int line_count;
+	int result;
+
+	if (!g_check_file_duplicate)
+	{
+		return 0;
+	}
+
+	if ((result=init_pthread_lock(&dedup_lock)) != 0)
+	{
+		return result;
+	}
+
+	if ((result=hash_init(&dedup_hash, PJWHash, 4096, 0.75)) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"hash_init fail, errno: %d", __LINE__, result);
+		return ENOMEM;
+	}
+
+	get_dedup_index_filename(index_filename, sizeof(index_filename));
+	if ((result=dedup_load_index(index_filename, &line_count)) != 0)
+	{
+		return result;
+	}
+
+	if (line_count > 2 * dedup_hash.item_count && \
+		(result=dedup_compact_index(index_filename)) != 0)
+	{
+		return result;
+	}
+
+	if ((fp_dedup_index=fopen(index_filename, "ab")) == NULL)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"open file \"%s\" fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, index_filename, errno, strerror(errno));
+		return errno != 0 ? errno : ENOENT;
+	}
+
+	dedup_inited = true;
+	return 0;
+}
+
+static void dedup_free_entry(const int index, const HashData *data, \
+		void *args)
+{
+	free(data->value);
+}
+
+int storage_dedup_destroy()
+{
+	if (!dedup_inited)
+	{
+		return 0;
+	}
+
+	pthread_mutex_lock(&dedup_lock);
+	fclose(fp_dedup_index);
+	fp_dedup_index = NULL;
+	hash_walk(&dedup_hash, dedup_free_entry, NULL);
+	hash_destroy(&dedup_hash);
+	dedup_inited = false;
+	pthread_mutex_unlock(&dedup_lock);
+
+	pthread_mutex_destroy(&dedup_lock);
+	return 0;
+}
+
+void storage_dedup_gen_key(const char *file_buff, const int file_size, \
+		char *key)
+{
+	/* two independent hash codes and the file size, the content
+	   is compared before linking, so a collision is harmless */
+	snprintf(key, STORAGE_DEDUP_KEY_SIZE, "%08X%08X%08X", \
+		BKDRHash(file_buff, file_size), \
+		APHash(file_buff, file_size), file_size);
+}
+
+int storage_dedup_find(const char *key, const char *file_buff, \
+		const int file_size, char *src_filename)
+{
+	char *pFilename;
+	char full_filename[MAX_PATH_SIZE+64];
+	char *src_buff;
+	int src_size;
+	int store_path_index;
+	int result;
+
+	if (!dedup_inited)
+	{
+		return ENOENT;
+	}
+
+	pthread_mutex_lock(&dedup_lock);
+	pFilename = (char *)hash_find(&dedup_hash, key, strlen(key));
+	if (pFilename != NULL)
+	{
+		strcpy(src_filename, pFilename);
+	}
+	pthread_mutex_unlock(&dedup_lock);
+	if (pFilename == NULL)
+	{
+		return ENOENT;
+	}
+
+	if (storage_get_full_filename(src_filename, full_filename, \
+		sizeof(full_filename), &store_path_index) != 0)
+	{
+		return ENOENT;
+	}
+
+	if ((result=storage_read_file(src_filename, full_filename, \
+		store_path_index, &src_buff, &src_size)) != 0)
+	{
+		if (result == ENOENT)  //the stored file was deleted
+		{
+			pthread_mutex_lock(&dedup_lock);
+			pFilename = (char *)hash_find(&dedup_hash, \
+					key, strlen(key));
+			if (pFilename != NULL && \
+				strcmp(pFilename, src_filename) == 0)
+			{
+				dedup_remove_entry(key);
+			}
+			pthread_mutex_unlock(&dedup_lock);
+		}
+		return ENOENT;
+	}
+
+	if (src_size == file_size && \
+		memcmp(src_buff, file_buff, file_size) == 0)
+	{
+		result = 0;
+	}
+	else
+	{
+		result = ENOENT;
+	}
+	free(src_buff);
+
+	return result;
+}
+
+int storage_dedup_add(const char *key, const char *filename)
+{
+	int result;
+
+	if (!dedup_inited)
+	{
+		return 0;
+	}
+
+	pthread_mutex_lock(&dedup_lock);
+	if ((result=dedup_set_entry(key, filename)) == 0)
+	{
+		if (fprintf(fp_dedup_index, "%s %s\n", key, filename) <= 0 \
+			|| fflush(fp_dedup_index) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"write to dedup index file fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, errno, strerror(errno));
+			result = errno != 0 ? errno : EIO;
+		}
+	}
+	pthread_mutex_unlock(&dedup_lock);
+
+	return result;
+}
@@ -0,0 +1,61 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//storage_dedup.h
+
+#ifndef _STORAGE_DEDUP_H_
+#define _STORAGE_DEDUP_H_
+
+#define STORAGE_DEDUP_KEY_SIZE	32
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+the index of the file content hash -> the first file stored with this
+content, the duplicate files are hard linked to it, so the link count
+of the file system is the reference count, enabled by
+g_check_file_duplicate
+*/
+int storage_dedup_init();
+int storage_dedup_destroy();
+
+/*
+generate the hash key of the file content
+params:
+	file_buff: the file content
+	file_size: the file size
+	key: return the key, the buffer size >= STORAGE_DEDUP_KEY_SIZE
+*/
+void storage_dedup_gen_key(const char *file_buff, const int file_size, \
+		char *key);
+
+/*
+find the stored file with the same content
+params:
+	key: the key generated by storage_dedup_gen_key
+	file_buff: the file content to compare
+	file_size: the file size
+	src_filename: return the logic filename of the stored file
+return: 0 for found, ENOENT for not found
+*/
+int storage_dedup_find(const char *key, const char *file_buff, \
+		const int file_size, char *src_filename);
+
+/*
+add the new stored file to the index
+return: 0 for success, != 0 for fail
+*/
+int storage_dedup_add(const char *key, const char *filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
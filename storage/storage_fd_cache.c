@@ -0,0 +1,414 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//storage_fd_cache.c
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "fdfs_define.h"
+#include "logger.h"
+#include "shared_func.h"
+#include "hash.h"
+#include "storage_global.h"
+#include "storage_func.h"
+#include "storage_fd_cache.h"
+
+/* the versions of the hashed filenames, an opened fd is not cached when
+   the file or the file of the same slot is invalidated when opening */
+#define FD_CACHE_VERSION_SLOTS	1024
+
+#define FD_CACHE_VERSION(filename, filename_len) \
+	fd_cache_versions[PJWHash(filename, filename_len) % \
+			FD_CACHE_VERSION_SLOTS]
+
+typedef struct tagStorageFdCacheEntry
+{
+	char filename[64];  //the logic filename
+	int filename_len;
+	int fd;
+	int file_size;
+	int ref_count;  //the threads reading this fd
+	bool evicted;   //removed from the cache, close by the last reader
+	struct tagStorageFdCacheEntry *prev;
+	struct tagStorageFdCacheEntry *next;
+} StorageFdCacheEntry;
+
+static pthread_mutex_t fd_cache_lock;
+static HashArray fd_cache_hash;
+static StorageFdCacheEntry *lru_head = NULL;  //the most recently used
+static StorageFdCacheEntry *lru_tail = NULL;
+static int fd_cache_count = 0;
+static int fd_cache_versions[FD_CACHE_VERSION_SLOTS];
+static bool fd_cache_inited = false;
+
+static void fd_cache_lock_acquire()
+{
+	if (pthread_mutex_lock(&fd_cache_lock) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call pthread_mutex_lock fail, " \
+			"errno: %d, error info:%s.", \
+			__LINE__, errno, strerror(errno));
+	}
+}
+
+static void fd_cache_lock_release()
+{
+	if (pthread_mutex_unlock(&fd_cache_lock) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call pthread_mutex_unlock fail, " \
+			"errno: %d, error info:%s.", \
+			__LINE__, errno, strerror(errno));
+	}
+}
+
+static void fd_cache_unlink_entry(StorageFdCacheEntry *pEntry)
+{
+	if (pEntry->prev == NULL)
+	{
+		lru_head = pEntry->next;
+	}
+	else
+	{
+		pEntry->prev->next = pEntry->next;
+	}
+
+	if (pEntry->next == NULL)
+	{
+		lru_tail = pEntry->prev;
+	}
+	else
+	{
+		pEntry->next->prev = pEntry->prev;
+	}
+
+	pEntry->prev = NULL;
+	pEntry->next = NULL;
+}
+
+static void fd_cache_link_head(StorageFdCacheEntry *pEntry)
+{
+	pEntry->prev = NULL;
+	pEntry->next = lru_head;
+	if (lru_head == NULL)
+	{
+		lru_tail = pEntry;
+	}
+	else
+	{
+		lru_head->prev = pEntry;
+	}
+	lru_head = pEntry;
+}
+
+static void fd_cache_free_entry(StorageFdCacheEntry *pEntry)
+{
+	close(pEntry->fd);
+	free(pEntry);
+}
+
+/* remove the entry from the cache, the fd is closed by the last reader */
+static void fd_cache_remove_entry(StorageFdCacheEntry *pEntry)
+{
+	hash_delete(&fd_cache_hash, pEntry->filename, pEntry->filename_len);
+	fd_cache_unlink_entry(pEntry);
+	fd_cache_count--;
+
+	if (pEntry->ref_count > 0)
+	{
+		pEntry->evicted = true;
+	}
+	else
+	{
+		fd_cache_free_entry(pEntry);
+	}
+}
+
+int storage_fd_cache_init()
+{
+	int result;
+
+	if (g_fd_cache_size <= 0)
+	{
+		return 0;
+	}
+
+	if ((result=init_pthread_lock(&fd_cache_lock)) != 0)
+	{
+		return result;
+	}
+
+	if ((result=hash_init(&fd_cache_hash, PJWHash, \
+			2 * g_fd_cache_size, 0.75)) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"hash_init fail, errno: %d", __LINE__, result);
+		return ENOMEM;
+	}
+
+	memset(fd_cache_versions, 0, sizeof(fd_cache_versions));
+	fd_cache_inited = true;
+	return 0;
+}
+
+int storage_fd_cache_destroy()
+{
+	StorageFdCacheEntry *pEntry;
+
+	if (!fd_cache_inited)
+	{
+		return 0;
+	}
+
+	fd_cache_lock_acquire();
+	while (lru_head != NULL)
+	{
+		pEntry = lru_head;
+		lru_head = pEntry->next;
+		fd_cache_free_entry(pEntry);
+	}
+	lru_tail = NULL;
+	fd_cache_count = 0;
+	hash_destroy(&fd_cache_hash);
+	fd_cache_inited = false;
+	fd_cache_lock_release();
+
+	pthread_mutex_destroy(&fd_cache_lock);
+	return 0;
+}
+
+/* get the cached entry or open the file and cache it */
+static StorageFdCacheEntry *fd_cache_get(const char *logic_filename, \
+		const char *full_filename, int *result)
+{
+	StorageFdCacheEntry *pEntry;
+	StorageFdCacheEntry *pFound;
+	struct stat stat_buf;
+	int filename_len;
+	int version;
+
+	filename_len = strlen(logic_filename);
+	fd_cache_lock_acquire();
+	pEntry = (StorageFdCacheEntry *)hash_find(&fd_cache_hash, \
+					logic_filename, filename_len);
+	if (pEntry != NULL)
+	{
+		pEntry->ref_count++;
+		fd_cache_unlink_entry(pEntry);
+		fd_cache_link_head(pEntry);
+	}
+	version = FD_CACHE_VERSION(logic_filename, filename_len);
+	fd_cache_lock_release();
+
+	if (pEntry != NULL)
+	{
+		*result = 0;
+		return pEntry;
+	}
+
+	if (filename_len >= sizeof(pEntry->filename))
+	{
+		*result = EINVAL;
+		return NULL;
+	}
+
+	pEntry = (StorageFdCacheEntry *)malloc(sizeof(StorageFdCacheEntry));
+	if (pEntry == NULL)
+	{
+		*result = errno != 0 ? errno : ENOMEM;
+		return NULL;
+	}
+
+	pEntry->fd = open(full_filename, O_RDONLY);
+	if (pEntry->fd < 0)
+	{
+		*result = errno != 0 ? errno : ENOENT;
+		free(pEntry);
+		return NULL;
+	}
+
+	if (fstat(pEntry->fd, &stat_buf) != 0)
+	{
+		*result = errno != 0 ? errno : ENOENT;
+		fd_cache_free_entry(pEntry);
+		return NULL;
+	}
+
+	memcpy(pEntry->filename, logic_filename, filename_len + 1);
+	pEntry->filename_len = filename_len;
+	pEntry->file_size = stat_buf.st_size;
+	storage_advise_file(pEntry->fd, pEntry->file_size, \
+			STORAGE_FADV_SEQUENTIAL);
+	pEntry->ref_count = 1;
+	pEntry->evicted = false;
+
+	fd_cache_lock_acquire();
+	pFound = (StorageFdCacheEntry *)hash_find(&fd_cache_hash, \
+					logic_filename, filename_len);
+	if (pFound != NULL)  //cached by other thread
+	{
+		pEntry->evicted = true;
+	}
+	else if (version != FD_CACHE_VERSION(logic_filename, \
+			filename_len))  //invalidated when opening
+	{
+		pEntry->evicted = true;
+	}
+	else if (hash_insert(&fd_cache_hash, pEntry->filename, \
+			filename_len, pEntry) < 0)
+	{
+		pEntry->evicted = true;
+	}
+	else
+	{
+		fd_cache_link_head(pEntry);
+		fd_cache_count++;
+		while (fd_cache_count > g_fd_cache_size)
+		{
+			fd_cache_remove_entry(lru_tail);
+		}
+	}
+	fd_cache_lock_release();
+
+	*result = 0;
+	return pEntry;
+}
+
+static void fd_cache_release(StorageFdCacheEntry *pEntry)
+{
+	bool bFree;
+
+	fd_cache_lock_acquire();
+	pEntry->ref_count--;
+	bFree = pEntry->evicted && pEntry->ref_count == 0;
+	fd_cache_lock_release();
+
+	if (bFree)
+	{
+		fd_cache_free_entry(pEntry);
+	}
+}
+
+/* read the whole file, drop its pages when the file is large */
+static int fd_cache_read_fd(const int fd, const char *full_filename, \
+		const int file_size, char **file_buff)
+{
+	char *buff;
+	int result;
+
+	buff = (char *)malloc(file_size + 1);
+	if (buff == NULL)
+	{
+		return errno != 0 ? errno : ENOMEM;
+	}
+
+	if (pread(fd, buff, file_size, 0) != file_size)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"read file \"%s\" fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, full_filename, errno, strerror(errno));
+		result = errno != 0 ? errno : EIO;
+		free(buff);
+		return result;
+	}
+
+	storage_advise_file(fd, file_size, STORAGE_FADV_DONTNEED);
+	buff[file_size] = '\0';
+	*file_buff = buff;
+	return 0;
+}
+
+/* read the file without the cache */
+static int fd_cache_read_file_direct(const char *full_filename, \
+		char **file_buff, int *file_size)
+{
+	struct stat stat_buf;
+	int fd;
+	int result;
+
+	if ((fd=open(full_filename, O_RDONLY)) < 0)
+	{
+		return errno != 0 ? errno : ENOENT;
+	}
+
+	if (fstat(fd, &stat_buf) != 0)
+	{
+		result = errno != 0 ? errno : ENOENT;
+		close(fd);
+		return result;
+	}
+
+	storage_advise_file(fd, stat_buf.st_size, STORAGE_FADV_SEQUENTIAL);
+	if ((result=fd_cache_read_fd(fd, full_filename, \
+		stat_buf.st_size, file_buff)) == 0)
+	{
+		*file_size = stat_buf.st_size;
+	}
+	close(fd);
+	return result;
+}
+
+int storage_fd_cache_read_file(const char *logic_filename, \
+		const char *full_filename, char **file_buff, int *file_size)
+{
+	StorageFdCacheEntry *pEntry;
+	int result;
+
+	*file_buff = NULL;
+	*file_size = 0;
+	if (!fd_cache_inited)
+	{
+		return fd_cache_read_file_direct(full_filename, \
+				file_buff, file_size);
+	}
+
+	if ((pEntry=fd_cache_get(logic_filename, full_filename, \
+			&result)) == NULL)
+	{
+		return result;
+	}
+
+	if ((result=fd_cache_read_fd(pEntry->fd, full_filename, \
+		pEntry->file_size, file_buff)) == 0)
+	{
+		*file_size = pEntry->file_size;
+	}
+	fd_cache_release(pEntry);
+	return result;
+}
+
+void storage_fd_cache_invalidate(const char *logic_filename)
+{
+	StorageFdCacheEntry *pEntry;
+	int filename_len;
+
+	if (!fd_cache_inited)
+	{
+		return;
+	}
+
+	filename_len = strlen(logic_filename);
+	fd_cache_lock_acquire();
+	FD_CACHE_VERSION(logic_filename, filename_len)++;
+	pEntry = (StorageFdCacheEntry *)hash_find(&fd_cache_hash, \
+			logic_filename, filename_len);
+	if (pEntry != NULL)
+	{
+		fd_cache_remove_entry(pEntry);
+	}
+	fd_cache_lock_release();
+}
@@ -0,0 +1,48 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//storage_fd_cache.h
+
+#ifndef _STORAGE_FD_CACHE_H_
+#define _STORAGE_FD_CACHE_H_
+
+#define STORAGE_DEF_FD_CACHE_SIZE	256
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+the LRU cache of the read only fds of the hot files, keyed by the
+logic filename, g_fd_cache_size is the max fd count, 0 for disabled
+*/
+int storage_fd_cache_init();
+int storage_fd_cache_destroy();
+
+/*
+read the file content through the cached fd
+params:
+	logic_filename: the filename return to the client
+	full_filename: the full filename to open when not cached
+	file_buff: return the file content, should be freed by the caller
+	file_size: return the file size
+return: 0 for success, != 0 for fail
+*/
+int storage_fd_cache_read_file(const char *logic_filename, \
+		const char *full_filename, char **file_buff, int *file_size);
+
+/*
+close the cached fd when the file is deleted or updated
+*/
+void storage_fd_cache_invalidate(const char *logic_filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,368 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//storage_fsync.c
+
+#ifdef OS_LINUX
+#define _GNU_SOURCE  //for syncfs
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "fdfs_define.h"
+#include "logger.h"
+#include "fdfs_global.h"
+#include "shared_func.h"
+#include "storage_global.h"
+#include "storage_sync.h"
+#include "storage_fsync.h"
+
+int g_fsync_thread_count = 0;
+
+static pthread_mutex_t fsync_lock;
+static pthread_cond_t fsync_cond;
+
+/* the group commit of the binlog in always mode */
+static int binlog_write_count = 0;   //the records written to the binlog
+static int binlog_synced_count = 0;  //the records synced
+static bool binlog_syncing = false;
+
+/* the binlog position synced by the syncer in periodic mode,
+   the sync threads read the binlog before it only */
+static int durable_binlog_index = 0;
+static int durable_binlog_offset = 0;
+
+static bool fsync_inited = false;
+
+int storage_fsync_init()
+{
+	int result;
+
+	if (g_fsync_mode == STORAGE_FSYNC_MODE_NONE)
+	{
+		return 0;
+	}
+
+	if ((result=init_pthread_lock(&fsync_lock)) != 0)
+	{
+		return result;
+	}
+	if ((result=storage_binlog_get_position(NULL, \
+		&durable_binlog_index, &durable_binlog_offset)) != 0)
+	{
+		return result;
+	}
+
+	if ((result=pthread_cond_init(&fsync_cond, NULL)) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"pthread_cond_init fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, result, strerror(result));
+		return result;
+	}
+
+	fsync_inited = true;
+	return 0;
+}
+
+int storage_fsync_file(const int fd, const char *filename)
+{
+	if (g_fsync_mode != STORAGE_FSYNC_MODE_ALWAYS)
+	{
+		return 0;
+	}
+
+	if (fsync(fd) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"fsync file %s fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, filename, errno, strerror(errno));
+		return errno != 0 ? errno : EIO;
+	}
+
+	return 0;
+}
+
+int storage_fsync_dir(const char *full_filename)
+{
+	char dir_name[MAX_PATH_SIZE + 128];
+	char *pSlash;
+	int fd;
+	int result;
+
+	if (g_fsync_mode != STORAGE_FSYNC_MODE_ALWAYS)
+	{
+		return 0;
+	}
+
+	snprintf(dir_name, sizeof(dir_name), "%s", full_filename);
+	pSlash = strrchr(dir_name, '/');
+	if (pSlash == NULL)
+	{
+		return 0;
+	}
+	*pSlash = '\0';
+
+	if ((fd=open(dir_name, O_RDONLY)) < 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"open dir %s fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, dir_name, errno, strerror(errno));
+		return errno != 0 ? errno : ENOENT;
+	}
+
+	result = storage_fsync_file(fd, dir_name);
+	close(fd);
+	return result;
+}
+
+int storage_fsync_binlog()
+{
+	int write_count;
+	int target_count;
+	int binlog_fd;
+	int binlog_index;
+	int binlog_offset;
+	int result;
+
+	if (g_fsync_mode != STORAGE_FSYNC_MODE_ALWAYS)
+	{
+		return 0;
+	}
+
+	result = 0;
+	pthread_mutex_lock(&fsync_lock);
+	write_count = ++binlog_write_count;
+	while (binlog_synced_count < write_count)
+	{
+		if (binlog_syncing)  //wait for the running fsync
+		{
+			pthread_cond_wait(&fsync_cond, &fsync_lock);
+			continue;
+		}
+
+		/* the leader syncs the records of all waiting writers */
+		binlog_syncing = true;
+		target_count = binlog_write_count;
+		pthread_mutex_unlock(&fsync_lock);
+
+		/* the binlog may be rotated, sync the dup of its fd */
+		if ((result=storage_binlog_get_position(&binlog_fd, \
+			&binlog_index, &binlog_offset)) == 0)
+		{
+			result = storage_fsync_file(binlog_fd, "binlog");
+			close(binlog_fd);
+		}
+
+		pthread_mutex_lock(&fsync_lock);
+		binlog_syncing = false;
+		if (result == 0)
+		{
+			binlog_synced_count = target_count;
+		}
+		pthread_cond_broadcast(&fsync_cond);
+		if (result != 0)
+		{
+			break;
+		}
+	}
+	pthread_mutex_unlock(&fsync_lock);
+
+	return result;
+}
+
+bool storage_fsync_binlog_readable(const int binlog_index, \
+		const int binlog_offset)
+{
+	bool readable;
+
+	if (g_fsync_mode != STORAGE_FSYNC_MODE_PERIODIC)
+	{
+		return true;
+	}
+
+	pthread_mutex_lock(&fsync_lock);
+	readable = binlog_index < durable_binlog_index || \
+		(binlog_index == durable_binlog_index && \
+		 binlog_offset < durable_binlog_offset);
+	pthread_mutex_unlock(&fsync_lock);
+
+	return readable;
+}
+
+/* sync the file system of the store path */
+static int fsync_store_path(const char *path)
+{
+	int fd;
+	int result;
+
+	if ((fd=open(path, O_RDONLY)) < 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"open dir %s fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, path, errno, strerror(errno));
+		return errno != 0 ? errno : ENOENT;
+	}
+
+#ifdef OS_LINUX
+	if (syncfs(fd) != 0)
+	{
+		result = errno != 0 ? errno : EIO;
+		logError("file: "__FILE__", line: %d, " \
+			"syncfs %s fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, path, result, strerror(result));
+	}
+	else
+	{
+		result = 0;
+	}
+#else
+	sync();
+	result = 0;
+#endif
+
+	close(fd);
+	return result;
+}
+
+/* sync the store paths and the binlog, then move the durable position */
+static int fsync_flush_binlog()
+{
+	int binlog_fd;
+	int binlog_index;
+	int binlog_offset;
+	int result;
+	int i;
+
+	if ((result=storage_binlog_get_position(&binlog_fd, \
+		&binlog_index, &binlog_offset)) != 0)
+	{
+		return result;
+	}
+
+	pthread_mutex_lock(&fsync_lock);
+	if (binlog_index == durable_binlog_index && \
+		binlog_offset == durable_binlog_offset)
+	{
+		pthread_mutex_unlock(&fsync_lock);
+		close(binlog_fd);
+		return 0;
+	}
+	pthread_mutex_unlock(&fsync_lock);
+
+	/* the data of the records before the position is written,
+	   sync it before the binlog */
+	for (i=0; i<g_path_count; i++)
+	{
+		if ((result=fsync_store_path(g_store_paths[i].path)) != 0)
+		{
+			close(binlog_fd);
+			return result;
+		}
+	}
+
+	if (fsync(binlog_fd) != 0)
+	{
+		result = errno != 0 ? errno : EIO;
+		logError("file: "__FILE__", line: %d, " \
+			"fsync binlog fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, result, strerror(result));
+		close(binlog_fd);
+		return result;
+	}
+	close(binlog_fd);
+
+	pthread_mutex_lock(&fsync_lock);
+	durable_binlog_index = binlog_index;
+	durable_binlog_offset = binlog_offset;
+	pthread_mutex_unlock(&fsync_lock);
+
+	return 0;
+}
+
+static void *fsync_thread_entrance(void *arg)
+{
+	while (g_continue_flag)
+	{
+		sleep(g_fsync_interval / 1000);
+		usleep((g_fsync_interval % 1000) * 1000);
+		fsync_flush_binlog();
+	}
+
+	pthread_mutex_lock(&fsync_lock);
+	g_fsync_thread_count--;
+	pthread_mutex_unlock(&fsync_lock);
+	return NULL;
+}
+
+int storage_fsync_thread_start()
+{
+	pthread_attr_t pattr;
+	pthread_t tid;
+	int result;
+
+	if (g_fsync_mode != STORAGE_FSYNC_MODE_PERIODIC)
+	{
+		return 0;
+	}
+
+	pthread_attr_init(&pattr);
+	pthread_attr_setdetachstate(&pattr, PTHREAD_CREATE_DETACHED);
+
+	pthread_mutex_lock(&fsync_lock);
+	g_fsync_thread_count++;
+	pthread_mutex_unlock(&fsync_lock);
+	if ((result=pthread_create(&tid, &pattr, fsync_thread_entrance, \
+		NULL)) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"create thread failed, errno: %d, " \
+			"error info: %s", \
+			__LINE__, result, strerror(result));
+		pthread_mutex_lock(&fsync_lock);
+		g_fsync_thread_count--;
+		pthread_mutex_unlock(&fsync_lock);
+	}
+
+	pthread_attr_destroy(&pattr);
+	return result;
+}
+
+int storage_fsync_destroy()
+{
+	int result;
+
+	if (!fsync_inited)
+	{
+		return 0;
+	}
+
+	result = 0;
+	if (g_fsync_mode == STORAGE_FSYNC_MODE_PERIODIC)
+	{
+		result = fsync_flush_binlog();
+	}
+
+	pthread_cond_destroy(&fsync_cond);
+	pthread_mutex_destroy(&fsync_lock);
+	fsync_inited = false;
+	return result;
+}
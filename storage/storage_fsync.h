@@ -0,0 +1,77 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//storage_fsync.h
+
+#ifndef _STORAGE_FSYNC_H_
+#define _STORAGE_FSYNC_H_
+
+#define STORAGE_FSYNC_MODE_NONE		0  //written back by the kernel
+#define STORAGE_FSYNC_MODE_PERIODIC	1  //synced by the syncer thread
+#define STORAGE_FSYNC_MODE_ALWAYS	2  //synced before the response
+
+#define STORAGE_DEF_FSYNC_INTERVAL	1000  //ms
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int g_fsync_thread_count;
+
+/*
+in periodic mode, the binlog records are written at once and the syncer
+thread syncs the store paths and the binlog, the sync threads send the
+records synced only, so the other storages never get the data which
+may be lost by a crash
+*/
+int storage_fsync_init();
+int storage_fsync_thread_start();
+
+/* sync the binlog the last time, call it after all threads exit */
+int storage_fsync_destroy();
+
+/*
+sync the written file before close in always mode
+params:
+	fd: the file descriptor
+	filename: the filename for the error log
+return: 0 for success, != 0 for fail
+*/
+int storage_fsync_file(const int fd, const char *filename);
+
+/*
+sync the dir of the created, renamed or linked file in always mode
+params:
+	full_filename: the full filename of the file
+return: 0 for success, != 0 for fail
+*/
+int storage_fsync_dir(const char *full_filename);
+
+/*
+sync the binlog in always mode, the concurrent writers share one
+fdatasync (group commit)
+return: 0 for success, != 0 for fail
+*/
+int storage_fsync_binlog();
+
+/*
+check if the binlog record at the position can be synced to the other
+storages, the records not synced by the syncer can't in periodic mode
+params:
+	binlog_index: the index of the binlog
+	binlog_offset: the offset of the record in the binlog
+return: true for readable, false for not
+*/
+bool storage_fsync_binlog_readable(const int binlog_index, \
+		const int binlog_offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
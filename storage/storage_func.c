@@ -18,18 +18,33 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <limits.h>
 #include <errno.h>
 #include <time.h>
+#ifdef OS_LINUX
+#include <sys/statfs.h>
+#endif
+#include <sys/param.h>
+#include <sys/mount.h>
 #include "fdfs_define.h"
 #include "logger.h"
 #include "fdfs_global.h"
 #include "sockopt.h"
 #include "shared_func.h"
 #include "ini_file_reader.h"
+#include "fdfs_base64.h"
+#include "crc32.h"
+#include "hash.h"
 #include "tracker_types.h"
 #include "tracker_proto.h"
 #include "storage_global.h"
 #include "storage_func.h"
+#include "storage_trunk.h"
+#include "storage_fd_cache.h"
+#include "storage_hot_cache.h"
+#include "storage_scrub.h"
+#include "storage_fsync.h"
 
 #define DATA_DIR_INITED_FILENAME	".data_init_flag"
 #define STORAGE_STAT_FILENAME		"storage_stat.dat"
@@ -52,8 +67,17 @@
 #define STAT_ITEM_SUCCESS_DELETE	"success_delete_count"
 #define STAT_ITEM_TOTAL_GET_META	"total_get_meta_count"
 #define STAT_ITEM_SUCCESS_GET_META	"success_get_meta_count"
+#define STAT_ITEM_SCRUB_PASS		"scrub_pass_count"
+#define STAT_ITEM_SCRUB_FILE		"scrub_file_count"
+#define STAT_ITEM_SCRUB_ERROR		"scrub_error_count"
+#define STAT_ITEM_SCRUB_REPAIR		"scrub_repair_count"
+#define STAT_ITEM_LAST_SCRUB_PASS	"last_scrub_pass_time"
+
+#define STORAGE_APPEND_LOCK_COUNT	32
 
 static int storage_stat_fd = -1;
+static pthread_mutex_t append_locks[STORAGE_APPEND_LOCK_COUNT];
+static pthread_mutex_t store_path_lock;  //for the round robin index
 
 static char *get_storage_stat_filename(const void *pArg, char *full_filename)
 {
@@ -182,6 +206,22 @@ int storage_open_storage_stat()
 				STAT_ITEM_SUCCESS_GET_META, \
 				items, nItemCount, 0);
 
+		g_scrub_stat.pass_count = iniGetIntValue( \
+				STAT_ITEM_SCRUB_PASS, \
+				items, nItemCount, 0);
+		g_scrub_stat.file_count = iniGetIntValue( \
+				STAT_ITEM_SCRUB_FILE, \
+				items, nItemCount, 0);
+		g_scrub_stat.error_count = iniGetIntValue( \
+				STAT_ITEM_SCRUB_ERROR, \
+				items, nItemCount, 0);
+		g_scrub_stat.repair_count = iniGetIntValue( \
+				STAT_ITEM_SCRUB_REPAIR, \
+				items, nItemCount, 0);
+		g_scrub_stat.last_pass_time = iniGetIntValue( \
+				STAT_ITEM_LAST_SCRUB_PASS, \
+				items, nItemCount, 0);
+
 		iniFreeItems(items);
 	}
 	else
@@ -222,7 +262,7 @@ int storage_close_storage_stat()
 
 int storage_write_to_stat_file()
 {
-	char buff[512];
+	char buff[1024];
 	int len;
 
 	len = sprintf(buff, 
@@ -237,6 +277,11 @@ int storage_write_to_stat_file()
 		"%s=%d\n"  \
 		"%s=%d\n"  \
 		"%s=%d\n"  \
+		"%s=%d\n"  \
+		"%s=%d\n"  \
+		"%s=%d\n"  \
+		"%s=%d\n"  \
+		"%s=%d\n"  \
 		"%s=%d\n", \
 		STAT_ITEM_TOTAL_UPLOAD, g_storage_stat.total_upload_count, \
 		STAT_ITEM_SUCCESS_UPLOAD, g_storage_stat.success_upload_count, \
@@ -253,7 +298,12 @@ int storage_write_to_stat_file()
 		STAT_ITEM_SUCCESS_DELETE, g_storage_stat.success_delete_count, \
 		STAT_ITEM_TOTAL_GET_META, g_storage_stat.total_get_meta_count, \
 		STAT_ITEM_SUCCESS_GET_META, \
-		g_storage_stat.success_get_meta_count
+		g_storage_stat.success_get_meta_count, \
+		STAT_ITEM_SCRUB_PASS, g_scrub_stat.pass_count, \
+		STAT_ITEM_SCRUB_FILE, g_scrub_stat.file_count, \
+		STAT_ITEM_SCRUB_ERROR, g_scrub_stat.error_count, \
+		STAT_ITEM_SCRUB_REPAIR, g_scrub_stat.repair_count, \
+		STAT_ITEM_LAST_SCRUB_PASS, g_scrub_stat.last_pass_time
 		);
 
 	return storage_write_to_fd(storage_stat_fd, \
@@ -300,13 +350,122 @@ int storage_write_to_sync_ini_file()
 	return 0;
 }
 
-int storage_check_and_make_data_dirs()
+static int storage_make_data_dirs(const char *pStorePath)
 {
-	char data_path[MAX_PATH_SIZE];
+	char data_path[MAX_PATH_SIZE + 8];
+	char last_path[MAX_PATH_SIZE + 16];
 	char dir_name[9];
 	char sub_name[9];
 	int i, k;
+
+	snprintf(data_path, sizeof(data_path), "%s/data", pStorePath);
+	if (!fileExists(data_path))
+	{
+		if (mkdir(data_path, 0755) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"mkdir \"%s\" fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, data_path, errno, strerror(errno));
+			return errno != 0 ? errno : ENOENT;
+		}
+	}
+
+	if (g_use_trunk_file)
+	{
+		snprintf(last_path, sizeof(last_path), \
+			"%s/"STORAGE_TRUNK_DIR_NAME, data_path);
+		if (!fileExists(last_path) && mkdir(last_path, 0755) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"mkdir \"%s\" fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, last_path, errno, strerror(errno));
+			return errno != 0 ? errno : ENOENT;
+		}
+	}
+
+	/* the last sub dir exists means all of the dirs have been made */
+	snprintf(last_path, sizeof(last_path), "%s/"STORAGE_DATA_DIR_FORMAT \
+		"/"STORAGE_DATA_DIR_FORMAT, data_path, \
+		DATA_DIR_COUNT_PER_PATH - 1, DATA_DIR_COUNT_PER_PATH - 1);
+	if (isDir(last_path))
+	{
+		return 0;
+	}
+
+	if (chdir(data_path) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"chdir \"%s\" fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, data_path, errno, strerror(errno));
+		return errno != 0 ? errno : ENOENT;
+	}
+
+	for (i=0; i<DATA_DIR_COUNT_PER_PATH; i++)
+	{
+		sprintf(dir_name, STORAGE_DATA_DIR_FORMAT, i);
+		if (mkdir(dir_name, 0755) != 0)
+		{
+			if (!(errno == EEXIST && isDir(dir_name)))
+			{
+				logError("file: "__FILE__", line: %d, " \
+					"mkdir \"%s/%s\" fail, " \
+					"errno: %d, error info: %s", \
+					__LINE__, data_path, dir_name, \
+					errno, strerror(errno));
+				return errno != 0 ? errno : ENOENT;
+			}
+		}
+
+		if (chdir(dir_name) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"chdir \"%s/%s\" fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, data_path, dir_name, \
+				errno, strerror(errno));
+			return errno != 0 ? errno : ENOENT;
+		}
+
+		for (k=0; k<DATA_DIR_COUNT_PER_PATH; k++)
+		{
+			sprintf(sub_name, STORAGE_DATA_DIR_FORMAT, k);
+			if (mkdir(sub_name, 0755) != 0)
+			{
+				if (!(errno == EEXIST && isDir(sub_name)))
+				{
+					logError("file: "__FILE__", line: %d," \
+						" mkdir \"%s/%s/%s\" fail, " \
+						"errno: %d, error info: %s", \
+						__LINE__, data_path, \
+						dir_name, sub_name, \
+						errno, strerror(errno));
+					return errno != 0 ? errno : ENOENT;
+				}
+			}
+		}
+
+		if (chdir("..") != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"chdir \"%s\" fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, data_path, \
+				errno, strerror(errno));
+			return errno != 0 ? errno : ENOENT;
+		}
+	}
+
+	return 0;
+}
+
+int storage_check_and_make_data_dirs()
+{
+	char data_path[MAX_PATH_SIZE];
 	int result;
+	int i;
 
 	snprintf(data_path, sizeof(data_path), "%s/data", g_base_path);
 	if (!fileExists(data_path))
@@ -321,6 +480,15 @@ int storage_check_and_make_data_dirs()
 		}
 	}
 
+	for (i=0; i<g_path_count; i++)
+	{
+		if ((result=storage_make_data_dirs( \
+				g_store_paths[i].path)) != 0)
+		{
+			return result;
+		}
+	}
+
 	if (chdir(data_path) != 0)
 	{
 		logError("file: "__FILE__", line: %d, " \
@@ -401,61 +569,6 @@ int storage_check_and_make_data_dirs()
 	}
 
 	g_storage_join_time = time(NULL);
-	for (i=0; i<DATA_DIR_COUNT_PER_PATH; i++)
-	{
-		sprintf(dir_name, STORAGE_DATA_DIR_FORMAT, i);
-		if (mkdir(dir_name, 0755) != 0)
-		{
-			if (!(errno == EEXIST && isDir(dir_name)))
-			{
-				logError("file: "__FILE__", line: %d, " \
-					"mkdir \"%s/%s\" fail, " \
-					"errno: %d, error info: %s", \
-					__LINE__, data_path, dir_name, \
-					errno, strerror(errno));
-				return errno != 0 ? errno : ENOENT;
-			}
-		}
-
-		if (chdir(dir_name) != 0)
-		{
-			logError("file: "__FILE__", line: %d, " \
-				"chdir \"%s/%s\" fail, " \
-				"errno: %d, error info: %s", \
-				__LINE__, data_path, dir_name, \
-				errno, strerror(errno));
-			return errno != 0 ? errno : ENOENT;
-		}
-
-		for (k=0; k<DATA_DIR_COUNT_PER_PATH; k++)
-		{
-			sprintf(sub_name, STORAGE_DATA_DIR_FORMAT, k);
-			if (mkdir(sub_name, 0755) != 0)
-			{
-				if (!(errno == EEXIST && isDir(sub_name)))
-				{
-					logError("file: "__FILE__", line: %d," \
-						" mkdir \"%s/%s/%s\" fail, " \
-						"errno: %d, error info: %s", \
-						__LINE__, data_path, \
-						dir_name, sub_name, \
-						errno, strerror(errno));
-					return errno != 0 ? errno : ENOENT;
-				}
-			}
-		}
-
-		if (chdir("..") != 0)
-		{
-			logError("file: "__FILE__", line: %d, " \
-				"chdir \"%s\" fail, " \
-				"errno: %d, error info: %s", \
-				__LINE__, data_path, \
-				errno, strerror(errno));
-			return errno != 0 ? errno : ENOENT;
-		}
-	}
-
 	result = storage_write_to_sync_ini_file();
 
 	return result;
@@ -579,12 +692,181 @@ static int copy_tracker_servers(const char *filename, char **ppTrackerServers)
 	return 0;
 }
 
+/*
+parse the bytes such as 256K, 64M, the value is default_value when not set,
+return EINVAL when it exceeds the int range
+*/
+static int storage_get_bytes_value(const char *filename, \
+		const char *szItemName, IniItemInfo *items, \
+		const int nItemCount, const int default_value, int *value)
+{
+	char *pValue;
+	char *pEnd;
+	int64_t bytes;
+
+	*value = default_value;
+	pValue = iniGetStrValue(szItemName, items, nItemCount);
+	if (pValue == NULL || *pValue == '\0')
+	{
+		return 0;
+	}
+
+	pEnd = NULL;
+	bytes = strtoll(pValue, &pEnd, 10);
+	if (pEnd != NULL)
+	{
+		if (*pEnd == 'G' || *pEnd == 'g')
+		{
+			bytes *= (int64_t)1024 * 1024 * 1024;
+		}
+		else if (*pEnd == 'M' || *pEnd == 'm')
+		{
+			bytes *= (int64_t)1024 * 1024;
+		}
+		else if (*pEnd == 'K' || *pEnd == 'k')
+		{
+			bytes *= 1024;
+		}
+	}
+
+	if (bytes > INT_MAX)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"conf file \"%s\", %s: %s is too large, " \
+			"which must be less than 2G", __LINE__, \
+			filename, szItemName, pValue);
+		return EINVAL;
+	}
+
+	if (bytes > 0)
+	{
+		*value = (int)bytes;
+	}
+	return 0;
+}
+
+static int storage_load_store_paths(const char *filename, \
+		IniItemInfo *items, const int nItemCount)
+{
+	char item_name[32];
+	char *pPath;
+	FDFSStorePath *pStorePath;
+	int total_mb;
+	int free_mb;
+	int result;
+	int i;
+
+	g_path_count = iniGetIntValue("store_path_count", \
+			items, nItemCount, 1);
+	if (g_path_count <= 0 || g_path_count > FDFS_MAX_STORE_PATHS)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"conf file \"%s\", store_path_count: %d is invalid, " \
+			"which must be in [1, %d]", __LINE__, filename, \
+			g_path_count, FDFS_MAX_STORE_PATHS);
+		return EINVAL;
+	}
+
+	g_store_paths = (FDFSStorePath *)malloc(sizeof(FDFSStorePath) * \
+						g_path_count);
+	if (g_store_paths == NULL)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"malloc %d bytes fail", __LINE__, \
+			(int)sizeof(FDFSStorePath) * g_path_count);
+		return errno != 0 ? errno : ENOMEM;
+	}
+	memset(g_store_paths, 0, sizeof(FDFSStorePath) * g_path_count);
+
+	for (i=0; i<g_path_count; i++)
+	{
+		pStorePath = g_store_paths + i;
+		sprintf(item_name, "store_path%d", i);
+		pPath = iniGetStrValue(item_name, items, nItemCount);
+		if (pPath == NULL)
+		{
+			if (i != 0)
+			{
+				logError("file: "__FILE__", line: %d, " \
+					"conf file \"%s\" must have item " \
+					"\"%s\"!", __LINE__, filename, \
+					item_name);
+				return ENOENT;
+			}
+
+			pPath = g_base_path;  //store_path0 default to base_path
+		}
+
+		snprintf(pStorePath->path, sizeof(pStorePath->path), \
+			"%s", pPath);
+		chopPath(pStorePath->path);
+		if (!isDir(pStorePath->path))
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"conf file \"%s\", %s \"%s\" " \
+				"is not a directory!", __LINE__, filename, \
+				item_name, pStorePath->path);
+			return ENOTDIR;
+		}
+
+		if ((result=pthread_mutex_init(&pStorePath->io_lock, \
+				NULL)) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"call pthread_mutex_init fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, result, strerror(result));
+			return result;
+		}
+
+		if ((result=pthread_cond_init(&pStorePath->io_cond, \
+				NULL)) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"call pthread_cond_init fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, result, strerror(result));
+			return result;
+		}
+	}
+
+	if ((result=init_pthread_lock(&store_path_lock)) != 0)
+	{
+		return result;
+	}
+
+	if ((result=storage_refresh_store_paths_space(&total_mb, \
+			&free_mb)) != 0)
+	{
+		return result;
+	}
+
+	g_store_path_mode = iniGetIntValue("store_path_lookup", \
+			items, nItemCount, FDFS_STORE_PATH_ROUND_ROBIN);
+	if (g_store_path_mode != FDFS_STORE_PATH_ROUND_ROBIN && \
+	    g_store_path_mode != FDFS_STORE_PATH_LOAD_BALANCE)
+	{
+		g_store_path_mode = FDFS_STORE_PATH_ROUND_ROBIN;
+	}
+
+	g_disk_io_threads = iniGetIntValue("disk_io_threads", \
+			items, nItemCount, 0);
+	if (g_disk_io_threads < 0)
+	{
+		g_disk_io_threads = 0;
+	}
+
+	return 0;
+}
+
 int storage_load_from_conf_file(const char *filename, \
 		char *bind_addr, const int addr_size)
 {
 	char *pBasePath;
 	char *pBindAddr;
 	char *pGroupName;
+	char *pFsyncMode;
+	char *pMetaIndexKeys;
 	char *ppTrackerServers[FDFS_MAX_TRACKERS];
 	IniItemInfo *items;
 	int nItemCount;
@@ -646,6 +928,12 @@ int storage_load_from_conf_file(const char *filename, \
 			break;
 		}
 
+		if ((result=storage_load_store_paths(filename, \
+				items, nItemCount)) != 0)
+		{
+			break;
+		}
+
 		g_network_timeout = iniGetIntValue("network_timeout", \
 				items, nItemCount, DEFAULT_NETWORK_TIMEOUT);
 		if (g_network_timeout <= 0)
@@ -760,21 +1048,165 @@ int storage_load_from_conf_file(const char *filename, \
 			g_max_connections = FDFS_DEF_MAX_CONNECTONS;
 		}
 
-		logInfo(STORAGE_ERROR_LOG_FILENAME, \
-			"FastDFS v%d.%d, base_path=%s, " \
-			"group_name=%s, " \
-			"network_timeout=%d, "\
+		g_fd_cache_size = iniGetIntValue("fd_cache_size", \
+				items, nItemCount, STORAGE_DEF_FD_CACHE_SIZE);
+		if (g_fd_cache_size < 0)
+		{
+			g_fd_cache_size = 0;
+		}
+
+		g_check_file_duplicate = iniGetBoolValue( \
+				"check_file_duplicate", items, nItemCount);
+
+		pFsyncMode = iniGetStrValue("fsync_mode", items, nItemCount);
+		if (pFsyncMode == NULL || *pFsyncMode == '\0' || \
+			strcasecmp(pFsyncMode, "none") == 0)
+		{
+			g_fsync_mode = STORAGE_FSYNC_MODE_NONE;
+		}
+		else if (strcasecmp(pFsyncMode, "periodic") == 0)
+		{
+			g_fsync_mode = STORAGE_FSYNC_MODE_PERIODIC;
+		}
+		else if (strcasecmp(pFsyncMode, "always") == 0)
+		{
+			g_fsync_mode = STORAGE_FSYNC_MODE_ALWAYS;
+		}
+		else
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"conf file \"%s\", fsync_mode: %s " \
+				"is invalid, which must be none, " \
+				"periodic or always", \
+				__LINE__, filename, pFsyncMode);
+			result = EINVAL;
+			break;
+		}
+
+		g_fsync_interval = iniGetIntValue("fsync_interval", \
+				items, nItemCount, STORAGE_DEF_FSYNC_INTERVAL);
+		if (g_fsync_interval <= 0)
+		{
+			g_fsync_interval = STORAGE_DEF_FSYNC_INTERVAL;
+		}
+
+		pMetaIndexKeys = iniGetStrValue("meta_index_keys", \
+					items, nItemCount);
+		snprintf(g_meta_index_keys, sizeof(g_meta_index_keys), "%s", \
+			pMetaIndexKeys != NULL ? pMetaIndexKeys : "");
+
+		g_scrub_interval = iniGetIntValue("scrub_interval", \
+				items, nItemCount, 0);
+		if (g_scrub_interval < 0)
+		{
+			g_scrub_interval = 0;
+		}
+		if ((result=storage_get_bytes_value(filename, \
+				"scrub_bytes_per_second", items, nItemCount, \
+				STORAGE_DEF_SCRUB_BYTES_PER_SECOND, \
+				&g_scrub_bytes_per_second)) != 0)
+		{
+			break;
+		}
+		if (g_scrub_bytes_per_second <= 0)
+		{
+			g_scrub_bytes_per_second = \
+				STORAGE_DEF_SCRUB_BYTES_PER_SECOND;
+		}
+
+		if ((result=storage_get_bytes_value(filename, \
+				"nocache_file_size", items, nItemCount, \
+				0, &g_nocache_file_size)) != 0)
+		{
+			break;
+		}
+		if (g_nocache_file_size < 0)
+		{
+			g_nocache_file_size = 0;
+		}
+
+		if ((result=storage_get_bytes_value(filename, \
+				"hot_cache_size", items, nItemCount, \
+				0, &g_hot_cache_size)) != 0)
+		{
+			break;
+		}
+		if (g_hot_cache_size < 0)
+		{
+			g_hot_cache_size = 0;
+		}
+		if ((result=storage_get_bytes_value(filename, \
+				"hot_cache_max_object_size", items, \
+				nItemCount, \
+				STORAGE_DEF_HOT_CACHE_MAX_OBJECT_SIZE, \
+				&g_hot_cache_max_object_size)) != 0)
+		{
+			break;
+		}
+		if (g_hot_cache_max_object_size <= 0)
+		{
+			g_hot_cache_max_object_size = \
+				STORAGE_DEF_HOT_CACHE_MAX_OBJECT_SIZE;
+		}
+
+		g_use_trunk_file = iniGetBoolValue("use_trunk_file", \
+					items, nItemCount);
+		if ((result=storage_get_bytes_value(filename, \
+				"slot_max_size", items, nItemCount, \
+				STORAGE_TRUNK_DEF_SLOT_MAX_SIZE, \
+				&g_slot_max_size)) != 0)
+		{
+			break;
+		}
+		if ((result=storage_get_bytes_value(filename, \
+				"trunk_file_size", items, nItemCount, \
+				STORAGE_TRUNK_DEF_FILE_SIZE, \
+				&g_trunk_file_size)) != 0)
+		{
+			break;
+		}
+		if (g_slot_max_size >= g_trunk_file_size / 2)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"conf file \"%s\", slot_max_size: %d " \
+				"should be less than half of " \
+				"trunk_file_size: %d", \
+				__LINE__, filename, g_slot_max_size, \
+				g_trunk_file_size);
+			result = EINVAL;
+			break;
+		}
+
+		logInfo(STORAGE_ERROR_LOG_FILENAME, \
+			"FastDFS v%d.%d, base_path=%s, " \
+			"group_name=%s, " \
+			"network_timeout=%d, "\
 			"port=%d, bind_addr=%s, " \
 			"max_connections=%d, "    \
 			"heart_beat_interval=%ds, " \
 			"stat_report_interval=%ds, tracker_server_count=%d, " \
-			"sync_wait_usec=%dms", \
+			"sync_wait_usec=%dms, store_path_count=%d, " \
+			"store_path_lookup=%d, disk_io_threads=%d, " \
+			"use_trunk_file=%d, slot_max_size=%d, " \
+			"trunk_file_size=%d, fd_cache_size=%d, " \
+			"hot_cache_size=%d, hot_cache_max_object_size=%d, " \
+			"nocache_file_size=%d, check_file_duplicate=%d, " \
+			"scrub_interval=%ds, scrub_bytes_per_second=%d, " \
+			"fsync_mode=%d, fsync_interval=%dms, " \
+			"meta_index_keys=%s", \
 			g_version.major, g_version.minor, \
 			g_base_path, g_group_name, \
 			g_network_timeout, \
 			g_server_port, bind_addr, g_max_connections, \
 			g_heart_beat_interval, g_stat_report_interval, \
-			g_tracker_server_count, g_sync_wait_usec / 1000);
+			g_tracker_server_count, g_sync_wait_usec / 1000, \
+			g_path_count, g_store_path_mode, g_disk_io_threads, \
+			g_use_trunk_file, g_slot_max_size, g_trunk_file_size, \
+			g_fd_cache_size, g_hot_cache_size, \
+			g_hot_cache_max_object_size, g_nocache_file_size, \
+			g_check_file_duplicate, g_scrub_interval, \
+			g_scrub_bytes_per_second, g_fsync_mode, \
+			g_fsync_interval, g_meta_index_keys);
 
 		break;
 	}
@@ -784,3 +1216,883 @@ int storage_load_from_conf_file(const char *filename, \
 	return result;
 }
 
+int storage_get_full_filename(const char *logic_filename, \
+		char *full_filename, const int buff_size, \
+		int *store_path_index)
+{
+	const char *pTrueFilename;
+	char szIndex[3];
+	char *pEnd;
+
+	pTrueFilename = logic_filename;
+	*store_path_index = 0;
+	if (*logic_filename == STORAGE_STORE_PATH_PREFIX_CHAR)
+	{
+		if (strlen(logic_filename) < 4 || logic_filename[3] != '/')
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"filename: %s is invalid", \
+				__LINE__, logic_filename);
+			return EINVAL;
+		}
+
+		szIndex[0] = logic_filename[1];
+		szIndex[1] = logic_filename[2];
+		szIndex[2] = '\0';
+		*store_path_index = strtol(szIndex, &pEnd, 16);
+		if (!isxdigit((unsigned char)szIndex[0]) || \
+			!isxdigit((unsigned char)szIndex[1]) || \
+			*pEnd != '\0' || *store_path_index < 0 || \
+			*store_path_index >= g_path_count)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"filename: %s is invalid, " \
+				"invalid store path index: %s, " \
+				"store path count: %d", __LINE__, \
+				logic_filename, szIndex, g_path_count);
+			return EINVAL;
+		}
+
+		pTrueFilename = logic_filename + 4;
+	}
+
+	snprintf(full_filename, buff_size, "%s/data/%s", \
+		g_store_paths[*store_path_index].path, pTrueFilename);
+	return 0;
+}
+
+int storage_get_filename_checksum(const char *logic_filename, \
+		int64_t *file_size, unsigned int *crc32)
+{
+	const char *pBaseName;
+	char buff[64];
+	int len;
+
+	pBaseName = strrchr(logic_filename, '/');
+	pBaseName = (pBaseName == NULL) ? logic_filename : pBaseName + 1;
+	len = strlen(pBaseName);
+	if ((len != STORAGE_FILENAME_ID_BYTES * 4 / 3 && \
+		len != STORAGE_OLD_FILENAME_ID_BYTES * 4 / 3) || \
+		storage_is_trunk_filename(logic_filename))
+	{
+		return EINVAL;  //such as the metadata file
+	}
+
+	base64_decode((char *)pBaseName, len, buff, &len);
+	if (len == STORAGE_OLD_FILENAME_ID_BYTES)
+	{
+		*file_size = (unsigned int)buff2int( \
+				(unsigned char *)buff + sizeof(int));
+		*crc32 = 0;
+		return ENOENT;
+	}
+	if (len != STORAGE_FILENAME_ID_BYTES)
+	{
+		return EINVAL;
+	}
+
+	*file_size = (unsigned int)buff2int((unsigned char *)buff + \
+				sizeof(int));
+	if (((unsigned char)buff[sizeof(int) * 3]) & \
+		STORAGE_FILENAME_SIZE_HIGH_FLAG)
+	{
+		*file_size |= ((int64_t)(buff[sizeof(int) * 3] & 0x7F) << 40) \
+			| ((int64_t)(unsigned char)buff[sizeof(int) * 3 + 1] \
+				<< 32);
+	}
+	*crc32 = buff2int((unsigned char *)buff + sizeof(int) * 2);
+	return 0;
+}
+
+int storage_get_appender_source(const char *logic_filename, char *ip_addr)
+{
+	const char *pBaseName;
+	char buff[64];
+	struct in_addr ip;
+	int len;
+
+	pBaseName = strrchr(logic_filename, '/');
+	pBaseName = (pBaseName == NULL) ? logic_filename : pBaseName + 1;
+	len = strlen(pBaseName);
+	if (len != STORAGE_FILENAME_ID_BYTES * 4 / 3 + \
+		sizeof(STORAGE_APPENDER_FILE_EXT) - 1 || \
+		strcmp(pBaseName + STORAGE_FILENAME_ID_BYTES * 4 / 3, \
+			STORAGE_APPENDER_FILE_EXT) != 0)
+	{
+		return EINVAL;
+	}
+
+	base64_decode((char *)pBaseName, STORAGE_FILENAME_ID_BYTES * 4 / 3, \
+			buff, &len);
+	if (len != STORAGE_FILENAME_ID_BYTES)
+	{
+		return EINVAL;
+	}
+
+	ip.s_addr = htonl(buff2int((unsigned char *)buff + sizeof(int) * 2));
+	snprintf(ip_addr, FDFS_IPADDR_SIZE, "%s", inet_ntoa(ip));
+	return 0;
+}
+
+int storage_check_file_checksum(const char *logic_filename, \
+		const char *file_buff, const int file_size)
+{
+	int64_t expect_size;
+	unsigned int expect_crc32;
+	int result;
+
+	result = storage_get_filename_checksum(logic_filename, \
+			&expect_size, &expect_crc32);
+	if (result == EINVAL)
+	{
+		return 0;
+	}
+
+	if (file_size != expect_size || (result == 0 && \
+		crc32c(file_buff, file_size) != expect_crc32))
+	{
+		return EIO;
+	}
+
+	return 0;
+}
+
+int storage_check_file_crc32(const char *logic_filename, \
+		const int64_t file_size, const unsigned int crc32)
+{
+	int64_t expect_size;
+	unsigned int expect_crc32;
+	int result;
+
+	result = storage_get_filename_checksum(logic_filename, \
+			&expect_size, &expect_crc32);
+	if (result == EINVAL)
+	{
+		return 0;
+	}
+
+	if (file_size != expect_size || (result == 0 && \
+		crc32 != expect_crc32))
+	{
+		return EIO;
+	}
+
+	return 0;
+}
+
+int storage_select_store_path(const int64_t file_size)
+{
+	static int current_index = 0;
+	FDFSStorePath *pStorePath;
+	int need_mb;
+	int store_path_index;
+	int result;
+	int i;
+
+	need_mb = (int)(file_size / FDFS_ONE_MB) + 1;
+	store_path_index = -1;
+	if (g_store_path_mode == FDFS_STORE_PATH_LOAD_BALANCE)
+	{
+		for (i=0; i<g_path_count; i++)
+		{
+			pStorePath = g_store_paths + i;
+			if (pStorePath->free_mb >= need_mb && \
+				(store_path_index < 0 || pStorePath->free_mb >\
+				g_store_paths[store_path_index].free_mb))
+			{
+				store_path_index = i;
+			}
+		}
+	}
+	else
+	{
+		if ((result=pthread_mutex_lock(&store_path_lock)) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"call pthread_mutex_lock fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, result, strerror(result));
+		}
+
+		for (i=0; i<g_path_count; i++)
+		{
+			pStorePath = g_store_paths + \
+				(current_index + i) % g_path_count;
+			if (pStorePath->free_mb >= need_mb)
+			{
+				store_path_index = pStorePath - g_store_paths;
+				break;
+			}
+		}
+
+		current_index = (store_path_index >= 0 ? \
+			store_path_index : current_index) + 1;
+		if (current_index >= g_path_count)
+		{
+			current_index = 0;
+		}
+
+		if ((result=pthread_mutex_unlock(&store_path_lock)) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"call pthread_mutex_unlock fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, result, strerror(result));
+		}
+	}
+
+	if (store_path_index < 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"no store path has %d MB free space " \
+			"for the file of "INT64_PRINTF_FORMAT" bytes", \
+			__LINE__, need_mb, file_size);
+	}
+	return store_path_index;
+}
+
+int storage_refresh_store_paths_space(int *total_mb, int *free_mb)
+{
+	FDFSStorePath *pStorePath;
+	FDFSStorePath *pEnd;
+	struct statfs sbuf;
+
+	*total_mb = 0;
+	*free_mb = 0;
+	pEnd = g_store_paths + g_path_count;
+	for (pStorePath=g_store_paths; pStorePath<pEnd; pStorePath++)
+	{
+		if (statfs(pStorePath->path, &sbuf) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"call statfs \"%s\" fail, " \
+				"errno: %d, error info: %s.", \
+				__LINE__, pStorePath->path, \
+				errno, strerror(errno));
+			return errno != 0 ? errno : EACCES;
+		}
+
+		pStorePath->total_mb = (int)(((double)(sbuf.f_blocks) * \
+					sbuf.f_bsize) / FDFS_ONE_MB);
+		pStorePath->free_mb = (int)(((double)(sbuf.f_bavail) * \
+					sbuf.f_bsize) / FDFS_ONE_MB);
+		*total_mb += pStorePath->total_mb;
+		if (pStorePath->free_mb > *free_mb)
+		{
+			*free_mb = pStorePath->free_mb;
+		}
+	}
+
+	return 0;
+}
+
+void storage_disk_io_begin(const int store_path_index)
+{
+	FDFSStorePath *pStorePath;
+	int result;
+
+	if (g_disk_io_threads <= 0)
+	{
+		return;
+	}
+
+	pStorePath = g_store_paths + store_path_index;
+	if ((result=pthread_mutex_lock(&pStorePath->io_lock)) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call pthread_mutex_lock fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, result, strerror(result));
+		return;
+	}
+
+	while (pStorePath->io_count >= g_disk_io_threads)
+	{
+		pthread_cond_wait(&pStorePath->io_cond, &pStorePath->io_lock);
+	}
+	pStorePath->io_count++;
+
+	if ((result=pthread_mutex_unlock(&pStorePath->io_lock)) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call pthread_mutex_unlock fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, result, strerror(result));
+	}
+}
+
+void storage_disk_io_end(const int store_path_index)
+{
+	FDFSStorePath *pStorePath;
+	int result;
+
+	if (g_disk_io_threads <= 0)
+	{
+		return;
+	}
+
+	pStorePath = g_store_paths + store_path_index;
+	if ((result=pthread_mutex_lock(&pStorePath->io_lock)) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call pthread_mutex_lock fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, result, strerror(result));
+		return;
+	}
+
+	pStorePath->io_count--;
+	pthread_cond_signal(&pStorePath->io_cond);
+
+	if ((result=pthread_mutex_unlock(&pStorePath->io_lock)) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call pthread_mutex_unlock fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, result, strerror(result));
+	}
+}
+
+
+bool storage_is_large_file(const int64_t file_size)
+{
+	return g_nocache_file_size > 0 && file_size >= g_nocache_file_size;
+}
+
+void storage_advise_file(const int fd, const int64_t file_size, \
+		const int advice)
+{
+#ifdef POSIX_FADV_DONTNEED
+	int result;
+
+	if (!storage_is_large_file(file_size))
+	{
+		return;
+	}
+
+	if ((result=posix_fadvise(fd, 0, 0, advice)) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call posix_fadvise fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, result, strerror(result));
+	}
+#endif
+}
+
+static int storage_write_buff(const int fd, const char *buff, \
+		const int size, const int64_t offset)
+{
+	int bytes;
+	int written;
+
+	written = 0;
+	while (written < size)
+	{
+		if ((bytes=pwrite(fd, buff + written, size - written, \
+			offset + written)) <= 0)
+		{
+			if (bytes < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			return errno != 0 ? errno : EIO;
+		}
+		written += bytes;
+	}
+
+	return 0;
+}
+
+/* allocate the blocks at once to reduce fragmentation,
+   the file systems not supporting it are ignored */
+static int storage_allocate_file(const int fd, const char *filename, \
+		const int64_t file_size)
+{
+	int result;
+
+	if (file_size > 0 && (result=posix_fallocate(fd, 0, \
+		file_size)) != 0 && result != EINVAL && \
+		result != EOPNOTSUPP)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"fallocate file %s fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, filename, result, strerror(result));
+		return result;
+	}
+
+	return 0;
+}
+
+/* the dirty pages can't be dropped before written back */
+static int storage_sync_written_file(const int fd, const char *filename, \
+		const int64_t file_size)
+{
+	int result;
+
+	if (storage_is_large_file(file_size) || \
+		g_fsync_mode == STORAGE_FSYNC_MODE_ALWAYS)
+	{
+		if (fsync(fd) != 0)
+		{
+			result = errno != 0 ? errno : EIO;
+			logError("file: "__FILE__", line: %d, " \
+				"fsync file %s fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, filename, result, strerror(result));
+			return result;
+		}
+	}
+
+	storage_advise_file(fd, file_size, STORAGE_FADV_DONTNEED);
+	return 0;
+}
+
+int storage_rename_file(const char *tmp_filename, const char *full_filename)
+{
+	int result;
+
+	/* the file is visible only when it is complete */
+	if (rename(tmp_filename, full_filename) != 0)
+	{
+		result = errno != 0 ? errno : EIO;
+		logError("file: "__FILE__", line: %d, " \
+			"rename file %s to %s fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, tmp_filename, full_filename, \
+			result, strerror(result));
+		unlink(tmp_filename);
+		return result;
+	}
+
+	return storage_fsync_dir(full_filename);
+}
+
+int storage_recv_to_fd(const int sock, const int fd, const int64_t offset, \
+		const int64_t size, unsigned int *crc32)
+{
+	char *buff;
+	int64_t received;
+	int recv_bytes;
+	int result;
+
+	*crc32 = CRC32C_INIT_VALUE;
+	buff = (char *)malloc(STORAGE_STREAM_BUFF_SIZE);
+	if (buff == NULL)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"malloc %d bytes fail", __LINE__, \
+			STORAGE_STREAM_BUFF_SIZE);
+		return errno != 0 ? errno : ENOMEM;
+	}
+
+	/* the content is always received to keep the connection usable */
+	result = 0;
+	received = 0;
+	while (received < size)
+	{
+		recv_bytes = size - received > STORAGE_STREAM_BUFF_SIZE ? \
+				STORAGE_STREAM_BUFF_SIZE : size - received;
+		if (tcprecvdata(sock, buff, recv_bytes, \
+			g_network_timeout) != 1)
+		{
+			result = errno != 0 ? errno : EPIPE;
+			logError("file: "__FILE__", line: %d, " \
+				"recv data fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, result, strerror(result));
+			break;
+		}
+
+		*crc32 = crc32c_ex(*crc32, buff, recv_bytes);
+		if (fd >= 0 && result == 0 && (result=storage_write_buff( \
+			fd, buff, recv_bytes, offset + received)) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"write file fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, result, strerror(result));
+		}
+		received += recv_bytes;
+	}
+	*crc32 = CRC32C_FINAL(*crc32);
+	free(buff);
+
+	return result;
+}
+
+int storage_recv_file(const int sock, const char *tmp_filename, \
+		const int64_t file_size, unsigned int *crc32)
+{
+	int fd;
+	int result;
+
+	fd = -1;
+	result = 0;
+	if (tmp_filename != NULL && (fd=open(tmp_filename, \
+		O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+	{
+		result = errno != 0 ? errno : ENOENT;
+		logError("file: "__FILE__", line: %d, " \
+			"open file %s fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, tmp_filename, result, strerror(result));
+	}
+
+	if (fd >= 0 && (result=storage_allocate_file(fd, tmp_filename, \
+			file_size)) == 0)
+	{
+		storage_advise_file(fd, file_size, STORAGE_FADV_SEQUENTIAL);
+	}
+
+	if (result != 0)
+	{
+		storage_recv_to_fd(sock, -1, 0, file_size, crc32);
+	}
+	else
+	{
+		result = storage_recv_to_fd(sock, fd, 0, file_size, crc32);
+	}
+
+	if (fd < 0)
+	{
+		return result;
+	}
+
+	if (result == 0)
+	{
+		result = storage_sync_written_file(fd, tmp_filename, file_size);
+	}
+	close(fd);
+	if (result != 0)
+	{
+		unlink(tmp_filename);
+	}
+	return result;
+}
+
+int storage_append_init()
+{
+	int result;
+	int i;
+
+	for (i=0; i<STORAGE_APPEND_LOCK_COUNT; i++)
+	{
+		if ((result=init_pthread_lock(append_locks + i)) != 0)
+		{
+			return result;
+		}
+	}
+
+	return 0;
+}
+
+int storage_recv_append_file(const int sock, const char *full_filename, \
+		int64_t *offset, const int64_t size)
+{
+	pthread_mutex_t *pLock;
+	struct stat stat_buf;
+	unsigned int crc32;
+	int fd;
+	int result;
+
+	if ((fd=open(full_filename, O_WRONLY)) < 0)
+	{
+		result = errno != 0 ? errno : ENOENT;
+		logError("file: "__FILE__", line: %d, " \
+			"open file %s fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, full_filename, result, strerror(result));
+		storage_recv_to_fd(sock, -1, 0, size, &crc32);
+		return result;
+	}
+
+	pLock = append_locks + PJWHash(full_filename, \
+			strlen(full_filename)) % STORAGE_APPEND_LOCK_COUNT;
+	pthread_mutex_lock(pLock);
+	while (1)
+	{
+		if (fstat(fd, &stat_buf) != 0)
+		{
+			result = errno != 0 ? errno : EIO;
+			logError("file: "__FILE__", line: %d, " \
+				"stat file %s fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, full_filename, \
+				result, strerror(result));
+			storage_recv_to_fd(sock, -1, 0, size, &crc32);
+			break;
+		}
+
+		/* the replica misses the former appends */
+		if (*offset > stat_buf.st_size)
+		{
+			storage_recv_to_fd(sock, -1, 0, size, &crc32);
+			result = ENOENT;
+			break;
+		}
+		if (*offset < 0)
+		{
+			*offset = stat_buf.st_size;
+		}
+
+		if ((result=storage_recv_to_fd(sock, fd, *offset, size, \
+				&crc32)) == 0)
+		{
+			result = storage_sync_written_file(fd, full_filename, \
+					*offset + size);
+		}
+
+		/* keep the file unchanged when fail */
+		if (result != 0 && ftruncate(fd, stat_buf.st_size) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"truncate file %s fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, full_filename, \
+				errno, strerror(errno));
+		}
+		break;
+	}
+	pthread_mutex_unlock(pLock);
+
+	close(fd);
+	return result;
+}
+
+int storage_get_appender_size(const char *full_filename, int64_t *file_size)
+{
+	pthread_mutex_t *pLock;
+	struct stat stat_buf;
+	int result;
+
+	pLock = append_locks + PJWHash(full_filename, \
+			strlen(full_filename)) % STORAGE_APPEND_LOCK_COUNT;
+	pthread_mutex_lock(pLock);
+	if (stat(full_filename, &stat_buf) != 0)
+	{
+		result = errno != 0 ? errno : ENOENT;
+	}
+	else
+	{
+		*file_size = stat_buf.st_size;
+		result = 0;
+	}
+	pthread_mutex_unlock(pLock);
+
+	return result;
+}
+
+static int storage_send_fd(const int sock, const int fd, \
+		const char *full_filename, const int64_t offset, \
+		const int64_t size)
+{
+	char *buff;
+	int64_t sent;
+	int bytes;
+	int result;
+
+	buff = (char *)malloc(STORAGE_STREAM_BUFF_SIZE);
+	if (buff == NULL)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"malloc %d bytes fail", __LINE__, \
+			STORAGE_STREAM_BUFF_SIZE);
+		return errno != 0 ? errno : ENOMEM;
+	}
+
+	result = 0;
+	sent = 0;
+	while (sent < size)
+	{
+		bytes = pread(fd, buff, size - sent > STORAGE_STREAM_BUFF_SIZE \
+			? STORAGE_STREAM_BUFF_SIZE : size - sent, \
+			offset + sent);
+		if (bytes <= 0)
+		{
+			if (bytes < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			result = (bytes < 0 && errno != 0) ? errno : EIO;
+			logError("file: "__FILE__", line: %d, " \
+				"read file %s fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, full_filename, \
+				result, strerror(result));
+			break;
+		}
+
+		if (tcpsenddata(sock, buff, bytes, g_network_timeout) != 1)
+		{
+			result = errno != 0 ? errno : EPIPE;
+			logError("file: "__FILE__", line: %d, " \
+				"send data fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, result, strerror(result));
+			break;
+		}
+		sent += bytes;
+	}
+
+	free(buff);
+	return result;
+}
+
+int storage_open_send_file(const char *full_filename, int *fd, \
+		int64_t *file_size)
+{
+	struct stat stat_buf;
+	int result;
+
+	if ((*fd=open(full_filename, O_RDONLY)) < 0)
+	{
+		result = errno != 0 ? errno : ENOENT;
+		logError("file: "__FILE__", line: %d, " \
+			"open file %s fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, full_filename, result, strerror(result));
+		return result;
+	}
+
+	if (fstat(*fd, &stat_buf) != 0)
+	{
+		result = errno != 0 ? errno : EIO;
+		logError("file: "__FILE__", line: %d, " \
+			"stat file %s fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, full_filename, result, strerror(result));
+		close(*fd);
+		*fd = -1;
+		return result;
+	}
+
+	*file_size = stat_buf.st_size;
+	return 0;
+}
+
+int storage_send_file_fd(const int sock, const int fd, \
+		const char *full_filename, const int64_t file_size)
+{
+	int result;
+
+	storage_advise_file(fd, file_size, STORAGE_FADV_SEQUENTIAL);
+	result = storage_send_fd(sock, fd, full_filename, 0, file_size);
+	storage_advise_file(fd, file_size, STORAGE_FADV_DONTNEED);
+	return result;
+}
+
+int storage_send_file(const int sock, const char *full_filename, \
+		const int64_t file_size)
+{
+	int64_t real_size;
+	int fd;
+	int result;
+
+	if ((result=storage_open_send_file(full_filename, \
+		&fd, &real_size)) != 0)
+	{
+		return result;
+	}
+
+	if (real_size != file_size)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"the size of file %s is changed", \
+			__LINE__, full_filename);
+		close(fd);
+		return EIO;
+	}
+
+	result = storage_send_file_fd(sock, fd, full_filename, file_size);
+	close(fd);
+	return result;
+}
+
+int storage_send_file_part(const int sock, const char *full_filename, \
+		const int64_t offset, const int64_t size)
+{
+	struct stat stat_buf;
+	int fd;
+	int result;
+
+	if ((fd=open(full_filename, O_RDONLY)) < 0)
+	{
+		result = errno != 0 ? errno : ENOENT;
+		logError("file: "__FILE__", line: %d, " \
+			"open file %s fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, full_filename, result, strerror(result));
+		return result;
+	}
+
+	if (fstat(fd, &stat_buf) != 0 || stat_buf.st_size < offset + size)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"the size of file %s is less than " \
+			INT64_PRINTF_FORMAT, \
+			__LINE__, full_filename, offset + size);
+		close(fd);
+		return EIO;
+	}
+
+	result = storage_send_fd(sock, fd, full_filename, offset, size);
+	close(fd);
+	return result;
+}
+
+int storage_write_file(const char *full_filename, const char *buff, \
+		const int file_size)
+{
+	char tmp_filename[MAX_PATH_SIZE + 128];
+	int fd;
+	int result;
+
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s%s", \
+		full_filename, STORAGE_TEMP_FILE_EXT);
+	fd = open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"open file %s fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, tmp_filename, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : ENOENT;
+	}
+
+	while (1)
+	{
+		if ((result=storage_allocate_file(fd, tmp_filename, \
+				file_size)) != 0)
+		{
+			break;
+		}
+
+		storage_advise_file(fd, file_size, STORAGE_FADV_SEQUENTIAL);
+		if ((result=storage_write_buff(fd, buff, file_size, 0)) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"write file %s fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, tmp_filename, \
+				result, strerror(result));
+			break;
+		}
+
+		result = storage_sync_written_file(fd, tmp_filename, file_size);
+		break;
+	}
+
+	close(fd);
+	if (result != 0)
+	{
+		unlink(tmp_filename);
+		return result;
+	}
+
+	return storage_rename_file(tmp_filename, full_filename);
+}
@@ -11,8 +11,42 @@
 #ifndef _STORAGE_FUNC_H_
 #define _STORAGE_FUNC_H_
 
+#include <fcntl.h>
+
 #define STORAGE_DATA_DIR_FORMAT		"%02X"
 #define STORAGE_META_FILE_EXT		"-m"
+#define STORAGE_TEMP_FILE_EXT		".tmp"
+
+/* the file id in the filename: base64 of timestamp(4), file size(4),
+   crc32(4) and random(3), the old ids have no crc32. The id of the file
+   of 4GB and more sets the high bit of the byte after the crc32, which
+   rand() never sets, the next 15 bits hold the bits 32 - 46 of the file
+   size and one byte is random */
+#define STORAGE_FILENAME_ID_BYTES	15
+#define STORAGE_OLD_FILENAME_ID_BYTES	12
+#define STORAGE_FILENAME_SIZE_HIGH_FLAG	0x80
+
+/* the appender file can be appended after uploaded, its filename ends
+   with this ext and holds the ip address of the source storage server
+   instead of the crc32, one char keeps the filename within 31 bytes */
+#define STORAGE_APPENDER_FILE_EXT	"~"
+
+/* the files >= this size are received and sent by chunks without
+   holding the whole content in memory, they may be larger than 2GB */
+#define STORAGE_STREAM_FILE_SIZE	(64 * 1024 * 1024)
+#define STORAGE_STREAM_BUFF_SIZE	(256 * 1024)
+
+/* the filename prefix of the store path, such as M00/ */
+#define STORAGE_STORE_PATH_PREFIX_CHAR	'M'
+#define STORAGE_STORE_PATH_PREFIX_FORMAT	"M%02X/"
+
+#ifdef POSIX_FADV_DONTNEED
+#define STORAGE_FADV_SEQUENTIAL	POSIX_FADV_SEQUENTIAL
+#define STORAGE_FADV_DONTNEED	POSIX_FADV_DONTNEED
+#else
+#define STORAGE_FADV_SEQUENTIAL	0
+#define STORAGE_FADV_DONTNEED	0
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -33,6 +67,205 @@ int storage_write_to_stat_file();
 int storage_check_and_make_data_dirs();
 int storage_write_to_sync_ini_file();
 
+/*
+get the full filename of the logic filename such as M00/2B/1A/xxx
+params:
+	logic_filename: the filename return to the client
+	full_filename: return the full filename
+	buff_size: the buffer size of full_filename
+	store_path_index: return the store path index
+return: 0 for success, != 0 for invalid filename
+*/
+int storage_get_full_filename(const char *logic_filename, \
+		char *full_filename, const int buff_size, \
+		int *store_path_index);
+
+/*
+get the file size and the crc32 from the filename
+params:
+	logic_filename: the filename return to the client
+	file_size: return the file size
+	crc32: return the CRC32C of the file content
+return: 0 for success, ENOENT for no crc32 in the filename (the file
+	size is still returned), EINVAL for invalid filename
+*/
+int storage_get_filename_checksum(const char *logic_filename, \
+		int64_t *file_size, unsigned int *crc32);
+
+/*
+get the source storage server of the appender file from the filename
+params:
+	logic_filename: the filename return to the client
+	ip_addr: return the ip address of the source storage server,
+		FDFS_IPADDR_SIZE bytes
+return: 0 for success, EINVAL for not an appender file
+*/
+int storage_get_appender_source(const char *logic_filename, char *ip_addr);
+
+/*
+check the file content against the size and the crc32 in the filename
+return: 0 for match or nothing to check, EIO for mismatch
+*/
+int storage_check_file_checksum(const char *logic_filename, \
+		const char *file_buff, const int file_size);
+
+/*
+check the size and the computed crc32 of the streamed file
+return: 0 for match or nothing to check, EIO for mismatch
+*/
+int storage_check_file_crc32(const char *logic_filename, \
+		const int64_t file_size, const unsigned int crc32);
+
+/*
+select the store path to save the uploaded file
+return: the store path index, < 0 for no store path has enough space
+*/
+int storage_select_store_path(const int64_t file_size);
+
+/*
+statfs every store path to refresh the free space
+params:
+	total_mb: return the total space of all store paths
+	free_mb: return the largest free space of the store paths, a file
+		can't be stored across the store paths
+return: 0 for success, != 0 for fail
+*/
+int storage_refresh_store_paths_space(int *total_mb, int *free_mb);
+
+/*
+limit the threads doing disk io on one store path at the same time
+*/
+void storage_disk_io_begin(const int store_path_index);
+void storage_disk_io_end(const int store_path_index);
+
+/*
+the large files (size >= g_nocache_file_size) are read and written
+without keeping their pages in the page cache, so they can't evict
+the small hot files
+*/
+bool storage_is_large_file(const int64_t file_size);
+
+/*
+call posix_fadvise when the file is large
+params:
+	fd: the opened fd
+	file_size: the file size
+	advice: STORAGE_FADV_SEQUENTIAL or STORAGE_FADV_DONTNEED
+*/
+void storage_advise_file(const int fd, const int64_t file_size, \
+		const int advice);
+
+/*
+write the file content to a temp file then rename it, so a crash can't
+leave a half-written file, bypass the page cache when the file is large
+return: 0 for success, != 0 for fail
+*/
+int storage_write_file(const char *full_filename, const char *buff, \
+		const int file_size);
+
+/*
+rename the temp file to the full filename and fsync the dir,
+the temp file is removed when fail
+return: 0 for success, != 0 for fail
+*/
+int storage_rename_file(const char *tmp_filename, const char *full_filename);
+
+/*
+recv the content of size bytes from the socket and write it at the offset
+of the file by chunks, the content is always received even if it can't
+be written, so the connection is still usable
+params:
+	sock: the socket to recv
+	fd: the file to write, < 0 for discard the content
+	offset: the file offset to write
+	size: the bytes to recv
+	crc32: return the CRC32C of the received content
+return: 0 for success, != 0 for fail
+*/
+int storage_recv_to_fd(const int sock, const int fd, const int64_t offset, \
+		const int64_t size, unsigned int *crc32);
+
+/*
+recv the file content of file_size bytes from the socket to the temp file
+by chunks, the content is always received even if the file can't be
+written, so the connection is still usable
+params:
+	sock: the socket to recv
+	tmp_filename: the file to write, NULL for discard the content
+	file_size: the bytes to recv
+	crc32: return the CRC32C of the received content
+return: 0 for success, != 0 for fail, the temp file is removed when fail
+*/
+int storage_recv_file(const int sock, const char *tmp_filename, \
+		const int64_t file_size, unsigned int *crc32);
+
+/*
+init the locks of the appender files
+return: 0 for success, != 0 for fail
+*/
+int storage_append_init();
+
+/*
+recv the content from the socket and append it to the file, the
+concurrent appends of the same file are serialized
+params:
+	sock: the socket to recv
+	full_filename: the file to append
+	offset: the file offset to write, < 0 for the end of the file,
+		return the offset written
+	size: the bytes to recv
+return: 0 for success, ENOENT for the offset beyond the end of the file,
+	!= 0 for fail, the file is not changed when fail
+*/
+int storage_recv_append_file(const int sock, const char *full_filename, \
+		int64_t *offset, const int64_t size);
+
+/*
+get the size of the appender file without the append in progress
+params:
+	full_filename: the appender file
+	file_size: return the file size
+return: 0 for success, != 0 for fail
+*/
+int storage_get_appender_size(const char *full_filename, int64_t *file_size);
+
+/*
+open the file to send and get its size, so the response header can be
+sent after the file opened
+params:
+	full_filename: the file to send
+	fd: return the opened fd, the caller should close it
+	file_size: return the file size
+return: 0 for success, != 0 for fail
+*/
+int storage_open_send_file(const char *full_filename, int *fd, \
+		int64_t *file_size);
+
+/*
+send file_size bytes of the opened file by chunks
+return: 0 for success, != 0 for fail
+*/
+int storage_send_file_fd(const int sock, const int fd, \
+		const char *full_filename, const int64_t file_size);
+
+/*
+send the file content by chunks
+params:
+	sock: the socket to send
+	full_filename: the file to send
+	file_size: the expected file size, EIO when the file size changed
+return: 0 for success, != 0 for fail
+*/
+int storage_send_file(const int sock, const char *full_filename, \
+		const int64_t file_size);
+
+/*
+send size bytes of the file from the offset by chunks
+return: 0 for success, != 0 for fail
+*/
+int storage_send_file_part(const int sock, const char *full_filename, \
+		const int64_t offset, const int64_t size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -32,6 +32,32 @@ bool g_sync_old_done = false;
 char g_sync_src_ip_addr[FDFS_IPADDR_SIZE] = {0};
 int g_sync_until_timestamp = 0;
 
+int g_path_count = 0;
+FDFSStorePath *g_store_paths = NULL;
+int g_store_path_mode = FDFS_STORE_PATH_ROUND_ROBIN;
+int g_disk_io_threads = 0;
+
+bool g_use_trunk_file = false;
+int g_slot_max_size = 0;
+int g_trunk_file_size = 0;
+
+int g_fd_cache_size = 0;
+
+int g_hot_cache_size = 0;
+int g_hot_cache_max_object_size = 0;
+
+int g_nocache_file_size = 0;
+
+bool g_check_file_duplicate = false;
+
+int g_scrub_interval = 0;
+int g_scrub_bytes_per_second = 0;
+
+int g_fsync_mode = 0;
+int g_fsync_interval = 0;
+
+char g_meta_index_keys[STORAGE_META_INDEX_KEYS_SIZE] = {0};
+
 int g_tracker_server_count = 0;
 TrackerServerInfo *g_tracker_servers = NULL;
 
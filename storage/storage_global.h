@@ -14,6 +14,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "fdfs_define.h"
 #include "tracker_types.h"
 
@@ -24,6 +25,23 @@
 
 #define STORAGE_MAX_LOCAL_IP_ADDRS	4
 
+#define FDFS_MAX_STORE_PATHS		256
+
+#define STORAGE_META_INDEX_KEYS_SIZE	256
+
+#define FDFS_STORE_PATH_ROUND_ROBIN	0  //round robin
+#define FDFS_STORE_PATH_LOAD_BALANCE	2  //the path with the most free space
+
+typedef struct
+{
+	char path[MAX_PATH_SIZE];  //the store path, data files under path/data
+	int total_mb;  //total disk storage in MB
+	int free_mb;   //free disk storage in MB
+	int io_count;  //threads doing disk io on this path
+	pthread_mutex_t io_lock;
+	pthread_cond_t io_cond;
+} FDFSStorePath;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -48,6 +66,32 @@ extern bool g_sync_old_done;
 extern char g_sync_src_ip_addr[FDFS_IPADDR_SIZE];
 extern int g_sync_until_timestamp;
 
+extern int g_path_count;  //store path count
+extern FDFSStorePath *g_store_paths;
+extern int g_store_path_mode;  //store path lookup mode
+extern int g_disk_io_threads;  //max disk io threads per store path, 0 for no limit
+
+extern bool g_use_trunk_file;  //pack the small files into the trunk files
+extern int g_slot_max_size;    //the max size of the small file
+extern int g_trunk_file_size;  //the size of the trunk file
+
+extern int g_fd_cache_size;  //max cached fds of the hot files, 0 for disabled
+
+extern int g_hot_cache_size;  //max bytes of the cached hot files, 0 for disabled
+extern int g_hot_cache_max_object_size;  //the max size of the cached file
+
+extern int g_nocache_file_size;  //bypass the page cache when file size >= it
+
+extern bool g_check_file_duplicate;  //hard link the files with same content
+
+extern int g_scrub_interval;  //seconds between two scrub passes, 0 for disabled
+extern int g_scrub_bytes_per_second;  //read budget of each scrub thread
+
+extern int g_fsync_mode;  //STORAGE_FSYNC_MODE_NONE, PERIODIC or ALWAYS
+extern int g_fsync_interval;  //ms between two syncs in periodic mode
+
+extern char g_meta_index_keys[STORAGE_META_INDEX_KEYS_SIZE];  //the indexed metadata names seperated by comma
+
 extern int g_tracker_server_count;
 extern TrackerServerInfo *g_tracker_servers;
 
@@ -0,0 +1,468 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//storage_hot_cache.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "fdfs_define.h"
+#include "logger.h"
+#include "fdfs_global.h"
+#include "sockopt.h"
+#include "shared_func.h"
+#include "hash.h"
+#include "tracker_proto.h"
+#include "storage_global.h"
+#include "storage_hot_cache.h"
+
+/* 2Q: the new files enter the in queue (FIFO), the files evicted from
+   the in queue are remembered by the out queue (keys only), the files
+   accessed again when in the out queue enter the main queue (LRU),
+   so the files read only once can't flush the main queue */
+#define HOT_QUEUE_IN	0
+#define HOT_QUEUE_MAIN	1
+#define HOT_QUEUE_OUT	2
+
+#define HOT_QUEUE_IN_PERCENT	25
+#define HOT_QUEUE_OUT_MIN_COUNT	64
+
+/* the versions of the hashed filenames, a reader only loses its admission
+   when the file or the file of the same slot is invalidated */
+#define HOT_CACHE_VERSION_SLOTS	1024
+
+#define HOT_CACHE_VERSION(filename, filename_len) \
+	hot_cache_versions[PJWHash(filename, filename_len) % \
+			HOT_CACHE_VERSION_SLOTS]
+
+typedef struct tagStorageHotEntry
+{
+	char filename[64];  //the logic filename
+	int filename_len;
+	char *buff;  //header + file content, NULL in the out queue
+	int length;  //the buff length
+	int ref_count;  //the threads sending this buff
+	bool evicted;   //removed from the cache, free by the last sender
+	char queue;
+	struct tagStorageHotEntry *prev;
+	struct tagStorageHotEntry *next;
+} StorageHotEntry;
+
+typedef struct
+{
+	StorageHotEntry *head;
+	StorageHotEntry *tail;
+	int count;
+	int bytes;
+} StorageHotQueue;
+
+static pthread_mutex_t hot_cache_lock;
+static HashArray hot_cache_hash;
+static StorageHotQueue hot_queues[3];
+static int hot_cache_versions[HOT_CACHE_VERSION_SLOTS];
+static bool hot_cache_inited = false;
+
+static void hot_cache_lock_acquire()
+{
+	if (pthread_mutex_lock(&hot_cache_lock) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call pthread_mutex_lock fail, " \
+			"errno: %d, error info:%s.", \
+			__LINE__, errno, strerror(errno));
+	}
+}
+
+static void hot_cache_lock_release()
+{
+	if (pthread_mutex_unlock(&hot_cache_lock) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call pthread_mutex_unlock fail, " \
+			"errno: %d, error info:%s.", \
+			__LINE__, errno, strerror(errno));
+	}
+}
+
+static void hot_queue_unlink(StorageHotEntry *pEntry)
+{
+	StorageHotQueue *pQueue;
+
+	pQueue = hot_queues + pEntry->queue;
+	if (pEntry->prev == NULL)
+	{
+		pQueue->head = pEntry->next;
+	}
+	else
+	{
+		pEntry->prev->next = pEntry->next;
+	}
+
+	if (pEntry->next == NULL)
+	{
+		pQueue->tail = pEntry->prev;
+	}
+	else
+	{
+		pEntry->next->prev = pEntry->prev;
+	}
+
+	pQueue->count--;
+	pQueue->bytes -= pEntry->length;
+	pEntry->prev = NULL;
+	pEntry->next = NULL;
+}
+
+static void hot_queue_link_head(StorageHotEntry *pEntry, const char queue)
+{
+	StorageHotQueue *pQueue;
+
+	pEntry->queue = queue;
+	pQueue = hot_queues + queue;
+	pEntry->prev = NULL;
+	pEntry->next = pQueue->head;
+	if (pQueue->head == NULL)
+	{
+		pQueue->tail = pEntry;
+	}
+	else
+	{
+		pQueue->head->prev = pEntry;
+	}
+	pQueue->head = pEntry;
+
+	pQueue->count++;
+	pQueue->bytes += pEntry->length;
+}
+
+static void hot_cache_free_entry(StorageHotEntry *pEntry)
+{
+	if (pEntry->buff != NULL)
+	{
+		free(pEntry->buff);
+	}
+	free(pEntry);
+}
+
+/* remove the entry from the cache, the buff is freed by the last sender */
+static void hot_cache_remove_entry(StorageHotEntry *pEntry)
+{
+	hash_delete(&hot_cache_hash, pEntry->filename, pEntry->filename_len);
+	hot_queue_unlink(pEntry);
+
+	if (pEntry->ref_count > 0)
+	{
+		pEntry->evicted = true;
+	}
+	else
+	{
+		hot_cache_free_entry(pEntry);
+	}
+}
+
+static void hot_cache_reclaim()
+{
+	StorageHotQueue *pIn;
+	StorageHotQueue *pMain;
+	StorageHotQueue *pOut;
+	StorageHotEntry *pEntry;
+	StorageHotEntry *pGhost;
+	int max_out_count;
+
+	pIn = hot_queues + HOT_QUEUE_IN;
+	pMain = hot_queues + HOT_QUEUE_MAIN;
+	pOut = hot_queues + HOT_QUEUE_OUT;
+	while (pIn->bytes + pMain->bytes > g_hot_cache_size)
+	{
+		if (pIn->bytes > g_hot_cache_size / 100 * \
+			HOT_QUEUE_IN_PERCENT || pMain->tail == NULL)
+		{
+			pEntry = pIn->tail;
+			pGhost = (StorageHotEntry *)malloc( \
+					sizeof(StorageHotEntry));
+			if (pGhost != NULL)
+			{
+				memset(pGhost, 0, sizeof(StorageHotEntry));
+				memcpy(pGhost->filename, pEntry->filename, \
+					pEntry->filename_len + 1);
+				pGhost->filename_len = pEntry->filename_len;
+			}
+
+			hot_cache_remove_entry(pEntry);
+			if (pGhost != NULL)
+			{
+				if (hash_insert(&hot_cache_hash, \
+					pGhost->filename, \
+					pGhost->filename_len, pGhost) < 0)
+				{
+					free(pGhost);
+				}
+				else
+				{
+					hot_queue_link_head(pGhost, \
+						HOT_QUEUE_OUT);
+				}
+			}
+		}
+		else
+		{
+			hot_cache_remove_entry(pMain->tail);
+		}
+	}
+
+	max_out_count = 2 * (pIn->count + pMain->count);
+	if (max_out_count < HOT_QUEUE_OUT_MIN_COUNT)
+	{
+		max_out_count = HOT_QUEUE_OUT_MIN_COUNT;
+	}
+	while (pOut->count > max_out_count)
+	{
+		hot_cache_remove_entry(pOut->tail);
+	}
+}
+
+int storage_hot_cache_init()
+{
+	int result;
+
+	if (g_hot_cache_size <= 0)
+	{
+		return 0;
+	}
+
+	if ((result=init_pthread_lock(&hot_cache_lock)) != 0)
+	{
+		return result;
+	}
+
+	if ((result=hash_init(&hot_cache_hash, PJWHash, \
+		2 * (g_hot_cache_size / g_hot_cache_max_object_size + \
+		HOT_QUEUE_OUT_MIN_COUNT), 0.75)) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"hash_init fail, errno: %d", __LINE__, result);
+		return ENOMEM;
+	}
+
+	memset(hot_queues, 0, sizeof(hot_queues));
+	memset(hot_cache_versions, 0, sizeof(hot_cache_versions));
+	hot_cache_inited = true;
+	return 0;
+}
+
+int storage_hot_cache_destroy()
+{
+	StorageHotQueue *pQueue;
+	StorageHotEntry *pEntry;
+
+	if (!hot_cache_inited)
+	{
+		return 0;
+	}
+
+	hot_cache_lock_acquire();
+	for (pQueue=hot_queues; pQueue<hot_queues+3; pQueue++)
+	{
+		while (pQueue->head != NULL)
+		{
+			pEntry = pQueue->head;
+			pQueue->head = pEntry->next;
+			hot_cache_free_entry(pEntry);
+		}
+	}
+	memset(hot_queues, 0, sizeof(hot_queues));
+	hash_destroy(&hot_cache_hash);
+	hot_cache_inited = false;
+	hot_cache_lock_release();
+
+	pthread_mutex_destroy(&hot_cache_lock);
+	return 0;
+}
+
+int storage_hot_cache_send(const char *logic_filename, const int sock, \
+		FDFSProtoHeader *pHeader, int *file_size, int *version)
+{
+	StorageHotEntry *pEntry;
+	char header_buff[FDFS_PROTO_MAX_HEADER_SIZE];
+	int header_len;
+	int filename_len;
+	bool bFree;
+	int result;
+
+	*version = 0;
+	if (!hot_cache_inited)
+	{
+		return ENOENT;
+	}
+
+	filename_len = strlen(logic_filename);
+	hot_cache_lock_acquire();
+	pEntry = (StorageHotEntry *)hash_find(&hot_cache_hash, \
+			logic_filename, filename_len);
+	if (pEntry == NULL || pEntry->queue == HOT_QUEUE_OUT)
+	{
+		*version = HOT_CACHE_VERSION(logic_filename, filename_len);
+		hot_cache_lock_release();
+		return ENOENT;
+	}
+
+	if (pEntry->queue == HOT_QUEUE_MAIN)
+	{
+		hot_queue_unlink(pEntry);
+		hot_queue_link_head(pEntry, HOT_QUEUE_MAIN);
+	}
+	pEntry->ref_count++;
+	hot_cache_lock_release();
+
+	*file_size = pEntry->length - sizeof(TrackerHeader);
+	if (pHeader == NULL)
+	{
+		result = tcpsenddata(sock, pEntry->buff, pEntry->length, \
+				g_network_timeout);
+	}
+	else
+	{
+		pHeader->pkg_len = *file_size;
+		header_len = fdfs_pack_header(pHeader, header_buff);
+		result = tcpsenddata(sock, header_buff, header_len, \
+				g_network_timeout);
+		if (result == 1)
+		{
+			result = tcpsenddata(sock, pEntry->buff + \
+				sizeof(TrackerHeader), *file_size, \
+				g_network_timeout);
+		}
+	}
+
+	if (result != 1)
+	{
+		result = errno != 0 ? errno : EPIPE;
+	}
+	else
+	{
+		result = 0;
+	}
+
+	hot_cache_lock_acquire();
+	pEntry->ref_count--;
+	bFree = pEntry->evicted && pEntry->ref_count == 0;
+	hot_cache_lock_release();
+	if (bFree)
+	{
+		hot_cache_free_entry(pEntry);
+	}
+
+	return result;
+}
+
+void storage_hot_cache_put(const char *logic_filename, \
+		const char *file_buff, const int file_size, const int version)
+{
+	StorageHotEntry *pEntry;
+	StorageHotEntry *pFound;
+	TrackerHeader *pHeader;
+	int filename_len;
+
+	if (!hot_cache_inited || file_size > g_hot_cache_max_object_size)
+	{
+		return;
+	}
+
+	filename_len = strlen(logic_filename);
+	if (filename_len >= sizeof(pEntry->filename))
+	{
+		return;
+	}
+
+	pEntry = (StorageHotEntry *)malloc(sizeof(StorageHotEntry));
+	if (pEntry == NULL)
+	{
+		return;
+	}
+	memset(pEntry, 0, sizeof(StorageHotEntry));
+	memcpy(pEntry->filename, logic_filename, filename_len + 1);
+	pEntry->filename_len = filename_len;
+	pEntry->length = sizeof(TrackerHeader) + file_size;
+	pEntry->buff = (char *)malloc(pEntry->length);
+	if (pEntry->buff == NULL)
+	{
+		free(pEntry);
+		return;
+	}
+
+	pHeader = (TrackerHeader *)pEntry->buff;
+	memset(pHeader, 0, sizeof(TrackerHeader));
+	sprintf(pHeader->pkg_len, "%x", file_size);
+	pHeader->cmd = STORAGE_PROTO_CMD_RESP;
+	pHeader->status = 0;
+	memcpy(pEntry->buff + sizeof(TrackerHeader), file_buff, file_size);
+
+	hot_cache_lock_acquire();
+	while (1)
+	{
+		if (version != HOT_CACHE_VERSION(logic_filename, \
+				filename_len))  //invalidated when reading
+		{
+			break;
+		}
+
+		pFound = (StorageHotEntry *)hash_find(&hot_cache_hash, \
+				logic_filename, filename_len);
+		if (pFound != NULL && pFound->queue != HOT_QUEUE_OUT)
+		{
+			break;  //cached by other thread
+		}
+
+		if (pFound != NULL)  //accessed again, promote to main queue
+		{
+			hot_cache_remove_entry(pFound);
+		}
+
+		if (hash_insert(&hot_cache_hash, pEntry->filename, \
+			filename_len, pEntry) < 0)
+		{
+			break;
+		}
+
+		hot_queue_link_head(pEntry, pFound != NULL ? \
+				HOT_QUEUE_MAIN : HOT_QUEUE_IN);
+		pEntry = NULL;
+		hot_cache_reclaim();
+		break;
+	}
+	hot_cache_lock_release();
+
+	if (pEntry != NULL)
+	{
+		hot_cache_free_entry(pEntry);
+	}
+}
+
+void storage_hot_cache_invalidate(const char *logic_filename)
+{
+	StorageHotEntry *pEntry;
+	int filename_len;
+
+	if (!hot_cache_inited)
+	{
+		return;
+	}
+
+	filename_len = strlen(logic_filename);
+	hot_cache_lock_acquire();
+	HOT_CACHE_VERSION(logic_filename, filename_len)++;
+	pEntry = (StorageHotEntry *)hash_find(&hot_cache_hash, \
+			logic_filename, filename_len);
+	if (pEntry != NULL)
+	{
+		hot_cache_remove_entry(pEntry);
+	}
+	hot_cache_lock_release();
+}
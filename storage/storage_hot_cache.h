@@ -0,0 +1,60 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//storage_hot_cache.h
+
+#ifndef _STORAGE_HOT_CACHE_H_
+#define _STORAGE_HOT_CACHE_H_
+
+#include "tracker_proto.h"
+
+#define STORAGE_DEF_HOT_CACHE_MAX_OBJECT_SIZE	(64 * 1024)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+the cache of the download responses of the hot small files,
+g_hot_cache_size is the max bytes, 0 for disabled
+*/
+int storage_hot_cache_init();
+int storage_hot_cache_destroy();
+
+/*
+send the cached download response (header and file content)
+params:
+	logic_filename: the filename return to the client
+	sock: the socket to send
+	pHeader: the v2 response header, the pkg_len is set to the
+		file size, NULL for the cached v1 header
+	file_size: return the file size
+	version: return the cache version when not cached,
+		 pass it to storage_hot_cache_put
+return: 0 for sent, ENOENT for not cached, other for send fail
+*/
+int storage_hot_cache_send(const char *logic_filename, const int sock, \
+		FDFSProtoHeader *pHeader, int *file_size, int *version);
+
+/*
+cache the file read from the disk, ignored when the cache was
+invalidated after the version
+*/
+void storage_hot_cache_put(const char *logic_filename, \
+		const char *file_buff, const int file_size, const int version);
+
+/*
+remove the file from the cache when it is deleted or updated
+*/
+void storage_hot_cache_invalidate(const char *logic_filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
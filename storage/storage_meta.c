@@ -0,0 +1,964 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//storage_meta.c
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <pthread.h>
+#include "fdfs_define.h"
+#include "logger.h"
+#include "fdfs_global.h"
+#include "shared_func.h"
+#include "hash.h"
+#include "storage_global.h"
+#include "storage_func.h"
+#include "storage_fsync.h"
+#include "storage_meta.h"
+#include "storage_meta_index.h"
+
+#define META_LOG_FILENAME	"meta.dat"
+
+#define META_OP_SET		'S'
+#define META_OP_DELETE		'D'
+
+/* each record: op(1) + key length(2, hex) + value length(8, hex)
+   + key + value */
+#define META_RECORD_HEADER_SIZE	11
+#define META_KEY_MAX_LEN	0xFF
+
+#define META_RECORD_SIZE(key_len, value_len) \
+	(META_RECORD_HEADER_SIZE + (key_len) + (value_len))
+
+/* compact the log when the dead bytes exceed it and the live bytes */
+#define META_COMPACT_MIN_BYTES	(16 * 1024 * 1024)
+
+typedef struct
+{
+	int64_t offset;  //the value offset in the log
+	int length;      //the value length
+} MetaIndexEntry;
+
+typedef struct
+{
+	pthread_mutex_t lock;
+	HashArray index;
+	int fd;
+	int64_t file_size;
+	int64_t dead_bytes;  //the bytes of the overwritten and deleted records
+	bool compacting;
+	char log_filename[MAX_PATH_SIZE + 32];
+} MetaStore;
+
+typedef struct
+{
+	int64_t offset;      //the value offset in the log
+	int64_t new_offset;  //the value offset in the compacted log
+	int key_len;
+	int length;
+} MetaCompactRecord;
+
+typedef struct
+{
+	MetaCompactRecord *records;
+	int count;
+	int64_t snapshot_size;  //the log size when the records are taken
+	int64_t shift;  //the offset change of the records appended after it
+} MetaCompactContext;
+
+static MetaStore *meta_stores = NULL;
+static bool meta_inited = false;
+
+static int meta_set_entry(MetaStore *pStore, const char *key, \
+		const int key_len, const int64_t offset, const int length)
+{
+	MetaIndexEntry *pEntry;
+
+	pEntry = (MetaIndexEntry *)hash_find(&pStore->index, key, key_len);
+	if (pEntry != NULL)
+	{
+		pStore->dead_bytes += META_RECORD_SIZE(key_len, \
+					pEntry->length);
+		pEntry->offset = offset;
+		pEntry->length = length;
+		return 0;
+	}
+
+	pEntry = (MetaIndexEntry *)malloc(sizeof(MetaIndexEntry));
+	if (pEntry == NULL)
+	{
+		return errno != 0 ? errno : ENOMEM;
+	}
+	pEntry->offset = offset;
+	pEntry->length = length;
+
+	if (hash_insert(&pStore->index, key, key_len, pEntry) < 0)
+	{
+		free(pEntry);
+		return ENOMEM;
+	}
+
+	return 0;
+}
+
+static void meta_remove_entry(MetaStore *pStore, const char *key, \
+		const int key_len)
+{
+	MetaIndexEntry *pEntry;
+
+	pEntry = (MetaIndexEntry *)hash_find(&pStore->index, key, key_len);
+	if (pEntry != NULL)
+	{
+		pStore->dead_bytes += META_RECORD_SIZE(key_len, \
+					pEntry->length);
+		hash_delete(&pStore->index, key, key_len);
+		free(pEntry);
+	}
+}
+
+/*
+build the index, the log is read record by record for it may be larger
+than the memory, truncate the incomplete record of the tail
+*/
+static int meta_load_log(MetaStore *pStore)
+{
+	FILE *fp;
+	char *record_buff;
+	char *pNewBuff;
+	char header[META_RECORD_HEADER_SIZE + 1];
+	int64_t offset;
+	int64_t file_size;
+	int buff_size;
+	int key_len;
+	int value_len;
+	int result;
+	struct stat file_stat;
+
+	if (!fileExists(pStore->log_filename))
+	{
+		return 0;
+	}
+
+	if ((fp=fopen(pStore->log_filename, "rb")) == NULL || \
+		fstat(fileno(fp), &file_stat) != 0)
+	{
+		result = errno != 0 ? errno : ENOENT;
+		logError("file: "__FILE__", line: %d, " \
+			"read file \"%s\" fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pStore->log_filename, \
+			result, strerror(result));
+		if (fp != NULL)
+		{
+			fclose(fp);
+		}
+		return result;
+	}
+	file_size = file_stat.st_size;
+
+	result = 0;
+	offset = 0;
+	buff_size = 0;
+	record_buff = NULL;
+	while (fread(header, META_RECORD_HEADER_SIZE, 1, fp) == 1)
+	{
+		header[META_RECORD_HEADER_SIZE] = '\0';
+		value_len = strtol(header + 3, NULL, 16);
+		header[3] = '\0';
+		key_len = strtol(header + 1, NULL, 16);
+		if ((*header != META_OP_SET && *header != META_OP_DELETE) \
+			|| key_len <= 0 || value_len < 0 || \
+			file_size - offset < META_RECORD_SIZE(key_len, \
+						value_len))
+		{
+			break;
+		}
+
+		if (key_len + value_len > buff_size)
+		{
+			pNewBuff = (char *)realloc(record_buff, \
+					key_len + value_len);
+			if (pNewBuff == NULL)
+			{
+				result = errno != 0 ? errno : ENOMEM;
+				break;
+			}
+			record_buff = pNewBuff;
+			buff_size = key_len + value_len;
+		}
+
+		if (fread(record_buff, key_len + value_len, 1, fp) != 1)
+		{
+			break;
+		}
+
+		if (*header == META_OP_SET)
+		{
+			if ((result=meta_set_entry(pStore, record_buff, \
+				key_len, offset + META_RECORD_HEADER_SIZE + \
+				key_len, value_len)) == 0)
+			{
+				result = storage_meta_index_update( \
+					record_buff, key_len, \
+					record_buff + key_len, value_len);
+			}
+		}
+		else
+		{
+			meta_remove_entry(pStore, record_buff, key_len);
+			pStore->dead_bytes += META_RECORD_SIZE(key_len, 0);
+			result = storage_meta_index_update(record_buff, \
+					key_len, NULL, 0);
+		}
+		if (result != 0)
+		{
+			break;
+		}
+
+		offset += META_RECORD_SIZE(key_len, value_len);
+	}
+
+	if (record_buff != NULL)
+	{
+		free(record_buff);
+	}
+	fclose(fp);
+	if (result != 0)
+	{
+		return result;
+	}
+
+	pStore->file_size = offset;
+	if (pStore->file_size != file_size)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"file \"%s\", the record at offset " \
+			INT64_PRINTF_FORMAT" is invalid, truncate the " \
+			"file size from "INT64_PRINTF_FORMAT" to " \
+			INT64_PRINTF_FORMAT, __LINE__, pStore->log_filename, \
+			pStore->file_size, file_size, pStore->file_size);
+		if (truncate(pStore->log_filename, pStore->file_size) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"truncate file \"%s\" fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, pStore->log_filename, \
+				errno, strerror(errno));
+			return errno != 0 ? errno : EIO;
+		}
+	}
+
+	return 0;
+}
+
+static void meta_snapshot_entry(const int index, const HashData *data, \
+		void *args)
+{
+	MetaCompactContext *pContext;
+	MetaIndexEntry *pEntry;
+	MetaCompactRecord *pRecord;
+
+	pContext = (MetaCompactContext *)args;
+	pEntry = (MetaIndexEntry *)data->value;
+	pRecord = pContext->records + pContext->count;
+	pRecord->offset = pEntry->offset;
+	pRecord->new_offset = 0;
+	pRecord->key_len = data->key_len;
+	pRecord->length = pEntry->length;
+	pContext->count++;
+}
+
+static int meta_cmp_by_offset(const void *p1, const void *p2)
+{
+	int64_t sub;
+
+	sub = ((MetaCompactRecord *)p1)->offset - \
+		((MetaCompactRecord *)p2)->offset;
+	return sub < 0 ? -1 : (sub > 0 ? 1 : 0);
+}
+
+static void meta_commit_entry(const int index, const HashData *data, \
+		void *args)
+{
+	MetaCompactContext *pContext;
+	MetaIndexEntry *pEntry;
+	MetaCompactRecord target;
+	MetaCompactRecord *pFound;
+
+	pContext = (MetaCompactContext *)args;
+	pEntry = (MetaIndexEntry *)data->value;
+	if (pEntry->offset >= pContext->snapshot_size)
+	{
+		pEntry->offset += pContext->shift;
+		return;
+	}
+
+	target.offset = pEntry->offset;
+	pFound = (MetaCompactRecord *)bsearch(&target, pContext->records, \
+			pContext->count, sizeof(MetaCompactRecord), \
+			meta_cmp_by_offset);
+	if (pFound != NULL)
+	{
+		pEntry->offset = pFound->new_offset;
+	}
+}
+
+static int meta_copy_bytes(const int fd, int64_t offset, int64_t bytes, \
+		FILE *fp, char *buff, const int buff_size)
+{
+	int read_bytes;
+
+	while (bytes > 0)
+	{
+		read_bytes = bytes > buff_size ? buff_size : bytes;
+		if (pread(fd, buff, read_bytes, offset) != read_bytes || \
+			fwrite(buff, read_bytes, 1, fp) != 1)
+		{
+			return errno != 0 ? errno : EIO;
+		}
+
+		offset += read_bytes;
+		bytes -= read_bytes;
+	}
+
+	return 0;
+}
+
+/*
+rewrite the log with the live records only, the live records are copied
+to the new log out of the lock, the records appended meanwhile are copied
+and the new log replaces the old one under the lock
+*/
+static int meta_compact_log(MetaStore *pStore)
+{
+	MetaCompactContext context;
+	MetaCompactRecord *pRecord;
+	MetaCompactRecord *pEnd;
+	FILE *fp;
+	char tmp_filename[MAX_PATH_SIZE + 64];
+	char buff[16 * 1024];
+	int64_t new_size;
+	int64_t dead_bytes;
+	int record_size;
+	int new_fd;
+	int result;
+
+	memset(&context, 0, sizeof(context));
+	pthread_mutex_lock(&pStore->lock);
+	if (pStore->compacting)
+	{
+		pthread_mutex_unlock(&pStore->lock);
+		return 0;
+	}
+
+	if (pStore->index.item_count > 0)
+	{
+		context.records = (MetaCompactRecord *)malloc( \
+			sizeof(MetaCompactRecord) * pStore->index.item_count);
+		if (context.records == NULL)
+		{
+			pthread_mutex_unlock(&pStore->lock);
+			return errno != 0 ? errno : ENOMEM;
+		}
+		hash_walk(&pStore->index, meta_snapshot_entry, &context);
+	}
+	context.snapshot_size = pStore->file_size;
+	dead_bytes = pStore->dead_bytes;
+	pStore->compacting = true;
+	pthread_mutex_unlock(&pStore->lock);
+
+	if (context.count > 0)
+	{
+		qsort(context.records, context.count, \
+			sizeof(MetaCompactRecord), meta_cmp_by_offset);
+	}
+
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s%s", \
+		pStore->log_filename, STORAGE_TEMP_FILE_EXT);
+	new_size = 0;
+	result = 0;
+	if ((fp=fopen(tmp_filename, "wb")) == NULL)
+	{
+		result = errno != 0 ? errno : ENOENT;
+	}
+	else
+	{
+		pEnd = context.records + context.count;
+		for (pRecord=context.records; pRecord<pEnd; pRecord++)
+		{
+			record_size = META_RECORD_SIZE(pRecord->key_len, \
+					pRecord->length);
+			if ((result=meta_copy_bytes(pStore->fd, \
+				pRecord->offset - (META_RECORD_HEADER_SIZE + \
+				pRecord->key_len), record_size, fp, \
+				buff, sizeof(buff))) != 0)
+			{
+				break;
+			}
+
+			pRecord->new_offset = new_size + \
+				META_RECORD_HEADER_SIZE + pRecord->key_len;
+			new_size += record_size;
+		}
+
+		if (result == 0 && (fflush(fp) != 0 || \
+			fsync(fileno(fp)) != 0))
+		{
+			result = errno != 0 ? errno : EIO;
+		}
+	}
+
+	pthread_mutex_lock(&pStore->lock);
+	while (result == 0)
+	{
+		if ((result=meta_copy_bytes(pStore->fd, \
+			context.snapshot_size, pStore->file_size - \
+			context.snapshot_size, fp, buff, sizeof(buff))) != 0)
+		{
+			break;
+		}
+
+		if (fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+		{
+			result = errno != 0 ? errno : EIO;
+			break;
+		}
+
+		if ((new_fd=open(tmp_filename, O_RDWR)) < 0)
+		{
+			result = errno != 0 ? errno : ENOENT;
+			break;
+		}
+
+		if (rename(tmp_filename, pStore->log_filename) != 0)
+		{
+			result = errno != 0 ? errno : EIO;
+			close(new_fd);
+			break;
+		}
+
+		context.shift = new_size - context.snapshot_size;
+		hash_walk(&pStore->index, meta_commit_entry, &context);
+		if (pStore->fd >= 0)
+		{
+			close(pStore->fd);
+		}
+		pStore->fd = new_fd;
+		pStore->file_size += context.shift;
+		pStore->dead_bytes -= dead_bytes;
+		break;
+	}
+	pStore->compacting = false;
+	pthread_mutex_unlock(&pStore->lock);
+
+	if (fp != NULL)
+	{
+		fclose(fp);
+	}
+	if (context.records != NULL)
+	{
+		free(context.records);
+	}
+
+	if (result != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"compact file \"%s\" fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pStore->log_filename, \
+			result, strerror(result));
+		unlink(tmp_filename);
+	}
+
+	return result;
+}
+
+static int meta_store_init(MetaStore *pStore, const char *store_path)
+{
+	int result;
+
+	pStore->fd = -1;
+	snprintf(pStore->log_filename, sizeof(pStore->log_filename), \
+		"%s/data/"META_LOG_FILENAME, store_path);
+	if ((result=init_pthread_lock(&pStore->lock)) != 0)
+	{
+		return result;
+	}
+
+	if ((result=hash_init(&pStore->index, PJWHash, 4096, 0.75)) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"hash_init fail, errno: %d", __LINE__, result);
+		return ENOMEM;
+	}
+
+	if ((result=meta_load_log(pStore)) != 0)
+	{
+		return result;
+	}
+
+	pStore->fd = open(pStore->log_filename, O_RDWR | O_CREAT, 0644);
+	if (pStore->fd < 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"open file \"%s\" fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pStore->log_filename, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : ENOENT;
+	}
+
+	if (pStore->dead_bytes > pStore->file_size / 2)
+	{
+		return meta_compact_log(pStore);
+	}
+
+	return 0;
+}
+
+int storage_meta_init()
+{
+	int result;
+	int i;
+
+	if ((result=storage_meta_index_init()) != 0)
+	{
+		return result;
+	}
+
+	meta_stores = (MetaStore *)malloc(sizeof(MetaStore) * g_path_count);
+	if (meta_stores == NULL)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"malloc %d bytes fail", __LINE__, \
+			(int)sizeof(MetaStore) * g_path_count);
+		return errno != 0 ? errno : ENOMEM;
+	}
+	memset(meta_stores, 0, sizeof(MetaStore) * g_path_count);
+
+	for (i=0; i<g_path_count; i++)
+	{
+		if ((result=meta_store_init(meta_stores + i, \
+			g_store_paths[i].path)) != 0)
+		{
+			return result;
+		}
+	}
+
+	meta_inited = true;
+	return 0;
+}
+
+static void meta_free_entry(const int index, const HashData *data, \
+		void *args)
+{
+	free(data->value);
+}
+
+int storage_meta_destroy()
+{
+	MetaStore *pStore;
+	MetaStore *pEnd;
+
+	if (!meta_inited)
+	{
+		return 0;
+	}
+
+	pEnd = meta_stores + g_path_count;
+	for (pStore=meta_stores; pStore<pEnd; pStore++)
+	{
+		pthread_mutex_lock(&pStore->lock);
+		if (pStore->fd >= 0)
+		{
+			close(pStore->fd);
+			pStore->fd = -1;
+		}
+		hash_walk(&pStore->index, meta_free_entry, NULL);
+		hash_destroy(&pStore->index);
+		pthread_mutex_unlock(&pStore->lock);
+
+		pthread_mutex_destroy(&pStore->lock);
+	}
+
+	free(meta_stores);
+	meta_stores = NULL;
+	meta_inited = false;
+	return storage_meta_index_destroy();
+}
+
+/* append the record to the log, return the value offset */
+static int meta_append_record(MetaStore *pStore, const char op, \
+		const char *key, const int key_len, const char *value, \
+		const int value_len, int64_t *value_offset)
+{
+	char fixed_buff[1024];
+	char *pBuff;
+	int record_len;
+	int result;
+
+	if (value_len > INT_MAX - META_RECORD_SIZE(key_len, 0))
+	{
+		return EINVAL;
+	}
+
+	record_len = META_RECORD_SIZE(key_len, value_len);
+	if (record_len <= sizeof(fixed_buff))
+	{
+		pBuff = fixed_buff;
+	}
+	else
+	{
+		pBuff = (char *)malloc(record_len + 1);
+		if (pBuff == NULL)
+		{
+			return errno != 0 ? errno : ENOMEM;
+		}
+	}
+
+	sprintf(pBuff, "%c%02x%08x", op, key_len, value_len);
+	memcpy(pBuff + META_RECORD_HEADER_SIZE, key, key_len);
+	if (value_len > 0)
+	{
+		memcpy(pBuff + META_RECORD_HEADER_SIZE + key_len, \
+			value, value_len);
+	}
+
+	if (pwrite(pStore->fd, pBuff, record_len, pStore->file_size) != \
+		record_len)
+	{
+		result = errno != 0 ? errno : EIO;
+		logError("file: "__FILE__", line: %d, " \
+			"write to file \"%s\" fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pStore->log_filename, \
+			result, strerror(result));
+
+		/* drop the half written record */
+		if (ftruncate(pStore->fd, pStore->file_size) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"truncate file \"%s\" fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, pStore->log_filename, \
+				errno, strerror(errno));
+		}
+	}
+	else
+	{
+		*value_offset = pStore->file_size + \
+				META_RECORD_HEADER_SIZE + key_len;
+		pStore->file_size += record_len;
+		result = storage_fsync_file(pStore->fd, pStore->log_filename);
+	}
+
+	if (pBuff != fixed_buff)
+	{
+		free(pBuff);
+	}
+	return result;
+}
+
+/* the caller holds the lock, compact out of the lock when true */
+static bool meta_need_compact(MetaStore *pStore)
+{
+	return !pStore->compacting && \
+		pStore->dead_bytes > META_COMPACT_MIN_BYTES && \
+		pStore->dead_bytes > pStore->file_size / 2;
+}
+
+/* get the store and the old metadata filename of the file */
+static MetaStore *meta_get_store(const char *logic_filename, \
+		char *meta_filename, const int size)
+{
+	int store_path_index;
+	int len;
+
+	if (!meta_inited || storage_get_full_filename(logic_filename, \
+		meta_filename, size, &store_path_index) != 0)
+	{
+		return NULL;
+	}
+
+	len = strlen(meta_filename);
+	snprintf(meta_filename + len, size - len, \
+		"%s", STORAGE_META_FILE_EXT);
+	return meta_stores + store_path_index;
+}
+
+int storage_meta_get(const char *logic_filename, char **meta_buff, \
+		int *meta_bytes)
+{
+	MetaStore *pStore;
+	MetaIndexEntry *pEntry;
+	char meta_filename[MAX_PATH_SIZE + 64];
+	int result;
+
+	*meta_buff = NULL;
+	*meta_bytes = 0;
+	if ((pStore=meta_get_store(logic_filename, meta_filename, \
+		sizeof(meta_filename))) == NULL)
+	{
+		return EINVAL;
+	}
+
+	pthread_mutex_lock(&pStore->lock);
+	pEntry = (MetaIndexEntry *)hash_find(&pStore->index, \
+			logic_filename, strlen(logic_filename));
+	if (pEntry != NULL)
+	{
+		*meta_buff = (char *)malloc(pEntry->length + 1);
+		if (*meta_buff == NULL)
+		{
+			result = errno != 0 ? errno : ENOMEM;
+		}
+		else if (pread(pStore->fd, *meta_buff, pEntry->length, \
+			pEntry->offset) != pEntry->length)
+		{
+			result = errno != 0 ? errno : EIO;
+			logError("file: "__FILE__", line: %d, " \
+				"read from file \"%s\" fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, pStore->log_filename, \
+				result, strerror(result));
+			free(*meta_buff);
+			*meta_buff = NULL;
+		}
+		else
+		{
+			(*meta_buff)[pEntry->length] = '\0';
+			*meta_bytes = pEntry->length;
+			result = 0;
+		}
+	}
+	pthread_mutex_unlock(&pStore->lock);
+
+	if (pEntry != NULL)
+	{
+		return result;
+	}
+
+	/* the metadata file of the old version */
+	return getFileContent(meta_filename, meta_buff, meta_bytes);
+}
+
+int storage_meta_read(const char *logic_filename, char *buff, \
+		const int buff_size, int *meta_bytes)
+{
+	MetaStore *pStore;
+	MetaIndexEntry *pEntry;
+	char meta_filename[MAX_PATH_SIZE + 64];
+	char *file_buff;
+	int result;
+
+	*meta_bytes = 0;
+	if ((pStore=meta_get_store(logic_filename, meta_filename, \
+		sizeof(meta_filename))) == NULL)
+	{
+		return EINVAL;
+	}
+
+	pthread_mutex_lock(&pStore->lock);
+	pEntry = (MetaIndexEntry *)hash_find(&pStore->index, \
+			logic_filename, strlen(logic_filename));
+	if (pEntry != NULL)
+	{
+		if (pEntry->length >= buff_size)
+		{
+			*meta_bytes = pEntry->length + 1;
+			result = ENOSPC;
+		}
+		else if (pread(pStore->fd, buff, pEntry->length, \
+			pEntry->offset) != pEntry->length)
+		{
+			result = errno != 0 ? errno : EIO;
+			logError("file: "__FILE__", line: %d, " \
+				"read from file \"%s\" fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, pStore->log_filename, \
+				result, strerror(result));
+		}
+		else
+		{
+			buff[pEntry->length] = '\0';
+			*meta_bytes = pEntry->length;
+			result = 0;
+		}
+	}
+	pthread_mutex_unlock(&pStore->lock);
+
+	if (pEntry != NULL)
+	{
+		return result;
+	}
+
+	/* the metadata file of the old version */
+	if ((result=getFileContent(meta_filename, &file_buff, \
+			meta_bytes)) != 0)
+	{
+		*meta_bytes = 0;
+		return result;
+	}
+
+	if (*meta_bytes >= buff_size)
+	{
+		(*meta_bytes)++;
+		result = ENOSPC;
+	}
+	else
+	{
+		memcpy(buff, file_buff, *meta_bytes + 1);
+	}
+	free(file_buff);
+	return result;
+}
+
+int storage_meta_set(const char *logic_filename, const char *meta_buff, \
+		const int meta_bytes, bool *bExist)
+{
+	MetaStore *pStore;
+	char meta_filename[MAX_PATH_SIZE + 64];
+	int key_len;
+	int64_t value_offset;
+	int result;
+	bool bCompact;
+
+	if ((pStore=meta_get_store(logic_filename, meta_filename, \
+		sizeof(meta_filename))) == NULL)
+	{
+		return EINVAL;
+	}
+
+	bCompact = false;
+	key_len = strlen(logic_filename);
+	if (key_len > META_KEY_MAX_LEN)
+	{
+		return EINVAL;
+	}
+
+	pthread_mutex_lock(&pStore->lock);
+	if (bExist != NULL)
+	{
+		*bExist = hash_find(&pStore->index, logic_filename, \
+				key_len) != NULL;
+	}
+	if ((result=meta_append_record(pStore, META_OP_SET, logic_filename, \
+		key_len, meta_buff, meta_bytes, &value_offset)) == 0)
+	{
+		if ((result=meta_set_entry(pStore, logic_filename, key_len, \
+				value_offset, meta_bytes)) == 0)
+		{
+			storage_meta_index_update(logic_filename, key_len, \
+				meta_buff, meta_bytes);
+		}
+		bCompact = meta_need_compact(pStore);
+	}
+	pthread_mutex_unlock(&pStore->lock);
+
+	if (result != 0)
+	{
+		return result;
+	}
+
+	if (bCompact)
+	{
+		meta_compact_log(pStore);
+	}
+
+	/* replaced by the record of the log */
+	if (unlink(meta_filename) == 0)
+	{
+		if (bExist != NULL)
+		{
+			*bExist = true;
+		}
+	}
+
+	return 0;
+}
+
+int storage_meta_delete(const char *logic_filename)
+{
+	MetaStore *pStore;
+	char meta_filename[MAX_PATH_SIZE + 64];
+	int key_len;
+	int64_t value_offset;
+	int result;
+	bool bFound;
+	bool bCompact;
+
+	if ((pStore=meta_get_store(logic_filename, meta_filename, \
+		sizeof(meta_filename))) == NULL)
+	{
+		return EINVAL;
+	}
+
+	key_len = strlen(logic_filename);
+	result = 0;
+	bCompact = false;
+	pthread_mutex_lock(&pStore->lock);
+	bFound = hash_find(&pStore->index, logic_filename, key_len) != NULL;
+	if (bFound && (result=meta_append_record(pStore, META_OP_DELETE, \
+		logic_filename, key_len, NULL, 0, &value_offset)) == 0)
+	{
+		meta_remove_entry(pStore, logic_filename, key_len);
+		pStore->dead_bytes += META_RECORD_SIZE(key_len, 0);
+		storage_meta_index_update(logic_filename, key_len, NULL, 0);
+		bCompact = meta_need_compact(pStore);
+	}
+	pthread_mutex_unlock(&pStore->lock);
+
+	if (result != 0)
+	{
+		return result;
+	}
+
+	if (bCompact)
+	{
+		meta_compact_log(pStore);
+	}
+
+	if (unlink(meta_filename) == 0)
+	{
+		bFound = true;
+	}
+	else if (errno != ENOENT)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"delete file %s fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, meta_filename, errno, strerror(errno));
+		return errno != 0 ? errno : EACCES;
+	}
+
+	return bFound ? 0 : ENOENT;
+}
+
+bool storage_meta_get_data_filename(const char *meta_filename, \
+		char *logic_filename)
+{
+	int len;
+
+	len = strlen(meta_filename) - (sizeof(STORAGE_META_FILE_EXT) - 1);
+	if (len <= 0 || strcmp(meta_filename + len, \
+		STORAGE_META_FILE_EXT) != 0)
+	{
+		return false;
+	}
+
+	memcpy(logic_filename, meta_filename, len);
+	logic_filename[len] = '\0';
+	return true;
+}
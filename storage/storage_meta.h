@@ -0,0 +1,85 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//storage_meta.h
+
+#ifndef _STORAGE_META_H_
+#define _STORAGE_META_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+the metadata of the files of each store path is kept in one append only
+log file data/meta.dat of the store path, the hash index of memory maps
+the filename to the metadata offset in the log, the overwritten records
+are removed by compaction, the old metadata files (the filename ends
+with "-m") are still read and replaced when updated
+*/
+int storage_meta_init();
+int storage_meta_destroy();
+
+/*
+get the packed metadata of the file
+params:
+	logic_filename: the filename return to the client
+	meta_buff: return the metadata, must be freed
+	meta_bytes: return the metadata length
+return: 0 for success, ENOENT for no metadata, != 0 for fail
+*/
+int storage_meta_get(const char *logic_filename, char **meta_buff, \
+		int *meta_bytes);
+
+/*
+get the packed metadata of the file to the buffer of the caller
+params:
+	logic_filename: the filename return to the client
+	buff: the buffer, the metadata ends with '\0'
+	buff_size: the buffer size
+	meta_bytes: return the metadata length, or the buffer size needed
+		when the buffer is too small
+return: 0 for success, ENOENT for no metadata, ENOSPC for the buffer
+	is too small, != 0 for fail
+*/
+int storage_meta_read(const char *logic_filename, char *buff, \
+		const int buff_size, int *meta_bytes);
+
+/*
+set the packed metadata of the file, overwrite the old one
+params:
+	logic_filename: the filename return to the client
+	meta_buff: the metadata
+	meta_bytes: the metadata length
+	bExist: return true when the file has metadata before, can be NULL
+return: 0 for success, != 0 for fail
+*/
+int storage_meta_set(const char *logic_filename, const char *meta_buff, \
+		const int meta_bytes, bool *bExist);
+
+/*
+delete the metadata of the file
+return: 0 for success, ENOENT for no metadata, != 0 for fail
+*/
+int storage_meta_delete(const char *logic_filename);
+
+/*
+get the data filename of the metadata filename in the binlog
+params:
+	meta_filename: the filename ends with "-m"
+	logic_filename: return the data filename
+return: true for the metadata filename
+*/
+bool storage_meta_get_data_filename(const char *meta_filename, \
+		char *logic_filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
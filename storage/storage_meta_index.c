@@ -0,0 +1,479 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//storage_meta_index.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "fdfs_define.h"
+#include "logger.h"
+#include "fdfs_global.h"
+#include "shared_func.h"
+#include "hash.h"
+#include "tracker_types.h"
+#include "tracker_proto.h"
+#include "storage_global.h"
+#include "storage_meta_index.h"
+
+/* the key of the value index: name + FDFS_FIELD_SEPERATOR + value */
+#define META_INDEX_ITEM_SIZE	(FDFS_MAX_META_NAME_LEN + \
+				FDFS_MAX_META_VALUE_LEN + 2)
+
+typedef struct
+{
+	char **filenames;  //sorted by filename
+	int count;
+	int alloc_count;
+} MetaIndexList;
+
+static pthread_mutex_t index_lock;
+static HashArray value_index;  //the item -> MetaIndexList
+static HashArray file_index;   //the filename -> the indexed items of it
+static char index_key_buff[STORAGE_META_INDEX_KEYS_SIZE];
+static char *index_keys[STORAGE_MAX_META_INDEX_KEYS];
+static int index_key_count = 0;
+static bool index_inited = false;
+
+int storage_meta_index_init()
+{
+	char *cols[STORAGE_MAX_META_INDEX_KEYS];
+	int col_count;
+	int result;
+	int i;
+
+	snprintf(index_key_buff, sizeof(index_key_buff), "%s", \
+		g_meta_index_keys);
+	col_count = splitEx(index_key_buff, ',', cols, \
+			STORAGE_MAX_META_INDEX_KEYS);
+	index_key_count = 0;
+	for (i=0; i<col_count; i++)
+	{
+		trim(cols[i]);
+		if (*cols[i] != '\0' && \
+			strlen(cols[i]) <= FDFS_MAX_META_NAME_LEN)
+		{
+			index_keys[index_key_count++] = cols[i];
+		}
+	}
+	if (index_key_count == 0)
+	{
+		return 0;
+	}
+
+	if ((result=init_pthread_lock(&index_lock)) != 0)
+	{
+		return result;
+	}
+
+	if ((result=hash_init(&value_index, PJWHash, 4096, 0.75)) != 0 || \
+		(result=hash_init(&file_index, PJWHash, 4096, 0.75)) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"hash_init fail, errno: %d", __LINE__, result);
+		return ENOMEM;
+	}
+
+	index_inited = true;
+	return 0;
+}
+
+static void meta_index_free_list(const int index, const HashData *data, \
+		void *args)
+{
+	MetaIndexList *pList;
+	int i;
+
+	pList = (MetaIndexList *)data->value;
+	for (i=0; i<pList->count; i++)
+	{
+		free(pList->filenames[i]);
+	}
+	if (pList->filenames != NULL)
+	{
+		free(pList->filenames);
+	}
+	free(pList);
+}
+
+static void meta_index_free_items(const int index, const HashData *data, \
+		void *args)
+{
+	free(data->value);
+}
+
+int storage_meta_index_destroy()
+{
+	if (!index_inited)
+	{
+		return 0;
+	}
+
+	pthread_mutex_lock(&index_lock);
+	hash_walk(&value_index, meta_index_free_list, NULL);
+	hash_destroy(&value_index);
+	hash_walk(&file_index, meta_index_free_items, NULL);
+	hash_destroy(&file_index);
+	index_inited = false;
+	pthread_mutex_unlock(&index_lock);
+
+	pthread_mutex_destroy(&index_lock);
+	return 0;
+}
+
+static bool meta_index_is_key(const char *name, const int name_len)
+{
+	int i;
+
+	for (i=0; i<index_key_count; i++)
+	{
+		if (strncmp(index_keys[i], name, name_len) == 0 && \
+			index_keys[i][name_len] == '\0')
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* return the position of the first filename >= the filename */
+static int meta_index_bsearch(const MetaIndexList *pList, \
+		const char *filename)
+{
+	int low;
+	int high;
+	int mid;
+
+	low = 0;
+	high = pList->count - 1;
+	while (low <= high)
+	{
+		mid = (low + high) / 2;
+		if (strcmp(pList->filenames[mid], filename) < 0)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid - 1;
+		}
+	}
+
+	return low;
+}
+
+static int meta_index_add(const char *item, const int item_len, \
+		const char *filename)
+{
+	MetaIndexList *pList;
+	char **filenames;
+	char *pFilename;
+	int pos;
+
+	pList = (MetaIndexList *)hash_find(&value_index, item, item_len);
+	if (pList == NULL)
+	{
+		pList = (MetaIndexList *)calloc(1, sizeof(MetaIndexList));
+		if (pList == NULL)
+		{
+			return errno != 0 ? errno : ENOMEM;
+		}
+		if (hash_insert(&value_index, item, item_len, pList) < 0)
+		{
+			free(pList);
+			return ENOMEM;
+		}
+	}
+
+	pos = meta_index_bsearch(pList, filename);
+	if (pos < pList->count && strcmp(pList->filenames[pos], \
+		filename) == 0)
+	{
+		return 0;
+	}
+
+	if (pList->count >= pList->alloc_count)
+	{
+		filenames = (char **)realloc(pList->filenames, sizeof(char *) \
+			* (pList->alloc_count == 0 ? 4 : \
+			2 * pList->alloc_count));
+		if (filenames == NULL)
+		{
+			return errno != 0 ? errno : ENOMEM;
+		}
+		pList->filenames = filenames;
+		pList->alloc_count = pList->alloc_count == 0 ? 4 : \
+					2 * pList->alloc_count;
+	}
+
+	pFilename = strdup(filename);
+	if (pFilename == NULL)
+	{
+		return errno != 0 ? errno : ENOMEM;
+	}
+
+	memmove(pList->filenames + pos + 1, pList->filenames + pos, \
+		sizeof(char *) * (pList->count - pos));
+	pList->filenames[pos] = pFilename;
+	pList->count++;
+	return 0;
+}
+
+static void meta_index_remove(const char *item, const int item_len, \
+		const char *filename)
+{
+	MetaIndexList *pList;
+	int pos;
+
+	pList = (MetaIndexList *)hash_find(&value_index, item, item_len);
+	if (pList == NULL)
+	{
+		return;
+	}
+
+	pos = meta_index_bsearch(pList, filename);
+	if (pos >= pList->count || strcmp(pList->filenames[pos], \
+		filename) != 0)
+	{
+		return;
+	}
+
+	free(pList->filenames[pos]);
+	pList->count--;
+	memmove(pList->filenames + pos, pList->filenames + pos + 1, \
+		sizeof(char *) * (pList->count - pos));
+	if (pList->count == 0)
+	{
+		hash_delete(&value_index, item, item_len);
+		free(pList->filenames);
+		free(pList);
+	}
+}
+
+/* add or remove the file of the items seperated by FDFS_RECORD_SEPERATOR */
+static int meta_index_walk_items(const char *items, const char *filename, \
+		const bool bAdd)
+{
+	const char *p;
+	const char *pEnd;
+	int item_len;
+	int result;
+
+	result = 0;
+	p = items;
+	while (1)
+	{
+		pEnd = strchr(p, FDFS_RECORD_SEPERATOR);
+		item_len = pEnd != NULL ? pEnd - p : strlen(p);
+		if (!bAdd)
+		{
+			meta_index_remove(p, item_len, filename);
+		}
+		else if (result == 0)
+		{
+			result = meta_index_add(p, item_len, filename);
+		}
+
+		if (pEnd == NULL)
+		{
+			break;
+		}
+		p = pEnd + 1;
+	}
+
+	return result;
+}
+
+/* pack the items of the indexed names, NULL for no item */
+static int meta_index_pack_items(const char *meta_buff, \
+		const int meta_bytes, char **items)
+{
+	FDFSMetaSlice *slices;
+	FDFSMetaSlice *pSlice;
+	FDFSMetaSlice *pEnd;
+	char *p;
+	int slice_count;
+	int item_count;
+
+	*items = NULL;
+	slice_count = fdfs_get_metadata_count(meta_buff, meta_bytes);
+	slices = (FDFSMetaSlice *)malloc(sizeof(FDFSMetaSlice) * slice_count);
+	if (slices == NULL)
+	{
+		return errno != 0 ? errno : ENOMEM;
+	}
+	slice_count = fdfs_split_metadata_slices(meta_buff, meta_bytes, \
+			slices, slice_count);
+
+	p = NULL;
+	item_count = 0;
+	pEnd = slices + slice_count;
+	for (pSlice=slices; pSlice<pEnd && item_count<index_key_count; \
+		pSlice++)
+	{
+		if (pSlice->value_len > FDFS_MAX_META_VALUE_LEN || \
+			!meta_index_is_key(pSlice->name, pSlice->name_len))
+		{
+			continue;
+		}
+
+		if (*items == NULL)
+		{
+			*items = (char *)malloc(META_INDEX_ITEM_SIZE * \
+					index_key_count);
+			if (*items == NULL)
+			{
+				free(slices);
+				return errno != 0 ? errno : ENOMEM;
+			}
+			p = *items;
+		}
+		else
+		{
+			*p++ = FDFS_RECORD_SEPERATOR;
+		}
+
+		memcpy(p, pSlice->name, pSlice->name_len);
+		p += pSlice->name_len;
+		*p++ = FDFS_FIELD_SEPERATOR;
+		memcpy(p, pSlice->value, pSlice->value_len);
+		p += pSlice->value_len;
+		item_count++;
+	}
+	if (p != NULL)
+	{
+		*p = '\0';
+	}
+
+	free(slices);
+	return 0;
+}
+
+int storage_meta_index_update(const char *logic_filename, \
+		const int filename_len, const char *meta_buff, \
+		const int meta_bytes)
+{
+	char filename[MAX_PATH_SIZE];
+	char *items;
+	char *pOld;
+	int result;
+
+	if (!index_inited)
+	{
+		return 0;
+	}
+
+	if (filename_len >= sizeof(filename))
+	{
+		return EINVAL;
+	}
+	memcpy(filename, logic_filename, filename_len);
+	filename[filename_len] = '\0';
+
+	items = NULL;
+	if (meta_bytes > 0 && (result=meta_index_pack_items(meta_buff, \
+			meta_bytes, &items)) != 0)
+	{
+		return result;
+	}
+
+	result = 0;
+	pthread_mutex_lock(&index_lock);
+	pOld = (char *)hash_find(&file_index, filename, filename_len);
+	if (pOld != NULL)
+	{
+		meta_index_walk_items(pOld, filename, false);
+		hash_delete(&file_index, filename, filename_len);
+		free(pOld);
+	}
+
+	if (items != NULL)
+	{
+		result = meta_index_walk_items(items, filename, true);
+		if (hash_insert(&file_index, filename, filename_len, \
+			items) < 0)
+		{
+			meta_index_walk_items(items, filename, false);
+			free(items);
+			result = ENOMEM;
+		}
+	}
+	pthread_mutex_unlock(&index_lock);
+
+	if (result != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"index the metadata of file: %s fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, filename, result, strerror(result));
+	}
+	return result;
+}
+
+int storage_meta_index_query(const char *name, const char *value, \
+		const char *cursor, char *buff, const int buff_size, \
+		const int max_count, int *count, int *bytes)
+{
+	MetaIndexList *pList;
+	char item[META_INDEX_ITEM_SIZE];
+	char *p;
+	int item_len;
+	int filename_len;
+	int pos;
+
+	*count = 0;
+	*bytes = 0;
+	if (!index_inited || !meta_index_is_key(name, strlen(name)))
+	{
+		return EINVAL;
+	}
+
+	item_len = snprintf(item, sizeof(item), "%s%c%s", \
+			name, FDFS_FIELD_SEPERATOR, value);
+	if (item_len >= sizeof(item))
+	{
+		return 0;
+	}
+
+	p = buff;
+	pthread_mutex_lock(&index_lock);
+	pList = (MetaIndexList *)hash_find(&value_index, item, item_len);
+	if (pList != NULL)
+	{
+		pos = meta_index_bsearch(pList, cursor);
+		if (pos < pList->count && strcmp(pList->filenames[pos], \
+			cursor) == 0)
+		{
+			pos++;
+		}
+
+		for (; pos < pList->count && *count < max_count; pos++)
+		{
+			filename_len = strlen(pList->filenames[pos]);
+			if ((p - buff) + filename_len + 1 > buff_size)
+			{
+				break;
+			}
+
+			if (*count > 0)
+			{
+				*p++ = FDFS_RECORD_SEPERATOR;
+			}
+			memcpy(p, pList->filenames[pos], filename_len);
+			p += filename_len;
+			(*count)++;
+		}
+	}
+	pthread_mutex_unlock(&index_lock);
+
+	*bytes = p - buff;
+	return 0;
+}
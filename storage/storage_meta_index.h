@@ -0,0 +1,65 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//storage_meta_index.h
+
+#ifndef _STORAGE_META_INDEX_H_
+#define _STORAGE_META_INDEX_H_
+
+#define STORAGE_MAX_META_INDEX_KEYS	16
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+the secondary index of the metadata, maps the value of the metadata
+names in g_meta_index_keys to the files sorted by filename, kept in
+memory and rebuilt when the metadata logs are loaded, updated by the
+metadata store, so the upload, set, delete and sync of the metadata
+all maintain it, the old metadata files are not indexed
+*/
+int storage_meta_index_init();
+int storage_meta_index_destroy();
+
+/*
+replace the indexed items of the file
+params:
+	logic_filename: the filename return to the client, need not end
+		with '\0'
+	filename_len: the filename length
+	meta_buff: the packed metadata, need not end with '\0'
+	meta_bytes: the metadata length, 0 for remove the file
+return: 0 for success, != 0 for fail
+*/
+int storage_meta_index_update(const char *logic_filename, \
+		const int filename_len, const char *meta_buff, \
+		const int meta_bytes);
+
+/*
+query the files whose metadata item has the value
+params:
+	name: the metadata name, must be one of g_meta_index_keys
+	value: the metadata value
+	cursor: return the files after it, empty for from the first one
+	buff: return the filenames seperated by FDFS_RECORD_SEPERATOR
+	buff_size: the buffer size
+	max_count: the max count of the filenames to return
+	count: return the count of the filenames
+	bytes: return the length of the filenames
+return: 0 for success, EINVAL for the name not indexed, != 0 for fail
+*/
+int storage_meta_index_query(const char *name, const char *value, \
+		const char *cursor, char *buff, const int buff_size, \
+		const int max_count, int *count, int *bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,572 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//storage_scrub.c
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "fdfs_define.h"
+#include "logger.h"
+#include "fdfs_global.h"
+#include "sockopt.h"
+#include "shared_func.h"
+#include "crc32.h"
+#include "tracker_types.h"
+#include "tracker_proto.h"
+#include "storage_global.h"
+#include "storage_func.h"
+#include "storage_fd_cache.h"
+#include "storage_hot_cache.h"
+#include "tracker_client_thread.h"
+#include "storage_scrub.h"
+
+#define SCRUB_READ_BUFF_SIZE	(64 * 1024)
+
+typedef struct
+{
+	int store_path_index;
+	time_t window_start;  //the current second of the rate limit
+	int window_bytes;     //the bytes read in the current second
+	int file_count;    //the checked files of the current pass
+	int error_count;   //the corrupted files of the current pass
+	int repair_count;  //the repaired files of the current pass
+	char buff[SCRUB_READ_BUFF_SIZE];
+} ScrubContext;
+
+StorageScrubStat g_scrub_stat = {0, 0, 0, 0, 0};
+int g_scrub_thread_count = 0;
+
+static pthread_mutex_t scrub_lock;
+
+#define SCRUB_NAME_END_WITH(name, len, ext) \
+	(len > sizeof(ext) - 1 && \
+	 strcmp(name + len - (sizeof(ext) - 1), ext) == 0)
+
+#define SCRUB_STAT_INC(field) \
+	pthread_mutex_lock(&scrub_lock); \
+	g_scrub_stat.field++; \
+	pthread_mutex_unlock(&scrub_lock);
+
+/* sleep when the bytes read in this second exceed the budget */
+static void scrub_throttle(ScrubContext *pContext, const int bytes)
+{
+	time_t current_time;
+
+	pContext->window_bytes += bytes;
+	if (pContext->window_bytes < g_scrub_bytes_per_second)
+	{
+		return;
+	}
+
+	current_time = time(NULL);
+	if (current_time == pContext->window_start)
+	{
+		sleep(1);
+		current_time = time(NULL);
+	}
+
+	pContext->window_start = current_time;
+	pContext->window_bytes = 0;
+}
+
+/*
+download the file from the storage server of the same group to the temp
+file by chunks, the v2 response carries the file larger than 2GB
+*/
+static int scrub_fetch_file(const char *ip_addr, const char *logic_filename, \
+		const char *tmp_filename, int64_t *file_size, \
+		unsigned int *crc32)
+{
+	TrackerServerInfo storage_server;
+	FDFSProtoHeader header;
+	char out_buff[FDFS_PROTO_MAX_HEADER_SIZE+FDFS_GROUP_NAME_MAX_LEN+64];
+	int header_len;
+	int filename_len;
+	int result;
+
+	*file_size = 0;
+	filename_len = strlen(logic_filename);
+	if (filename_len >= 64)
+	{
+		return EINVAL;
+	}
+
+	memset(&storage_server, 0, sizeof(storage_server));
+	strcpy(storage_server.ip_addr, ip_addr);
+	storage_server.port = g_server_port;
+	storage_server.sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (storage_server.sock < 0)
+	{
+		return errno != 0 ? errno : EMFILE;
+	}
+
+	while (1)
+	{
+		if (connectserverbyip(storage_server.sock, \
+			storage_server.ip_addr, storage_server.port) != 1)
+		{
+			result = errno != 0 ? errno : ECONNREFUSED;
+			break;
+		}
+
+		memset(&header, 0, sizeof(header));
+		header.version = FDFS_PROTO_VERSION_2;
+		header.cmd = STORAGE_PROTO_CMD_DOWNLOAD_FILE;
+		header.pkg_len = FDFS_GROUP_NAME_MAX_LEN + filename_len;
+		memset(out_buff, 0, sizeof(out_buff));
+		header_len = fdfs_pack_header(&header, out_buff);
+		snprintf(out_buff + header_len, FDFS_GROUP_NAME_MAX_LEN + 1, \
+			"%s", g_group_name);
+		memcpy(out_buff + header_len + FDFS_GROUP_NAME_MAX_LEN, \
+			logic_filename, filename_len);
+
+		if (tcpsenddata(storage_server.sock, out_buff, header_len + \
+			FDFS_GROUP_NAME_MAX_LEN + filename_len, \
+			g_network_timeout) != 1)
+		{
+			result = errno != 0 ? errno : EPIPE;
+			break;
+		}
+
+		if ((result=tracker_recv_header(&storage_server, \
+				file_size)) != 0)
+		{
+			break;
+		}
+
+		result = storage_recv_file(storage_server.sock, \
+				tmp_filename, *file_size, crc32);
+		break;
+	}
+
+	close(storage_server.sock);
+	return result;
+}
+
+/*
+copy the good copy to the corrupted file in place, the hard links of the
+deduplicated file share the inode, so they are repaired together
+*/
+static int scrub_copy_in_place(ScrubContext *pContext, \
+		const char *tmp_filename, const char *full_filename, \
+		const int64_t file_size)
+{
+	int src_fd;
+	int dest_fd;
+	int64_t offset;
+	int bytes;
+	int result;
+
+	if ((src_fd=open(tmp_filename, O_RDONLY)) < 0)
+	{
+		return errno != 0 ? errno : ENOENT;
+	}
+
+	if ((dest_fd=open(full_filename, O_WRONLY)) < 0)
+	{
+		result = errno != 0 ? errno : ENOENT;
+		close(src_fd);
+		return result;
+	}
+
+	result = 0;
+	offset = 0;
+	while (offset < file_size)
+	{
+		if ((bytes=read(src_fd, pContext->buff, \
+				SCRUB_READ_BUFF_SIZE)) <= 0)
+		{
+			result = (bytes < 0 && errno != 0) ? errno : EIO;
+			break;
+		}
+
+		storage_disk_io_begin(pContext->store_path_index);
+		if (pwrite(dest_fd, pContext->buff, bytes, offset) != bytes)
+		{
+			result = errno != 0 ? errno : EIO;
+		}
+		storage_disk_io_end(pContext->store_path_index);
+		if (result != 0)
+		{
+			break;
+		}
+		offset += bytes;
+	}
+
+	if (result == 0 && (ftruncate(dest_fd, file_size) != 0 || \
+		fsync(dest_fd) != 0))
+	{
+		result = errno != 0 ? errno : EIO;
+	}
+
+	if (result != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"write file %s fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, full_filename, result, strerror(result));
+	}
+
+	close(src_fd);
+	close(dest_fd);
+	unlink(tmp_filename);
+	return result;
+}
+
+/*
+replace the corrupted file by the good copy of the other servers, the copy
+is checked in the temp file, and not used when the file is deleted
+meanwhile, the hard linked file is repaired in place
+*/
+static int scrub_repair_file(ScrubContext *pContext, \
+		const char *logic_filename, const char *full_filename)
+{
+	FDFSStorageBrief servers[FDFS_MAX_SERVERS_EACH_GROUP];
+	FDFSStorageBrief *pServer;
+	FDFSStorageBrief *pEnd;
+	char tmp_filename[MAX_PATH_SIZE + 128];
+	struct stat stat_buf;
+	int64_t fetch_size;
+	unsigned int crc32;
+	int server_count;
+	int result;
+
+	/* the list is changed by the tracker reporter threads */
+	if ((result=tracker_get_storage_servers(servers, \
+			&server_count)) != 0)
+	{
+		return result;
+	}
+
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s"STORAGE_TEMP_FILE_EXT, \
+		full_filename);
+	pEnd = servers + server_count;
+	for (pServer=servers; pServer<pEnd; pServer++)
+	{
+		if (pServer->status != FDFS_STORAGE_STATUS_ACTIVE || \
+			is_local_host_ip(pServer->ip_addr))
+		{
+			continue;
+		}
+
+		if (scrub_fetch_file(pServer->ip_addr, logic_filename, \
+			tmp_filename, &fetch_size, &crc32) != 0)
+		{
+			continue;
+		}
+
+		if (storage_check_file_crc32(logic_filename, \
+			fetch_size, crc32) != 0)
+		{
+			unlink(tmp_filename);
+			continue;  //the copy of this server is bad too
+		}
+
+		if (stat(full_filename, &stat_buf) != 0)
+		{
+			unlink(tmp_filename);
+			return ENOENT;  //deleted when repairing
+		}
+
+		if (stat_buf.st_nlink > 1)
+		{
+			result = scrub_copy_in_place(pContext, tmp_filename, \
+					full_filename, fetch_size);
+		}
+		else
+		{
+			result = storage_rename_file(tmp_filename, \
+					full_filename);
+		}
+		if (result != 0)
+		{
+			return result;
+		}
+
+		storage_fd_cache_invalidate(logic_filename);
+		storage_hot_cache_invalidate(logic_filename);
+		logInfo(STORAGE_ERROR_LOG_FILENAME, "file: "__FILE__", " \
+			"line: %d, repair file %s from storage server %s", \
+			__LINE__, full_filename, pServer->ip_addr);
+		return 0;
+	}
+
+	return ENOENT;
+}
+
+/* return: true for the file is good */
+static bool scrub_verify_file(ScrubContext *pContext, \
+		const char *full_filename, const int64_t file_size, \
+		const bool has_crc32, const unsigned int crc32)
+{
+	struct stat stat_buf;
+	unsigned int crc;
+	int fd;
+	int bytes;
+	bool bGood;
+
+	if ((fd=open(full_filename, O_RDONLY)) < 0)
+	{
+		return true;  //deleted
+	}
+
+	if (fstat(fd, &stat_buf) != 0 || stat_buf.st_size != file_size)
+	{
+		close(fd);
+		return false;
+	}
+
+	if (!has_crc32)
+	{
+		close(fd);
+		return true;
+	}
+
+	/* the disk io slot is held by one read only, the uploads and
+	   downloads of the store path not wait for the throttled scrub */
+	crc = CRC32C_INIT_VALUE;
+	while (g_continue_flag)
+	{
+		storage_disk_io_begin(pContext->store_path_index);
+		bytes = read(fd, pContext->buff, SCRUB_READ_BUFF_SIZE);
+		storage_disk_io_end(pContext->store_path_index);
+		if (bytes <= 0)
+		{
+			break;
+		}
+
+		crc = crc32c_ex(crc, pContext->buff, bytes);
+		scrub_throttle(pContext, bytes);
+	}
+	if (!g_continue_flag)  //not read to the end when exiting
+	{
+		close(fd);
+		return true;
+	}
+	bGood = (bytes == 0 && CRC32C_FINAL(crc) == crc32);
+
+#ifdef POSIX_FADV_DONTNEED
+	/* the scrubbed files should not evict the hot files */
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+	close(fd);
+
+	return bGood;
+}
+
+static void scrub_check_file(ScrubContext *pContext, \
+		const char *logic_filename, const char *full_filename)
+{
+	int64_t file_size;
+	unsigned int crc32;
+	bool has_crc32;
+	int result;
+
+	result = storage_get_filename_checksum(logic_filename, \
+			&file_size, &crc32);
+	if (result != 0 && result != ENOENT)
+	{
+		return;  //not a data file
+	}
+	has_crc32 = (result == 0);
+
+	pContext->file_count++;
+	SCRUB_STAT_INC(file_count)
+	if (scrub_verify_file(pContext, full_filename, file_size, \
+		has_crc32, crc32))
+	{
+		return;
+	}
+
+	pContext->error_count++;
+	SCRUB_STAT_INC(error_count)
+	logError("file: "__FILE__", line: %d, " \
+		"scrub file %s fail, the file is corrupted", \
+		__LINE__, full_filename);
+
+	if ((result=scrub_repair_file(pContext, logic_filename, \
+		full_filename)) == 0)
+	{
+		pContext->repair_count++;
+		SCRUB_STAT_INC(repair_count)
+	}
+	else
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"repair file %s fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, full_filename, result, strerror(result));
+	}
+}
+
+static void scrub_store_path(ScrubContext *pContext)
+{
+	char dir_name[MAX_PATH_SIZE + 32];
+	char full_filename[MAX_PATH_SIZE + 64];
+	char logic_filename[64];
+	DIR *dir;
+	struct dirent *pEntry;
+	int name_len;
+	int i;
+	int k;
+
+	for (i=0; i<256 && g_continue_flag; i++)
+	{
+	for (k=0; k<256 && g_continue_flag; k++)
+	{
+		snprintf(dir_name, sizeof(dir_name), "%s/data/" \
+			STORAGE_DATA_DIR_FORMAT"/"STORAGE_DATA_DIR_FORMAT, \
+			g_store_paths[pContext->store_path_index].path, i, k);
+		if ((dir=opendir(dir_name)) == NULL)
+		{
+			continue;
+		}
+
+		while (g_continue_flag && (pEntry=readdir(dir)) != NULL)
+		{
+			name_len = strlen(pEntry->d_name);
+			if (*(pEntry->d_name) == '.' || name_len > 32 || \
+			    SCRUB_NAME_END_WITH(pEntry->d_name, name_len, \
+				STORAGE_META_FILE_EXT) || \
+			    SCRUB_NAME_END_WITH(pEntry->d_name, name_len, \
+				STORAGE_TEMP_FILE_EXT))
+			{
+				continue;
+			}
+
+			snprintf(logic_filename, sizeof(logic_filename), \
+				STORAGE_STORE_PATH_PREFIX_FORMAT \
+				STORAGE_DATA_DIR_FORMAT"/" \
+				STORAGE_DATA_DIR_FORMAT"/%.32s", \
+				pContext->store_path_index, i, k, \
+				pEntry->d_name);
+			snprintf(full_filename, sizeof(full_filename), \
+				"%s/%s", dir_name, pEntry->d_name);
+			scrub_check_file(pContext, logic_filename, \
+					full_filename);
+		}
+
+		closedir(dir);
+	}
+	}
+}
+
+static void *scrub_thread_entrance(void *arg)
+{
+	ScrubContext *pContext;
+	time_t next_time;
+
+	pContext = (ScrubContext *)arg;
+	next_time = g_scrub_stat.last_pass_time + g_scrub_interval;
+	while (g_continue_flag)
+	{
+		if (time(NULL) < next_time)
+		{
+			sleep(1);
+			continue;
+		}
+
+		pContext->file_count = 0;
+		pContext->error_count = 0;
+		pContext->repair_count = 0;
+		scrub_store_path(pContext);
+		if (!g_continue_flag)
+		{
+			break;
+		}
+
+		pthread_mutex_lock(&scrub_lock);
+		g_scrub_stat.pass_count++;
+		g_scrub_stat.last_pass_time = time(NULL);
+		pthread_mutex_unlock(&scrub_lock);
+
+		++g_stat_change_count;
+		storage_write_to_stat_file();
+
+		logInfo(STORAGE_ERROR_LOG_FILENAME, "file: "__FILE__", " \
+			"line: %d, scrub store path %s done, " \
+			"checked files: %d, corrupted files: %d, " \
+			"repaired files: %d", __LINE__, \
+			g_store_paths[pContext->store_path_index].path, \
+			pContext->file_count, pContext->error_count, \
+			pContext->repair_count);
+		next_time = time(NULL) + g_scrub_interval;
+	}
+
+	free(pContext);
+
+	pthread_mutex_lock(&scrub_lock);
+	g_scrub_thread_count--;
+	pthread_mutex_unlock(&scrub_lock);
+	return NULL;
+}
+
+int storage_scrub_start()
+{
+	pthread_attr_t pattr;
+	pthread_t tid;
+	ScrubContext *pContext;
+	int result;
+	int i;
+
+	if (g_scrub_interval <= 0)
+	{
+		return 0;
+	}
+
+	if ((result=init_pthread_lock(&scrub_lock)) != 0)
+	{
+		return result;
+	}
+
+	pthread_attr_init(&pattr);
+	pthread_attr_setdetachstate(&pattr, PTHREAD_CREATE_DETACHED);
+	result = 0;
+	for (i=0; i<g_path_count; i++)
+	{
+		pContext = (ScrubContext *)malloc(sizeof(ScrubContext));
+		if (pContext == NULL)
+		{
+			result = errno != 0 ? errno : ENOMEM;
+			break;
+		}
+		memset(pContext, 0, sizeof(ScrubContext));
+		pContext->store_path_index = i;
+
+		pthread_mutex_lock(&scrub_lock);
+		g_scrub_thread_count++;
+		pthread_mutex_unlock(&scrub_lock);
+		if (pthread_create(&tid, &pattr, scrub_thread_entrance, \
+			pContext) != 0)
+		{
+			result = errno != 0 ? errno : EAGAIN;
+			logError("file: "__FILE__", line: %d, " \
+				"create thread failed, errno: %d, " \
+				"error info: %s", \
+				__LINE__, result, strerror(result));
+			pthread_mutex_lock(&scrub_lock);
+			g_scrub_thread_count--;
+			pthread_mutex_unlock(&scrub_lock);
+			free(pContext);
+			break;
+		}
+	}
+
+	pthread_attr_destroy(&pattr);
+	return result;
+}
@@ -0,0 +1,45 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//storage_scrub.h
+
+#ifndef _STORAGE_SCRUB_H_
+#define _STORAGE_SCRUB_H_
+
+#define STORAGE_DEF_SCRUB_BYTES_PER_SECOND	(8 * 1024 * 1024)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+	int pass_count;    //the finished passes of the store paths
+	int file_count;    //the checked files
+	int error_count;   //the corrupted files found
+	int repair_count;  //the corrupted files fetched from the peers
+	int last_pass_time;  //the finish time of the last pass
+} StorageScrubStat;
+
+extern StorageScrubStat g_scrub_stat;
+extern int g_scrub_thread_count;
+
+/*
+start one scrub thread per store path, every g_scrub_interval seconds
+each thread walks the data dirs of its store path, checks the size
+and the crc32 of every file against its filename and fetches the
+corrupted file from the other storage servers of the group,
+g_scrub_interval 0 for disabled
+*/
+int storage_scrub_start();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
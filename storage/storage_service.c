@@ -9,6 +9,7 @@
 //storage_service.c
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -18,6 +19,7 @@
 #include <errno.h>
 #include <time.h>
 #include <sys/time.h>
+#include <limits.h>
 #include "fdfs_define.h"
 #include "logger.h"
 #include "fdfs_global.h"
@@ -28,22 +30,35 @@
 #include "storage_service.h"
 #include "storage_func.h"
 #include "storage_sync.h"
+#include "storage_trunk.h"
+#include "storage_hot_cache.h"
+#include "storage_dedup.h"
+#include "storage_fsync.h"
+#include "storage_meta.h"
+#include "storage_meta_index.h"
+#include "storage_upload_session.h"
 #include "storage_global.h"
+#include "tracker_client_thread.h"
 #include "fdfs_base64.h"
 #include "hash.h"
+#include "crc32.h"
+
+/* the slices after the metadata in the buffer are 8 bytes aligned */
+#define STORAGE_META_ALIGN(size)	(((size) + 7) & (~7))
 
 pthread_mutex_t g_storage_thread_lock;
 int g_storage_thread_count = 0;
 
 static int storage_gen_filename(StorageClientInfo *pClientInfo, \
-			const int file_size, \
+			const int64_t file_size, const unsigned int crc32, \
+			const int store_path_index, const bool bAppender, \
 			char *filename, int *filename_len)
 {
 	//struct timeval tv;
 	int current_time;
 	int r;
-	char buff[sizeof(int) * 3];
-	char encoded[sizeof(int) * 4 + 1];
+	char buff[STORAGE_FILENAME_ID_BYTES + 1];
+	char encoded[STORAGE_FILENAME_ID_BYTES * 4 / 3 + 4];
 	int n;
 	int len;
 
@@ -64,178 +79,452 @@ static int storage_gen_filename(StorageClientInfo *pClientInfo, \
 	r = rand();
 	current_time = time(NULL);
 	int2buff(current_time, buff);
-	int2buff(file_size, buff+sizeof(int));
-	int2buff(r, buff+sizeof(int)*2);
+	int2buff((int)file_size, buff+sizeof(int));  //the low 32 bits
+	int2buff(crc32, buff+sizeof(int)*2);
+	int2buff(r, buff+sizeof(int)*3);  //only 3 bytes are used
+	if ((file_size >> 32) != 0)  //the high bits replace 2 random bytes
+	{
+		buff[sizeof(int)*3] = STORAGE_FILENAME_SIZE_HIGH_FLAG | \
+					((file_size >> 40) & 0x7F);
+		buff[sizeof(int)*3 + 1] = (file_size >> 32) & 0xFF;
+	}
 
-	base64_encode_ex(buff, sizeof(int) * 3, encoded, filename_len, false);
+	base64_encode_ex(buff, STORAGE_FILENAME_ID_BYTES, encoded, \
+			filename_len, false);
 	n = PJWHash(encoded, *filename_len) % (1 << 16);
-	len = sprintf(buff, STORAGE_DATA_DIR_FORMAT"/", (n >> 8) & 0xFF);
+	len = sprintf(buff, STORAGE_STORE_PATH_PREFIX_FORMAT, \
+			store_path_index);
+	len += sprintf(buff + len, STORAGE_DATA_DIR_FORMAT"/", (n >> 8) & 0xFF);
 	len += sprintf(buff + len, STORAGE_DATA_DIR_FORMAT"/", n & 0xFF);
 
 	memcpy(filename, buff, len);
 	memcpy(filename+len, encoded, *filename_len+1);
         *filename_len += len;
+	if (bAppender)
+	{
+		*filename_len += sprintf(filename + *filename_len, \
+				STORAGE_APPENDER_FILE_EXT);
+	}
 
 	return 0;
 }
 
-static int storage_sort_metadata_buff(char *meta_buff, const int meta_size)
+/* pack the response header as the version of the request */
+static int storage_pack_resp_header(StorageClientInfo *pClientInfo, \
+		const char status, const int64_t pkg_len, char *buff)
 {
-	FDFSMetaData *meta_list;
-	int meta_count;
-	int meta_bytes;
-	int result;
+	FDFSProtoHeader header;
+
+	header.pkg_len = pkg_len;
+	header.request_id = pClientInfo->request_id;
+	header.cmd = STORAGE_PROTO_CMD_RESP;
+	header.status = status;
+	header.flags = 0;
+	header.version = pClientInfo->proto_version;
+	return fdfs_pack_header(&header, buff);
+}
+
+/* return 1 for success as tcpsenddata */
+static int storage_send_resp_header(StorageClientInfo *pClientInfo, \
+		const char status, const int64_t pkg_len)
+{
+	char buff[FDFS_PROTO_MAX_HEADER_SIZE];
+	int header_len;
+
+	header_len = storage_pack_resp_header(pClientInfo, status, \
+			pkg_len, buff);
+	return tcpsenddata(pClientInfo->sock, buff, header_len, \
+			g_network_timeout);
+}
+
+/* grow the buffer of the connection, the content is kept */
+static char *storage_alloc_client_buff(char **ppBuff, int *buff_size, \
+		const int size)
+{
+	char *pNewBuff;
+	int alloc_size;
 
-	meta_list = fdfs_split_metadata(meta_buff, &meta_count, &result);
-	if (meta_list == NULL)
+	if (size <= *buff_size)
 	{
-		return result;
+		return *ppBuff;
 	}
 
-	/*
+	alloc_size = *buff_size > 0 ? *buff_size : 4 * 1024;
+	while (alloc_size < size)
 	{
-	int i;
-	printf("meta_count=%d\n", meta_count);
-	for (i=0; i<meta_count; i++)
+		alloc_size *= 2;
+	}
+
+	pNewBuff = (char *)realloc(*ppBuff, alloc_size);
+	if (pNewBuff == NULL)
 	{
-		printf("%d. %s=%s\n", i+1, meta_list[i].name, meta_list[i].value);
+		logError("file: "__FILE__", line: %d, " \
+			"malloc %d bytes fail", __LINE__, alloc_size);
+		return NULL;
 	}
+
+	*ppBuff = pNewBuff;
+	*buff_size = alloc_size;
+	return pNewBuff;
+}
+
+static char *storage_alloc_meta_buff(StorageClientInfo *pClientInfo, \
+		const int size)
+{
+	return storage_alloc_client_buff(&pClientInfo->meta_buff, \
+			&pClientInfo->meta_buff_size, size);
+}
+
+static char *storage_alloc_in_buff(StorageClientInfo *pClientInfo, \
+		const int size)
+{
+	return storage_alloc_client_buff(&pClientInfo->in_buff, \
+			&pClientInfo->in_buff_size, size);
+}
+
+/* sort the metadata by name, meta_size is updated */
+static int storage_sort_metadata_buff(StorageClientInfo *pClientInfo, \
+		char *meta_buff, int *meta_size)
+{
+	FDFSMetaSlice *slices;
+	char *pBuff;
+	int meta_count;
+	int slices_bytes;
+
+	meta_count = fdfs_get_metadata_count(meta_buff, *meta_size);
+	slices_bytes = sizeof(FDFSMetaSlice) * meta_count;
+	pBuff = storage_alloc_meta_buff(pClientInfo, \
+			slices_bytes + *meta_size + 1);
+	if (pBuff == NULL)
+	{
+		return ENOMEM;
 	}
-	*/
 
-	qsort((void *)meta_list, meta_count, sizeof(FDFSMetaData), \
-		metadata_cmp_by_name);
+	slices = (FDFSMetaSlice *)pBuff;
+	pBuff += slices_bytes;
+	meta_count = fdfs_split_metadata_slices(meta_buff, *meta_size, \
+			slices, meta_count);
 
-	fdfs_pack_metadata(meta_list, meta_count, meta_buff, &meta_bytes);
-	free(meta_list);
+	qsort((void *)slices, meta_count, sizeof(FDFSMetaSlice), \
+		metadata_slice_cmp_by_name);
 
+	*meta_size = fdfs_pack_metadata_slices(slices, meta_count, pBuff);
+	memcpy(meta_buff, pBuff, *meta_size + 1);
 	return 0;
 }
 
-static int storage_save_file(StorageClientInfo *pClientInfo, \
-			const char *file_buff, const int file_size, \
-			char *meta_buff, const int meta_size, \
-			char *filename, int *filename_len)
+/*
+generate the filename which not exists on the store path, the crc32 of
+the appender file is the ip address of the source storage server
+*/
+static int storage_gen_uniq_filename(StorageClientInfo *pClientInfo, \
+		const int64_t file_size, const unsigned int crc32, \
+		const int store_path_index, const bool bAppender, \
+		char *filename, int *filename_len, \
+		char *full_filename, const int buff_size)
 {
 	int result;
 	int i;
-	char full_filename[MAX_PATH_SIZE+32];
+	int path_index;
 
 	for (i=0; i<1024; i++)
 	{
 		if ((result=storage_gen_filename(pClientInfo, file_size, \
-				filename, filename_len)) != 0)
+			crc32, store_path_index, bAppender, \
+			filename, filename_len)) != 0)
 		{
-			return result;
+			break;
 		}
 
-		sprintf(full_filename, "%s/data/%s", g_base_path, filename);
-		if (!fileExists(full_filename))
+		if ((result=storage_get_full_filename(filename, full_filename, \
+				buff_size, &path_index)) != 0)
 		{
 			break;
 		}
-
-		*full_filename = '\0';
+		if (!fileExists(full_filename))
+		{
+			return 0;
+		}
 	}
 
-	if (*full_filename == '\0')
+	if (i == 1024)
 	{
 		logError("file: "__FILE__", line: %d, " \
 			"Can't generate uniq filename", __LINE__);
-		*filename = '\0';
-		*filename_len = 0;
-		return ENOENT;
+		result = ENOENT;
 	}
 
-	if ((result=writeToFile(full_filename, file_buff, file_size)) != 0)
+	*filename = '\0';
+	*filename_len = 0;
+	return result;
+}
+
+/*
+src_filename: return the stored file with the same content which the
+	new file is hard linked to, empty for not linked
+*/
+static int storage_save_file(StorageClientInfo *pClientInfo, \
+			const char *file_buff, const int file_size, \
+			char *meta_buff, int meta_size, \
+			char *filename, int *filename_len, char *src_filename)
+{
+	int result;
+	int store_path_index;
+	int src_store_path_index;
+	char full_filename[MAX_PATH_SIZE+32];
+	char src_full_filename[MAX_PATH_SIZE+32];
+	char dedup_key[STORAGE_DEDUP_KEY_SIZE];
+	unsigned int crc32;
+
+	if (meta_size > 0 && (result=storage_sort_metadata_buff( \
+			pClientInfo, meta_buff, &meta_size)) != 0)
 	{
 		*filename = '\0';
 		*filename_len = 0;
 		return result;
 	}
 
-	if (meta_size > 0)
+	*src_filename = '\0';
+	if ((store_path_index=storage_select_store_path(file_size)) < 0)
+	{
+		*filename = '\0';
+		*filename_len = 0;
+		return ENOSPC;
+	}
+	if (g_use_trunk_file && file_size <= g_slot_max_size)
 	{
-		char meta_filename[MAX_PATH_SIZE+32];
+		if ((result=storage_trunk_save_file(store_path_index, \
+			file_buff, file_size, filename, filename_len)) == 0 \
+			&& meta_size > 0)
+		{
+			if ((result=storage_meta_set(filename, \
+				meta_buff, meta_size, NULL)) != 0)
+			{
+				storage_trunk_delete_file(filename);
+			}
+		}
 
-		if ((result=storage_sort_metadata_buff(meta_buff, \
-				meta_size)) != 0)
+		if (result != 0)
 		{
 			*filename = '\0';
 			*filename_len = 0;
-			unlink(full_filename);
-			return result;
 		}
+		return result;
+	}
 
-		sprintf(meta_filename, "%s"STORAGE_META_FILE_EXT, \
-				full_filename);
-		if ((result=writeToFile(meta_filename, meta_buff, \
-				meta_size)) != 0)
+	/* the hard link must be on the same store path of the src file */
+	if (g_check_file_duplicate)
+	{
+		storage_dedup_gen_key(file_buff, file_size, dedup_key);
+		if (storage_dedup_find(dedup_key, file_buff, file_size, \
+			src_filename) != 0 || storage_get_full_filename( \
+			src_filename, src_full_filename, \
+			sizeof(src_full_filename), &src_store_path_index) != 0)
+		{
+			*src_filename = '\0';
+		}
+		else
+		{
+			store_path_index = src_store_path_index;
+		}
+	}
+
+	crc32 = crc32c(file_buff, file_size);
+	if ((result=storage_gen_uniq_filename(pClientInfo, file_size, \
+		crc32, store_path_index, false, filename, filename_len, \
+		full_filename, sizeof(full_filename))) != 0)
+	{
+		return result;
+	}
+
+	storage_disk_io_begin(store_path_index);
+	if (*src_filename != '\0' && \
+		link(src_full_filename, full_filename) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"link file %s to %s fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, src_full_filename, full_filename, \
+			errno, strerror(errno));
+		*src_filename = '\0';  //save the content instead
+	}
+
+	if (*src_filename == '\0')
+	{
+		result = storage_write_file(full_filename, \
+				file_buff, file_size);
+	}
+	else
+	{
+		result = storage_fsync_dir(full_filename);
+	}
+
+	if (result == 0 && meta_size > 0)
+	{
+		if ((result=storage_meta_set(filename, \
+				meta_buff, meta_size, NULL)) != 0)
 		{
-			*filename = '\0';
-			*filename_len = 0;
 			unlink(full_filename);
-			return result;
 		}
 	}
+	storage_disk_io_end(store_path_index);
+
+	if (result != 0)
+	{
+		*filename = '\0';
+		*filename_len = 0;
+		*src_filename = '\0';
+		return result;
+	}
+
+	if (g_check_file_duplicate && *src_filename == '\0')
+	{
+		storage_dedup_add(dedup_key, filename);
+	}
 
 	return 0;
 }
 
+/*
+save the large file received from the socket, the content is written to
+a temp file first because the filename contains the crc32 of it, the
+large files are never deduplicated nor packed in the trunk files, nor
+the appender files whose content changes later
+*/
+static int storage_save_stream_file(StorageClientInfo *pClientInfo, \
+			const int64_t file_size, const bool bAppender, \
+			char *meta_buff, int meta_size, \
+			char *filename, int *filename_len)
+{
+	int result;
+	int store_path_index;
+	unsigned int crc32;
+	char ip_addr[FDFS_IPADDR_SIZE];
+	char tmp_filename[MAX_PATH_SIZE+32];
+	char full_filename[MAX_PATH_SIZE+32];
+
+	*filename = '\0';
+	*filename_len = 0;
+	if ((store_path_index=storage_select_store_path(file_size)) < 0)
+	{
+		return ENOSPC;
+	}
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s/data/%d"\
+		STORAGE_TEMP_FILE_EXT, g_store_paths[store_path_index].path, \
+		pClientInfo->sock);
+	if ((result=storage_recv_file(pClientInfo->sock, tmp_filename, \
+			file_size, &crc32)) != 0)
+	{
+		return result;
+	}
+
+	if (meta_size > 0 && (result=storage_sort_metadata_buff( \
+			pClientInfo, meta_buff, &meta_size)) != 0)
+	{
+		unlink(tmp_filename);
+		return result;
+	}
+
+	/* the appends are accepted by the ip joined to the tracker only */
+	if (bAppender)
+	{
+		if (tracker_get_registered_ip(ip_addr) == 0)
+		{
+			crc32 = ntohl(inet_addr(ip_addr));
+		}
+		else
+		{
+			crc32 = ntohl(getSockIpaddr(pClientInfo->sock, \
+					ip_addr, sizeof(ip_addr)));
+		}
+	}
+
+	if ((result=storage_gen_uniq_filename(pClientInfo, file_size, \
+		crc32, store_path_index, bAppender, filename, filename_len, \
+		full_filename, sizeof(full_filename))) != 0)
+	{
+		unlink(tmp_filename);
+		return result;
+	}
+
+	if (meta_size > 0 && (result=storage_meta_set(filename, \
+			meta_buff, meta_size, NULL)) != 0)
+	{
+		unlink(tmp_filename);
+	}
+	else if ((result=storage_rename_file(tmp_filename, \
+			full_filename)) != 0 && meta_size > 0)
+	{
+		storage_meta_delete(filename);
+	}
+
+	if (result != 0)
+	{
+		*filename = '\0';
+		*filename_len = 0;
+	}
+	return result;
+}
+
+/*
+the old metadata, the slices and the merged metadata are all in the
+buffer of the thread, so the metadata is merged without copying items
+*/
 static int storage_do_set_metadata(StorageClientInfo *pClientInfo, \
-		const char *full_meta_filename, char *meta_buff, \
-		const int meta_bytes, const char op_flag, char *sync_flag)
+		const char *filename, char *meta_buff, \
+		int meta_bytes, const char op_flag, char *sync_flag)
 {
-	FDFSMetaData *old_meta_list;
-	FDFSMetaData *new_meta_list;
-	FDFSMetaData *all_meta_list;
-	FDFSMetaData *pOldMeta;
-	FDFSMetaData *pNewMeta;
-	FDFSMetaData *pAllMeta;
-	FDFSMetaData *pOldMetaEnd;
-	FDFSMetaData *pNewMetaEnd;
-	char *file_buff;
+	FDFSMetaSlice *old_slices;
+	FDFSMetaSlice *new_slices;
+	char *pBuff;
 	char *all_meta_buff;
-	int file_bytes;
+	int old_meta_bytes;
 	int old_meta_count;
 	int new_meta_count;
 	int all_meta_bytes;
+	int slices_offset;
+	int all_meta_offset;
 	int result;
+	bool bExist;
 
 	*sync_flag = '\0';
 	if (op_flag == STORAGE_SET_METADATA_FLAG_OVERWRITE)
 	{
 		if (meta_bytes == 0)
 		{
-			if (!fileExists(full_meta_filename))
+			result = storage_meta_delete(filename);
+			if (result == ENOENT)
 			{
 				return 0;
 			}
-
-			if (unlink(full_meta_filename) != 0)
+			if (result != 0)
 			{
 				logError("file: "__FILE__", line: %d, " \
 					"client ip: %s, " \
-					"delete meta file %s fail," \
+					"delete metadata of file %s fail," \
 					"errno: %d, error info: %s", \
-					__LINE__, \
-					pClientInfo->ip_addr, \
-					full_meta_filename, \
-					errno, strerror(errno));
-				return errno != 0 ? errno : EACCES;
+					__LINE__, pClientInfo->ip_addr, \
+					filename, result, strerror(result));
+				return result;
 			}
 
 			*sync_flag = STORAGE_OP_TYPE_SOURCE_DELETE_FILE;
 			return 0;
 		}
 
-		if ((result=storage_sort_metadata_buff(meta_buff, \
-				meta_bytes)) != 0)
+		if ((result=storage_sort_metadata_buff(pClientInfo, \
+				meta_buff, &meta_bytes)) != 0)
+		{
+			return result;
+		}
+
+		if ((result=storage_meta_set(filename, meta_buff, \
+				meta_bytes, &bExist)) != 0)
 		{
 			return result;
 		}
 
-		if (fileExists(full_meta_filename))
+		if (bExist)
 		{
 			*sync_flag = STORAGE_OP_TYPE_SOURCE_UPDATE_FILE;
 		}
@@ -243,10 +532,26 @@ static int storage_do_set_metadata(StorageClientInfo *pClientInfo, \
 		{
 			*sync_flag = STORAGE_OP_TYPE_SOURCE_CREATE_FILE;
 		}
-		return writeToFile(full_meta_filename, meta_buff, meta_bytes);
+		return 0;
+	}
+
+	if ((pBuff=storage_alloc_meta_buff(pClientInfo, 1)) == NULL)
+	{
+		return ENOMEM;
+	}
+	result = storage_meta_read(filename, pBuff, \
+			pClientInfo->meta_buff_size, &old_meta_bytes);
+	if (result == ENOSPC)
+	{
+		if ((pBuff=storage_alloc_meta_buff(pClientInfo, \
+				old_meta_bytes)) == NULL)
+		{
+			return ENOMEM;
+		}
+		result = storage_meta_read(filename, pBuff, \
+			pClientInfo->meta_buff_size, &old_meta_bytes);
 	}
 
-	result = getFileContent(full_meta_filename, &file_buff, &file_bytes);
 	if (result == ENOENT)
 	{
 		if (meta_bytes == 0)
@@ -254,107 +559,51 @@ static int storage_do_set_metadata(StorageClientInfo *pClientInfo, \
 			return 0;
 		}
 
-		if ((result=storage_sort_metadata_buff(meta_buff, \
-				meta_bytes)) != 0)
+		if ((result=storage_sort_metadata_buff(pClientInfo, \
+				meta_buff, &meta_bytes)) != 0)
 		{
 			return result;
 		}
 
 		*sync_flag = STORAGE_OP_TYPE_SOURCE_CREATE_FILE;
-		return writeToFile(full_meta_filename, meta_buff, meta_bytes);
+		return storage_meta_set(filename, meta_buff, meta_bytes, NULL);
 	}
 	else if (result != 0)
 	{
 		return result;
 	}
 
-	old_meta_list = fdfs_split_metadata(file_buff, &old_meta_count, &result);
-	if (old_meta_list == NULL)
-	{
-		free(file_buff);
-		return result;
-	}
-
-	new_meta_list = fdfs_split_metadata(meta_buff, &new_meta_count, &result);
-	if (new_meta_list == NULL)
-	{
-		free(file_buff);
-		free(old_meta_list);
-		return result;
-	}
-
-	all_meta_list = (FDFSMetaData *)malloc(sizeof(FDFSMetaData) * \
-				(old_meta_count + new_meta_count));
-	if (all_meta_list == NULL)
+	/* the buffer: old metadata, slices, merged metadata */
+	old_meta_count = fdfs_get_metadata_count(pBuff, old_meta_bytes);
+	new_meta_count = fdfs_get_metadata_count(meta_buff, meta_bytes);
+	slices_offset = STORAGE_META_ALIGN(old_meta_bytes + 1);
+	all_meta_offset = slices_offset + sizeof(FDFSMetaSlice) * \
+			(old_meta_count + new_meta_count);
+	if ((pBuff=storage_alloc_meta_buff(pClientInfo, all_meta_offset + \
+			old_meta_bytes + meta_bytes + 2)) == NULL)
 	{
-		free(file_buff);
-		free(old_meta_list);
-		free(new_meta_list);
 		return ENOMEM;
 	}
 
-	qsort((void *)new_meta_list, new_meta_count, sizeof(FDFSMetaData), \
-		metadata_cmp_by_name);
-
-	pOldMetaEnd = old_meta_list + old_meta_count;
-	pNewMetaEnd = new_meta_list + new_meta_count;
-	pOldMeta = old_meta_list;
-	pNewMeta = new_meta_list;
-	pAllMeta = all_meta_list;
-	while (pOldMeta < pOldMetaEnd && pNewMeta < pNewMetaEnd)
-	{
-		result = strcmp(pOldMeta->name, pNewMeta->name);
-		if (result < 0)
-		{
-			memcpy(pAllMeta, pOldMeta, sizeof(FDFSMetaData));
-			pOldMeta++;
-		}
-		else if (result == 0)
-		{
-			memcpy(pAllMeta, pNewMeta, sizeof(FDFSMetaData));
-			pOldMeta++;
-			pNewMeta++;
-		}
-		else  //result > 0
-		{
-			memcpy(pAllMeta, pNewMeta, sizeof(FDFSMetaData));
-			pNewMeta++;
-		}
-
-		pAllMeta++;
-	}
-
-	while (pOldMeta < pOldMetaEnd)
-	{
-		memcpy(pAllMeta, pOldMeta, sizeof(FDFSMetaData));
-		pOldMeta++;
-		pAllMeta++;
-	}
-
-	while (pNewMeta < pNewMetaEnd)
-	{
-		memcpy(pAllMeta, pNewMeta, sizeof(FDFSMetaData));
-		pNewMeta++;
-		pAllMeta++;
-	}
+	old_slices = (FDFSMetaSlice *)(pBuff + slices_offset);
+	new_slices = old_slices + old_meta_count;
+	all_meta_buff = pBuff + all_meta_offset;
 
-	free(file_buff);
-	free(old_meta_list);
-	free(new_meta_list);
+	/* the old metadata is sorted when it is stored */
+	old_meta_count = fdfs_split_metadata_slices(pBuff, old_meta_bytes, \
+			old_slices, old_meta_count);
+	new_meta_count = fdfs_split_metadata_slices(meta_buff, meta_bytes, \
+			new_slices, new_meta_count);
+	qsort((void *)new_slices, new_meta_count, sizeof(FDFSMetaSlice), \
+		metadata_slice_cmp_by_name);
 
-	all_meta_buff = fdfs_pack_metadata(all_meta_list, \
-			pAllMeta - all_meta_list, NULL, &all_meta_bytes);
-	free(all_meta_list);
-	if (all_meta_buff == NULL)
-	{
-		return ENOMEM;
-	}
+	all_meta_bytes = fdfs_merge_metadata_slices(old_slices, \
+			old_meta_count, new_slices, new_meta_count, \
+			all_meta_buff);
 
 	*sync_flag = STORAGE_OP_TYPE_SOURCE_UPDATE_FILE;
-	result = writeToFile(full_meta_filename, all_meta_buff, all_meta_bytes);
-	free(all_meta_buff);
-
-	return result;
+	return storage_meta_set(filename, all_meta_buff, \
+			all_meta_bytes, NULL);
 }
 
 /**
@@ -382,8 +631,8 @@ static int storage_set_metadata(StorageClientInfo *pClientInfo, \
 	char *meta_buff;
 	int meta_bytes;
 	int filename_len;
+	int store_path_index;
 
-	in_buff = NULL;
 	while (1)
 	{
 		if (nInPackLen <= 2 * TRACKER_PROTO_PKG_LEN_SIZE + 1 + \
@@ -402,10 +651,11 @@ static int storage_set_metadata(StorageClientInfo *pClientInfo, \
 			break;
 		}
 
-		in_buff = (char *)malloc(nInPackLen + 1);
-		if (in_buff == NULL)
+		/* the meta buff is used to merge the metadata */
+		if ((in_buff=storage_alloc_in_buff(pClientInfo, \
+			nInPackLen + 1)) == NULL)
 		{
-			resp.status = errno != 0 ? errno : ENOMEM;
+			resp.status = ENOMEM;
 			break;
 		}
 
@@ -479,8 +729,13 @@ static int storage_set_metadata(StorageClientInfo *pClientInfo, \
 				FDFS_GROUP_NAME_MAX_LEN + filename_len;
 		*(meta_buff + meta_bytes) = '\0';
 
-		sprintf(full_filename, "%s/data/%s", g_base_path, filename);
-		if (!fileExists(full_filename))
+		if ((resp.status=storage_get_full_filename(filename, \
+			full_filename, sizeof(full_filename), \
+			&store_path_index)) != 0)
+		{
+			break;
+		}
+		if (!storage_file_exists(filename, full_filename))
 		{
 			logError("file: "__FILE__", line: %d, " \
 				"client ip:%s, filename: %s not exist", \
@@ -490,11 +745,12 @@ static int storage_set_metadata(StorageClientInfo *pClientInfo, \
 		}
 
 		sprintf(meta_filename, "%s"STORAGE_META_FILE_EXT, filename);
-		strcat(full_filename, STORAGE_META_FILE_EXT);
 
+		storage_disk_io_begin(store_path_index);
 		resp.status = storage_do_set_metadata(pClientInfo, \
-			full_filename, meta_buff, meta_bytes, \
+			filename, meta_buff, meta_bytes, \
 			op_flag, &sync_flag);
+		storage_disk_io_end(store_path_index);
 		if (resp.status != 0)
 		{
 			break;
@@ -509,16 +765,7 @@ static int storage_set_metadata(StorageClientInfo *pClientInfo, \
 		break;
 	}
 
-	resp.cmd = STORAGE_PROTO_CMD_RESP;
-	sprintf(resp.pkg_len, "%x", 0);
-
-	if (in_buff != NULL)
-	{
-		free(in_buff);
-	}
-
-	if (tcpsenddata(pClientInfo->sock, (void *)&resp, \
-		sizeof(resp), g_network_timeout) != 1)
+	if (storage_send_resp_header(pClientInfo, resp.status, 0) != 1)
 	{
 		logError("file: "__FILE__", line: %d, " \
 			"client ip: %s, send data fail, " \
@@ -538,48 +785,53 @@ meta data bytes: each meta data seperated by \x01,
 		 name and value seperated by \x02
 1 bytes: pad byte, should be \0
 file size bytes: file content
+the two sizes are 8 bytes big endian integers for the v2 protocol,
+the file larger than 2GB can be uploaded by the v2 protocol only,
+the appender file is uploaded by the same format
 **/
 static int storage_upload_file(StorageClientInfo *pClientInfo, \
-				const int nInPackLen)
+				const int64_t nInPackLen, const bool bAppender)
 {
 	TrackerHeader resp;
+	int field_size;
+	int header_len;
 	int out_len;
 	char *in_buff;
 	char *meta_buff;
+	char fixed_buff[2 * TRACKER_PROTO_PKG_LEN_SIZE];
 	char out_buff[128];
 	char filename[128];
-	int meta_bytes;
-	int file_bytes;
+	char src_filename[128];
+	char meta_filename[64];
+	int64_t meta_bytes;
+	int64_t file_bytes;
+	int recv_bytes;
 	int filename_len;
+	bool bStream;
 
 	in_buff = NULL;
 	filename[0] = '\0';
 	filename_len = 0;
+	*src_filename = '\0';
+	field_size = FDFS_PROTO_FIELD_SIZE(pClientInfo->proto_version);
 	while (1)
 	{
-		if (nInPackLen <= 0)
+		if (nInPackLen <= 2 * field_size)
 		{
 			logError("file: "__FILE__", line: %d, " \
-				"cmd=%d, client ip: %s, package size %d " \
-				"is not correct, " \
-				"expect length > 0", \
+				"cmd=%d, client ip: %s, package size " \
+				INT64_PRINTF_FORMAT" is not correct, " \
+				"expect length > %d", \
 				__LINE__, \
 				STORAGE_PROTO_CMD_UPLOAD_FILE, \
 				pClientInfo->ip_addr,  \
-				nInPackLen);
+				nInPackLen, 2 * field_size);
 			resp.status = EINVAL;
 			break;
 		}
 
-		in_buff = (char *)malloc(nInPackLen + 1);
-		if (in_buff == NULL)
-		{
-			resp.status = errno != 0 ? errno : ENOMEM;
-			break;
-		}
-
-		if (tcprecvdata(pClientInfo->sock, in_buff, \
-			nInPackLen, g_network_timeout) != 1)
+		if (tcprecvdata(pClientInfo->sock, fixed_buff, \
+			2 * field_size, g_network_timeout) != 1)
 		{
 			logError("file: "__FILE__", line: %d, " \
 				"client ip:%s, recv data fail, " \
@@ -590,14 +842,17 @@ static int storage_upload_file(StorageClientInfo *pClientInfo, \
 			break;
 		}
 
-		*(in_buff + nInPackLen) = '\0';
-		meta_bytes = strtol(in_buff, NULL, 16);
-		file_bytes = strtol(in_buff + TRACKER_PROTO_PKG_LEN_SIZE, \
-				NULL, 16);
-		if (meta_bytes < 0)
+		meta_bytes = fdfs_unpack_size_field( \
+				pClientInfo->proto_version, fixed_buff);
+		file_bytes = fdfs_unpack_size_field( \
+				pClientInfo->proto_version, \
+				fixed_buff + field_size);
+		/* only the file content may be larger than 2GB */
+		if (meta_bytes < 0 || meta_bytes >= INT_MAX / 2)
 		{
 			logError("file: "__FILE__", line: %d, " \
-				"client ip:%s, invalid meta bytes: %d", \
+				"client ip:%s, invalid meta bytes: " \
+				INT64_PRINTF_FORMAT, \
 				__LINE__, pClientInfo->ip_addr, \
 				meta_bytes);
 			resp.status = EINVAL;
@@ -605,39 +860,89 @@ static int storage_upload_file(StorageClientInfo *pClientInfo, \
 		}
 
 		if (file_bytes < 0 || file_bytes != nInPackLen - \
-			(2 * TRACKER_PROTO_PKG_LEN_SIZE + meta_bytes + 1))
+			(2 * field_size + meta_bytes + 1))
 		{
 			logError("file: "__FILE__", line: %d, " \
-				"client ip:%s, invalid file bytes: %d", \
+				"client ip:%s, invalid file bytes: " \
+				INT64_PRINTF_FORMAT, \
 				__LINE__, pClientInfo->ip_addr, \
 				file_bytes);
 			resp.status = EINVAL;
 			break;
 		}
 
-		meta_buff = in_buff + 2 * TRACKER_PROTO_PKG_LEN_SIZE;
-		*(meta_buff + meta_bytes) = '\0';
-		resp.status = storage_save_file(pClientInfo,  \
-			meta_buff + meta_bytes + 1, \
-			file_bytes, meta_buff, meta_bytes, \
-			filename, &filename_len);
-
-		if (resp.status != 0)
-		{
-			break;
-		}
-
-		resp.status = storage_binlog_write( \
-					STORAGE_OP_TYPE_SOURCE_CREATE_FILE, \
-					filename);
-		if (resp.status != 0)
+		bStream = bAppender || file_bytes >= STORAGE_STREAM_FILE_SIZE;
+		recv_bytes = (int)meta_bytes + 1 + (bStream ? 0 : \
+				(int)file_bytes);
+		in_buff = (char *)malloc(recv_bytes + 1);
+		if (in_buff == NULL)
 		{
+			resp.status = errno != 0 ? errno : ENOMEM;
 			break;
 		}
 
-		if (meta_bytes > 0)
+		if (tcprecvdata(pClientInfo->sock, in_buff, \
+			recv_bytes, g_network_timeout) != 1)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip:%s, recv data fail, " \
+				"errno: %d, error info: %s.", \
+				__LINE__, pClientInfo->ip_addr, \
+				errno, strerror(errno));
+			resp.status = errno != 0 ? errno : EPIPE;
+			break;
+		}
+
+		*(in_buff + recv_bytes) = '\0';
+		meta_buff = in_buff;
+		*(meta_buff + meta_bytes) = '\0';
+		if (bStream)
+		{
+			resp.status = storage_save_stream_file(pClientInfo, \
+				file_bytes, bAppender, meta_buff, \
+				(int)meta_bytes, filename, &filename_len);
+		}
+		else
+		{
+			resp.status = storage_save_file(pClientInfo,  \
+				meta_buff + meta_bytes + 1, \
+				(int)file_bytes, meta_buff, (int)meta_bytes, \
+				filename, &filename_len, src_filename);
+		}
+
+		if (resp.status != 0)
+		{
+			break;
+		}
+
+		/* the data file and its metadata are synced together */
+		if (*src_filename == '\0' && meta_bytes > 0)
+		{
+			resp.status = storage_binlog_write( \
+					STORAGE_OP_TYPE_SOURCE_CREATE_FILE_META, \
+					filename);
+			break;
+		}
+
+		if (*src_filename != '\0')
+		{
+			resp.status = storage_binlog_write_link( \
+					STORAGE_OP_TYPE_SOURCE_LINK_FILE, \
+					filename, src_filename);
+		}
+		else
+		{
+			resp.status = storage_binlog_write( \
+					STORAGE_OP_TYPE_SOURCE_CREATE_FILE, \
+					filename);
+		}
+		if (resp.status != 0)
+		{
+			break;
+		}
+
+		if (meta_bytes > 0)
 		{
-			char meta_filename[64];
 			sprintf(meta_filename, "%s"STORAGE_META_FILE_EXT, \
 				filename);
 			resp.status = storage_binlog_write( \
@@ -645,38 +950,1465 @@ static int storage_upload_file(StorageClientInfo *pClientInfo, \
 					meta_filename);
 		}
 
-		break;
+		break;
+	}
+
+	out_len = resp.status == 0 ? filename_len : 0;
+	header_len = storage_pack_resp_header(pClientInfo, resp.status, \
+			out_len, out_buff);
+	memcpy(out_buff + header_len, filename, out_len);
+
+	if (in_buff != NULL)
+	{
+		free(in_buff);
+	}
+
+	if (tcpsenddata(pClientInfo->sock, out_buff, \
+		header_len + out_len, g_network_timeout) != 1)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, send data fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pClientInfo->ip_addr, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+
+	return resp.status;
+}
+
+/**
+pkg format:
+Header
+FDFS_PROTO_FIELD_SIZE bytes: file size
+FDFS_PROTO_FIELD_SIZE bytes: part size, the last part may be smaller
+FDFS_PROTO_FIELD_SIZE bytes: meta data bytes
+meta data bytes: each meta data seperated by \x01,
+		 name and value seperated by \x02
+response: STORAGE_UPLOAD_SESSION_ID_LEN bytes session id
+**/
+static int storage_upload_begin(StorageClientInfo *pClientInfo, \
+				const int nInPackLen)
+{
+	char *in_buff;
+	char *meta_buff;
+	char out_buff[FDFS_PROTO_MAX_HEADER_SIZE + \
+			STORAGE_UPLOAD_SESSION_ID_LEN];
+	char session_id[STORAGE_UPLOAD_SESSION_ID_LEN + 1];
+	char status;
+	int64_t file_size;
+	int64_t part_size;
+	int64_t meta_bytes;
+	int meta_size;
+	int field_size;
+	int header_len;
+	int out_len;
+
+	in_buff = NULL;
+	*session_id = '\0';
+	field_size = FDFS_PROTO_FIELD_SIZE(pClientInfo->proto_version);
+	while (1)
+	{
+		if (nInPackLen < 3 * field_size)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"cmd=%d, client ip: %s, package size %d " \
+				"is not correct, expect length >= %d", \
+				__LINE__, STORAGE_PROTO_CMD_UPLOAD_BEGIN, \
+				pClientInfo->ip_addr, nInPackLen, \
+				3 * field_size);
+			status = EINVAL;
+			break;
+		}
+
+		in_buff = (char *)malloc(nInPackLen + 1);
+		if (in_buff == NULL)
+		{
+			status = errno != 0 ? errno : ENOMEM;
+			break;
+		}
+
+		if (tcprecvdata(pClientInfo->sock, in_buff, \
+			nInPackLen, g_network_timeout) != 1)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip:%s, recv data fail, " \
+				"errno: %d, error info: %s.", \
+				__LINE__, pClientInfo->ip_addr, \
+				errno, strerror(errno));
+			status = errno != 0 ? errno : EPIPE;
+			break;
+		}
+
+		file_size = fdfs_unpack_size_field( \
+				pClientInfo->proto_version, in_buff);
+		part_size = fdfs_unpack_size_field( \
+				pClientInfo->proto_version, \
+				in_buff + field_size);
+		meta_bytes = fdfs_unpack_size_field( \
+				pClientInfo->proto_version, \
+				in_buff + 2 * field_size);
+		if (file_size <= 0 || part_size < \
+			STORAGE_UPLOAD_MIN_PART_SIZE || part_size > \
+			STORAGE_UPLOAD_MAX_PART_SIZE || (file_size + \
+			part_size - 1) / part_size > \
+			STORAGE_UPLOAD_MAX_PART_COUNT)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip:%s, invalid file size: " \
+				INT64_PRINTF_FORMAT" or part size: " \
+				INT64_PRINTF_FORMAT, __LINE__, \
+				pClientInfo->ip_addr, file_size, part_size);
+			status = EINVAL;
+			break;
+		}
+
+		if (meta_bytes != nInPackLen - 3 * field_size)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip:%s, invalid meta bytes: " \
+				INT64_PRINTF_FORMAT, __LINE__, \
+				pClientInfo->ip_addr, meta_bytes);
+			status = EINVAL;
+			break;
+		}
+
+		meta_buff = in_buff + 3 * field_size;
+		meta_size = (int)meta_bytes;
+		*(meta_buff + meta_size) = '\0';
+		if (meta_size > 0 && (status=storage_sort_metadata_buff( \
+			pClientInfo, meta_buff, &meta_size)) != 0)
+		{
+			break;
+		}
+
+		status = storage_upload_session_begin(file_size, \
+				(int)part_size, meta_buff, meta_size, \
+				session_id);
+		break;
+	}
+
+	if (in_buff != NULL)
+	{
+		free(in_buff);
+	}
+
+	out_len = status == 0 ? STORAGE_UPLOAD_SESSION_ID_LEN : 0;
+	header_len = storage_pack_resp_header(pClientInfo, status, \
+			out_len, out_buff);
+	memcpy(out_buff + header_len, session_id, out_len);
+	if (tcpsenddata(pClientInfo->sock, out_buff, \
+		header_len + out_len, g_network_timeout) != 1)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, send data fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pClientInfo->ip_addr, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+
+	return status;
+}
+
+/* recv the session id at the head of the package and load the session */
+static int storage_recv_upload_session(StorageClientInfo *pClientInfo, \
+		StorageUploadSession *pSession)
+{
+	char session_id[STORAGE_UPLOAD_SESSION_ID_LEN + 1];
+	int result;
+
+	if (tcprecvdata(pClientInfo->sock, session_id, \
+		STORAGE_UPLOAD_SESSION_ID_LEN, g_network_timeout) != 1)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"client ip:%s, recv data fail, " \
+			"errno: %d, error info: %s.", \
+			__LINE__, pClientInfo->ip_addr, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+	session_id[STORAGE_UPLOAD_SESSION_ID_LEN] = '\0';
+
+	if ((result=storage_upload_session_load(session_id, \
+		pSession)) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, load upload session %s fail, " \
+			"errno: %d, error info: %s", __LINE__, \
+			pClientInfo->ip_addr, session_id, \
+			result, strerror(result));
+	}
+	return result;
+}
+
+/**
+pkg format:
+Header
+STORAGE_UPLOAD_SESSION_ID_LEN bytes: session id
+FDFS_PROTO_FIELD_SIZE bytes: part index, based 0
+FDFS_PROTO_FIELD_SIZE bytes: the crc32 of the part content
+part bytes: the part content, all of the parts are part size bytes
+	except the last one
+the parts can be uploaded in any order by many connections, the part
+uploaded again overwrites the old one
+**/
+static int storage_upload_part(StorageClientInfo *pClientInfo, \
+				const int nInPackLen)
+{
+	StorageUploadSession session;
+	char fixed_buff[2 * TRACKER_PROTO_PKG_LEN_SIZE];
+	char status;
+	unsigned int crc32;
+	unsigned int expect_crc32;
+	int64_t part_index;
+	int field_size;
+	int part_bytes;
+
+	memset(&session, 0, sizeof(session));
+	field_size = FDFS_PROTO_FIELD_SIZE(pClientInfo->proto_version);
+	while (1)
+	{
+		if (nInPackLen < STORAGE_UPLOAD_SESSION_ID_LEN + 2 * field_size)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"cmd=%d, client ip: %s, package size %d " \
+				"is not correct", __LINE__, \
+				STORAGE_PROTO_CMD_UPLOAD_PART, \
+				pClientInfo->ip_addr, nInPackLen);
+			status = EINVAL;
+			break;
+		}
+
+		/* the content is received to send the status back */
+		if ((status=storage_recv_upload_session(pClientInfo, \
+			&session)) != 0)
+		{
+			storage_recv_to_fd(pClientInfo->sock, -1, 0, \
+				nInPackLen - STORAGE_UPLOAD_SESSION_ID_LEN, \
+				&crc32);
+			break;
+		}
+
+		if (tcprecvdata(pClientInfo->sock, fixed_buff, \
+			2 * field_size, g_network_timeout) != 1)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip:%s, recv data fail, " \
+				"errno: %d, error info: %s.", \
+				__LINE__, pClientInfo->ip_addr, \
+				errno, strerror(errno));
+			status = errno != 0 ? errno : EPIPE;
+			break;
+		}
+
+		part_index = fdfs_unpack_size_field( \
+				pClientInfo->proto_version, fixed_buff);
+		expect_crc32 = (unsigned int)fdfs_unpack_size_field( \
+			pClientInfo->proto_version, fixed_buff + field_size);
+		part_bytes = nInPackLen - (STORAGE_UPLOAD_SESSION_ID_LEN + \
+				2 * field_size);
+		if (part_index < 0 || part_index >= session.part_count || \
+			part_bytes != storage_upload_session_part_bytes( \
+				&session, (int)part_index))
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip:%s, invalid part index: " \
+				INT64_PRINTF_FORMAT" or part bytes: %d " \
+				"of upload session %s", __LINE__, \
+				pClientInfo->ip_addr, part_index, \
+				part_bytes, session.id);
+			storage_recv_to_fd(pClientInfo->sock, -1, 0, \
+				part_bytes, &crc32);
+			status = EINVAL;
+			break;
+		}
+
+		status = storage_upload_session_recv_part(&session, \
+			pClientInfo->sock, (int)part_index, expect_crc32);
+		break;
+	}
+
+	storage_upload_session_free(&session);
+	if (storage_send_resp_header(pClientInfo, status, 0) != 1)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, send data fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pClientInfo->ip_addr, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+
+	return status;
+}
+
+/**
+pkg format:
+Header
+STORAGE_UPLOAD_SESSION_ID_LEN bytes: session id
+response:
+FDFS_PROTO_FIELD_SIZE bytes: file size
+FDFS_PROTO_FIELD_SIZE bytes: part size
+part count bytes: the part map, \x01 for the part uploaded, otherwise \x00
+**/
+static int storage_upload_query(StorageClientInfo *pClientInfo, \
+				const int nInPackLen)
+{
+	StorageUploadSession session;
+	char out_buff[FDFS_PROTO_MAX_HEADER_SIZE + \
+			2 * TRACKER_PROTO_PKG_LEN_SIZE];
+	char *p;
+	char status;
+	int field_size;
+	int out_len;
+	int result;
+
+	memset(&session, 0, sizeof(session));
+	field_size = FDFS_PROTO_FIELD_SIZE(pClientInfo->proto_version);
+	while (1)
+	{
+		if (nInPackLen != STORAGE_UPLOAD_SESSION_ID_LEN)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"cmd=%d, client ip: %s, package size %d " \
+				"is not correct, expect length: %d", \
+				__LINE__, STORAGE_PROTO_CMD_UPLOAD_QUERY, \
+				pClientInfo->ip_addr, nInPackLen, \
+				STORAGE_UPLOAD_SESSION_ID_LEN);
+			status = EINVAL;
+			break;
+		}
+
+		status = storage_recv_upload_session(pClientInfo, &session);
+		break;
+	}
+
+	out_len = status == 0 ? 2 * field_size + session.part_count : 0;
+	p = out_buff + storage_pack_resp_header(pClientInfo, status, \
+			out_len, out_buff);
+	if (status == 0)
+	{
+		fdfs_pack_size_field(pClientInfo->proto_version, \
+			session.file_size, p);
+		p += field_size;
+		fdfs_pack_size_field(pClientInfo->proto_version, \
+			session.part_size, p);
+		p += field_size;
+	}
+
+	result = 0;
+	if (tcpsenddata(pClientInfo->sock, out_buff, p - out_buff, \
+		g_network_timeout) != 1 || (session.part_count > 0 && \
+		tcpsenddata(pClientInfo->sock, session.part_map, \
+		session.part_count, g_network_timeout) != 1))
+	{
+		result = errno != 0 ? errno : EPIPE;
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, send data fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pClientInfo->ip_addr, \
+			result, strerror(result));
+	}
+
+	storage_upload_session_free(&session);
+	return result != 0 ? result : status;
+}
+
+/**
+pkg format:
+Header
+STORAGE_UPLOAD_SESSION_ID_LEN bytes: session id
+response: the filename
+the filename is generated here because it contains the crc32 of the file,
+the file is synced to the other storage servers after committed only
+**/
+static int storage_upload_commit(StorageClientInfo *pClientInfo, \
+				const int nInPackLen)
+{
+	StorageUploadSession session;
+	char out_buff[FDFS_PROTO_MAX_HEADER_SIZE + 128];
+	char filename[128];
+	char full_filename[MAX_PATH_SIZE+32];
+	char status;
+	unsigned int crc32;
+	int filename_len;
+	int header_len;
+	int out_len;
+
+	memset(&session, 0, sizeof(session));
+	filename_len = 0;
+	while (1)
+	{
+		if (nInPackLen != STORAGE_UPLOAD_SESSION_ID_LEN)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"cmd=%d, client ip: %s, package size %d " \
+				"is not correct, expect length: %d", \
+				__LINE__, STORAGE_PROTO_CMD_UPLOAD_COMMIT, \
+				pClientInfo->ip_addr, nInPackLen, \
+				STORAGE_UPLOAD_SESSION_ID_LEN);
+			status = EINVAL;
+			break;
+		}
+
+		if ((status=storage_recv_upload_session(pClientInfo, \
+			&session)) != 0)
+		{
+			break;
+		}
+
+		if ((status=storage_upload_session_checksum(&session, \
+			&crc32)) != 0)
+		{
+			if (status == EAGAIN)
+			{
+				logError("file: "__FILE__", line: %d, " \
+					"client ip: %s, some parts of " \
+					"upload session %s are not uploaded", \
+					__LINE__, pClientInfo->ip_addr, \
+					session.id);
+			}
+			break;
+		}
+
+		if ((status=storage_gen_uniq_filename(pClientInfo, \
+			session.file_size, crc32, session.store_path_index, \
+			false, filename, &filename_len, full_filename, \
+			sizeof(full_filename))) != 0)
+		{
+			break;
+		}
+
+		if (session.meta_bytes > 0 && (status=storage_meta_set( \
+			filename, session.meta_buff, session.meta_bytes, \
+			NULL)) != 0)
+		{
+			break;
+		}
+
+		/* the part file is removed when fail to rename */
+		if ((status=storage_rename_file(session.part_filename, \
+			full_filename)) != 0 && session.meta_bytes > 0)
+		{
+			storage_meta_delete(filename);
+		}
+		storage_upload_session_remove(&session);
+		if (status != 0)
+		{
+			break;
+		}
+
+		/* the data file and its metadata are synced together */
+		status = storage_binlog_write(session.meta_bytes > 0 ? \
+				STORAGE_OP_TYPE_SOURCE_CREATE_FILE_META : \
+				STORAGE_OP_TYPE_SOURCE_CREATE_FILE, filename);
+		break;
+	}
+
+	storage_upload_session_free(&session);
+	out_len = status == 0 ? filename_len : 0;
+	header_len = storage_pack_resp_header(pClientInfo, status, \
+			out_len, out_buff);
+	memcpy(out_buff + header_len, filename, out_len);
+	if (tcpsenddata(pClientInfo->sock, out_buff, \
+		header_len + out_len, g_network_timeout) != 1)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, send data fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pClientInfo->ip_addr, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+
+	return status;
+}
+
+/**
+pkg format:
+Header
+STORAGE_UPLOAD_SESSION_ID_LEN bytes: session id
+**/
+static int storage_upload_abort(StorageClientInfo *pClientInfo, \
+				const int nInPackLen)
+{
+	StorageUploadSession session;
+	char status;
+
+	memset(&session, 0, sizeof(session));
+	while (1)
+	{
+		if (nInPackLen != STORAGE_UPLOAD_SESSION_ID_LEN)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"cmd=%d, client ip: %s, package size %d " \
+				"is not correct, expect length: %d", \
+				__LINE__, STORAGE_PROTO_CMD_UPLOAD_ABORT, \
+				pClientInfo->ip_addr, nInPackLen, \
+				STORAGE_UPLOAD_SESSION_ID_LEN);
+			status = EINVAL;
+			break;
+		}
+
+		if ((status=storage_recv_upload_session(pClientInfo, \
+			&session)) != 0)
+		{
+			break;
+		}
+
+		status = storage_upload_session_remove(&session);
+		break;
+	}
+
+	storage_upload_session_free(&session);
+	if (storage_send_resp_header(pClientInfo, status, 0) != 1)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, send data fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pClientInfo->ip_addr, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+
+	return status;
+}
+
+/*
+save the large file synced from the source storage server, the content is
+received even if the file exists, so the connection can be used later
+*/
+static int storage_sync_save_stream_file(StorageClientInfo *pClientInfo, \
+		const char *filename, const char *full_filename, \
+		const char *meta_buff, const int meta_bytes, \
+		const int64_t file_size, const char proto_cmd)
+{
+	char tmp_filename[MAX_PATH_SIZE + 32];
+	unsigned int crc32;
+	int result;
+
+	if ((proto_cmd == STORAGE_PROTO_CMD_SYNC_CREATE_FILE || \
+		proto_cmd == STORAGE_PROTO_CMD_SYNC_CREATE_FILE_META) \
+		&& fileExists(full_filename))
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"cmd=%d, client ip: %s, data file: %s " \
+			"already exists, ignore it", \
+			__LINE__, proto_cmd, \
+			pClientInfo->ip_addr, full_filename);
+		result = storage_recv_file(pClientInfo->sock, NULL, \
+				file_size, &crc32);
+		return result != 0 ? result : EEXIST;
+	}
+
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s%s", \
+		full_filename, STORAGE_TEMP_FILE_EXT);
+	if ((result=storage_recv_file(pClientInfo->sock, tmp_filename, \
+			file_size, &crc32)) != 0)
+	{
+		return result;
+	}
+
+	if (storage_check_file_crc32(filename, file_size, crc32) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"cmd=%d, client ip: %s, the content of " \
+			"data file: %s not match the checksum", \
+			__LINE__, proto_cmd, \
+			pClientInfo->ip_addr, full_filename);
+		unlink(tmp_filename);
+		return EIO;
+	}
+
+	/* the metadata is stored before the data file appears */
+	if (meta_bytes > 0 && (result=storage_meta_set(filename, \
+			meta_buff, meta_bytes, NULL)) != 0)
+	{
+		unlink(tmp_filename);
+		return result;
+	}
+
+	if ((result=storage_rename_file(tmp_filename, \
+			full_filename)) != 0 && meta_bytes > 0)
+	{
+		storage_meta_delete(filename);
+	}
+	return result;
+}
+
+/**
+9 bytes: filename bytes
+9 bytes: meta data bytes, only for STORAGE_PROTO_CMD_SYNC_CREATE_FILE_META
+9 bytes: file size
+FDFS_GROUP_NAME_MAX_LEN bytes: group_name
+filename bytes : filename
+meta data bytes: meta data, only for STORAGE_PROTO_CMD_SYNC_CREATE_FILE_META
+file size bytes: file content
+the sizes are 8 bytes big endian integers for the v2 protocol
+**/
+static int storage_sync_copy_file(StorageClientInfo *pClientInfo, \
+			const int64_t nInPackLen, const char proto_cmd)
+{
+	TrackerHeader resp;
+	char *in_buff;
+	char *pBuff;
+	char *meta_buff;
+	char fixed_buff[3 * TRACKER_PROTO_PKG_LEN_SIZE + \
+			FDFS_GROUP_NAME_MAX_LEN];
+	char group_name[FDFS_GROUP_NAME_MAX_LEN + 1];
+	char filename[128];
+	char data_filename[128];
+	char full_filename[MAX_PATH_SIZE];
+	int field_size;
+	int fixed_len;
+	int filename_len;
+	int recv_bytes;
+	int64_t meta_bytes;
+	int64_t file_bytes;
+	int store_path_index;
+	bool bStream;
+
+	in_buff = NULL;
+	field_size = FDFS_PROTO_FIELD_SIZE(pClientInfo->proto_version);
+	if (proto_cmd == STORAGE_PROTO_CMD_SYNC_CREATE_FILE_META)
+	{
+		fixed_len = 3 * field_size + FDFS_GROUP_NAME_MAX_LEN;
+	}
+	else
+	{
+		fixed_len = 2 * field_size + FDFS_GROUP_NAME_MAX_LEN;
+	}
+	while (1)
+	{
+		if (nInPackLen <= fixed_len)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"cmd=%d, client ip: %s, package size " \
+				INT64_PRINTF_FORMAT" is not correct, " \
+				"expect length > %d", \
+				__LINE__, proto_cmd, \
+				pClientInfo->ip_addr,  nInPackLen, \
+				fixed_len);
+			resp.status = EINVAL;
+			break;
+		}
+
+		if (tcprecvdata(pClientInfo->sock, fixed_buff, \
+			fixed_len, g_network_timeout) != 1)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, recv data fail, " \
+				"errno: %d, error info: %s.", \
+				__LINE__, pClientInfo->ip_addr, \
+				errno, strerror(errno));
+			resp.status = errno != 0 ? errno : EPIPE;
+			break;
+		}
+
+		pBuff = fixed_buff;
+		filename_len = fdfs_unpack_size_field( \
+				pClientInfo->proto_version, pBuff);
+		pBuff += field_size;
+		if (proto_cmd == STORAGE_PROTO_CMD_SYNC_CREATE_FILE_META)
+		{
+			meta_bytes = fdfs_unpack_size_field( \
+					pClientInfo->proto_version, pBuff);
+			pBuff += field_size;
+		}
+		else
+		{
+			meta_bytes = 0;
+		}
+		file_bytes = fdfs_unpack_size_field( \
+				pClientInfo->proto_version, pBuff);
+		pBuff += field_size;
+
+		if (filename_len < 0 || filename_len >= sizeof(filename))
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, in request pkg, " \
+				"filename length: %d is invalid, " \
+				"which < 0 or >= %d", \
+				__LINE__, pClientInfo->ip_addr, \
+				filename_len,  sizeof(filename));
+			resp.status = EPIPE;
+			break;
+		}
+
+		if (meta_bytes < 0 || meta_bytes >= INT_MAX / 2)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, in request pkg, " \
+				"meta data bytes: "INT64_PRINTF_FORMAT \
+				" is invalid", __LINE__, \
+				pClientInfo->ip_addr, meta_bytes);
+			resp.status = EPIPE;
+			break;
+		}
+
+		if (file_bytes < 0 || file_bytes != nInPackLen - \
+			(fixed_len + filename_len + meta_bytes))
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, in request pkg, " \
+				"file size: "INT64_PRINTF_FORMAT \
+				" != remain bytes: "INT64_PRINTF_FORMAT, \
+				__LINE__, pClientInfo->ip_addr, file_bytes, \
+				nInPackLen - (fixed_len + filename_len + \
+				meta_bytes));
+			resp.status = EPIPE;
+			break;
+		}
+
+		memcpy(group_name, pBuff, FDFS_GROUP_NAME_MAX_LEN);
+		group_name[FDFS_GROUP_NAME_MAX_LEN] = '\0';
+		if (strcmp(group_name, g_group_name) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip:%s, group_name: %s " \
+				"not correct, should be: %s", \
+				__LINE__, pClientInfo->ip_addr, \
+				group_name, g_group_name);
+			resp.status = EINVAL;
+			break;
+		}
+
+		/* the large file content is left in the socket */
+		bStream = file_bytes >= STORAGE_STREAM_FILE_SIZE;
+		recv_bytes = filename_len + (int)meta_bytes + \
+				(bStream ? 0 : (int)file_bytes);
+		in_buff = (char *)malloc(recv_bytes + 1);
+		if (in_buff == NULL)
+		{
+			resp.status = errno != 0 ? errno : ENOMEM;
+			break;
+		}
+
+		if (tcprecvdata(pClientInfo->sock, in_buff, \
+			recv_bytes, g_network_timeout) != 1)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, recv data fail, " \
+				"expect pkg length: %d, " \
+				"errno: %d, error info: %s.", \
+				__LINE__, \
+				pClientInfo->ip_addr, recv_bytes, \
+				errno, strerror(errno));
+			resp.status = errno != 0 ? errno : EPIPE;
+			break;
+		}
+
+		*(in_buff + recv_bytes) = '\0';
+		memcpy(filename, in_buff, filename_len);
+		filename[filename_len] = '\0';
+		if ((resp.status=storage_get_full_filename(filename, \
+			full_filename, sizeof(full_filename), \
+			&store_path_index)) != 0)
+		{
+			break;
+		}
+		meta_buff = in_buff + filename_len;
+		pBuff = meta_buff + meta_bytes;
+
+		if (bStream)
+		{
+			resp.status = storage_sync_save_stream_file( \
+				pClientInfo, filename, full_filename, \
+				meta_buff, meta_bytes, file_bytes, proto_cmd);
+		}
+		else if (storage_meta_get_data_filename(filename, data_filename))
+		{
+			storage_disk_io_begin(store_path_index);
+			resp.status = storage_meta_set(data_filename, \
+					pBuff, file_bytes, NULL);
+			storage_disk_io_end(store_path_index);
+		}
+		else if ((proto_cmd == STORAGE_PROTO_CMD_SYNC_CREATE_FILE || \
+			proto_cmd == STORAGE_PROTO_CMD_SYNC_CREATE_FILE_META) \
+			&& fileExists(full_filename))
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"cmd=%d, client ip: %s, data file: %s " \
+				"already exists, ignore it", \
+				__LINE__, proto_cmd, \
+				pClientInfo->ip_addr, full_filename);
+			resp.status = EEXIST;
+			break;
+		}
+		else if (storage_check_file_checksum(filename, \
+			pBuff, file_bytes) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"cmd=%d, client ip: %s, the content of " \
+				"data file: %s not match the checksum", \
+				__LINE__, proto_cmd, \
+				pClientInfo->ip_addr, full_filename);
+			resp.status = EIO;
+			break;
+		}
+		else if (meta_bytes > 0)
+		{
+			/* the metadata is stored before the data file
+			   appears, so the file is never seen without it */
+			storage_disk_io_begin(store_path_index);
+			if ((resp.status=storage_meta_set(filename, \
+				meta_buff, meta_bytes, NULL)) == 0 && \
+				(resp.status=storage_write_file(full_filename, \
+					pBuff, file_bytes)) != 0)
+			{
+				storage_meta_delete(filename);
+			}
+			storage_disk_io_end(store_path_index);
+		}
+		else
+		{
+			storage_disk_io_begin(store_path_index);
+			resp.status = storage_write_file(full_filename, \
+					pBuff, file_bytes);
+			storage_disk_io_end(store_path_index);
+		}
+		if (resp.status != 0)
+		{
+			break;
+		}
+
+		if (proto_cmd == STORAGE_PROTO_CMD_SYNC_CREATE_FILE_META)
+		{
+			resp.status = storage_binlog_write( \
+				STORAGE_OP_TYPE_REPLICA_CREATE_FILE_META, \
+				filename);
+		}
+		else if (proto_cmd == STORAGE_PROTO_CMD_SYNC_CREATE_FILE)
+		{
+			resp.status = storage_binlog_write( \
+				STORAGE_OP_TYPE_REPLICA_CREATE_FILE, \
+				filename);
+		}
+		else
+		{
+			resp.status = storage_binlog_write( \
+				STORAGE_OP_TYPE_REPLICA_UPDATE_FILE, \
+				filename);
+		}
+
+		break;
+	}
+
+	if (in_buff != NULL)
+	{
+		free(in_buff);
+	}
+
+	if (storage_send_resp_header(pClientInfo, resp.status, \
+		0) != 1)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, send data fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pClientInfo->ip_addr, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+
+	if (resp.status == EEXIST)
+	{
+		return 0;
+	}
+	else
+	{
+		return resp.status;
+	}
+}
+
+/**
+pkg format:
+Header
+9 bytes: filename bytes
+9 bytes: src filename bytes
+FDFS_GROUP_NAME_MAX_LEN bytes: group_name
+filename bytes : filename
+src filename bytes : src filename
+**/
+static int storage_sync_link_file(StorageClientInfo *pClientInfo, \
+			const int nInPackLen)
+{
+	TrackerHeader resp;
+	char in_buff[2 * TRACKER_PROTO_PKG_LEN_SIZE + \
+			FDFS_GROUP_NAME_MAX_LEN + 256];
+	char *pBuff;
+	char group_name[FDFS_GROUP_NAME_MAX_LEN + 1];
+	char filename[128];
+	char src_filename[128];
+	char full_filename[MAX_PATH_SIZE];
+	char src_full_filename[MAX_PATH_SIZE];
+	int filename_len;
+	int src_filename_len;
+	int store_path_index;
+	int src_store_path_index;
+
+	while (1)
+	{
+		if (nInPackLen <= 2 * TRACKER_PROTO_PKG_LEN_SIZE + \
+				FDFS_GROUP_NAME_MAX_LEN || \
+			nInPackLen >= sizeof(in_buff))
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"cmd=%d, client ip: %s, package size %d " \
+				"is not correct", __LINE__, \
+				STORAGE_PROTO_CMD_SYNC_LINK_FILE, \
+				pClientInfo->ip_addr,  nInPackLen);
+			resp.status = EINVAL;
+			break;
+		}
+
+		if (tcprecvdata(pClientInfo->sock, in_buff, \
+			nInPackLen, g_network_timeout) != 1)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, recv data fail, " \
+				"expect pkg length: %d, " \
+				"errno: %d, error info: %s.", \
+				__LINE__, \
+				pClientInfo->ip_addr, nInPackLen, \
+				errno, strerror(errno));
+			resp.status = errno != 0 ? errno : EPIPE;
+			break;
+		}
+
+		*(in_buff + nInPackLen) = '\0';
+		pBuff = in_buff;
+		filename_len = strtol(pBuff, NULL, 16);
+		pBuff += TRACKER_PROTO_PKG_LEN_SIZE;
+		src_filename_len = strtol(pBuff, NULL, 16);
+		pBuff += TRACKER_PROTO_PKG_LEN_SIZE;
+		if (filename_len <= 0 || src_filename_len <= 0 || \
+			filename_len >= sizeof(filename) || \
+			src_filename_len >= sizeof(src_filename) || \
+			filename_len + src_filename_len != nInPackLen - \
+			(2 * TRACKER_PROTO_PKG_LEN_SIZE + \
+			FDFS_GROUP_NAME_MAX_LEN))
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, in request pkg, " \
+				"filename length: %d or src filename " \
+				"length: %d is invalid", \
+				__LINE__, pClientInfo->ip_addr, \
+				filename_len, src_filename_len);
+			resp.status = EINVAL;
+			break;
+		}
+
+		memcpy(group_name, pBuff, FDFS_GROUP_NAME_MAX_LEN);
+		pBuff += FDFS_GROUP_NAME_MAX_LEN;
+		group_name[FDFS_GROUP_NAME_MAX_LEN] = '\0';
+		if (strcmp(group_name, g_group_name) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip:%s, group_name: %s " \
+				"not correct, should be: %s", \
+				__LINE__, pClientInfo->ip_addr, \
+				group_name, g_group_name);
+			resp.status = EINVAL;
+			break;
+		}
+
+		memcpy(filename, pBuff, filename_len);
+		filename[filename_len] = '\0';
+		pBuff += filename_len;
+		memcpy(src_filename, pBuff, src_filename_len);
+		src_filename[src_filename_len] = '\0';
+		if ((resp.status=storage_get_full_filename(filename, \
+			full_filename, sizeof(full_filename), \
+			&store_path_index)) != 0 || \
+		    (resp.status=storage_get_full_filename(src_filename, \
+			src_full_filename, sizeof(src_full_filename), \
+			&src_store_path_index)) != 0)
+		{
+			break;
+		}
+
+		if (fileExists(full_filename))
+		{
+			resp.status = EEXIST;
+			break;
+		}
+
+		/* the sender copies the file content when ENOENT */
+		if (store_path_index != src_store_path_index || \
+			link(src_full_filename, full_filename) != 0)
+		{
+			resp.status = ENOENT;
+			break;
+		}
+
+		if ((resp.status=storage_fsync_dir(full_filename)) != 0)
+		{
+			break;
+		}
+
+		resp.status = storage_binlog_write_link( \
+				STORAGE_OP_TYPE_REPLICA_LINK_FILE, \
+				filename, src_filename);
+		break;
+	}
+
+	if (storage_send_resp_header(pClientInfo, resp.status, \
+		0) != 1)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, send data fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pClientInfo->ip_addr, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+
+	if (resp.status == EEXIST || resp.status == ENOENT)
+	{
+		return 0;
+	}
+	else
+	{
+		return resp.status;
+	}
+}
+
+/*
+recv the fixed part of the append request, the content remains in the
+socket, offset is -1 for the append request of the client
+*/
+static int storage_recv_append_header(StorageClientInfo *pClientInfo, \
+		const int64_t nInPackLen, const char cmd, int64_t *offset, \
+		int64_t *append_bytes, char *filename, char *full_filename, \
+		const int buff_size)
+{
+	char in_buff[3 * TRACKER_PROTO_PKG_LEN_SIZE + FDFS_GROUP_NAME_MAX_LEN];
+	char group_name[FDFS_GROUP_NAME_MAX_LEN + 1];
+	char *pBuff;
+	int field_size;
+	int fixed_size;
+	int64_t filename_len;
+	int store_path_index;
+
+	field_size = FDFS_PROTO_FIELD_SIZE(pClientInfo->proto_version);
+	fixed_size = (cmd == STORAGE_PROTO_CMD_SYNC_APPEND_FILE ? 3 : 2) * \
+			field_size + FDFS_GROUP_NAME_MAX_LEN;
+	if (nInPackLen <= fixed_size)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"cmd=%d, client ip: %s, package size " \
+			INT64_PRINTF_FORMAT" is not correct, " \
+			"expect length > %d", __LINE__, cmd, \
+			pClientInfo->ip_addr, nInPackLen, fixed_size);
+		return EINVAL;
+	}
+
+	if (tcprecvdata(pClientInfo->sock, in_buff, fixed_size, \
+		g_network_timeout) != 1)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, recv data fail, " \
+			"errno: %d, error info: %s.", \
+			__LINE__, pClientInfo->ip_addr, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+
+	pBuff = in_buff;
+	filename_len = fdfs_unpack_size_field(pClientInfo->proto_version, \
+			pBuff);
+	pBuff += field_size;
+	*offset = -1;
+	if (cmd == STORAGE_PROTO_CMD_SYNC_APPEND_FILE)
+	{
+		*offset = fdfs_unpack_size_field( \
+				pClientInfo->proto_version, pBuff);
+		pBuff += field_size;
+	}
+	*append_bytes = fdfs_unpack_size_field(pClientInfo->proto_version, \
+			pBuff);
+	pBuff += field_size;
+	if (filename_len <= 0 || filename_len >= 128 || \
+		(cmd == STORAGE_PROTO_CMD_SYNC_APPEND_FILE && *offset < 0) || \
+		*append_bytes < 0 || *append_bytes != nInPackLen - \
+		(fixed_size + filename_len))
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, in request pkg, " \
+			"filename length: "INT64_PRINTF_FORMAT \
+			" or append bytes: "INT64_PRINTF_FORMAT \
+			" is invalid", __LINE__, pClientInfo->ip_addr, \
+			filename_len, *append_bytes);
+		return EINVAL;
+	}
+
+	memcpy(group_name, pBuff, FDFS_GROUP_NAME_MAX_LEN);
+	group_name[FDFS_GROUP_NAME_MAX_LEN] = '\0';
+	if (strcmp(group_name, g_group_name) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"client ip:%s, group_name: %s " \
+			"not correct, should be: %s", \
+			__LINE__, pClientInfo->ip_addr, \
+			group_name, g_group_name);
+		return EINVAL;
+	}
+
+	if (tcprecvdata(pClientInfo->sock, filename, (int)filename_len, \
+		g_network_timeout) != 1)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, recv data fail, " \
+			"errno: %d, error info: %s.", \
+			__LINE__, pClientInfo->ip_addr, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+	filename[filename_len] = '\0';
+
+	return storage_get_full_filename(filename, full_filename, \
+			buff_size, &store_path_index);
+}
+
+/**
+pkg format:
+Header
+FDFS_PROTO_FIELD_SIZE bytes: filename bytes
+FDFS_PROTO_FIELD_SIZE bytes: the bytes to append
+FDFS_GROUP_NAME_MAX_LEN bytes: group_name
+filename bytes : the appender filename
+remain bytes: the content to append
+response: FDFS_PROTO_FIELD_SIZE bytes: the offset of the appended content
+the appender file is appended on its source storage server only, the
+replicas are synced by the appended ranges
+**/
+static int storage_append_file(StorageClientInfo *pClientInfo, \
+				const int64_t nInPackLen)
+{
+	char out_buff[FDFS_PROTO_MAX_HEADER_SIZE + TRACKER_PROTO_PKG_LEN_SIZE];
+	char filename[128];
+	char full_filename[MAX_PATH_SIZE];
+	char src_ip_addr[FDFS_IPADDR_SIZE];
+	char local_ip_addr[FDFS_IPADDR_SIZE];
+	unsigned int crc32;
+	int64_t offset;
+	int64_t append_bytes;
+	int header_len;
+	int out_len;
+	int status;
+
+	offset = -1;
+	while (1)
+	{
+		if ((status=storage_recv_append_header(pClientInfo, \
+			nInPackLen, STORAGE_PROTO_CMD_APPEND_FILE, &offset, \
+			&append_bytes, filename, full_filename, \
+			sizeof(full_filename))) != 0)
+		{
+			break;
+		}
+
+		if (storage_get_appender_source(filename, src_ip_addr) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, file: %s " \
+				"is not an appender file", __LINE__, \
+				pClientInfo->ip_addr, filename);
+			status = EINVAL;
+		}
+		else if (tracker_get_registered_ip(local_ip_addr) != 0 || \
+			strcmp(src_ip_addr, local_ip_addr) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, the appender file: %s " \
+				"should be appended on the source " \
+				"storage server: %s", __LINE__, \
+				pClientInfo->ip_addr, filename, src_ip_addr);
+			status = EPERM;
+		}
+		else if (!fileExists(full_filename))
+		{
+			status = ENOENT;
+		}
+
+		if (status != 0)
+		{
+			storage_recv_to_fd(pClientInfo->sock, -1, 0, \
+					append_bytes, &crc32);
+			break;
+		}
+
+		if ((status=storage_recv_append_file(pClientInfo->sock, \
+			full_filename, &offset, append_bytes)) != 0)
+		{
+			break;
+		}
+
+		if (append_bytes > 0)
+		{
+			status = storage_binlog_write_append( \
+					STORAGE_OP_TYPE_SOURCE_APPEND_FILE, \
+					filename, offset, append_bytes);
+		}
+		break;
+	}
+
+	out_len = status == 0 ? FDFS_PROTO_FIELD_SIZE( \
+			pClientInfo->proto_version) : 0;
+	header_len = storage_pack_resp_header(pClientInfo, status, \
+			out_len, out_buff);
+	if (out_len > 0)
+	{
+		fdfs_pack_size_field(pClientInfo->proto_version, offset, \
+			out_buff + header_len);
+	}
+
+	if (tcpsenddata(pClientInfo->sock, out_buff, \
+		header_len + out_len, g_network_timeout) != 1)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, send data fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pClientInfo->ip_addr, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+
+	return status;
+}
+
+/**
+pkg format (protocol version 2):
+Header
+8 bytes: filename bytes
+8 bytes: the offset to append
+8 bytes: the appended bytes
+FDFS_GROUP_NAME_MAX_LEN bytes: group_name
+filename bytes : the appender filename
+remain bytes: the appended content
+**/
+static int storage_sync_append_file(StorageClientInfo *pClientInfo, \
+				const int64_t nInPackLen)
+{
+	char filename[128];
+	char full_filename[MAX_PATH_SIZE];
+	unsigned int crc32;
+	int64_t offset;
+	int64_t append_bytes;
+	int status;
+
+	while (1)
+	{
+		if ((status=storage_recv_append_header(pClientInfo, \
+			nInPackLen, STORAGE_PROTO_CMD_SYNC_APPEND_FILE, \
+			&offset, &append_bytes, filename, full_filename, \
+			sizeof(full_filename))) != 0)
+		{
+			break;
+		}
+
+		/* the sender copies the whole file when ENOENT */
+		if (!fileExists(full_filename))
+		{
+			storage_recv_to_fd(pClientInfo->sock, -1, 0, \
+					append_bytes, &crc32);
+			status = ENOENT;
+			break;
+		}
+
+		if ((status=storage_recv_append_file(pClientInfo->sock, \
+			full_filename, &offset, append_bytes)) != 0)
+		{
+			break;
+		}
+
+		status = storage_binlog_write_append( \
+				STORAGE_OP_TYPE_REPLICA_APPEND_FILE, \
+				filename, offset, append_bytes);
+		break;
+	}
+
+	if (storage_send_resp_header(pClientInfo, status, 0) != 1)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, send data fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pClientInfo->ip_addr, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+
+	return status == ENOENT ? 0 : status;
+}
+
+/*
+read the metadata of the file to the offset of the thread buffer
+return: 0 for success, meta_bytes is 0 when no metadata, ENOENT for the
+	file not exist, != 0 for fail
+*/
+static int storage_read_metadata(StorageClientInfo *pClientInfo, \
+		const char *filename, const int offset, int *meta_bytes)
+{
+	char full_filename[MAX_PATH_SIZE + 128];
+	int store_path_index;
+	int result;
+
+	*meta_bytes = 0;
+	if ((result=storage_get_full_filename(filename, full_filename, \
+			sizeof(full_filename), &store_path_index)) != 0)
+	{
+		return result;
+	}
+	if (!storage_file_exists(filename, full_filename))
+	{
+		return ENOENT;
+	}
+
+	if (storage_alloc_meta_buff(pClientInfo, offset + 1) == NULL)
+	{
+		return ENOMEM;
+	}
+
+	storage_disk_io_begin(store_path_index);
+	result = storage_meta_read(filename, pClientInfo->meta_buff + offset, \
+			pClientInfo->meta_buff_size - offset, meta_bytes);
+	if (result == ENOSPC)
+	{
+		if (storage_alloc_meta_buff(pClientInfo, \
+				offset + *meta_bytes) == NULL)
+		{
+			result = ENOMEM;
+		}
+		else
+		{
+			result = storage_meta_read(filename, \
+				pClientInfo->meta_buff + offset, \
+				pClientInfo->meta_buff_size - offset, \
+				meta_bytes);
+		}
+	}
+	storage_disk_io_end(store_path_index);
+
+	if (result == ENOENT)  //the file has no metadata
+	{
+		result = 0;
 	}
+	if (result != 0)
+	{
+		*meta_bytes = 0;
+	}
+	return result;
+}
+
+/**
+pkg format:
+Header
+FDFS_GROUP_NAME_MAX_LEN bytes: group_name
+filename
+**/
+static int storage_get_metadata(StorageClientInfo *pClientInfo, \
+				const int nInPackLen)
+{
+	TrackerHeader resp;
+	int result;
+	char in_buff[FDFS_GROUP_NAME_MAX_LEN + 32];
+	char group_name[FDFS_GROUP_NAME_MAX_LEN + 1];
+	char *file_buff;
+	int file_bytes;
 
-	resp.cmd = STORAGE_PROTO_CMD_RESP;
-	if (resp.status == 0)
+	file_buff = NULL;
+	file_bytes = 0;
+	while (1)
 	{
-		out_len = filename_len;
-		sprintf(resp.pkg_len, "%x", out_len);
+		if (nInPackLen <= FDFS_GROUP_NAME_MAX_LEN)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"cmd=%d, client ip: %s, package size %d " \
+				"is not correct, " \
+				"expect length > %d", \
+				__LINE__, \
+				STORAGE_PROTO_CMD_UPLOAD_FILE, \
+				pClientInfo->ip_addr,  \
+				nInPackLen, FDFS_GROUP_NAME_MAX_LEN);
+			resp.status = EINVAL;
+			break;
+		}
+
+		if (nInPackLen >= sizeof(in_buff))
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"cmd=%d, client ip: %s, package size %d " \
+				"is too large, " \
+				"expect length should < %d", \
+				__LINE__, \
+				STORAGE_PROTO_CMD_UPLOAD_FILE, \
+				pClientInfo->ip_addr,  \
+				nInPackLen, sizeof(in_buff));
+			resp.status = EINVAL;
+			break;
+		}
+
+		if (tcprecvdata(pClientInfo->sock, in_buff, \
+			nInPackLen, g_network_timeout) != 1)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip:%s, recv data fail, " \
+				"errno: %d, error info: %s.", \
+				__LINE__, pClientInfo->ip_addr, \
+				errno, strerror(errno));
+			resp.status = errno != 0 ? errno : EPIPE;
+			break;
+		}
+
+		memcpy(group_name, in_buff, FDFS_GROUP_NAME_MAX_LEN);
+		group_name[FDFS_GROUP_NAME_MAX_LEN] = '\0';
+		if (strcmp(group_name, g_group_name) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip:%s, group_name: %s " \
+				"not correct, should be: %s", \
+				__LINE__, pClientInfo->ip_addr, \
+				group_name, g_group_name);
+			resp.status = EINVAL;
+			break;
+		}
 
-		memcpy(out_buff, &resp, sizeof(resp));
-		memcpy(out_buff+sizeof(resp), filename, filename_len);
+		*(in_buff + nInPackLen) = '\0';
+		resp.status = storage_read_metadata(pClientInfo, \
+				in_buff + FDFS_GROUP_NAME_MAX_LEN, \
+				0, &file_bytes);
+		file_buff = pClientInfo->meta_buff;
+		break;
 	}
-	else
+
+	if (storage_send_resp_header(pClientInfo, resp.status, \
+		file_bytes) != 1)
 	{
-		out_len = 0;
-		sprintf(resp.pkg_len, "%x", out_len);
-		memcpy(out_buff, &resp, sizeof(resp));
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, send data fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pClientInfo->ip_addr, \
+			errno, strerror(errno));
+
+		return errno != 0 ? errno : EPIPE;
 	}
 
-	if (in_buff != NULL)
+	if (resp.status != 0)
 	{
-		free(in_buff);
+		return resp.status;
 	}
 
-	if (tcpsenddata(pClientInfo->sock, out_buff, \
-		sizeof(resp) + out_len, g_network_timeout) != 1)
+	result = tcpsenddata(pClientInfo->sock, \
+		file_buff, file_bytes, g_network_timeout);
+	if(result != 1)
 	{
 		logError("file: "__FILE__", line: %d, " \
 			"client ip: %s, send data fail, " \
 			"errno: %d, error info: %s", \
 			__LINE__, pClientInfo->ip_addr, \
 			errno, strerror(errno));
+
 		return errno != 0 ? errno : EPIPE;
 	}
 
@@ -684,44 +2416,62 @@ static int storage_upload_file(StorageClientInfo *pClientInfo, \
 }
 
 /**
-9 bytes: filename bytes
-9 bytes: file size
+pkg format:
+Header
 FDFS_GROUP_NAME_MAX_LEN bytes: group_name
-filename bytes : filename
-file size bytes: file content
+TRACKER_PROTO_PKG_LEN_SIZE bytes: file count (hex string)
+TRACKER_PROTO_PKG_LEN_SIZE bytes: key list length (hex string), 0 for all
+key list length bytes: key names seperated by FDFS_RECORD_SEPERATOR
+file count items:
+	TRACKER_PROTO_PKG_LEN_SIZE bytes: filename length (hex string)
+	filename length bytes: filename
+response: file count records, see STORAGE_BATCH_META_FIXED_LEN
 **/
-static int storage_sync_copy_file(StorageClientInfo *pClientInfo, \
-			const int nInPackLen, const char proto_cmd)
+static int storage_batch_get_metadata(StorageClientInfo *pClientInfo, \
+				const int nInPackLen)
 {
 	TrackerHeader resp;
-	char *in_buff;
-	char *pBuff;
+	FDFSMetaSlice keys[STORAGE_MAX_BATCH_META_KEYS];
 	char group_name[FDFS_GROUP_NAME_MAX_LEN + 1];
+	char sz_len[TRACKER_PROTO_PKG_LEN_SIZE + 1];
 	char filename[128];
-	char full_filename[MAX_PATH_SIZE];
+	char *in_buff;
+	char *pIn;
+	char *pInEnd;
+	char *pRecord;
+	int out_bytes;
 	int filename_len;
-	int file_bytes;
+	int keys_len;
+	int key_count;
+	int meta_bytes;
+	int count;
+	int status;
+	int i;
+	int result;
 
 	in_buff = NULL;
+	out_bytes = 0;
 	while (1)
 	{
-		if (nInPackLen <= 2 * TRACKER_PROTO_PKG_LEN_SIZE + \
-					FDFS_GROUP_NAME_MAX_LEN)
+		if (nInPackLen <= FDFS_GROUP_NAME_MAX_LEN + \
+			2 * TRACKER_PROTO_PKG_LEN_SIZE || nInPackLen > \
+			FDFS_GROUP_NAME_MAX_LEN + 2 * TRACKER_PROTO_PKG_LEN_SIZE \
+			+ STORAGE_MAX_BATCH_META_KEYS * \
+			(FDFS_MAX_META_NAME_LEN + 1) + \
+			STORAGE_MAX_BATCH_META_COUNT * \
+			(TRACKER_PROTO_PKG_LEN_SIZE + sizeof(filename)))
 		{
 			logError("file: "__FILE__", line: %d, " \
 				"cmd=%d, client ip: %s, package size %d " \
-				"is not correct, " \
-				"expect length > %d", \
+				"is not correct", \
 				__LINE__, \
-				STORAGE_PROTO_CMD_SYNC_CREATE_FILE, \
-				pClientInfo->ip_addr,  nInPackLen, \
-				2 * TRACKER_PROTO_PKG_LEN_SIZE + \
-					FDFS_GROUP_NAME_MAX_LEN);
+				STORAGE_PROTO_CMD_BATCH_GET_METADATA, \
+				pClientInfo->ip_addr, nInPackLen);
 			resp.status = EINVAL;
 			break;
 		}
 
-		in_buff = (char *)malloc(nInPackLen + 1);
+		in_buff = (char *)malloc(nInPackLen);
 		if (in_buff == NULL)
 		{
 			resp.status = errno != 0 ? errno : ENOMEM;
@@ -733,47 +2483,18 @@ static int storage_sync_copy_file(StorageClientInfo *pClientInfo, \
 		{
 			logError("file: "__FILE__", line: %d, " \
 				"client ip: %s, recv data fail, " \
-				"expect pkg length: %d, " \
-				"errno: %d, error info: %s.", \
-				__LINE__, \
-				pClientInfo->ip_addr, nInPackLen, \
+				"errno: %d, error info: %s", \
+				__LINE__, pClientInfo->ip_addr, \
 				errno, strerror(errno));
 			resp.status = errno != 0 ? errno : EPIPE;
 			break;
 		}
 
-		*(in_buff + nInPackLen) = '\0';
-		pBuff = in_buff;
-		filename_len = strtol(pBuff, NULL, 16);
-		pBuff += TRACKER_PROTO_PKG_LEN_SIZE;
-		file_bytes = strtol(pBuff, NULL, 16);
-		pBuff += TRACKER_PROTO_PKG_LEN_SIZE;
-
-		if (filename_len < 0 || filename_len >= sizeof(filename))
-		{
-			logError("file: "__FILE__", line: %d, " \
-				"client ip: %s, in request pkg, " \
-				"filename length: %d is invalid, " \
-				"which < 0 or >= %d", \
-				__LINE__, pClientInfo->ip_addr, \
-				filename_len,  sizeof(filename));
-			resp.status = EPIPE;
-			break;
-		}
-
-		if (file_bytes < 0)
-		{
-			logError("file: "__FILE__", line: %d, " \
-				"client ip: %s, in request pkg, " \
-				"file size: %d is invalid, which < 0", \
-				__LINE__, pClientInfo->ip_addr, file_bytes);
-			resp.status = EPIPE;
-			break;
-		}
-
-		memcpy(group_name, pBuff, FDFS_GROUP_NAME_MAX_LEN);
-		pBuff += FDFS_GROUP_NAME_MAX_LEN;
+		pIn = in_buff;
+		pInEnd = in_buff + nInPackLen;
+		memcpy(group_name, pIn, FDFS_GROUP_NAME_MAX_LEN);
 		group_name[FDFS_GROUP_NAME_MAX_LEN] = '\0';
+		pIn += FDFS_GROUP_NAME_MAX_LEN;
 		if (strcmp(group_name, g_group_name) != 0)
 		{
 			logError("file: "__FILE__", line: %d, " \
@@ -785,54 +2506,96 @@ static int storage_sync_copy_file(StorageClientInfo *pClientInfo, \
 			break;
 		}
 
-		memcpy(filename, pBuff, filename_len);
-		filename[filename_len] = '\0';
-		snprintf(full_filename, sizeof(full_filename), \
-				"%s/data/%s", g_base_path, filename);
-		pBuff += filename_len;
-		if (file_bytes != nInPackLen - (pBuff - in_buff))
+		memcpy(sz_len, pIn, TRACKER_PROTO_PKG_LEN_SIZE);
+		sz_len[TRACKER_PROTO_PKG_LEN_SIZE] = '\0';
+		count = strtol(sz_len, NULL, 16);
+		pIn += TRACKER_PROTO_PKG_LEN_SIZE;
+		memcpy(sz_len, pIn, TRACKER_PROTO_PKG_LEN_SIZE);
+		sz_len[TRACKER_PROTO_PKG_LEN_SIZE] = '\0';
+		keys_len = strtol(sz_len, NULL, 16);
+		pIn += TRACKER_PROTO_PKG_LEN_SIZE;
+		if (count <= 0 || count > STORAGE_MAX_BATCH_META_COUNT || \
+			keys_len < 0 || keys_len > pInEnd - pIn)
 		{
 			logError("file: "__FILE__", line: %d, " \
-				"client ip: %s, in request pkg, " \
-				"file size: %d != remain bytes: %d", \
-				__LINE__, pClientInfo->ip_addr, file_bytes, \
-				nInPackLen - (pBuff - in_buff));
-			resp.status = EPIPE;
+				"client ip: %s, invalid file count: %d " \
+				"or key list length: %d", __LINE__, \
+				pClientInfo->ip_addr, count, keys_len);
+			resp.status = EINVAL;
 			break;
 		}
 
-		if ((proto_cmd == STORAGE_PROTO_CMD_SYNC_CREATE_FILE) && \
-			fileExists(full_filename))
+		key_count = fdfs_split_metadata_keys(pIn, keys_len, \
+				keys, STORAGE_MAX_BATCH_META_KEYS);
+		if (key_count < 0)
 		{
 			logError("file: "__FILE__", line: %d, " \
-				"cmd=%d, client ip: %s, data file: %s " \
-				"already exists, ignore it", \
-				__LINE__, \
-				STORAGE_PROTO_CMD_SYNC_CREATE_FILE, \
-				pClientInfo->ip_addr, full_filename);
-			resp.status = EEXIST;
+				"client ip: %s, key count exceeds %d", \
+				__LINE__, pClientInfo->ip_addr, \
+				STORAGE_MAX_BATCH_META_KEYS);
+			resp.status = EINVAL;
 			break;
 		}
+		pIn += keys_len;
 
-		if ((resp.status=writeToFile(full_filename, \
-				pBuff, file_bytes)) != 0)
+		resp.status = 0;
+		for (i=0; i<count; i++)
 		{
-			break;
-		}
+			if (pInEnd - pIn < TRACKER_PROTO_PKG_LEN_SIZE)
+			{
+				resp.status = EINVAL;
+				break;
+			}
+			memcpy(sz_len, pIn, TRACKER_PROTO_PKG_LEN_SIZE);
+			sz_len[TRACKER_PROTO_PKG_LEN_SIZE] = '\0';
+			filename_len = strtol(sz_len, NULL, 16);
+			pIn += TRACKER_PROTO_PKG_LEN_SIZE;
+			if (filename_len <= 0 || filename_len >= \
+				sizeof(filename) || filename_len > pInEnd - pIn)
+			{
+				resp.status = EINVAL;
+				break;
+			}
+			memcpy(filename, pIn, filename_len);
+			filename[filename_len] = '\0';
+			pIn += filename_len;
 
-		if (proto_cmd == STORAGE_PROTO_CMD_SYNC_CREATE_FILE)
-		{
-			resp.status = storage_binlog_write( \
-				STORAGE_OP_TYPE_REPLICA_CREATE_FILE, \
-				filename);
+			/* the metadata is read after the record header */
+			if (storage_alloc_meta_buff(pClientInfo, out_bytes + \
+				STORAGE_BATCH_META_FIXED_LEN + 1) == NULL)
+			{
+				resp.status = ENOMEM;
+				break;
+			}
+			status = storage_read_metadata(pClientInfo, filename, \
+				out_bytes + STORAGE_BATCH_META_FIXED_LEN, \
+				&meta_bytes);
+			if (status == ENOMEM)
+			{
+				resp.status = ENOMEM;
+				break;
+			}
+
+			pRecord = pClientInfo->meta_buff + out_bytes;
+			if (status == 0 && key_count > 0)
+			{
+				meta_bytes = fdfs_filter_metadata(pRecord + \
+					STORAGE_BATCH_META_FIXED_LEN, \
+					meta_bytes, keys, key_count);
+			}
+
+			*pRecord = status;
+			sprintf(pRecord + 1, "%x", meta_bytes);
+			out_bytes += STORAGE_BATCH_META_FIXED_LEN + meta_bytes;
 		}
-		else
+
+		if (resp.status == EINVAL)
 		{
-			resp.status = storage_binlog_write( \
-				STORAGE_OP_TYPE_REPLICA_UPDATE_FILE, \
-				filename);
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, the filename of file " \
+				"index: %d is invalid", __LINE__, \
+				pClientInfo->ip_addr, i);
 		}
-
 		break;
 	}
 
@@ -841,11 +2604,13 @@ static int storage_sync_copy_file(StorageClientInfo *pClientInfo, \
 		free(in_buff);
 	}
 
-	resp.cmd = STORAGE_PROTO_CMD_RESP;
-	resp.pkg_len[0] = '0';
-	resp.pkg_len[1] = '\0';
-	if (tcpsenddata(pClientInfo->sock, \
-		&resp, sizeof(resp), g_network_timeout) != 1)
+	if (resp.status != 0)
+	{
+		out_bytes = 0;
+	}
+
+	if (storage_send_resp_header(pClientInfo, resp.status, \
+		out_bytes) != 1)
 	{
 		logError("file: "__FILE__", line: %d, " \
 			"client ip: %s, send data fail, " \
@@ -855,61 +2620,66 @@ static int storage_sync_copy_file(StorageClientInfo *pClientInfo, \
 		return errno != 0 ? errno : EPIPE;
 	}
 
-	if (resp.status == EEXIST)
-	{
-		return 0;
-	}
-	else
+	if (out_bytes > 0 && tcpsenddata(pClientInfo->sock, \
+		pClientInfo->meta_buff, out_bytes, g_network_timeout) != 1)
 	{
-		return resp.status;
+		result = errno != 0 ? errno : EPIPE;
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, send data fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pClientInfo->ip_addr, \
+			result, strerror(result));
+		return result;
 	}
+
+	return resp.status;
 }
 
 /**
 pkg format:
 Header
 FDFS_GROUP_NAME_MAX_LEN bytes: group_name
-filename
+TRACKER_PROTO_PKG_LEN_SIZE bytes: max count of the filenames (hex string)
+TRACKER_PROTO_PKG_LEN_SIZE bytes: cursor length (hex string)
+cursor length bytes: the last filename of the previous page, empty for
+	the first page
+remain bytes: name FDFS_FIELD_SEPERATOR value, the name must be one of
+	meta_index_keys
+response: the filenames seperated by FDFS_RECORD_SEPERATOR, sorted by
+	filename, less than max count for the last page
 **/
-static int storage_get_metadata(StorageClientInfo *pClientInfo, \
+static int storage_query_by_metadata(StorageClientInfo *pClientInfo, \
 				const int nInPackLen)
 {
 	TrackerHeader resp;
-	int result;
-	char in_buff[FDFS_GROUP_NAME_MAX_LEN + 32];
+	char in_buff[FDFS_GROUP_NAME_MAX_LEN + 2 * TRACKER_PROTO_PKG_LEN_SIZE \
+		+ 128 + FDFS_MAX_META_NAME_LEN + FDFS_MAX_META_VALUE_LEN + 2];
 	char group_name[FDFS_GROUP_NAME_MAX_LEN + 1];
-	char full_filename[MAX_PATH_SIZE+sizeof(in_buff)+32];
-	char *file_buff;
-	int file_bytes;
+	char sz_len[TRACKER_PROTO_PKG_LEN_SIZE + 1];
+	char cursor[128];
+	char *pIn;
+	char *pInEnd;
+	char *pName;
+	char *pValue;
+	int max_count;
+	int cursor_len;
+	int count;
+	int out_bytes;
+	int result;
 
-	file_buff = NULL;
-	file_bytes = 0;
+	out_bytes = 0;
 	while (1)
 	{
-		if (nInPackLen <= FDFS_GROUP_NAME_MAX_LEN)
-		{
-			logError("file: "__FILE__", line: %d, " \
-				"cmd=%d, client ip: %s, package size %d " \
-				"is not correct, " \
-				"expect length > %d", \
-				__LINE__, \
-				STORAGE_PROTO_CMD_UPLOAD_FILE, \
-				pClientInfo->ip_addr,  \
-				nInPackLen, FDFS_GROUP_NAME_MAX_LEN);
-			resp.status = EINVAL;
-			break;
-		}
-
-		if (nInPackLen >= sizeof(in_buff))
+		if (nInPackLen <= FDFS_GROUP_NAME_MAX_LEN + \
+			2 * TRACKER_PROTO_PKG_LEN_SIZE || \
+			nInPackLen >= sizeof(in_buff))
 		{
 			logError("file: "__FILE__", line: %d, " \
 				"cmd=%d, client ip: %s, package size %d " \
-				"is too large, " \
-				"expect length should < %d", \
+				"is not correct", \
 				__LINE__, \
-				STORAGE_PROTO_CMD_UPLOAD_FILE, \
-				pClientInfo->ip_addr,  \
-				nInPackLen, sizeof(in_buff));
+				STORAGE_PROTO_CMD_QUERY_BY_METADATA, \
+				pClientInfo->ip_addr, nInPackLen);
 			resp.status = EINVAL;
 			break;
 		}
@@ -917,17 +2687,21 @@ static int storage_get_metadata(StorageClientInfo *pClientInfo, \
 		if (tcprecvdata(pClientInfo->sock, in_buff, \
 			nInPackLen, g_network_timeout) != 1)
 		{
-			logError("file: "__FILE__", line: %d, " \
-				"client ip:%s, recv data fail, " \
-				"errno: %d, error info: %s.", \
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, recv data fail, " \
+				"errno: %d, error info: %s", \
 				__LINE__, pClientInfo->ip_addr, \
 				errno, strerror(errno));
 			resp.status = errno != 0 ? errno : EPIPE;
 			break;
 		}
+		in_buff[nInPackLen] = '\0';
 
-		memcpy(group_name, in_buff, FDFS_GROUP_NAME_MAX_LEN);
+		pIn = in_buff;
+		pInEnd = in_buff + nInPackLen;
+		memcpy(group_name, pIn, FDFS_GROUP_NAME_MAX_LEN);
 		group_name[FDFS_GROUP_NAME_MAX_LEN] = '\0';
+		pIn += FDFS_GROUP_NAME_MAX_LEN;
 		if (strcmp(group_name, g_group_name) != 0)
 		{
 			logError("file: "__FILE__", line: %d, " \
@@ -939,72 +2713,153 @@ static int storage_get_metadata(StorageClientInfo *pClientInfo, \
 			break;
 		}
 
-		*(in_buff + nInPackLen) = '\0';
-		sprintf(full_filename, "%s/data/%s", \
-				g_base_path, in_buff+FDFS_GROUP_NAME_MAX_LEN);
-		if (!fileExists(full_filename))
+		memcpy(sz_len, pIn, TRACKER_PROTO_PKG_LEN_SIZE);
+		sz_len[TRACKER_PROTO_PKG_LEN_SIZE] = '\0';
+		max_count = strtol(sz_len, NULL, 16);
+		pIn += TRACKER_PROTO_PKG_LEN_SIZE;
+		memcpy(sz_len, pIn, TRACKER_PROTO_PKG_LEN_SIZE);
+		sz_len[TRACKER_PROTO_PKG_LEN_SIZE] = '\0';
+		cursor_len = strtol(sz_len, NULL, 16);
+		pIn += TRACKER_PROTO_PKG_LEN_SIZE;
+		if (max_count <= 0 || max_count > STORAGE_MAX_META_QUERY_COUNT \
+			|| cursor_len < 0 || cursor_len >= sizeof(cursor) || \
+			cursor_len > pInEnd - pIn)
 		{
-			resp.status = ENOENT;
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, invalid max count: %d " \
+				"or cursor length: %d", __LINE__, \
+				pClientInfo->ip_addr, max_count, cursor_len);
+			resp.status = EINVAL;
 			break;
 		}
+		memcpy(cursor, pIn, cursor_len);
+		cursor[cursor_len] = '\0';
+		pIn += cursor_len;
 
-		strcat(full_filename, STORAGE_META_FILE_EXT);
-		resp.status = getFileContent(full_filename, \
-				&file_buff, &file_bytes);
-		if (resp.status == ENOENT)
+		pName = pIn;
+		pValue = strchr(pName, FDFS_FIELD_SEPERATOR);
+		if (pValue == NULL)
 		{
-			resp.status = 0;
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, the metadata value " \
+				"not found", __LINE__, pClientInfo->ip_addr);
+			resp.status = EINVAL;
+			break;
+		}
+		*pValue++ = '\0';
+
+		if (storage_alloc_meta_buff(pClientInfo, \
+			max_count * sizeof(cursor)) == NULL)
+		{
+			resp.status = ENOMEM;
+			break;
+		}
+
+		resp.status = storage_meta_index_query(pName, pValue, cursor, \
+				pClientInfo->meta_buff, \
+				pClientInfo->meta_buff_size, max_count, \
+				&count, &out_bytes);
+		if (resp.status == EINVAL)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, the metadata name: %s " \
+				"is not indexed", __LINE__, \
+				pClientInfo->ip_addr, pName);
 		}
 		break;
 	}
 
-	resp.cmd = STORAGE_PROTO_CMD_RESP;
-	sprintf(resp.pkg_len, "%x", file_bytes);
+	if (resp.status != 0)
+	{
+		out_bytes = 0;
+	}
 
-	if (tcpsenddata(pClientInfo->sock, \
-		&resp, sizeof(resp), g_network_timeout) != 1)
+	if (storage_send_resp_header(pClientInfo, resp.status, \
+		out_bytes) != 1)
 	{
 		logError("file: "__FILE__", line: %d, " \
 			"client ip: %s, send data fail, " \
 			"errno: %d, error info: %s", \
 			__LINE__, pClientInfo->ip_addr, \
 			errno, strerror(errno));
-
-		if (file_buff != NULL)
-		{
-			free(file_buff);
-		}
 		return errno != 0 ? errno : EPIPE;
 	}
 
-	if (resp.status != 0)
+	if (out_bytes > 0 && tcpsenddata(pClientInfo->sock, \
+		pClientInfo->meta_buff, out_bytes, g_network_timeout) != 1)
 	{
-		if (file_buff != NULL)
-		{
-			free(file_buff);
-		}
-
-		return resp.status;
+		result = errno != 0 ? errno : EPIPE;
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, send data fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pClientInfo->ip_addr, \
+			result, strerror(result));
+		return result;
 	}
 
-	result = tcpsenddata(pClientInfo->sock, \
-		file_buff, file_bytes, g_network_timeout);
-	if (file_buff != NULL)
+	return resp.status;
+}
+
+/*
+the file is opened before the response header sent, so an error after
+the header means the connection is broken, the v1 response can't carry
+the file larger than 2GB
+*/
+static int storage_send_stream_file(StorageClientInfo *pClientInfo, \
+		const char *full_filename)
+{
+	int64_t file_size;
+	int fd;
+	int result;
+	char status;
+
+	fd = -1;
+	file_size = 0;
+	if ((status=storage_open_send_file(full_filename, \
+		&fd, &file_size)) == 0 && \
+		pClientInfo->proto_version != FDFS_PROTO_VERSION_2 && \
+		file_size > INT_MAX)
 	{
-		free(file_buff);
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, file %s is too large " \
+			"for the v1 protocol", __LINE__, \
+			pClientInfo->ip_addr, full_filename);
+		status = EFBIG;
 	}
-	if(result != 1)
+
+	if (storage_send_resp_header(pClientInfo, status, \
+		status == 0 ? file_size : 0) != 1)
 	{
+		result = errno != 0 ? errno : EPIPE;
 		logError("file: "__FILE__", line: %d, " \
 			"client ip: %s, send data fail, " \
 			"errno: %d, error info: %s", \
 			__LINE__, pClientInfo->ip_addr, \
-			errno, strerror(errno));
+			result, strerror(result));
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return result;
+	}
 
-		return errno != 0 ? errno : EPIPE;
+	if (status != 0)
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return status;
 	}
 
-	return resp.status;
+	result = storage_send_file_fd(pClientInfo->sock, fd, \
+			full_filename, file_size);
+	close(fd);
+	if (result == ENOENT)  //the content is partly sent
+	{
+		result = EIO;
+	}
+	return result;
 }
 
 /**
@@ -1017,12 +2872,17 @@ static int storage_download_file(StorageClientInfo *pClientInfo, \
 				const int nInPackLen)
 {
 	TrackerHeader resp;
+	FDFSProtoHeader header;
+	FDFSProtoHeader *pHeader;
 	int result;
 	char in_buff[FDFS_GROUP_NAME_MAX_LEN + 32];
 	char group_name[FDFS_GROUP_NAME_MAX_LEN + 1];
 	char full_filename[MAX_PATH_SIZE+sizeof(in_buff)+16];
 	char *file_buff;
+	struct stat stat_buf;
 	int file_bytes;
+	int store_path_index;
+	int cache_version;
 
 	file_buff = NULL;
 	file_bytes = 0;
@@ -1082,18 +2942,66 @@ static int storage_download_file(StorageClientInfo *pClientInfo, \
 		}
 
 		*(in_buff + nInPackLen) = '\0';
-		sprintf(full_filename, "%s/data/%s", g_base_path, \
-				in_buff+FDFS_GROUP_NAME_MAX_LEN);
-		resp.status=getFileContent(full_filename, \
+		if ((resp.status=storage_get_full_filename( \
+			in_buff+FDFS_GROUP_NAME_MAX_LEN, full_filename, \
+			sizeof(full_filename), &store_path_index)) != 0)
+		{
+			break;
+		}
+
+		if (pClientInfo->proto_version == FDFS_PROTO_VERSION_2)
+		{
+			header.request_id = pClientInfo->request_id;
+			header.cmd = STORAGE_PROTO_CMD_RESP;
+			header.status = 0;
+			header.flags = 0;
+			header.version = FDFS_PROTO_VERSION_2;
+			pHeader = &header;
+		}
+		else
+		{
+			pHeader = NULL;  //send the cached v1 response
+		}
+		result = storage_hot_cache_send( \
+				in_buff+FDFS_GROUP_NAME_MAX_LEN, \
+				pClientInfo->sock, pHeader, \
+				&file_bytes, &cache_version);
+		if (result == 0)
+		{
+			return 0;
+		}
+		if (result != ENOENT)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, send data fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, pClientInfo->ip_addr, \
+				result, strerror(result));
+			return result;
+		}
+
+		/* the large file is sent from the disk by chunks */
+		if (stat(full_filename, &stat_buf) == 0 && \
+			stat_buf.st_size >= STORAGE_STREAM_FILE_SIZE)
+		{
+			return storage_send_stream_file(pClientInfo, \
+					full_filename);
+		}
+
+		resp.status = storage_read_file( \
+				in_buff+FDFS_GROUP_NAME_MAX_LEN, \
+				full_filename, store_path_index, \
 				&file_buff, &file_bytes);
+		if (resp.status == 0)
+		{
+			storage_hot_cache_put(in_buff+FDFS_GROUP_NAME_MAX_LEN, \
+				file_buff, file_bytes, cache_version);
+		}
 		break;
 	}
 
-	resp.cmd = STORAGE_PROTO_CMD_RESP;
-	sprintf(resp.pkg_len, "%x", file_bytes);
-
-	if (tcpsenddata(pClientInfo->sock, \
-		&resp, sizeof(resp), g_network_timeout) != 1)
+	if (storage_send_resp_header(pClientInfo, resp.status, \
+		file_bytes) != 1)
 	{
 		logError("file: "__FILE__", line: %d, " \
 			"client ip: %s, send data fail, " \
@@ -1148,10 +3056,12 @@ static int storage_sync_delete_file(StorageClientInfo *pClientInfo, \
 				const int nInPackLen)
 {
 	TrackerHeader resp;
-	char in_buff[FDFS_GROUP_NAME_MAX_LEN + 32];
+	char in_buff[FDFS_GROUP_NAME_MAX_LEN + 64];
 	char group_name[FDFS_GROUP_NAME_MAX_LEN + 1];
 	char full_filename[MAX_PATH_SIZE+sizeof(in_buff)];
 	char *filename;
+	char data_filename[128];
+	int store_path_index;
 
 	while (1)
 	{
@@ -1210,9 +3120,35 @@ static int storage_sync_delete_file(StorageClientInfo *pClientInfo, \
 
 		*(in_buff + nInPackLen) = '\0';
 		filename = in_buff + FDFS_GROUP_NAME_MAX_LEN;
-		sprintf(full_filename, "%s/data/%s", \
-			g_base_path, filename);
-		if (unlink(full_filename) != 0)
+		if ((resp.status=storage_get_full_filename(filename, \
+			full_filename, sizeof(full_filename), \
+			&store_path_index)) != 0)
+		{
+			break;
+		}
+		if (storage_meta_get_data_filename(filename, data_filename))
+		{
+			resp.status = storage_meta_delete(data_filename);
+			if (resp.status == ENOENT)
+			{
+				logError("file: "__FILE__", line: %d, " \
+					"cmd=%d, client ip: %s, metadata of " \
+					"file %s not exist, maybe delete later?", \
+					__LINE__, \
+					STORAGE_PROTO_CMD_SYNC_DELETE_FILE, \
+					pClientInfo->ip_addr, data_filename);
+			}
+			else if (resp.status != 0)
+			{
+				break;
+			}
+		}
+		else if ((resp.status=storage_trunk_delete_file(filename)) \
+				!= 0 && resp.status != ENOENT)
+		{
+			break;
+		}
+		else if (resp.status == ENOENT && unlink(full_filename) != 0)
 		{
 			if (errno == ENOENT)
 			{
@@ -1241,11 +3177,8 @@ static int storage_sync_delete_file(StorageClientInfo *pClientInfo, \
 		break;
 	}
 
-	resp.cmd = STORAGE_PROTO_CMD_RESP;
-	strcpy(resp.pkg_len, "0");
-
-	if (tcpsenddata(pClientInfo->sock, \
-		&resp, sizeof(resp), g_network_timeout) != 1)
+	if (storage_send_resp_header(pClientInfo, resp.status, \
+		0) != 1)
 	{
 		logError("file: "__FILE__", line: %d, " \
 			"client ip: %s, send data fail, " \
@@ -1274,6 +3207,7 @@ static int storage_delete_file(StorageClientInfo *pClientInfo, \
 	char full_filename[MAX_PATH_SIZE+sizeof(in_buff)];
 	char meta_filename[MAX_PATH_SIZE+sizeof(in_buff)];
 	char *filename;
+	int store_path_index;
 
 	while (1)
 	{
@@ -1332,9 +3266,18 @@ static int storage_delete_file(StorageClientInfo *pClientInfo, \
 
 		*(in_buff + nInPackLen) = '\0';
 		filename = in_buff + FDFS_GROUP_NAME_MAX_LEN;
-		sprintf(full_filename, "%s/data/%s", \
-			g_base_path, filename);
-		if (unlink(full_filename) != 0)
+		if ((resp.status=storage_get_full_filename(filename, \
+			full_filename, sizeof(full_filename), \
+			&store_path_index)) != 0)
+		{
+			break;
+		}
+		resp.status = storage_trunk_delete_file(filename);
+		if (resp.status != 0 && resp.status != ENOENT)
+		{
+			break;
+		}
+		if (resp.status == ENOENT && unlink(full_filename) != 0)
 		{
 			logError("file: "__FILE__", line: %d, " \
 				"client ip: %s, delete file %s fail," \
@@ -1353,21 +3296,20 @@ static int storage_delete_file(StorageClientInfo *pClientInfo, \
 			break;
 		}
 
-		sprintf(meta_filename, "%s"STORAGE_META_FILE_EXT, \
-				full_filename);
-		if (unlink(meta_filename) != 0)
+		resp.status = storage_meta_delete(filename);
+		if (resp.status == ENOENT)
+		{
+			resp.status = 0;
+			break;
+		}
+		if (resp.status != 0)
 		{
 			logError("file: "__FILE__", line: %d, " \
-				"client ip: %s, delete file %s fail," \
-				"errno: %d, error info: %s", \
-				__LINE__, \
-				pClientInfo->ip_addr, meta_filename, \
-				errno, strerror(errno));
-			if (errno != ENOENT)
-			{
-				resp.status = errno != 0 ? errno : EACCES;
-				break;
-			}
+				"client ip: %s, delete metadata of file %s " \
+				"fail, errno: %d, error info: %s", \
+				__LINE__, pClientInfo->ip_addr, filename, \
+				resp.status, strerror(resp.status));
+			break;
 		}
 
 		sprintf(meta_filename, "%s"STORAGE_META_FILE_EXT, \
@@ -1378,11 +3320,8 @@ static int storage_delete_file(StorageClientInfo *pClientInfo, \
 		break;
 	}
 
-	resp.cmd = STORAGE_PROTO_CMD_RESP;
-	strcpy(resp.pkg_len, "0");
-
-	if (tcpsenddata(pClientInfo->sock, \
-		&resp, sizeof(resp), g_network_timeout) != 1)
+	if (storage_send_resp_header(pClientInfo, resp.status, \
+		0) != 1)
 	{
 		logError("file: "__FILE__", line: %d, " \
 			"client ip: %s, send data fail, " \
@@ -1413,11 +3352,13 @@ package format:
 1 bytes cmd (char)
 1 bytes status(char)
 data buff (struct)
+or the v2 header (TrackerHeaderV2) then data buff
 */
 	StorageClientInfo client_info;
-	TrackerHeader header;
+	char header_buff[FDFS_PROTO_MAX_HEADER_SIZE];
+	FDFSProtoHeader header;
 	int result;
-	int nInPackLen;
+	int64_t nInPackLen;
 	int count;
 	
 	memset(&client_info, 0, sizeof(client_info));
@@ -1428,8 +3369,8 @@ data buff (struct)
 	count = 0;
 	while (g_continue_flag)
 	{
-		result = tcprecvdata(client_info.sock, &header, \
-				sizeof(header), g_network_timeout);
+		result = tcprecvdata(client_info.sock, header_buff, \
+				sizeof(TrackerHeader), g_network_timeout);
 		if (result == 0)
 		{
 			continue;
@@ -1445,14 +3386,49 @@ data buff (struct)
 			break;
 		}
 
-		header.pkg_len[sizeof(header.pkg_len)-1] = '\0';
-		nInPackLen = strtol(header.pkg_len, NULL, 16);
+		if ((result=fdfs_parse_header(client_info.sock, \
+				header_buff, &header)) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, recv data fail, " \
+				"errno: %d, error info: %s.", \
+				__LINE__, client_info.ip_addr, \
+				result, strerror(result));
+			break;
+		}
+
+		/* only the file content may be larger than 2GB */
+		if (header.pkg_len < 0 || (header.pkg_len > INT_MAX && \
+			header.cmd != STORAGE_PROTO_CMD_UPLOAD_FILE && \
+			header.cmd != STORAGE_PROTO_CMD_SYNC_CREATE_FILE && \
+			header.cmd != STORAGE_PROTO_CMD_SYNC_CREATE_FILE_META && \
+			header.cmd != STORAGE_PROTO_CMD_SYNC_UPDATE_FILE && \
+			header.cmd != STORAGE_PROTO_CMD_UPLOAD_APPENDER_FILE && \
+			header.cmd != STORAGE_PROTO_CMD_APPEND_FILE && \
+			header.cmd != STORAGE_PROTO_CMD_SYNC_APPEND_FILE))
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, package size " \
+				INT64_PRINTF_FORMAT" is not correct", \
+				__LINE__, client_info.ip_addr, \
+				header.pkg_len);
+			break;
+		}
+
+		nInPackLen = header.pkg_len;
+		client_info.proto_version = header.version;
+		client_info.request_id = header.request_id;
 
 		if (header.cmd == STORAGE_PROTO_CMD_DOWNLOAD_FILE)
 		{
 			g_storage_stat.total_download_count++;
-			if (storage_download_file(&client_info, \
-				nInPackLen) != 0)
+			result = storage_download_file(&client_info, nInPackLen);
+			if (result == ENOENT && header.version == \
+				FDFS_PROTO_VERSION_2)
+			{
+				continue;  //keep the pipelined requests after it
+			}
+			if (result != 0)
 			{
 				break;
 			}
@@ -1470,10 +3446,93 @@ data buff (struct)
 			g_storage_stat.success_get_meta_count++;
 			CHECK_AND_WRITE_TO_STAT_FILE
 		}
+		else if (header.cmd == STORAGE_PROTO_CMD_BATCH_GET_METADATA)
+		{
+			g_storage_stat.total_get_meta_count++;
+			if (storage_batch_get_metadata(&client_info, \
+				nInPackLen) != 0)
+			{
+				break;
+			}
+			g_storage_stat.success_get_meta_count++;
+			CHECK_AND_WRITE_TO_STAT_FILE
+		}
+		else if (header.cmd == STORAGE_PROTO_CMD_QUERY_BY_METADATA)
+		{
+			g_storage_stat.total_get_meta_count++;
+			if (storage_query_by_metadata(&client_info, \
+				nInPackLen) != 0)
+			{
+				break;
+			}
+			g_storage_stat.success_get_meta_count++;
+			CHECK_AND_WRITE_TO_STAT_FILE
+		}
 		else if (header.cmd == STORAGE_PROTO_CMD_UPLOAD_FILE)
 		{
 			g_storage_stat.total_upload_count++;
 			if (storage_upload_file(&client_info, \
+				nInPackLen, false) != 0)
+			{
+				break;
+			}
+
+			g_storage_stat.success_upload_count++;
+			g_storage_stat.last_source_update = time(NULL);
+			CHECK_AND_WRITE_TO_STAT_FILE
+		}
+		else if (header.cmd == STORAGE_PROTO_CMD_UPLOAD_APPENDER_FILE)
+		{
+			g_storage_stat.total_upload_count++;
+			if (storage_upload_file(&client_info, \
+				nInPackLen, true) != 0)
+			{
+				break;
+			}
+
+			g_storage_stat.success_upload_count++;
+			g_storage_stat.last_source_update = time(NULL);
+			CHECK_AND_WRITE_TO_STAT_FILE
+		}
+		else if (header.cmd == STORAGE_PROTO_CMD_APPEND_FILE)
+		{
+			if (storage_append_file(&client_info, \
+				nInPackLen) != 0)
+			{
+				break;
+			}
+
+			g_storage_stat.last_source_update = time(NULL);
+			CHECK_AND_WRITE_TO_STAT_FILE
+		}
+		else if (header.cmd == STORAGE_PROTO_CMD_UPLOAD_BEGIN)
+		{
+			if (storage_upload_begin(&client_info, \
+				nInPackLen) != 0)
+			{
+				break;
+			}
+		}
+		else if (header.cmd == STORAGE_PROTO_CMD_UPLOAD_PART)
+		{
+			if (storage_upload_part(&client_info, \
+				nInPackLen) != 0)
+			{
+				break;
+			}
+		}
+		else if (header.cmd == STORAGE_PROTO_CMD_UPLOAD_QUERY)
+		{
+			if (storage_upload_query(&client_info, \
+				nInPackLen) != 0)
+			{
+				break;
+			}
+		}
+		else if (header.cmd == STORAGE_PROTO_CMD_UPLOAD_COMMIT)
+		{
+			g_storage_stat.total_upload_count++;
+			if (storage_upload_commit(&client_info, \
 				nInPackLen) != 0)
 			{
 				break;
@@ -1483,6 +3542,14 @@ data buff (struct)
 			g_storage_stat.last_source_update = time(NULL);
 			CHECK_AND_WRITE_TO_STAT_FILE
 		}
+		else if (header.cmd == STORAGE_PROTO_CMD_UPLOAD_ABORT)
+		{
+			if (storage_upload_abort(&client_info, \
+				nInPackLen) != 0)
+			{
+				break;
+			}
+		}
 		else if (header.cmd == STORAGE_PROTO_CMD_DELETE_FILE)
 		{
 			g_storage_stat.total_delete_count++;
@@ -1505,6 +3572,16 @@ data buff (struct)
 			g_storage_stat.last_sync_update = time(NULL);
 			CHECK_AND_WRITE_TO_STAT_FILE
 		}
+		else if (header.cmd == STORAGE_PROTO_CMD_SYNC_CREATE_FILE_META)
+		{
+			if (storage_sync_copy_file(&client_info, \
+				nInPackLen, header.cmd) != 0)
+			{
+				break;
+			}
+			g_storage_stat.last_sync_update = time(NULL);
+			CHECK_AND_WRITE_TO_STAT_FILE
+		}
 		else if (header.cmd == STORAGE_PROTO_CMD_SYNC_DELETE_FILE)
 		{
 			if (storage_sync_delete_file(&client_info, \
@@ -1525,6 +3602,26 @@ data buff (struct)
 			g_storage_stat.last_sync_update = time(NULL);
 			CHECK_AND_WRITE_TO_STAT_FILE
 		}
+		else if (header.cmd == STORAGE_PROTO_CMD_SYNC_LINK_FILE)
+		{
+			if (storage_sync_link_file(&client_info, \
+				nInPackLen) != 0)
+			{
+				break;
+			}
+			g_storage_stat.last_sync_update = time(NULL);
+			CHECK_AND_WRITE_TO_STAT_FILE
+		}
+		else if (header.cmd == STORAGE_PROTO_CMD_SYNC_APPEND_FILE)
+		{
+			if (storage_sync_append_file(&client_info, \
+				nInPackLen) != 0)
+			{
+				break;
+			}
+			g_storage_stat.last_sync_update = time(NULL);
+			CHECK_AND_WRITE_TO_STAT_FILE
+		}
 		else if (header.cmd == STORAGE_PROTO_CMD_SET_METADATA)
 		{
 			g_storage_stat.total_set_meta_count++;
@@ -1569,6 +3666,15 @@ data buff (struct)
 			__LINE__, errno, strerror(errno));
 	}
 
+	if (client_info.meta_buff != NULL)
+	{
+		free(client_info.meta_buff);
+	}
+	if (client_info.in_buff != NULL)
+	{
+		free(client_info.in_buff);
+	}
+
 	close(client_info.sock);
 	return NULL;
 }
@@ -30,7 +30,12 @@
 #include "tracker_proto.h"
 #include "storage_global.h"
 #include "storage_func.h"
+#include "storage_trunk.h"
+#include "storage_fd_cache.h"
+#include "storage_hot_cache.h"
 #include "storage_sync.h"
+#include "storage_fsync.h"
+#include "storage_meta.h"
 #include "tracker_client_thread.h"
 
 #define SYNC_BINLOG_FILE_MAX_SIZE	1024 * 1024 * 1024
@@ -46,6 +51,7 @@
 #define MARK_ITEM_UNTIL_TIMESTAMP	"until_timestamp"
 #define MARK_ITEM_SCAN_ROW_COUNT	"scan_row_count"
 #define MARK_ITEM_SYNC_ROW_COUNT	"sync_row_count"
+#define SYNC_BINLOG_RECORD_SIZE		128
 
 FILE *g_fp_binlog = NULL;
 int g_binlog_index = 0;
@@ -53,6 +59,7 @@ static int binlog_file_size = 0;
 
 int g_storage_sync_thread_count = 0;
 static pthread_mutex_t sync_thread_lock;
+static pthread_mutex_t binlog_write_lock;  //the threads write the binlog
 
 static int storage_write_to_mark_file(BinLogReader *pReader);
 static int storage_binlog_reader_skip(BinLogReader *pReader);
@@ -60,68 +67,181 @@ static void storage_reader_destroy(BinLogReader *pReader);
 
 /**
 9 bytes: filename bytes
+9 bytes: meta data bytes, only for STORAGE_PROTO_CMD_SYNC_CREATE_FILE_META
 9 bytes: file size
 FDFS_GROUP_NAME_MAX_LEN bytes: group_name
 filename bytes : filename
+meta data bytes: meta data, only for STORAGE_PROTO_CMD_SYNC_CREATE_FILE_META
 file size bytes: file content
+the large file is sent from the disk by the v2 protocol whose sizes are
+8 bytes big endian integers
 **/
 static int storage_sync_copy_file(TrackerServerInfo *pStorageServer, \
 			const BinLogRecord *pRecord, const char proto_cmd)
 {
-	TrackerHeader header;
+	FDFSProtoHeader header;
+	struct stat stat_buf;
 	int result;
 	int in_bytes;
-	int file_size;
+	int buff_size;
+	int64_t file_size;
+	int meta_bytes;
+	int store_path_index;
+	int field_size;
+	int header_len;
+	bool bStream;
+	bool bAppender;
 	char *file_buff;
+	char *meta_buff;
+	char *pBody;
 	char *p;
 	char *pBuff;
+	char ip_addr[FDFS_IPADDR_SIZE];
+	char data_filename[128];
 	char full_filename[MAX_PATH_SIZE];
-	char out_buff[sizeof(TrackerHeader)+FDFS_GROUP_NAME_MAX_LEN+256];
+	char header_buff[FDFS_PROTO_MAX_HEADER_SIZE];
+	char out_buff[FDFS_PROTO_MAX_HEADER_SIZE+FDFS_GROUP_NAME_MAX_LEN+256];
 	char in_buff[1];
 
-	snprintf(full_filename, sizeof(full_filename), \
-			"%s/data/%s", g_base_path, pRecord->filename);
-	if (!fileExists(full_filename))
+	if (storage_get_full_filename(pRecord->filename, full_filename, \
+			sizeof(full_filename), &store_path_index) != 0)
 	{
-		if (pRecord->op_type == STORAGE_OP_TYPE_SOURCE_CREATE_FILE)
+		return 0;  //invalid filename, skip it
+	}
+
+	meta_buff = NULL;
+	meta_bytes = 0;
+	bStream = false;
+	bAppender = false;
+
+	/* the metadata record is sent from the metadata store */
+	if (storage_meta_get_data_filename(pRecord->filename, data_filename))
+	{
+		result = storage_meta_get(data_filename, \
+				&file_buff, &buff_size);
+		file_size = buff_size;
+		if (result == ENOENT)
 		{
-			logError("file: "__FILE__", line: %d, " \
-				"sync data file, file: %s not exists, " \
-				"maybe deleted later?", \
-				__LINE__, full_filename);
+			return 0;
+		}
+		else if (result != 0)
+		{
+			return result;
 		}
-
-		return 0;
 	}
-
-	if ((result=getFileContent(full_filename, \
-			&file_buff, &file_size)) != 0)
+	else
 	{
-		return result;
+		if (!storage_file_exists(pRecord->filename, full_filename))
+		{
+			if (pRecord->op_type == \
+				STORAGE_OP_TYPE_SOURCE_CREATE_FILE || \
+				pRecord->op_type == \
+				STORAGE_OP_TYPE_SOURCE_CREATE_FILE_META)
+			{
+				logError("file: "__FILE__", line: %d, " \
+					"sync data file, file: %s not exists, " \
+					"maybe deleted later?", \
+					__LINE__, full_filename);
+			}
+
+			return 0;
+		}
+
+		/* the appender file is sent without the append in
+		   progress, the later appends are synced by their records */
+		file_size = -1;
+		if (storage_get_appender_source(pRecord->filename, \
+			ip_addr) == 0)
+		{
+			bAppender = true;
+			if ((result=storage_get_appender_size(full_filename, \
+				&file_size)) != 0)
+			{
+				return result == ENOENT ? 0 : result;
+			}
+		}
+		else if (stat(full_filename, &stat_buf) == 0)
+		{
+			file_size = stat_buf.st_size;
+		}
+
+		/* the checksum of the large file is verified by the dest */
+		if (file_size >= STORAGE_STREAM_FILE_SIZE)
+		{
+			bStream = true;
+			file_buff = NULL;
+		}
+		else if ((result=storage_read_file(pRecord->filename, \
+			full_filename, store_path_index, \
+			&file_buff, &buff_size)) != 0)
+		{
+			return result;
+		}
+		else if (!bAppender || buff_size < file_size)
+		{
+			file_size = buff_size;
+		}
+
+		if (!bStream && storage_check_file_checksum( \
+			pRecord->filename, file_buff, file_size) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"sync data file, file: %s is corrupted, " \
+				"skip it", __LINE__, full_filename);
+			free(file_buff);
+			return 0;
+		}
+
+		/* the metadata deleted later is synced by its own record */
+		if (proto_cmd == STORAGE_PROTO_CMD_SYNC_CREATE_FILE_META && \
+			(result=storage_meta_get(pRecord->filename, \
+				&meta_buff, &meta_bytes)) != 0)
+		{
+			if (result != ENOENT)
+			{
+				if (file_buff != NULL)
+				{
+					free(file_buff);
+				}
+				return result;
+			}
+			meta_buff = NULL;
+			meta_bytes = 0;
+		}
 	}
 
 	//printf("sync create file: %s\n", pRecord->filename);
 	while (1)
 	{
-		sprintf(header.pkg_len, "%x", 2 * TRACKER_PROTO_PKG_LEN_SIZE + \
-				FDFS_GROUP_NAME_MAX_LEN + \
-				pRecord->filename_len + file_size);
-		header.cmd = proto_cmd;
-		header.status = 0;
-		memcpy(out_buff, &header, sizeof(TrackerHeader));
-
-		p = out_buff + sizeof(TrackerHeader);
-		sprintf(p, "%x", pRecord->filename_len);
-		p += TRACKER_PROTO_PKG_LEN_SIZE;
-		sprintf(p, "%x", file_size);
-		p += TRACKER_PROTO_PKG_LEN_SIZE;
+		header.version = bStream ? \
+			FDFS_PROTO_VERSION_2 : FDFS_PROTO_VERSION_1;
+		field_size = FDFS_PROTO_FIELD_SIZE(header.version);
+		pBody = out_buff + FDFS_PROTO_MAX_HEADER_SIZE;
+		p = pBody;
+		fdfs_pack_size_field(header.version, pRecord->filename_len, p);
+		p += field_size;
+		if (proto_cmd == STORAGE_PROTO_CMD_SYNC_CREATE_FILE_META)
+		{
+			fdfs_pack_size_field(header.version, meta_bytes, p);
+			p += field_size;
+		}
+		fdfs_pack_size_field(header.version, file_size, p);
+		p += field_size;
 		sprintf(p, "%s", pStorageServer->group_name);
 		p += FDFS_GROUP_NAME_MAX_LEN;
 		memcpy(p, pRecord->filename, pRecord->filename_len);
 		p += pRecord->filename_len;
 
-		if(tcpsenddata(pStorageServer->sock, out_buff, \
-			p - out_buff, g_network_timeout) != 1)
+		header.pkg_len = (p - pBody) + meta_bytes + file_size;
+		header.request_id = 0;
+		header.cmd = proto_cmd;
+		header.status = 0;
+		header.flags = 0;
+		header_len = fdfs_pack_header(&header, header_buff);
+		memcpy(pBody - header_len, header_buff, header_len);
+
+		if(tcpsenddata(pStorageServer->sock, pBody - header_len, \
+			(p - pBody) + header_len, g_network_timeout) != 1)
 		{
 			logError("file: "__FILE__", line: %d, " \
 				"sync data to storage server %s:%d fail, " \
@@ -134,7 +254,32 @@ static int storage_sync_copy_file(TrackerServerInfo *pStorageServer, \
 			break;
 		}
 
-		if((file_size > 0) && (tcpsenddata(pStorageServer->sock, \
+		if((meta_bytes > 0) && (tcpsenddata(pStorageServer->sock, \
+			meta_buff, meta_bytes, g_network_timeout) != 1))
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"sync data to storage server %s:%d fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, pStorageServer->ip_addr, \
+				pStorageServer->port, \
+				errno, strerror(errno));
+
+			result = errno != 0 ? errno : EPIPE;
+			break;
+		}
+
+		if (bStream)
+		{
+			if ((result=bAppender ? storage_send_file_part( \
+				pStorageServer->sock, full_filename, 0, \
+				file_size) : storage_send_file( \
+				pStorageServer->sock, full_filename, \
+				file_size)) != 0)
+			{
+				break;
+			}
+		}
+		else if((file_size > 0) && (tcpsenddata(pStorageServer->sock, \
 			file_buff, file_size, g_network_timeout) != 1))
 		{
 			logError("file: "__FILE__", line: %d, " \
@@ -158,12 +303,21 @@ static int storage_sync_copy_file(TrackerServerInfo *pStorageServer, \
 		break;
 	}
 
-	free(file_buff);
+	if (file_buff != NULL)
+	{
+		free(file_buff);
+	}
+	if (meta_buff != NULL)
+	{
+		free(meta_buff);
+	}
 
 	//printf("sync create file end!\n");
 	if (result == EEXIST)
 	{
-		if (pRecord->op_type == STORAGE_OP_TYPE_SOURCE_CREATE_FILE)
+		if (pRecord->op_type == STORAGE_OP_TYPE_SOURCE_CREATE_FILE || \
+			pRecord->op_type == \
+				STORAGE_OP_TYPE_SOURCE_CREATE_FILE_META)
 		{
 			logError("file: "__FILE__", line: %d, " \
 				"storage server ip: %s:%d, data file: %s " \
@@ -191,14 +345,18 @@ static int storage_sync_delete_file(TrackerServerInfo *pStorageServer, \
 	TrackerHeader header;
 	int result;
 	char full_filename[MAX_PATH_SIZE];
-	char out_buff[sizeof(TrackerHeader)+FDFS_GROUP_NAME_MAX_LEN+32];
+	char out_buff[sizeof(TrackerHeader)+FDFS_GROUP_NAME_MAX_LEN+64];
 	char in_buff[1];
 	char *pBuff;
 	int in_bytes;
+	int store_path_index;
 
-	snprintf(full_filename, sizeof(full_filename), \
-			"%s/data/%s", g_base_path, pRecord->filename);
-	if (fileExists(full_filename))
+	if (storage_get_full_filename(pRecord->filename, full_filename, \
+			sizeof(full_filename), &store_path_index) != 0)
+	{
+		return 0;  //invalid filename, skip it
+	}
+	if (storage_file_exists(pRecord->filename, full_filename))
 	{
 		if (pRecord->op_type == STORAGE_OP_TYPE_SOURCE_DELETE_FILE)
 		{
@@ -252,6 +410,177 @@ static int storage_sync_delete_file(TrackerServerInfo *pStorageServer, \
 	return result;
 }
 
+/**
+send pkg format:
+9 bytes: filename bytes
+9 bytes: src filename bytes
+FDFS_GROUP_NAME_MAX_LEN bytes: group_name
+filename bytes : filename
+src filename bytes : src filename
+**/
+static int storage_sync_link_file(TrackerServerInfo *pStorageServer, \
+			const BinLogRecord *pRecord)
+{
+	TrackerHeader header;
+	int result;
+	int in_bytes;
+	int store_path_index;
+	char *p;
+	char *pBuff;
+	char full_filename[MAX_PATH_SIZE];
+	char out_buff[sizeof(TrackerHeader)+FDFS_GROUP_NAME_MAX_LEN+256];
+	char in_buff[1];
+
+	if (storage_get_full_filename(pRecord->filename, full_filename, \
+			sizeof(full_filename), &store_path_index) != 0)
+	{
+		return 0;  //invalid filename, skip it
+	}
+	if (!fileExists(full_filename))
+	{
+		return 0;
+	}
+
+	memset(out_buff, 0, sizeof(out_buff));
+	sprintf(header.pkg_len, "%x", 2 * TRACKER_PROTO_PKG_LEN_SIZE + \
+			FDFS_GROUP_NAME_MAX_LEN + pRecord->filename_len + \
+			pRecord->src_filename_len);
+	header.cmd = STORAGE_PROTO_CMD_SYNC_LINK_FILE;
+	header.status = 0;
+	memcpy(out_buff, &header, sizeof(TrackerHeader));
+
+	p = out_buff + sizeof(TrackerHeader);
+	sprintf(p, "%x", pRecord->filename_len);
+	p += TRACKER_PROTO_PKG_LEN_SIZE;
+	sprintf(p, "%x", pRecord->src_filename_len);
+	p += TRACKER_PROTO_PKG_LEN_SIZE;
+	sprintf(p, "%s", pStorageServer->group_name);
+	p += FDFS_GROUP_NAME_MAX_LEN;
+	memcpy(p, pRecord->filename, pRecord->filename_len);
+	p += pRecord->filename_len;
+	memcpy(p, pRecord->src_filename, pRecord->src_filename_len);
+	p += pRecord->src_filename_len;
+
+	if (tcpsenddata(pStorageServer->sock, out_buff, \
+		p - out_buff, g_network_timeout) != 1)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"sync data to storage server %s:%d fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pStorageServer->ip_addr, \
+			pStorageServer->port, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+
+	pBuff = in_buff;
+	result = tracker_recv_response(pStorageServer, &pBuff, 0, &in_bytes);
+	if (result == EEXIST)
+	{
+		return 0;
+	}
+	else if (result == ENOENT)  //the peer has not the src file
+	{
+		return storage_sync_copy_file(pStorageServer, pRecord, \
+				STORAGE_PROTO_CMD_SYNC_CREATE_FILE);
+	}
+	else
+	{
+		return result;
+	}
+}
+
+/**
+send pkg format (protocol version 2):
+8 bytes: filename bytes
+8 bytes: the offset to append
+8 bytes: the appended bytes
+FDFS_GROUP_NAME_MAX_LEN bytes: group_name
+filename bytes : filename
+remain bytes: the appended content
+**/
+static int storage_sync_append_file(TrackerServerInfo *pStorageServer, \
+			const BinLogRecord *pRecord)
+{
+	FDFSProtoHeader header;
+	int result;
+	int in_bytes;
+	int store_path_index;
+	int field_size;
+	int header_len;
+	char *p;
+	char *pBody;
+	char *pBuff;
+	char full_filename[MAX_PATH_SIZE];
+	char header_buff[FDFS_PROTO_MAX_HEADER_SIZE];
+	char out_buff[FDFS_PROTO_MAX_HEADER_SIZE+FDFS_GROUP_NAME_MAX_LEN+256];
+	char in_buff[1];
+
+	if (storage_get_full_filename(pRecord->filename, full_filename, \
+			sizeof(full_filename), &store_path_index) != 0)
+	{
+		return 0;  //invalid filename, skip it
+	}
+	if (!storage_file_exists(pRecord->filename, full_filename))
+	{
+		return 0;  //deleted later
+	}
+
+	header.version = FDFS_PROTO_VERSION_2;
+	field_size = FDFS_PROTO_FIELD_SIZE(header.version);
+	pBody = out_buff + FDFS_PROTO_MAX_HEADER_SIZE;
+	p = pBody;
+	fdfs_pack_size_field(header.version, pRecord->filename_len, p);
+	p += field_size;
+	fdfs_pack_size_field(header.version, pRecord->offset, p);
+	p += field_size;
+	fdfs_pack_size_field(header.version, pRecord->length, p);
+	p += field_size;
+	sprintf(p, "%s", pStorageServer->group_name);
+	p += FDFS_GROUP_NAME_MAX_LEN;
+	memcpy(p, pRecord->filename, pRecord->filename_len);
+	p += pRecord->filename_len;
+
+	header.pkg_len = (p - pBody) + pRecord->length;
+	header.request_id = 0;
+	header.cmd = STORAGE_PROTO_CMD_SYNC_APPEND_FILE;
+	header.status = 0;
+	header.flags = 0;
+	header_len = fdfs_pack_header(&header, header_buff);
+	memcpy(pBody - header_len, header_buff, header_len);
+
+	if (tcpsenddata(pStorageServer->sock, pBody - header_len, \
+		(p - pBody) + header_len, g_network_timeout) != 1)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"sync data to storage server %s:%d fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pStorageServer->ip_addr, \
+			pStorageServer->port, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+
+	/* only the appended range is sent */
+	if ((result=storage_send_file_part(pStorageServer->sock, \
+		full_filename, pRecord->offset, pRecord->length)) != 0)
+	{
+		return result;
+	}
+
+	pBuff = in_buff;
+	result = tracker_recv_response(pStorageServer, &pBuff, 0, &in_bytes);
+	if (result == ENOENT)  //the peer misses the file or former appends
+	{
+		return storage_sync_copy_file(pStorageServer, pRecord, \
+				STORAGE_PROTO_CMD_SYNC_UPDATE_FILE);
+	}
+	else
+	{
+		return result;
+	}
+}
+
 #define STARAGE_CHECK_IF_NEED_SYNC_OLD(pReader, pRecord) \
 	if ((!pReader->need_sync_old) || pReader->sync_old_done || \
 		(pRecord->timestamp > pReader->until_timestamp)) \
@@ -293,6 +622,33 @@ static int storage_sync_data(BinLogReader *pReader, \
 			result = storage_sync_copy_file(pStorageServer, \
 				pRecord, STORAGE_PROTO_CMD_SYNC_UPDATE_FILE);
 			break;
+		case STORAGE_OP_TYPE_SOURCE_LINK_FILE:
+			result = storage_sync_link_file(pStorageServer, \
+				pRecord);
+			break;
+		case STORAGE_OP_TYPE_REPLICA_LINK_FILE:
+			STARAGE_CHECK_IF_NEED_SYNC_OLD(pReader, pRecord)
+			result = storage_sync_link_file(pStorageServer, \
+				pRecord);
+			break;
+		case STORAGE_OP_TYPE_SOURCE_CREATE_FILE_META:
+			result = storage_sync_copy_file(pStorageServer, \
+				pRecord, STORAGE_PROTO_CMD_SYNC_CREATE_FILE_META);
+			break;
+		case STORAGE_OP_TYPE_REPLICA_CREATE_FILE_META:
+			STARAGE_CHECK_IF_NEED_SYNC_OLD(pReader, pRecord)
+			result = storage_sync_copy_file(pStorageServer, \
+				pRecord, STORAGE_PROTO_CMD_SYNC_CREATE_FILE_META);
+			break;
+		case STORAGE_OP_TYPE_SOURCE_APPEND_FILE:
+			result = storage_sync_append_file(pStorageServer, \
+				pRecord);
+			break;
+		case STORAGE_OP_TYPE_REPLICA_APPEND_FILE:
+			STARAGE_CHECK_IF_NEED_SYNC_OLD(pReader, pRecord)
+			result = storage_sync_append_file(pStorageServer, \
+				pRecord);
+			break;
 		default:
 			return EINVAL;
 	}
@@ -464,6 +820,11 @@ int storage_sync_init()
 		}
 	}
 
+	if ((result=init_pthread_lock(&binlog_write_lock)) != 0)
+	{
+		return result;
+	}
+
 	get_writable_binlog_filename(full_filename);
 	g_fp_binlog = fopen(full_filename, "a");
 	if (g_fp_binlog == NULL)
@@ -511,6 +872,7 @@ int storage_sync_destroy()
 		g_fp_binlog = NULL;
 	}
 
+	pthread_mutex_destroy(&binlog_write_lock);
 	if (pthread_mutex_destroy(&sync_thread_lock) != 0)
 	{
 		logError("file: "__FILE__", line: %d, " \
@@ -524,10 +886,72 @@ int storage_sync_destroy()
 }
 
 int storage_binlog_write(const char op_type, const char *filename)
+{
+	return storage_binlog_write_link(op_type, filename, NULL);
+}
+
+static int storage_binlog_write_record(const char *filename, \
+		const char *record, const int record_len)
+{
+	int result;
+
+	/* every change of the file goes here */
+	storage_fd_cache_invalidate(filename);
+	storage_hot_cache_invalidate(filename);
+
+	if (record_len >= SYNC_BINLOG_RECORD_SIZE)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"binlog record of file %s is too long", \
+			__LINE__, filename);
+		return EINVAL;
+	}
+
+	if ((result=storage_binlog_write_buff(record, record_len)) != 0)
+	{
+		return result;
+	}
+
+	return storage_fsync_binlog();
+}
+
+int storage_binlog_write_link(const char op_type, const char *filename, \
+		const char *src_filename)
+{
+	char record[SYNC_BINLOG_RECORD_SIZE];
+	int record_len;
+
+	if (src_filename == NULL)
+	{
+		record_len = snprintf(record, sizeof(record), "%d %c %s\n", \
+			(int)time(NULL), op_type, filename);
+	}
+	else
+	{
+		record_len = snprintf(record, sizeof(record), \
+			"%d %c %s %s\n", (int)time(NULL), op_type, \
+			filename, src_filename);
+	}
+
+	return storage_binlog_write_record(filename, record, record_len);
+}
+
+int storage_binlog_write_append(const char op_type, const char *filename, \
+		const int64_t offset, const int64_t length)
+{
+	char record[SYNC_BINLOG_RECORD_SIZE];
+	int record_len;
+
+	record_len = snprintf(record, sizeof(record), "%d %c %s " \
+		INT64_PRINTF_FORMAT" "INT64_PRINTF_FORMAT"\n", \
+		(int)time(NULL), op_type, filename, offset, length);
+	return storage_binlog_write_record(filename, record, record_len);
+}
+
+static int binlog_write_buff(const char *buff, const int length)
 {
 	int fd;
 	struct flock lock;
-	int write_bytes;
 	int result;
 
 	fd = fileno(g_fp_binlog);
@@ -546,9 +970,7 @@ int storage_binlog_write(const char op_type, const char *filename)
 		return errno != 0 ? errno : ENOENT;
 	}
 	
-	write_bytes = fprintf(g_fp_binlog, "%d %c %s\n", \
-			(int)time(NULL), op_type, filename);
-	if (write_bytes <= 0)
+	if (fwrite(buff, length, 1, g_fp_binlog) != 1)
 	{
 		logError("file: "__FILE__", line: %d, " \
 			"write to binlog file \"%s\" fail, " \
@@ -568,9 +990,16 @@ int storage_binlog_write(const char op_type, const char *filename)
 	}
 	else
 	{
-		binlog_file_size += write_bytes;
+		binlog_file_size += length;
 		if (binlog_file_size >= SYNC_BINLOG_FILE_MAX_SIZE)
 		{
+			/* the records of the full binlog are synced here,
+			   the later fsync goes to the next binlog */
+			if (g_fsync_mode != STORAGE_FSYNC_MODE_NONE)
+			{
+				fsync(fd);
+			}
+
 			g_binlog_index++;
 			if ((result=write_to_binlog_index()) == 0)
 			{
@@ -608,6 +1037,40 @@ int storage_binlog_write(const char op_type, const char *filename)
 	return result;
 }
 
+int storage_binlog_write_buff(const char *buff, const int length)
+{
+	int result;
+
+	pthread_mutex_lock(&binlog_write_lock);
+	result = binlog_write_buff(buff, length);
+	pthread_mutex_unlock(&binlog_write_lock);
+
+	return result;
+}
+
+int storage_binlog_get_position(int *binlog_fd, int *binlog_index, \
+		int *binlog_offset)
+{
+	int result;
+
+	result = 0;
+	pthread_mutex_lock(&binlog_write_lock);
+	if (binlog_fd != NULL && (*binlog_fd=dup(fileno(g_fp_binlog))) < 0)
+	{
+		result = errno != 0 ? errno : EMFILE;
+		logError("file: "__FILE__", line: %d, " \
+			"dup fd of binlog file \"%s\" fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, get_writable_binlog_filename(NULL), \
+			result, strerror(result));
+	}
+	*binlog_index = g_binlog_index;
+	*binlog_offset = binlog_file_size;
+	pthread_mutex_unlock(&binlog_write_lock);
+
+	return result;
+}
+
 static char *get_binlog_readable_filename(BinLogReader *pReader, \
 		char *full_filename)
 {
@@ -1052,11 +1515,18 @@ static int storage_binlog_read(BinLogReader *pReader, \
 			BinLogRecord *pRecord, int *record_length)
 {
 	char line[256];
-	char *cols[3];
+	char *cols[5];
 	int result;
 
 	while (1)
 	{
+		/* the records not synced to disk may be lost by a crash */
+		if (!storage_fsync_binlog_readable(pReader->binlog_index, \
+			pReader->binlog_offset))
+		{
+			return ENOENT;
+		}
+
 		if ((*record_length=fd_gets(pReader->binlog_fd, line, \
 			sizeof(line), 38)) < 0)
 		{
@@ -1114,7 +1584,7 @@ static int storage_binlog_read(BinLogReader *pReader, \
 		return ENOENT;
 	}
 
-	if ((result=splitEx(line, ' ', cols, 3)) < 3)
+	if ((result=splitEx(line, ' ', cols, 5)) < 3)
 	{
 		logError("file: "__FILE__", line: %d, " \
 			"read data from binlog file \"%s\" fail, " \
@@ -1127,7 +1597,43 @@ static int storage_binlog_read(BinLogReader *pReader, \
 
 	pRecord->timestamp = atoi(cols[0]);
 	pRecord->op_type = *(cols[1]);
-	pRecord->filename_len = strlen(cols[2]) - 1; //need trim new line \n
+	pRecord->offset = 0;
+	pRecord->length = 0;
+	if (result == 5)  //append record: filename offset length
+	{
+		pRecord->filename_len = strlen(cols[2]);
+		pRecord->src_filename_len = 0;
+		pRecord->offset = strtoll(cols[3], NULL, 10);
+		pRecord->length = strtoll(cols[4], NULL, 10);
+	}
+	else if (result == 4)  //link record: filename src_filename
+	{
+		pRecord->filename_len = strlen(cols[2]);
+		pRecord->src_filename_len = strlen(cols[3]) - 1;
+		if (pRecord->src_filename_len > \
+			sizeof(pRecord->src_filename) - 1)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"item \"src_filename\" in binlog " \
+				"file \"%s\" is invalid, file offset: %d, " \
+				"filename length: %d > %d", \
+				__LINE__, \
+				get_binlog_readable_filename(pReader, NULL), \
+				pReader->binlog_offset, \
+				pRecord->src_filename_len, \
+				sizeof(pRecord->src_filename)-1);
+			return EINVAL;
+		}
+		memcpy(pRecord->src_filename, cols[3], \
+			pRecord->src_filename_len);
+	}
+	else
+	{
+		pRecord->filename_len = strlen(cols[2]) - 1; //trim \n
+		pRecord->src_filename_len = 0;
+	}
+	pRecord->src_filename[pRecord->src_filename_len] = '\0';
+
 	if (pRecord->filename_len > sizeof(pRecord->filename)-1)
 	{
 		logError("file: "__FILE__", line: %d, " \
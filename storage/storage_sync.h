@@ -17,6 +17,12 @@
 #define STORAGE_OP_TYPE_REPLICA_CREATE_FILE	'c'
 #define STORAGE_OP_TYPE_REPLICA_DELETE_FILE	'd'
 #define STORAGE_OP_TYPE_REPLICA_UPDATE_FILE	'u'
+#define STORAGE_OP_TYPE_SOURCE_LINK_FILE	'L'  //hard link to a dup file
+#define STORAGE_OP_TYPE_REPLICA_LINK_FILE	'l'
+#define STORAGE_OP_TYPE_SOURCE_CREATE_FILE_META	'M'  //file with metadata
+#define STORAGE_OP_TYPE_REPLICA_CREATE_FILE_META	'm'
+#define STORAGE_OP_TYPE_SOURCE_APPEND_FILE	'A'  //append to appender file
+#define STORAGE_OP_TYPE_REPLICA_APPEND_FILE	'a'
 
 #ifdef __cplusplus
 extern "C" {
@@ -41,8 +47,12 @@ typedef struct
 {
 	int timestamp;
 	char op_type;
-	char filename[32];
+	char filename[64];
 	int filename_len;
+	char src_filename[64];  //the linked file of the link record
+	int src_filename_len;
+	int64_t offset;  //the appended range of the append record
+	int64_t length;
 } BinLogRecord;
 
 extern FILE *g_fp_binlog;
@@ -54,6 +64,35 @@ int storage_sync_init();
 int storage_sync_destroy();
 int storage_binlog_write(const char op_type, const char *filename);
 
+/*
+write the link record, the file is a hard link of src_filename
+*/
+int storage_binlog_write_link(const char op_type, const char *filename, \
+		const char *src_filename);
+
+/*
+write the append record, the length bytes are appended at the offset
+*/
+int storage_binlog_write_append(const char op_type, const char *filename, \
+		const int64_t offset, const int64_t length);
+
+/*
+write the formatted records to the binlog
+*/
+int storage_binlog_write_buff(const char *buff, const int length);
+
+/*
+get the end position of the writable binlog
+params:
+	binlog_fd: return the dup fd of the binlog, NULL for not need,
+		the caller should close it
+	binlog_index: return the index of the binlog
+	binlog_offset: return the size of the binlog
+return: 0 for success, != 0 for fail
+*/
+int storage_binlog_get_position(int *binlog_fd, int *binlog_index, \
+		int *binlog_offset);
+
 int storage_sync_thread_start(const FDFSStorageBrief *pStorage);
 
 #ifdef __cplusplus
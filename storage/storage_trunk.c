@@ -0,0 +1,858 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//storage_trunk.c
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "fdfs_define.h"
+#include "logger.h"
+#include "fdfs_global.h"
+#include "shared_func.h"
+#include "fdfs_base64.h"
+#include "storage_global.h"
+#include "storage_func.h"
+#include "storage_trunk.h"
+#include "storage_fsync.h"
+#include "storage_fd_cache.h"
+
+#define TRUNK_SLOT_ALIGN_SIZE		64
+#define TRUNK_MAX_FILES_PER_PATH	0xFFFF
+#define TRUNK_FILENAME_SIZE		(MAX_PATH_SIZE + 32)
+
+/* the encoded slot: timestamp(4) + file size(4) + offset(4) +
+   trunk id(2) + rand(1) */
+#define TRUNK_ENCODED_BYTES		15
+
+#define TRUNK_ALIGN_SIZE(size)	(((size) + TRUNK_SLOT_ALIGN_SIZE - 1) & \
+				(~(TRUNK_SLOT_ALIGN_SIZE - 1)))
+
+typedef struct tagFDFSTrunkBlock
+{
+	int offset;
+	int size;
+	struct tagFDFSTrunkBlock *next;
+} FDFSTrunkBlock;
+
+typedef struct
+{
+	int fd;
+	FDFSTrunkBlock *free_blocks;  //order by offset
+} FDFSTrunkFile;
+
+typedef struct
+{
+	int count;
+	int alloc_count;
+	FDFSTrunkFile *trunks;  //the trunk id is the index + 1
+} FDFSTrunkPath;
+
+typedef struct
+{
+	int store_path_index;
+	int trunk_id;
+	int offset;
+	int file_size;
+	int timestamp;
+	char rand;
+} FDFSTrunkSlot;
+
+static pthread_mutex_t trunk_lock;
+static FDFSTrunkPath *trunk_paths = NULL;
+
+static void trunk_lock_acquire()
+{
+	if (pthread_mutex_lock(&trunk_lock) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call pthread_mutex_lock fail, " \
+			"errno: %d, error info:%s.", \
+			__LINE__, errno, strerror(errno));
+	}
+}
+
+static void trunk_lock_release()
+{
+	if (pthread_mutex_unlock(&trunk_lock) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call pthread_mutex_unlock fail, " \
+			"errno: %d, error info:%s.", \
+			__LINE__, errno, strerror(errno));
+	}
+}
+
+static char *get_trunk_filename(const int store_path_index, \
+		const int trunk_id, char *full_filename)
+{
+	snprintf(full_filename, TRUNK_FILENAME_SIZE, "%s/data/" \
+		STORAGE_TRUNK_DIR_NAME"/%06d", \
+		g_store_paths[store_path_index].path, trunk_id);
+	return full_filename;
+}
+
+static int trunk_write_header(const int fd, const int offset, \
+		const int alloc_size, const FDFSTrunkSlot *pSlot, \
+		const char status)
+{
+	FDFSTrunkSlotHeader header;
+
+	memset(&header, 0, sizeof(header));
+	int2buff(alloc_size, header.sz_alloc_size);
+	if (pSlot != NULL)
+	{
+		int2buff(pSlot->file_size, header.sz_file_size);
+		int2buff(pSlot->timestamp, header.sz_timestamp);
+		header.rand = pSlot->rand;
+	}
+	header.status = status;
+
+	if (pwrite(fd, &header, sizeof(header), offset) != sizeof(header))
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"write trunk slot header fail, offset: %d, " \
+			"errno: %d, error info: %s", \
+			__LINE__, offset, errno, strerror(errno));
+		return errno != 0 ? errno : EIO;
+	}
+
+	return 0;
+}
+
+/* insert the free block and merge it with the adjacent free blocks,
+   return the merged block */
+static FDFSTrunkBlock *trunk_add_free_block(FDFSTrunkFile *pTrunk, \
+		const int offset, const int size)
+{
+	FDFSTrunkBlock *pPrevious;
+	FDFSTrunkBlock *pNext;
+	FDFSTrunkBlock *pBlock;
+
+	pPrevious = NULL;
+	pNext = pTrunk->free_blocks;
+	while (pNext != NULL && pNext->offset < offset)
+	{
+		pPrevious = pNext;
+		pNext = pNext->next;
+	}
+
+	if (pPrevious != NULL && pPrevious->offset + pPrevious->size == offset)
+	{
+		pBlock = pPrevious;
+		pBlock->size += size;
+	}
+	else
+	{
+		pBlock = (FDFSTrunkBlock *)malloc(sizeof(FDFSTrunkBlock));
+		if (pBlock == NULL)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"malloc %d bytes fail", __LINE__, \
+				(int)sizeof(FDFSTrunkBlock));
+			return NULL;
+		}
+
+		pBlock->offset = offset;
+		pBlock->size = size;
+		pBlock->next = pNext;
+		if (pPrevious == NULL)
+		{
+			pTrunk->free_blocks = pBlock;
+		}
+		else
+		{
+			pPrevious->next = pBlock;
+		}
+	}
+
+	if (pNext != NULL && pBlock->offset + pBlock->size == pNext->offset)
+	{
+		pBlock->size += pNext->size;
+		pBlock->next = pNext->next;
+		free(pNext);
+	}
+
+	return pBlock;
+}
+
+static void trunk_remove_free_block(FDFSTrunkFile *pTrunk, \
+		FDFSTrunkBlock *pBlock)
+{
+	FDFSTrunkBlock *pPrevious;
+
+	if (pTrunk->free_blocks == pBlock)
+	{
+		pTrunk->free_blocks = pBlock->next;
+	}
+	else
+	{
+		pPrevious = pTrunk->free_blocks;
+		while (pPrevious->next != pBlock)
+		{
+			pPrevious = pPrevious->next;
+		}
+		pPrevious->next = pBlock->next;
+	}
+
+	free(pBlock);
+}
+
+/* return true when the offset lies inside a free block */
+static bool trunk_in_free_block(const FDFSTrunkFile *pTrunk, const int offset)
+{
+	FDFSTrunkBlock *pBlock;
+
+	for (pBlock=pTrunk->free_blocks; pBlock!=NULL && \
+		pBlock->offset<=offset; pBlock=pBlock->next)
+	{
+		if (offset < pBlock->offset + pBlock->size)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* free the slot in the lock, the slot header is marked free before the
+   merged block header is written, so the slot is never read as used */
+static int trunk_free_slot(FDFSTrunkFile *pTrunk, const int offset, \
+		const int alloc_size)
+{
+	FDFSTrunkBlock *pBlock;
+	int result;
+
+	if ((result=trunk_write_header(pTrunk->fd, offset, alloc_size, \
+			NULL, TRUNK_SLOT_STATUS_FREE)) != 0)
+	{
+		return result;
+	}
+
+	if ((pBlock=trunk_add_free_block(pTrunk, offset, alloc_size)) == NULL)
+	{
+		return ENOMEM;
+	}
+
+	if (pBlock->offset == offset && pBlock->size == alloc_size)
+	{
+		return 0;
+	}
+
+	return trunk_write_header(pTrunk->fd, pBlock->offset, \
+			pBlock->size, NULL, TRUNK_SLOT_STATUS_FREE);
+}
+
+static int trunk_check_alloc(FDFSTrunkPath *pPath)
+{
+	FDFSTrunkFile *trunks;
+	int alloc_count;
+
+	if (pPath->count < pPath->alloc_count)
+	{
+		return 0;
+	}
+
+	alloc_count = pPath->alloc_count == 0 ? 16 : 2 * pPath->alloc_count;
+	trunks = (FDFSTrunkFile *)realloc(pPath->trunks, \
+			sizeof(FDFSTrunkFile) * alloc_count);
+	if (trunks == NULL)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"malloc %d bytes fail", __LINE__, \
+			(int)sizeof(FDFSTrunkFile) * alloc_count);
+		return errno != 0 ? errno : ENOMEM;
+	}
+
+	pPath->trunks = trunks;
+	pPath->alloc_count = alloc_count;
+	return 0;
+}
+
+static int trunk_load_file(const int store_path_index, const int trunk_id)
+{
+	FDFSTrunkPath *pPath;
+	FDFSTrunkFile *pTrunk;
+	FDFSTrunkSlotHeader header;
+	char full_filename[TRUNK_FILENAME_SIZE];
+	struct stat stat_buf;
+	int offset;
+	int alloc_size;
+	int result;
+
+	pPath = trunk_paths + store_path_index;
+	if ((result=trunk_check_alloc(pPath)) != 0)
+	{
+		return result;
+	}
+
+	get_trunk_filename(store_path_index, trunk_id, full_filename);
+	pTrunk = pPath->trunks + pPath->count;
+	pTrunk->free_blocks = NULL;
+	pTrunk->fd = open(full_filename, O_RDWR);
+	if (pTrunk->fd < 0 || fstat(pTrunk->fd, &stat_buf) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"open trunk file \"%s\" fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, full_filename, errno, strerror(errno));
+		return errno != 0 ? errno : ENOENT;
+	}
+	pPath->count++;
+
+	offset = 0;
+	while (offset < stat_buf.st_size)
+	{
+		if (pread(pTrunk->fd, &header, sizeof(header), offset) != \
+			sizeof(header))
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"read trunk file \"%s\" fail, offset: %d, " \
+				"errno: %d, error info: %s", __LINE__, \
+				full_filename, offset, errno, strerror(errno));
+			return errno != 0 ? errno : EIO;
+		}
+
+		alloc_size = buff2int((unsigned char *)header.sz_alloc_size);
+		if (alloc_size == 0)  //never allocated
+		{
+			alloc_size = stat_buf.st_size - offset;
+			header.status = TRUNK_SLOT_STATUS_FREE;
+		}
+		else if (alloc_size < sizeof(header) || \
+			alloc_size > stat_buf.st_size - offset)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"trunk file \"%s\", offset: %d, " \
+				"invalid slot size: %d, " \
+				"ignore the remain space", __LINE__, \
+				full_filename, offset, alloc_size);
+			break;
+		}
+
+		if (header.status != TRUNK_SLOT_STATUS_USED && \
+			trunk_add_free_block(pTrunk, offset, alloc_size) == NULL)
+		{
+			return ENOMEM;
+		}
+
+		offset += alloc_size;
+	}
+
+	return 0;
+}
+
+static FDFSTrunkFile *trunk_create_file(const int store_path_index)
+{
+	FDFSTrunkPath *pPath;
+	FDFSTrunkFile *pTrunk;
+	char full_filename[TRUNK_FILENAME_SIZE];
+
+	pPath = trunk_paths + store_path_index;
+	if (pPath->count >= TRUNK_MAX_FILES_PER_PATH || \
+		trunk_check_alloc(pPath) != 0)
+	{
+		return NULL;
+	}
+
+	get_trunk_filename(store_path_index, pPath->count + 1, full_filename);
+	pTrunk = pPath->trunks + pPath->count;
+	pTrunk->free_blocks = NULL;
+	pTrunk->fd = open(full_filename, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (pTrunk->fd < 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"create trunk file \"%s\" fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, full_filename, errno, strerror(errno));
+		return NULL;
+	}
+
+	/* pre-allocate the trunk file, the holes read as zero headers */
+	if (ftruncate(pTrunk->fd, g_trunk_file_size) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"truncate trunk file \"%s\" to %d bytes fail, " \
+			"errno: %d, error info: %s", __LINE__, \
+			full_filename, g_trunk_file_size, \
+			errno, strerror(errno));
+		close(pTrunk->fd);
+		unlink(full_filename);
+		return NULL;
+	}
+
+	if (trunk_add_free_block(pTrunk, 0, g_trunk_file_size) == NULL)
+	{
+		close(pTrunk->fd);
+		unlink(full_filename);
+		return NULL;
+	}
+
+	pPath->count++;
+	return pTrunk;
+}
+
+int storage_trunk_init()
+{
+	char full_filename[TRUNK_FILENAME_SIZE];
+	int result;
+	int store_path_index;
+	int trunk_id;
+
+	if ((result=init_pthread_lock(&trunk_lock)) != 0)
+	{
+		return result;
+	}
+
+	trunk_paths = (FDFSTrunkPath *)malloc(sizeof(FDFSTrunkPath) * \
+						g_path_count);
+	if (trunk_paths == NULL)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"malloc %d bytes fail", __LINE__, \
+			(int)sizeof(FDFSTrunkPath) * g_path_count);
+		return errno != 0 ? errno : ENOMEM;
+	}
+	memset(trunk_paths, 0, sizeof(FDFSTrunkPath) * g_path_count);
+
+	for (store_path_index=0; store_path_index<g_path_count; \
+		store_path_index++)
+	{
+		for (trunk_id=1; trunk_id<=TRUNK_MAX_FILES_PER_PATH; trunk_id++)
+		{
+			get_trunk_filename(store_path_index, trunk_id, \
+					full_filename);
+			if (!fileExists(full_filename))
+			{
+				break;
+			}
+
+			if ((result=trunk_load_file(store_path_index, \
+					trunk_id)) != 0)
+			{
+				return result;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int storage_trunk_destroy()
+{
+	FDFSTrunkPath *pPath;
+	FDFSTrunkFile *pTrunk;
+	FDFSTrunkBlock *pBlock;
+
+	if (trunk_paths == NULL)
+	{
+		return 0;
+	}
+
+	for (pPath=trunk_paths; pPath<trunk_paths+g_path_count; pPath++)
+	{
+		for (pTrunk=pPath->trunks; pTrunk<pPath->trunks+pPath->count; \
+			pTrunk++)
+		{
+			close(pTrunk->fd);
+			while (pTrunk->free_blocks != NULL)
+			{
+				pBlock = pTrunk->free_blocks;
+				pTrunk->free_blocks = pBlock->next;
+				free(pBlock);
+			}
+		}
+
+		if (pPath->trunks != NULL)
+		{
+			free(pPath->trunks);
+		}
+	}
+
+	free(trunk_paths);
+	trunk_paths = NULL;
+
+	pthread_mutex_destroy(&trunk_lock);
+	return 0;
+}
+
+bool storage_is_trunk_filename(const char *logic_filename)
+{
+	return *logic_filename == STORAGE_STORE_PATH_PREFIX_CHAR && \
+		strncmp(logic_filename + 3, "/"STORAGE_TRUNK_DIR_NAME"/", \
+			sizeof(STORAGE_TRUNK_DIR_NAME) + 1) == 0;
+}
+
+static int trunk_parse_filename(const char *logic_filename, \
+		FDFSTrunkSlot *pSlot)
+{
+	char full_filename[MAX_PATH_SIZE];
+	char encoded[TRUNK_ENCODED_BYTES * 4 / 3 + 1];
+	char buff[TRUNK_ENCODED_BYTES + 4];
+	const char *pEncoded;
+	int len;
+
+	if (!storage_is_trunk_filename(logic_filename))
+	{
+		return ENOENT;
+	}
+
+	if (storage_get_full_filename(logic_filename, full_filename, \
+		sizeof(full_filename), &pSlot->store_path_index) != 0)
+	{
+		return EINVAL;
+	}
+
+	pEncoded = logic_filename + 4 + sizeof(STORAGE_TRUNK_DIR_NAME);
+	if (strlen(pEncoded) != sizeof(encoded) - 1)
+	{
+		return EINVAL;
+	}
+
+	memcpy(encoded, pEncoded, sizeof(encoded));
+	base64_decode(encoded, sizeof(encoded) - 1, buff, &len);
+	if (len != TRUNK_ENCODED_BYTES)
+	{
+		return EINVAL;
+	}
+
+	pSlot->timestamp = buff2int((unsigned char *)buff);
+	pSlot->file_size = buff2int((unsigned char *)buff + 4);
+	pSlot->offset = buff2int((unsigned char *)buff + 8);
+	pSlot->trunk_id = (((unsigned char)buff[12]) << 8) | \
+			((unsigned char)buff[13]);
+	pSlot->rand = buff[14];
+	if (pSlot->trunk_id <= 0 || pSlot->offset < 0 || pSlot->file_size < 0)
+	{
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+static void trunk_gen_filename(const FDFSTrunkSlot *pSlot, \
+		char *filename, int *filename_len)
+{
+	char buff[TRUNK_ENCODED_BYTES];
+	int len;
+
+	int2buff(pSlot->timestamp, buff);
+	int2buff(pSlot->file_size, buff + 4);
+	int2buff(pSlot->offset, buff + 8);
+	buff[12] = (pSlot->trunk_id >> 8) & 0xFF;
+	buff[13] = pSlot->trunk_id & 0xFF;
+	buff[14] = pSlot->rand;
+
+	len = sprintf(filename, STORAGE_STORE_PATH_PREFIX_FORMAT \
+			STORAGE_TRUNK_DIR_NAME"/", pSlot->store_path_index);
+	base64_encode_ex(buff, sizeof(buff), filename + len, \
+			filename_len, false);
+	*filename_len += len;
+}
+
+/* get the fd of the trunk file, return -1 when the trunk not exist */
+static int trunk_get_fd(const FDFSTrunkSlot *pSlot)
+{
+	FDFSTrunkPath *pPath;
+	int fd;
+
+	trunk_lock_acquire();
+	pPath = trunk_paths + pSlot->store_path_index;
+	fd = pSlot->trunk_id <= pPath->count ? \
+		pPath->trunks[pSlot->trunk_id - 1].fd : -1;
+	trunk_lock_release();
+
+	return fd;
+}
+
+static bool trunk_check_header(const FDFSTrunkSlot *pSlot, \
+		const FDFSTrunkSlotHeader *pHeader)
+{
+	return pHeader->status == TRUNK_SLOT_STATUS_USED && \
+		pHeader->rand == pSlot->rand && \
+		buff2int((unsigned char *)pHeader->sz_file_size) == \
+			pSlot->file_size && \
+		buff2int((unsigned char *)pHeader->sz_timestamp) == \
+			pSlot->timestamp;
+}
+
+int storage_trunk_save_file(const int store_path_index, \
+		const char *file_buff, const int file_size, \
+		char *filename, int *filename_len)
+{
+	FDFSTrunkPath *pPath;
+	FDFSTrunkFile *pTrunk;
+	FDFSTrunkFile *pTrunkEnd;
+	FDFSTrunkBlock *pBlock;
+	FDFSTrunkSlot slot;
+	int alloc_size;
+	int fd;
+	int result;
+
+	alloc_size = TRUNK_ALIGN_SIZE(sizeof(FDFSTrunkSlotHeader) + file_size);
+	if (alloc_size > g_trunk_file_size)
+	{
+		return EFBIG;
+	}
+
+	trunk_lock_acquire();
+
+	pBlock = NULL;
+	pPath = trunk_paths + store_path_index;
+	pTrunkEnd = pPath->trunks + pPath->count;
+	for (pTrunk=pPath->trunks; pTrunk<pTrunkEnd; pTrunk++)
+	{
+		for (pBlock=pTrunk->free_blocks; pBlock!=NULL; \
+			pBlock=pBlock->next)
+		{
+			if (pBlock->size >= alloc_size)
+			{
+				break;
+			}
+		}
+
+		if (pBlock != NULL)
+		{
+			break;
+		}
+	}
+
+	if (pBlock == NULL)
+	{
+		if ((pTrunk=trunk_create_file(store_path_index)) == NULL)
+		{
+			trunk_lock_release();
+			return ENOSPC;
+		}
+		pBlock = pTrunk->free_blocks;
+	}
+
+	memset(&slot, 0, sizeof(slot));
+	slot.store_path_index = store_path_index;
+	slot.trunk_id = (pTrunk - pPath->trunks) + 1;
+	slot.offset = pBlock->offset;
+	slot.file_size = file_size;
+	slot.timestamp = time(NULL);
+	slot.rand = (char)rand();
+	fd = pTrunk->fd;
+
+	/* split the block when the remain space is enough for a slot,
+	   the header of the remain space must be written in the lock */
+	result = 0;
+	if (pBlock->size - alloc_size >= TRUNK_SLOT_ALIGN_SIZE)
+	{
+		if ((result=trunk_write_header(fd, pBlock->offset + \
+			alloc_size, pBlock->size - alloc_size, NULL, \
+			TRUNK_SLOT_STATUS_FREE)) == 0)
+		{
+			pBlock->offset += alloc_size;
+			pBlock->size -= alloc_size;
+		}
+	}
+	else
+	{
+		alloc_size = pBlock->size;
+		trunk_remove_free_block(pTrunk, pBlock);
+	}
+
+	trunk_lock_release();
+	if (result != 0)
+	{
+		return result;
+	}
+
+	/* write the content first, then the header, a half written slot
+	   is still free after restart */
+	storage_disk_io_begin(store_path_index);
+	if (pwrite(fd, file_buff, file_size, slot.offset + \
+		sizeof(FDFSTrunkSlotHeader)) != file_size)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"write to trunk file fail, trunk id: %d, " \
+			"offset: %d, errno: %d, error info: %s", \
+			__LINE__, slot.trunk_id, slot.offset, \
+			errno, strerror(errno));
+		result = errno != 0 ? errno : EIO;
+	}
+	else
+	{
+		result = trunk_write_header(fd, slot.offset, alloc_size, \
+				&slot, TRUNK_SLOT_STATUS_USED);
+		if (result == 0)
+		{
+			result = storage_fsync_file(fd, "trunk file");
+		}
+	}
+	storage_disk_io_end(store_path_index);
+
+	/* the trunks may be reallocated out of the lock */
+	if (result != 0)
+	{
+		trunk_lock_acquire();
+		trunk_free_slot(pPath->trunks + (slot.trunk_id - 1), \
+				slot.offset, alloc_size);
+		trunk_lock_release();
+		return result;
+	}
+
+	trunk_gen_filename(&slot, filename, filename_len);
+	return 0;
+}
+
+/* read the content of the small file, return ENOENT when the slot
+   not belong to this file, such as the replica of other server */
+static int trunk_read_file(const FDFSTrunkSlot *pSlot, \
+		char **file_buff, int *file_size)
+{
+	FDFSTrunkSlotHeader *pHeader;
+	char *buff;
+	int read_bytes;
+	int fd;
+
+	if ((fd=trunk_get_fd(pSlot)) < 0)
+	{
+		return ENOENT;
+	}
+
+	read_bytes = sizeof(FDFSTrunkSlotHeader) + pSlot->file_size;
+	buff = (char *)malloc(read_bytes);
+	if (buff == NULL)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"malloc %d bytes fail", __LINE__, read_bytes);
+		return errno != 0 ? errno : ENOMEM;
+	}
+
+	storage_disk_io_begin(pSlot->store_path_index);
+	if (pread(fd, buff, read_bytes, pSlot->offset) != read_bytes)
+	{
+		storage_disk_io_end(pSlot->store_path_index);
+		free(buff);
+		return ENOENT;
+	}
+	storage_disk_io_end(pSlot->store_path_index);
+
+	pHeader = (FDFSTrunkSlotHeader *)buff;
+	if (!trunk_check_header(pSlot, pHeader))
+	{
+		free(buff);
+		return ENOENT;
+	}
+
+	memmove(buff, buff + sizeof(FDFSTrunkSlotHeader), pSlot->file_size);
+	*file_buff = buff;
+	*file_size = pSlot->file_size;
+	return 0;
+}
+
+int storage_read_file(const char *logic_filename, \
+		const char *full_filename, const int store_path_index, \
+		char **file_buff, int *file_size)
+{
+	FDFSTrunkSlot slot;
+	int result;
+
+	if (trunk_paths != NULL && \
+		trunk_parse_filename(logic_filename, &slot) == 0 && \
+		trunk_read_file(&slot, file_buff, file_size) == 0)
+	{
+		return 0;
+	}
+
+	storage_disk_io_begin(store_path_index);
+	result = storage_fd_cache_read_file(logic_filename, full_filename, \
+			file_buff, file_size);
+	storage_disk_io_end(store_path_index);
+	return result;
+}
+
+static bool trunk_slot_exists(const FDFSTrunkSlot *pSlot)
+{
+	FDFSTrunkSlotHeader header;
+	int fd;
+
+	if ((fd=trunk_get_fd(pSlot)) < 0)
+	{
+		return false;
+	}
+
+	if (pread(fd, &header, sizeof(header), pSlot->offset) != \
+		sizeof(header))
+	{
+		return false;
+	}
+
+	return trunk_check_header(pSlot, &header);
+}
+
+bool storage_file_exists(const char *logic_filename, \
+		const char *full_filename)
+{
+	FDFSTrunkSlot slot;
+
+	if (trunk_paths != NULL && \
+		trunk_parse_filename(logic_filename, &slot) == 0 && \
+		trunk_slot_exists(&slot))
+	{
+		return true;
+	}
+
+	return fileExists(full_filename);
+}
+
+int storage_trunk_delete_file(const char *logic_filename)
+{
+	FDFSTrunkSlot slot;
+	FDFSTrunkSlotHeader header;
+	FDFSTrunkPath *pPath;
+	FDFSTrunkFile *pTrunk;
+	int alloc_size;
+	int result;
+
+	if (trunk_paths == NULL || \
+		trunk_parse_filename(logic_filename, &slot) != 0)
+	{
+		return ENOENT;
+	}
+
+	trunk_lock_acquire();
+	while (1)
+	{
+		pPath = trunk_paths + slot.store_path_index;
+		if (slot.trunk_id > pPath->count)
+		{
+			result = ENOENT;
+			break;
+		}
+
+		/* the slot freed already must not be freed twice */
+		pTrunk = pPath->trunks + (slot.trunk_id - 1);
+		if (trunk_in_free_block(pTrunk, slot.offset) || \
+			pread(pTrunk->fd, &header, sizeof(header), \
+			slot.offset) != sizeof(header) || \
+			!trunk_check_header(&slot, &header))
+		{
+			result = ENOENT;
+			break;
+		}
+
+		alloc_size = buff2int((unsigned char *)header.sz_alloc_size);
+		result = trunk_free_slot(pTrunk, slot.offset, alloc_size);
+		break;
+	}
+	trunk_lock_release();
+
+	return result;
+}
@@ -0,0 +1,98 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//storage_trunk.h
+
+#ifndef _STORAGE_TRUNK_H_
+#define _STORAGE_TRUNK_H_
+
+#include "fdfs_define.h"
+
+/* small files are packed into the trunk files under data/TK,
+   the filename is M00/TK/ + the encoded slot */
+#define STORAGE_TRUNK_DIR_NAME		"TK"
+
+#define STORAGE_TRUNK_DEF_SLOT_MAX_SIZE	(256 * 1024)
+#define STORAGE_TRUNK_DEF_FILE_SIZE	(64 * 1024 * 1024)
+
+#define TRUNK_SLOT_STATUS_FREE		'F'
+#define TRUNK_SLOT_STATUS_USED		'U'
+
+/* the header before each slot in the trunk file,
+   alloc size 0 means the remain space is never allocated */
+typedef struct
+{
+	char sz_alloc_size[4];  //slot size include this header
+	char sz_file_size[4];
+	char sz_timestamp[4];
+	char status;  //TRUNK_SLOT_STATUS_FREE or TRUNK_SLOT_STATUS_USED
+	char rand;
+	char pad[2];
+} FDFSTrunkSlotHeader;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+open the trunk files of all store paths and load the free slots
+*/
+int storage_trunk_init();
+int storage_trunk_destroy();
+
+/*
+is the filename a small file packed in the trunk file
+*/
+bool storage_is_trunk_filename(const char *logic_filename);
+
+/*
+save the small file to the trunk file of the store path
+params:
+	store_path_index: the store path index
+	file_buff: the file content
+	file_size: the file size
+	filename: return the logic filename
+	filename_len: return the filename length
+return: 0 for success, != 0 for fail
+*/
+int storage_trunk_save_file(const int store_path_index, \
+		const char *file_buff, const int file_size, \
+		char *filename, int *filename_len);
+
+/*
+read the file content, the small file packed in the trunk file or
+the normal file (including the replica of the trunk file)
+params:
+	logic_filename: the filename return to the client
+	full_filename: the full filename of the normal file
+	store_path_index: the store path index
+	file_buff: return the file content, should be freed by the caller
+	file_size: return the file size
+return: 0 for success, != 0 for fail
+*/
+int storage_read_file(const char *logic_filename, \
+		const char *full_filename, const int store_path_index, \
+		char **file_buff, int *file_size);
+
+/*
+check if the file exists, the trunk slot or the normal file
+*/
+bool storage_file_exists(const char *logic_filename, \
+		const char *full_filename);
+
+/*
+free the slot of the small file
+return: 0 for success, ENOENT for not in the trunk file
+*/
+int storage_trunk_delete_file(const char *logic_filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,622 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//storage_upload_session.c
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "fdfs_define.h"
+#include "logger.h"
+#include "fdfs_global.h"
+#include "shared_func.h"
+#include "crc32.h"
+#include "storage_global.h"
+#include "storage_func.h"
+#include "storage_upload_session.h"
+
+#define UPLOAD_SESSION_FILE_EXT	".sess"
+#define UPLOAD_PART_FILE_EXT	".part"
+
+/*
+the session file:
+8 bytes: file size
+4 bytes: part size
+4 bytes: meta data bytes
+meta data bytes: the sorted metadata
+part count bytes: the part map, 1 for the part received
+*/
+#define UPLOAD_SESSION_HEADER_SIZE	16
+
+static void upload_session_get_filenames(StorageUploadSession *pSession)
+{
+	snprintf(pSession->sess_filename, sizeof(pSession->sess_filename), \
+		"%s/data/"STORAGE_UPLOAD_SESSION_DIR"/%s" \
+		UPLOAD_SESSION_FILE_EXT, \
+		g_store_paths[pSession->store_path_index].path, pSession->id);
+	snprintf(pSession->part_filename, sizeof(pSession->part_filename), \
+		"%s/data/"STORAGE_UPLOAD_SESSION_DIR"/%s" \
+		UPLOAD_PART_FILE_EXT, \
+		g_store_paths[pSession->store_path_index].path, pSession->id);
+}
+
+int g_upload_session_thread_count = 0;
+
+static pthread_mutex_t upload_session_lock;
+
+/* remove the expired session files of the store path */
+static int upload_session_clean_path(const char *session_path)
+{
+	char full_filename[MAX_PATH_SIZE + 320];
+	struct stat stat_buf;
+	DIR *dir;
+	struct dirent *pEntry;
+	time_t expire_time;
+	int64_t total_bytes;
+	int name_len;
+	int count;
+
+	if ((dir=opendir(session_path)) == NULL)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"open dir \"%s\" fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, session_path, errno, strerror(errno));
+		return errno != 0 ? errno : ENOENT;
+	}
+
+	count = 0;
+	total_bytes = 0;
+	expire_time = time(NULL) - STORAGE_UPLOAD_SESSION_TIMEOUT;
+	while ((pEntry=readdir(dir)) != NULL)
+	{
+		if (*(pEntry->d_name) == '.')
+		{
+			continue;
+		}
+
+		snprintf(full_filename, sizeof(full_filename), "%s/%s", \
+			session_path, pEntry->d_name);
+		if (stat(full_filename, &stat_buf) != 0 || \
+			stat_buf.st_mtime >= expire_time || \
+			unlink(full_filename) != 0)
+		{
+			continue;
+		}
+
+		total_bytes += stat_buf.st_size;
+		name_len = strlen(pEntry->d_name);
+		if (name_len > sizeof(UPLOAD_SESSION_FILE_EXT) - 1 && \
+			strcmp(pEntry->d_name + name_len - \
+			(sizeof(UPLOAD_SESSION_FILE_EXT) - 1), \
+			UPLOAD_SESSION_FILE_EXT) == 0)
+		{
+			count++;
+			logInfo(STORAGE_ERROR_LOG_FILENAME, "file: "__FILE__", " \
+				"line: %d, remove expired upload session " \
+				"%.*s of %s", __LINE__, name_len - \
+				(int)(sizeof(UPLOAD_SESSION_FILE_EXT) - 1), \
+				pEntry->d_name, session_path);
+		}
+	}
+	closedir(dir);
+
+	if (total_bytes > 0 || count > 0)
+	{
+		logInfo(STORAGE_ERROR_LOG_FILENAME, "file: "__FILE__", " \
+			"line: %d, remove %d expired upload sessions " \
+			"of %s, reclaim "INT64_PRINTF_FORMAT" bytes", \
+			__LINE__, count, session_path, total_bytes);
+	}
+	return 0;
+}
+
+static void upload_session_clean_paths()
+{
+	char session_path[MAX_PATH_SIZE + 32];
+	int i;
+
+	for (i=0; i<g_path_count; i++)
+	{
+		snprintf(session_path, sizeof(session_path), \
+			"%s/data/"STORAGE_UPLOAD_SESSION_DIR, \
+			g_store_paths[i].path);
+		upload_session_clean_path(session_path);
+	}
+}
+
+static void *upload_session_thread_entrance(void *arg)
+{
+	time_t next_time;
+
+	next_time = time(NULL) + STORAGE_UPLOAD_SESSION_CLEAN_INTERVAL;
+	while (g_continue_flag)
+	{
+		if (time(NULL) < next_time)
+		{
+			sleep(1);
+			continue;
+		}
+
+		upload_session_clean_paths();
+		next_time = time(NULL) + STORAGE_UPLOAD_SESSION_CLEAN_INTERVAL;
+	}
+
+	pthread_mutex_lock(&upload_session_lock);
+	g_upload_session_thread_count--;
+	pthread_mutex_unlock(&upload_session_lock);
+	return NULL;
+}
+
+int storage_upload_session_thread_start()
+{
+	pthread_attr_t pattr;
+	pthread_t tid;
+	int result;
+
+	if ((result=init_pthread_lock(&upload_session_lock)) != 0)
+	{
+		return result;
+	}
+
+	pthread_attr_init(&pattr);
+	pthread_attr_setdetachstate(&pattr, PTHREAD_CREATE_DETACHED);
+
+	pthread_mutex_lock(&upload_session_lock);
+	g_upload_session_thread_count++;
+	pthread_mutex_unlock(&upload_session_lock);
+	if ((result=pthread_create(&tid, &pattr, \
+		upload_session_thread_entrance, NULL)) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"create thread failed, errno: %d, " \
+			"error info: %s", \
+			__LINE__, result, strerror(result));
+		pthread_mutex_lock(&upload_session_lock);
+		g_upload_session_thread_count--;
+		pthread_mutex_unlock(&upload_session_lock);
+	}
+
+	pthread_attr_destroy(&pattr);
+	return result;
+}
+
+int storage_upload_session_init()
+{
+	char session_path[MAX_PATH_SIZE + 32];
+	int result;
+	int i;
+
+	for (i=0; i<g_path_count; i++)
+	{
+		snprintf(session_path, sizeof(session_path), \
+			"%s/data/"STORAGE_UPLOAD_SESSION_DIR, \
+			g_store_paths[i].path);
+		if (!fileExists(session_path) && mkdir(session_path, 0755) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"mkdir \"%s\" fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, session_path, \
+				errno, strerror(errno));
+			return errno != 0 ? errno : EPERM;
+		}
+
+		if ((result=upload_session_clean_path(session_path)) != 0)
+		{
+			return result;
+		}
+	}
+
+	return 0;
+}
+
+/* create the part file and allocate its space */
+static int upload_session_create_part_file(const char *part_filename, \
+		const int64_t file_size)
+{
+	int fd;
+	int result;
+
+	if ((fd=open(part_filename, O_WRONLY | O_CREAT | O_EXCL, 0644)) < 0)
+	{
+		result = errno != 0 ? errno : EEXIST;
+		logError("file: "__FILE__", line: %d, " \
+			"open file %s fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, part_filename, result, strerror(result));
+		return result;
+	}
+
+	result = 0;
+	if (ftruncate(fd, file_size) != 0)
+	{
+		result = errno != 0 ? errno : EIO;
+	}
+	else if (file_size > 0 && (result=posix_fallocate(fd, 0, \
+		file_size)) != 0 && (result == EINVAL || result == EOPNOTSUPP))
+	{
+		result = 0;  //the file systems not supporting it
+	}
+	close(fd);
+
+	if (result != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"allocate file %s fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, part_filename, result, strerror(result));
+		unlink(part_filename);
+	}
+	return result;
+}
+
+int storage_upload_session_begin(const int64_t file_size, \
+		const int part_size, const char *meta_buff, \
+		const int meta_bytes, char *session_id)
+{
+	StorageUploadSession session;
+	char *buff;
+	int buff_size;
+	int result;
+	int i;
+
+	*session_id = '\0';
+	memset(&session, 0, sizeof(session));
+	if ((session.store_path_index=storage_select_store_path( \
+		file_size)) < 0)
+	{
+		return ENOSPC;
+	}
+	session.part_count = (int)((file_size + part_size - 1) / part_size);
+	for (i=0; i<1024; i++)
+	{
+		sprintf(session.id, "%02X%08X%06X", session.store_path_index, \
+			(int)time(NULL), rand() & 0xFFFFFF);
+		upload_session_get_filenames(&session);
+		if (!fileExists(session.sess_filename) && \
+			!fileExists(session.part_filename))
+		{
+			break;
+		}
+	}
+	if (i == 1024)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"Can't generate uniq session id", __LINE__);
+		return EEXIST;
+	}
+
+	buff_size = UPLOAD_SESSION_HEADER_SIZE + meta_bytes + \
+			session.part_count;
+	buff = (char *)calloc(1, buff_size);
+	if (buff == NULL)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"malloc %d bytes fail", __LINE__, buff_size);
+		return errno != 0 ? errno : ENOMEM;
+	}
+
+	long2buff(file_size, buff);
+	int2buff(part_size, buff + 8);
+	int2buff(meta_bytes, buff + 12);
+	memcpy(buff + UPLOAD_SESSION_HEADER_SIZE, meta_buff, meta_bytes);
+
+	if ((result=upload_session_create_part_file(session.part_filename, \
+		file_size)) == 0 && (result=storage_write_file( \
+		session.sess_filename, buff, buff_size)) != 0)
+	{
+		unlink(session.part_filename);
+	}
+	free(buff);
+
+	if (result == 0)
+	{
+		strcpy(session_id, session.id);
+	}
+	return result;
+}
+
+int storage_upload_session_load(const char *session_id, \
+		StorageUploadSession *pSession)
+{
+	char szIndex[3];
+	char *pEnd;
+	int buff_size;
+	int result;
+	int i;
+
+	memset(pSession, 0, sizeof(StorageUploadSession));
+	if (strlen(session_id) != STORAGE_UPLOAD_SESSION_ID_LEN)
+	{
+		return EINVAL;
+	}
+	for (i=0; i<STORAGE_UPLOAD_SESSION_ID_LEN; i++)
+	{
+		if (!((session_id[i] >= '0' && session_id[i] <= '9') || \
+			(session_id[i] >= 'A' && session_id[i] <= 'F')))
+		{
+			return EINVAL;
+		}
+	}
+
+	szIndex[0] = session_id[0];
+	szIndex[1] = session_id[1];
+	szIndex[2] = '\0';
+	pSession->store_path_index = strtol(szIndex, &pEnd, 16);
+	if (pSession->store_path_index >= g_path_count)
+	{
+		return EINVAL;
+	}
+
+	strcpy(pSession->id, session_id);
+	upload_session_get_filenames(pSession);
+	if (!fileExists(pSession->sess_filename))
+	{
+		return ENOENT;
+	}
+
+	if ((result=getFileContent(pSession->sess_filename, \
+		&pSession->buff, &buff_size)) != 0)
+	{
+		pSession->buff = NULL;
+		return result;
+	}
+
+	if (buff_size >= UPLOAD_SESSION_HEADER_SIZE)
+	{
+		pSession->file_size = buff2long((unsigned char *) \
+					pSession->buff);
+		pSession->part_size = buff2int((unsigned char *) \
+					pSession->buff + 8);
+		pSession->meta_bytes = buff2int((unsigned char *) \
+					pSession->buff + 12);
+	}
+	if (buff_size < UPLOAD_SESSION_HEADER_SIZE || \
+		pSession->part_size <= 0 || pSession->meta_bytes < 0 || \
+		pSession->meta_bytes > buff_size - UPLOAD_SESSION_HEADER_SIZE)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"session file %s is invalid", \
+			__LINE__, pSession->sess_filename);
+		storage_upload_session_free(pSession);
+		return EINVAL;
+	}
+
+	pSession->part_count = (int)((pSession->file_size + \
+			pSession->part_size - 1) / pSession->part_size);
+	if (pSession->part_count != buff_size - UPLOAD_SESSION_HEADER_SIZE \
+		- pSession->meta_bytes)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"session file %s is invalid", \
+			__LINE__, pSession->sess_filename);
+		storage_upload_session_free(pSession);
+		return EINVAL;
+	}
+
+	pSession->meta_buff = pSession->buff + UPLOAD_SESSION_HEADER_SIZE;
+	pSession->part_map = pSession->meta_buff + pSession->meta_bytes;
+	return 0;
+}
+
+void storage_upload_session_free(StorageUploadSession *pSession)
+{
+	if (pSession->buff != NULL)
+	{
+		free(pSession->buff);
+		pSession->buff = NULL;
+	}
+	pSession->meta_buff = NULL;
+	pSession->part_map = NULL;
+}
+
+int storage_upload_session_part_bytes(const StorageUploadSession *pSession, \
+		const int part_index)
+{
+	if (part_index < pSession->part_count - 1)
+	{
+		return pSession->part_size;
+	}
+
+	return (int)(pSession->file_size - (int64_t)pSession->part_size * \
+			(pSession->part_count - 1));
+}
+
+/* write the flag of the part to the part map */
+static int upload_session_mark_part(StorageUploadSession *pSession, \
+		const int part_index, const char received)
+{
+	int fd;
+	int result;
+
+	if ((fd=open(pSession->sess_filename, O_WRONLY)) < 0)
+	{
+		result = errno != 0 ? errno : ENOENT;
+		logError("file: "__FILE__", line: %d, " \
+			"open file %s fail, " \
+			"errno: %d, error info: %s", __LINE__, \
+			pSession->sess_filename, result, strerror(result));
+		return result;
+	}
+
+	result = 0;
+	if (pwrite(fd, &received, 1, (pSession->part_map - \
+		pSession->buff) + part_index) != 1)
+	{
+		result = errno != 0 ? errno : EIO;
+		logError("file: "__FILE__", line: %d, " \
+			"write file %s fail, " \
+			"errno: %d, error info: %s", __LINE__, \
+			pSession->sess_filename, result, strerror(result));
+	}
+	/* the part is unmarked on the disk before its content changed */
+	else if (!received && fsync(fd) != 0)
+	{
+		result = errno != 0 ? errno : EIO;
+		logError("file: "__FILE__", line: %d, " \
+			"fsync file %s fail, " \
+			"errno: %d, error info: %s", __LINE__, \
+			pSession->sess_filename, result, strerror(result));
+	}
+	close(fd);
+
+	if (result == 0)
+	{
+		pSession->part_map[part_index] = received;
+	}
+	return result;
+}
+
+int storage_upload_session_recv_part(StorageUploadSession *pSession, \
+		const int sock, const int part_index, \
+		const unsigned int expect_crc32)
+{
+	unsigned int crc32;
+	int fd;
+	int result;
+	int part_bytes;
+
+	part_bytes = storage_upload_session_part_bytes(pSession, part_index);
+	if (pSession->part_map[part_index] && (result= \
+		upload_session_mark_part(pSession, part_index, 0)) != 0)
+	{
+		storage_recv_to_fd(sock, -1, 0, part_bytes, &crc32);
+		return result;
+	}
+
+	if ((fd=open(pSession->part_filename, O_WRONLY)) < 0)
+	{
+		result = errno != 0 ? errno : ENOENT;
+		logError("file: "__FILE__", line: %d, " \
+			"open file %s fail, " \
+			"errno: %d, error info: %s", __LINE__, \
+			pSession->part_filename, result, strerror(result));
+		storage_recv_to_fd(sock, -1, 0, part_bytes, &crc32);
+		return result;
+	}
+
+	result = storage_recv_to_fd(sock, fd, (int64_t)pSession->part_size \
+			* part_index, part_bytes, &crc32);
+	if (result == 0 && crc32 != expect_crc32)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"crc32 %08X of part %d of upload session %s " \
+			"!= the crc32 %08X sent by the client", __LINE__, \
+			crc32, part_index, pSession->id, expect_crc32);
+		result = EIO;
+	}
+
+	/* the part is marked after its content is on the disk */
+	if (result == 0 && fsync(fd) != 0)
+	{
+		result = errno != 0 ? errno : EIO;
+		logError("file: "__FILE__", line: %d, " \
+			"fsync file %s fail, " \
+			"errno: %d, error info: %s", __LINE__, \
+			pSession->part_filename, result, strerror(result));
+	}
+	close(fd);
+	if (result != 0)
+	{
+		return result;
+	}
+
+	return upload_session_mark_part(pSession, part_index, 1);
+}
+
+int storage_upload_session_checksum(const StorageUploadSession *pSession, \
+		unsigned int *crc32)
+{
+	char *buff;
+	int64_t total_bytes;
+	int bytes;
+	int fd;
+	int result;
+	int i;
+
+	for (i=0; i<pSession->part_count; i++)
+	{
+		if (!pSession->part_map[i])
+		{
+			return EAGAIN;
+		}
+	}
+
+	if ((fd=open(pSession->part_filename, O_RDONLY)) < 0)
+	{
+		result = errno != 0 ? errno : ENOENT;
+		logError("file: "__FILE__", line: %d, " \
+			"open file %s fail, " \
+			"errno: %d, error info: %s", __LINE__, \
+			pSession->part_filename, result, strerror(result));
+		return result;
+	}
+
+	buff = (char *)malloc(STORAGE_STREAM_BUFF_SIZE);
+	if (buff == NULL)
+	{
+		close(fd);
+		return errno != 0 ? errno : ENOMEM;
+	}
+
+	storage_advise_file(fd, pSession->file_size, STORAGE_FADV_SEQUENTIAL);
+	*crc32 = CRC32C_INIT_VALUE;
+	total_bytes = 0;
+	while ((bytes=read(fd, buff, STORAGE_STREAM_BUFF_SIZE)) > 0)
+	{
+		*crc32 = crc32c_ex(*crc32, buff, bytes);
+		total_bytes += bytes;
+	}
+	*crc32 = CRC32C_FINAL(*crc32);
+	storage_advise_file(fd, pSession->file_size, STORAGE_FADV_DONTNEED);
+	free(buff);
+	close(fd);
+
+	if (bytes < 0 || total_bytes != pSession->file_size)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"read file %s fail, file size: "INT64_PRINTF_FORMAT \
+			", expect: "INT64_PRINTF_FORMAT, __LINE__, \
+			pSession->part_filename, total_bytes, \
+			pSession->file_size);
+		return EIO;
+	}
+
+	return 0;
+}
+
+int storage_upload_session_remove(const StorageUploadSession *pSession)
+{
+	if (unlink(pSession->part_filename) != 0 && errno != ENOENT)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"unlink file %s fail, " \
+			"errno: %d, error info: %s", __LINE__, \
+			pSession->part_filename, errno, strerror(errno));
+	}
+
+	if (unlink(pSession->sess_filename) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"unlink file %s fail, " \
+			"errno: %d, error info: %s", __LINE__, \
+			pSession->sess_filename, errno, strerror(errno));
+		return errno != 0 ? errno : ENOENT;
+	}
+
+	return 0;
+}
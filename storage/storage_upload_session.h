@@ -0,0 +1,120 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//storage_upload_session.h
+
+#ifndef _STORAGE_UPLOAD_SESSION_H_
+#define _STORAGE_UPLOAD_SESSION_H_
+
+#include "fdfs_define.h"
+#include "tracker_types.h"
+
+/* the session files are under the store path/data/sessions */
+#define STORAGE_UPLOAD_SESSION_DIR	"sessions"
+
+/* the session id: store path index(2) + timestamp(8) + random(6) in hex */
+#define STORAGE_UPLOAD_SESSION_ID_LEN	16
+
+#define STORAGE_UPLOAD_MIN_PART_SIZE	(64 * 1024)
+#define STORAGE_UPLOAD_MAX_PART_SIZE	(1024 * 1024 * 1024)
+#define STORAGE_UPLOAD_MAX_PART_COUNT	(64 * 1024)
+
+/* the sessions not committed in time are removed when the server starts
+   and then every clean interval */
+#define STORAGE_UPLOAD_SESSION_TIMEOUT		(7 * 24 * 3600)
+#define STORAGE_UPLOAD_SESSION_CLEAN_INTERVAL	3600
+
+typedef struct
+{
+	char id[STORAGE_UPLOAD_SESSION_ID_LEN + 1];
+	char sess_filename[MAX_PATH_SIZE + 64];  //the state of the session
+	char part_filename[MAX_PATH_SIZE + 64];  //the file content
+	int store_path_index;
+	int64_t file_size;
+	int part_size;
+	int part_count;
+	int meta_bytes;
+	char *meta_buff;  //the sorted metadata, refer to buff
+	char *part_map;   //1 for the part received, refer to buff
+	char *buff;
+} StorageUploadSession;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int g_upload_session_thread_count;
+
+/*
+the upload session of the large file, the parts of the file are uploaded
+at their offsets over many connections in any order, then the session is
+committed to a normal file, the received parts are kept in the session
+files, so the upload can be resumed after the connection broken or the
+server restarted
+*/
+int storage_upload_session_init();
+
+/* start the thread removing the expired sessions */
+int storage_upload_session_thread_start();
+
+/*
+create the session, the space of the file is allocated at once
+params:
+	file_size: the file size
+	part_size: the size of each part except the last one
+	meta_buff: the sorted metadata
+	meta_bytes: the metadata length
+	session_id: return the session id
+return: 0 for success, != 0 for fail
+*/
+int storage_upload_session_begin(const int64_t file_size, \
+		const int part_size, const char *meta_buff, \
+		const int meta_bytes, char *session_id);
+
+/*
+load the session, free it by storage_upload_session_free
+return: 0 for success, ENOENT for the session not exist, != 0 for fail
+*/
+int storage_upload_session_load(const char *session_id, \
+		StorageUploadSession *pSession);
+void storage_upload_session_free(StorageUploadSession *pSession);
+
+/*
+return the size of the part
+*/
+int storage_upload_session_part_bytes(const StorageUploadSession *pSession, \
+		const int part_index);
+
+/*
+recv the part from the socket to its offset and mark it received, the
+content is always received to keep the connection usable
+params:
+	expect_crc32: the crc32 of the part computed by the client
+return: 0 for success, EIO for the crc32 not match, != 0 for fail
+*/
+int storage_upload_session_recv_part(StorageUploadSession *pSession, \
+		const int sock, const int part_index, \
+		const unsigned int expect_crc32);
+
+/*
+check all of the parts are received and compute the crc32 of the file
+return: 0 for success, EAGAIN for some parts missing, != 0 for fail
+*/
+int storage_upload_session_checksum(const StorageUploadSession *pSession, \
+		unsigned int *crc32);
+
+/*
+remove the session files, the part file is kept when it has been renamed
+*/
+int storage_upload_session_remove(const StorageUploadSession *pSession);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -16,11 +16,6 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
-#ifdef OS_LINUX
-#include <sys/statfs.h>
-#endif
-#include <sys/param.h>
-#include <sys/mount.h>
 #include "fdfs_define.h"
 #include "logger.h"
 #include "fdfs_global.h"
@@ -34,9 +29,17 @@
 #include "storage_func.h"
 
 static pthread_mutex_t reporter_thread_lock;
+static char registered_ip_addr[FDFS_IPADDR_SIZE];  //joined with this ip
+
+typedef struct
+{
+	int group_version;  //the group version last seen from the tracker
+	bool stat_sent;     //all stat fields sent since join
+	FDFSStorageStatBuff stat_buff;  //the stat fields last sent
+} TrackerBeatContext;
 
 static int tracker_heart_beat(TrackerServerInfo *pTrackerServer, \
-			int *pstat_chg_sync_count);
+			int *pstat_chg_sync_count, TrackerBeatContext *pContext);
 static int tracker_report_stat(TrackerServerInfo *pTrackerServer);
 static int tracker_sync_dest_req(TrackerServerInfo *pTrackerServer);
 static int tracker_sync_notify(TrackerServerInfo *pTrackerServer);
@@ -67,11 +70,62 @@ int tracker_report_destroy()
 	return 0;
 }
 
+int tracker_get_storage_servers(FDFSStorageBrief *servers, int *server_count)
+{
+	if (pthread_mutex_lock(&reporter_thread_lock) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call pthread_mutex_lock fail, " \
+			"errno: %d, error info:%s.", \
+			__LINE__, errno, strerror(errno));
+		return errno != 0 ? errno : EAGAIN;
+	}
+
+	memcpy(servers, g_storage_servers, \
+		sizeof(FDFSStorageBrief) * g_storage_count);
+	*server_count = g_storage_count;
+
+	if (pthread_mutex_unlock(&reporter_thread_lock) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call pthread_mutex_unlock fail, " \
+			"errno: %d, error info:%s.", \
+			__LINE__, errno, strerror(errno));
+	}
+
+	return 0;
+}
+
+int tracker_get_registered_ip(char *ip_addr)
+{
+	if (pthread_mutex_lock(&reporter_thread_lock) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call pthread_mutex_lock fail, " \
+			"errno: %d, error info:%s.", \
+			__LINE__, errno, strerror(errno));
+		return errno != 0 ? errno : EAGAIN;
+	}
+
+	strcpy(ip_addr, registered_ip_addr);
+
+	if (pthread_mutex_unlock(&reporter_thread_lock) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call pthread_mutex_unlock fail, " \
+			"errno: %d, error info:%s.", \
+			__LINE__, errno, strerror(errno));
+	}
+
+	return *ip_addr != '\0' ? 0 : ENOENT;
+}
+
 static void* tracker_report_thread_entrance(void* arg)
 {
 	TrackerServerInfo *pTrackerServer;
 	char tracker_client_ip[FDFS_IPADDR_SIZE];
 	bool sync_old_done;
+	TrackerBeatContext beat_context;
 	int stat_chg_sync_count;
 	int sleep_secs;
 	time_t current_time;
@@ -140,6 +194,15 @@ static void* tracker_report_thread_entrance(void* arg)
 			continue;
 		}
 
+		if (pthread_mutex_lock(&reporter_thread_lock) == 0)
+		{
+			strcpy(registered_ip_addr, tracker_client_ip);
+			pthread_mutex_unlock(&reporter_thread_lock);
+		}
+
+		//the tracker may be restarted, begin with the full list
+		memset(&beat_context, 0, sizeof(beat_context));
+
 		if (!sync_old_done)
 		{
 			if (pthread_mutex_lock(&reporter_thread_lock) != 0)
@@ -207,7 +270,8 @@ static void* tracker_report_thread_entrance(void* arg)
 					g_heart_beat_interval)
 			{
 				if (tracker_heart_beat(pTrackerServer, \
-					&stat_chg_sync_count) != 0)
+					&stat_chg_sync_count, \
+					&beat_context) != 0)
 				{
 					break;
 				}
@@ -349,8 +413,13 @@ int tracker_sync_diff_servers(TrackerServerInfo *pTrackerServer, \
 	return resp.status;
 }
 
+/*
+merge the storage servers from the tracker, briefServers only contains
+the changed storage servers when bFullList is false
+*/
 static int tracker_merge_servers(TrackerServerInfo *pTrackerServer, \
-		FDFSStorageBrief *briefServers, const int server_count)
+		FDFSStorageBrief *briefServers, const int server_count, \
+		const bool bFullList)
 {
 	FDFSStorageBrief *pServer;
 	FDFSStorageBrief *pInsertedServer;
@@ -437,7 +506,7 @@ static int tracker_merge_servers(TrackerServerInfo *pTrackerServer, \
 		}
 	}
 
-	if (g_storage_count == server_count)
+	if (!bFullList || g_storage_count == server_count)
 	{
 		if (pDiffServer - diffServers > 0)
 		{
@@ -568,7 +637,58 @@ static int tracker_check_response(TrackerServerInfo *pTrackerServer)
 	*/
 
 	return tracker_merge_servers(pTrackerServer, \
-                briefServers, server_count);
+                briefServers, server_count, true);
+}
+
+static int tracker_check_delta_response(TrackerServerInfo *pTrackerServer, \
+		TrackerBeatContext *pContext)
+{
+	TrackerDeltaBeatRespHeader *pRespHeader;
+	char in_buff[sizeof(TrackerDeltaBeatRespHeader) + \
+		sizeof(FDFSStorageBrief) * FDFS_MAX_SERVERS_EACH_GROUP];
+	char *pInBuff;
+	int in_bytes;
+	int server_count;
+	int result;
+
+	pInBuff = in_buff;
+	if ((result=tracker_recv_response(pTrackerServer, &pInBuff, \
+			sizeof(in_buff), &in_bytes)) != 0)
+	{
+		return result;
+	}
+
+	if (in_bytes == 0)  //group not changed
+	{
+		return 0;
+	}
+
+	if (in_bytes < sizeof(TrackerDeltaBeatRespHeader) || \
+		(in_bytes - sizeof(TrackerDeltaBeatRespHeader)) % \
+		sizeof(FDFSStorageBrief) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"tracker server %s:%d, " \
+			"package size %d is not correct", \
+			__LINE__, pTrackerServer->ip_addr, \
+			pTrackerServer->port, in_bytes);
+		return EINVAL;
+	}
+
+	pRespHeader = (TrackerDeltaBeatRespHeader *)in_buff;
+	server_count = (in_bytes - sizeof(TrackerDeltaBeatRespHeader)) / \
+			sizeof(FDFSStorageBrief);
+	if ((result=tracker_merge_servers(pTrackerServer, \
+		(FDFSStorageBrief *)(in_buff + \
+		sizeof(TrackerDeltaBeatRespHeader)), server_count, \
+		pRespHeader->full_list)) != 0)
+	{
+		return result;
+	}
+
+	pContext->group_version = buff2int((unsigned char *) \
+					pRespHeader->sz_group_version);
+	return 0;
 }
 
 int tracker_sync_src_req(TrackerServerInfo *pTrackerServer, \
@@ -773,14 +893,14 @@ static int tracker_report_stat(TrackerServerInfo *pTrackerServer)
 	char out_buff[sizeof(TrackerHeader) + sizeof(TrackerStatReportReqBody)];
 	TrackerHeader *pHeader;
 	TrackerStatReportReqBody *pStatBuff;
-	struct statfs sbuf;
+	int total_mb;
+	int free_mb;
+	int result;
 
-	if (statfs(g_base_path, &sbuf) != 0)
+	if ((result=storage_refresh_store_paths_space(&total_mb, \
+			&free_mb)) != 0)
 	{
-		logError("file: "__FILE__", line: %d, " \
-			"call statfs fail, errno: %d, error info: %s.", \
-			__LINE__, errno, strerror(errno));
-		return errno != 0 ? errno : EACCES;
+		return result;
 	}
 
 	pHeader = (TrackerHeader *)out_buff;
@@ -790,10 +910,8 @@ static int tracker_report_stat(TrackerServerInfo *pTrackerServer)
 	pHeader->cmd = TRACKER_PROTO_CMD_STORAGE_REPORT;
 	pHeader->status = 0;
 
-	int2buff((int)(((double)(sbuf.f_blocks) * sbuf.f_bsize) / FDFS_ONE_MB),\
-		pStatBuff->sz_total_mb);
-	int2buff((int)(((double)(sbuf.f_bavail) * sbuf.f_bsize) / FDFS_ONE_MB),\
-		pStatBuff->sz_free_mb);
+	int2buff(total_mb, pStatBuff->sz_total_mb);
+	int2buff(free_mb, pStatBuff->sz_free_mb);
 
 	if(tcpsenddata(pTrackerServer->sock, out_buff, \
 		sizeof(out_buff), g_network_timeout) != 1)
@@ -810,55 +928,89 @@ static int tracker_report_stat(TrackerServerInfo *pTrackerServer)
 	return tracker_check_response(pTrackerServer);
 }
 
+static void tracker_pack_stat_buff(FDFSStorageStatBuff *pStatBuff)
+{
+	int2buff(g_storage_stat.total_upload_count, \
+		pStatBuff->sz_total_upload_count);
+	int2buff(g_storage_stat.success_upload_count, \
+		pStatBuff->sz_success_upload_count);
+	int2buff(g_storage_stat.total_download_count, \
+		pStatBuff->sz_total_download_count);
+	int2buff(g_storage_stat.success_download_count, \
+		pStatBuff->sz_success_download_count);
+	int2buff(g_storage_stat.total_set_meta_count, \
+		pStatBuff->sz_total_set_meta_count);
+	int2buff(g_storage_stat.success_set_meta_count, \
+		pStatBuff->sz_success_set_meta_count);
+	int2buff(g_storage_stat.total_delete_count, \
+		pStatBuff->sz_total_delete_count);
+	int2buff(g_storage_stat.success_delete_count, \
+		pStatBuff->sz_success_delete_count);
+	int2buff(g_storage_stat.total_get_meta_count, \
+		pStatBuff->sz_total_get_meta_count);
+	int2buff(g_storage_stat.success_get_meta_count, \
+	 	pStatBuff->sz_success_get_meta_count);
+	int2buff(g_storage_stat.last_source_update, \
+		pStatBuff->sz_last_source_update);
+	int2buff(g_storage_stat.last_sync_update, \
+		pStatBuff->sz_last_sync_update);
+}
+
+/*
+send the group version last seen and the stat fields changed since
+the last beat, get the changed storage servers of the group
+*/
 static int tracker_heart_beat(TrackerServerInfo *pTrackerServer, \
-			int *pstat_chg_sync_count)
+			int *pstat_chg_sync_count, TrackerBeatContext *pContext)
 {
-	char out_buff[sizeof(TrackerHeader) + sizeof(FDFSStorageStatBuff)];
+	char out_buff[sizeof(TrackerHeader) + \
+		sizeof(TrackerDeltaBeatReqHeader) + \
+		sizeof(FDFSStorageStatBuff)];
 	TrackerHeader *pHeader;
-	FDFSStorageStatBuff *pStatBuff;
+	TrackerDeltaBeatReqHeader *pReqHeader;
+	FDFSStorageStatBuff statBuff;
+	char *pField;
+	char *pLastField;
+	int stat_mask;
 	int body_len;
+	int i;
 
 	pHeader = (TrackerHeader *)out_buff;
-	if (*pstat_chg_sync_count != g_stat_change_count)
-	{
-		pStatBuff = (FDFSStorageStatBuff *)( \
-				out_buff + sizeof(TrackerHeader));
-		int2buff(g_storage_stat.total_upload_count, \
-			pStatBuff->sz_total_upload_count);
-		int2buff(g_storage_stat.success_upload_count, \
-			pStatBuff->sz_success_upload_count);
-		int2buff(g_storage_stat.total_download_count, \
-			pStatBuff->sz_total_download_count);
-		int2buff(g_storage_stat.success_download_count, \
-			pStatBuff->sz_success_download_count);
-		int2buff(g_storage_stat.total_set_meta_count, \
-			pStatBuff->sz_total_set_meta_count);
-		int2buff(g_storage_stat.success_set_meta_count, \
-			pStatBuff->sz_success_set_meta_count);
-		int2buff(g_storage_stat.total_delete_count, \
-			pStatBuff->sz_total_delete_count);
-		int2buff(g_storage_stat.success_delete_count, \
-			pStatBuff->sz_success_delete_count);
-		int2buff(g_storage_stat.total_get_meta_count, \
-			pStatBuff->sz_total_get_meta_count);
-		int2buff(g_storage_stat.success_get_meta_count, \
-		 	pStatBuff->sz_success_get_meta_count);
-		int2buff(g_storage_stat.last_source_update, \
-			pStatBuff->sz_last_source_update);
-		int2buff(g_storage_stat.last_sync_update, \
-			pStatBuff->sz_last_sync_update);
+	pReqHeader = (TrackerDeltaBeatReqHeader *)(out_buff + \
+			sizeof(TrackerHeader));
+	pField = out_buff + sizeof(TrackerHeader) + \
+			sizeof(TrackerDeltaBeatReqHeader);
+	stat_mask = 0;
+	if (*pstat_chg_sync_count != g_stat_change_count || \
+		!pContext->stat_sent)
+	{
+		tracker_pack_stat_buff(&statBuff);
+		for (i=0; i<FDFS_STORAGE_STAT_FIELD_COUNT; i++)
+		{
+			pLastField = (char *)&(pContext->stat_buff) + 4 * i;
+			if (pContext->stat_sent && memcmp(pLastField, \
+				(char *)&statBuff + 4 * i, 4) == 0)
+			{
+				continue;
+			}
+
+			memcpy(pField, (char *)&statBuff + 4 * i, 4);
+			memcpy(pLastField, pField, 4);
+			pField += 4;
+			stat_mask |= 1 << i;
+		}
 
 		*pstat_chg_sync_count = g_stat_change_count;
-		body_len = sizeof(FDFSStorageStatBuff);
-	}
-	else
-	{
-		body_len = 0;
+		pContext->stat_sent = true;
 	}
 
+	int2buff(pContext->group_version, pReqHeader->sz_group_version);
+	int2buff(stat_mask, pReqHeader->sz_stat_mask);
+	body_len = pField - (out_buff + sizeof(TrackerHeader));
+
+	memset(pHeader, 0, sizeof(TrackerHeader));
 	sprintf(pHeader->pkg_len, "%x", body_len);
-	pHeader->cmd = TRACKER_PROTO_CMD_STORAGE_BEAT;
-	pHeader->status = 0;
+	pHeader->cmd = TRACKER_PROTO_CMD_STORAGE_DELTA_BEAT;
 
 	if(tcpsenddata(pTrackerServer->sock, out_buff, \
 		sizeof(TrackerHeader) + body_len, g_network_timeout) != 1)
@@ -872,7 +1024,7 @@ static int tracker_heart_beat(TrackerServerInfo *pTrackerServer, \
 		return errno != 0 ? errno : EPIPE;
 	}
 
-	return tracker_check_response(pTrackerServer);
+	return tracker_check_delta_response(pTrackerServer, pContext);
 }
 
 int tracker_report_thread_start()
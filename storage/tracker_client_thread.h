@@ -22,6 +22,23 @@ int tracker_report_init();
 int tracker_report_destroy();
 int tracker_report_thread_start();
 
+/*
+copy the storage servers of the group under the lock of the reporters
+params:
+	servers: the array of FDFS_MAX_SERVERS_EACH_GROUP elements at least
+	server_count: return the server count
+return: 0 for success, != 0 for fail
+*/
+int tracker_get_storage_servers(FDFSStorageBrief *servers, int *server_count);
+
+/*
+get the ip address of this storage server joined to the tracker server
+params:
+	ip_addr: return the ip address, FDFS_IPADDR_SIZE bytes at least
+return: 0 for success, ENOENT for not joined yet
+*/
+int tracker_get_registered_ip(char *ip_addr);
+
 int tracker_report_join(TrackerServerInfo *pTrackerServer);
 int tracker_sync_src_req(TrackerServerInfo *pTrackerServer, \
 			BinLogReader *pReader);
@@ -29,6 +29,7 @@
 #include "tracker_service.h"
 #include "tracker_global.h"
 #include "tracker_func.h"
+#include "tracker_peer.h"
 
 bool bReloadFlag = false;
 
@@ -73,6 +74,12 @@ int main(int argc, char *argv[])
 	{
 		return result;
 	}
+
+	//warm up before listening, so trackers starting together don't wait
+	if ((result=tracker_peer_init()) != 0)
+	{
+		return result;
+	}
 	
 	sock = socketServer(bind_addr, g_server_port, \
 			TRACKER_ERROR_LOG_FILENAME);
@@ -91,6 +98,11 @@ int main(int argc, char *argv[])
 	}
 	
 	g_tracker_thread_count = 0;
+	if ((result=tracker_peer_thread_start()) != 0)
+	{
+		return result;
+	}
+
 	pthread_attr_init(&pattr);
 	pthread_attr_setdetachstate(&pattr, PTHREAD_CREATE_DETACHED);
 
@@ -181,12 +193,13 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	while (g_tracker_thread_count != 0)
+	while (g_tracker_thread_count != 0 || g_tracker_peer_thread_count != 0)
 	{
 		sleep(1);
 	}
 	
 	//gc_destroy();
+	tracker_peer_destroy();
 	tracker_mem_destroy();
 
 	pthread_attr_destroy(&pattr);
@@ -29,11 +29,14 @@
 #include "tracker_global.h"
 #include "tracker_func.h"
 #include "tracker_mem.h"
+#include "tracker_peer.h"
 
 static int tracker_load_store_lookup(const char *filename, \
 		IniItemInfo *items, const int nItemCount)
 {
 	char *pGroupName;
+	int nMaxShare;
+
 	g_groups.store_lookup = iniGetIntValue("store_lookup", \
 			items, nItemCount, FDFS_STORE_LOOKUP_ROUND_ROBIN);
 	if (g_groups.store_lookup == FDFS_STORE_LOOKUP_ROUND_ROBIN)
@@ -48,6 +51,23 @@ static int tracker_load_store_lookup(const char *filename, \
 		return 0;
 	}
 
+	if (g_groups.store_lookup == FDFS_STORE_LOOKUP_WEIGHTED)
+	{
+		g_groups.store_group[0] = '\0';
+		nMaxShare = iniGetIntValue("store_max_share", \
+				items, nItemCount, FDFS_DEF_STORE_MAX_SHARE);
+		if (nMaxShare < 0 || nMaxShare > 100)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"conf file \"%s\", the value of " \
+				"\"store_max_share\" is invalid, value=%d!", \
+				__LINE__, filename, nMaxShare);
+			return EINVAL;
+		}
+		g_groups.store_max_share = nMaxShare;
+		return 0;
+	}
+
 	if (g_groups.store_lookup != FDFS_STORE_LOOKUP_SPEC_GROUP)
 	{
 		logError("file: "__FILE__", line: %d, " \
@@ -87,6 +107,93 @@ static int tracker_load_store_lookup(const char *filename, \
 	return 0;
 }
 
+static int tracker_load_peer_servers(const char *filename, \
+		IniItemInfo *items, const int nItemCount)
+{
+	char *ppPeerServers[FDFS_MAX_TRACKERS];
+	TrackerServerInfo *pServer;
+	char *pSeperator;
+	char szHost[128];
+	int nHostLen;
+	int nCount;
+	int i;
+
+	g_tracker_peer_sync_interval = iniGetIntValue("peer_sync_interval", \
+			items, nItemCount, FDFS_DEF_PEER_SYNC_INTERVAL);
+	if (g_tracker_peer_sync_interval <= 0)
+	{
+		g_tracker_peer_sync_interval = FDFS_DEF_PEER_SYNC_INTERVAL;
+	}
+
+	nCount = iniGetValues("peer_tracker_server", items, nItemCount, \
+			ppPeerServers, FDFS_MAX_TRACKERS);
+	if (nCount <= 0)
+	{
+		g_tracker_peer_count = 0;
+		return 0;
+	}
+
+	g_tracker_peers = (TrackerServerInfo *)malloc( \
+			sizeof(TrackerServerInfo) * nCount);
+	if (g_tracker_peers == NULL)
+	{
+		return errno != 0 ? errno : ENOMEM;
+	}
+	memset(g_tracker_peers, 0, sizeof(TrackerServerInfo) * nCount);
+
+	g_tracker_peer_count = 0;
+	for (i=0; i<nCount; i++)
+	{
+		if ((pSeperator=strchr(ppPeerServers[i], ':')) == NULL)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"conf file \"%s\", " \
+				"peer_tracker_server \"%s\" is invalid, " \
+				"correct format is host:port", \
+				__LINE__, filename, ppPeerServers[i]);
+			return EINVAL;
+		}
+
+		nHostLen = pSeperator - ppPeerServers[i];
+		if (nHostLen >= sizeof(szHost))
+		{
+			nHostLen = sizeof(szHost) - 1;
+		}
+		memcpy(szHost, ppPeerServers[i], nHostLen);
+		szHost[nHostLen] = '\0';
+
+		pServer = g_tracker_peers + g_tracker_peer_count;
+		if (getIpaddrByName(szHost, pServer->ip_addr, \
+			sizeof(pServer->ip_addr)) == INADDR_NONE)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"conf file \"%s\", " \
+				"host \"%s\" is invalid", \
+				__LINE__, filename, szHost);
+			return EINVAL;
+		}
+		if (strcmp(pServer->ip_addr, "127.0.0.1") == 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"conf file \"%s\", " \
+				"host \"%s\" is invalid, " \
+				"ip addr can't be 127.0.0.1", \
+				__LINE__, filename, szHost);
+			return EINVAL;
+		}
+
+		pServer->port = atoi(pSeperator+1);
+		if (pServer->port <= 0)
+		{
+			pServer->port = FDFS_TRACKER_SERVER_DEF_PORT;
+		}
+		pServer->sock = -1;
+		g_tracker_peer_count++;
+	}
+
+	return 0;
+}
+
 int tracker_load_from_conf_file(const char *filename, \
 		char *bind_addr, const int addr_size)
 {
@@ -226,6 +333,12 @@ int tracker_load_from_conf_file(const char *filename, \
 		{
 			g_max_connections = FDFS_DEF_MAX_CONNECTONS;
 		}
+
+		if ((result=tracker_load_peer_servers(filename, \
+			items, nItemCount)) != 0)
+		{
+			break;
+		}
 		
 		logInfo(TRACKER_ERROR_LOG_FILENAME, \
 			"FastDFS v%d.%d, base_path=%s, " \
@@ -233,13 +346,17 @@ int tracker_load_from_conf_file(const char *filename, \
 			"port=%d, bind_addr=%s, " \
 			"max_connections=%d, "    \
 			"store_lookup=%d, store_group=%s, " \
-			"reserved_storage_space=%dMB", \
+			"store_max_share=%d%%, " \
+			"reserved_storage_space=%dMB, " \
+			"peer_tracker_server_count=%d, " \
+			"peer_sync_interval=%ds", \
 			g_version.major, g_version.minor,  \
 			g_base_path, \
 			g_network_timeout, \
 			g_server_port, bind_addr, g_max_connections, \
 			g_groups.store_lookup, g_groups.store_group, \
-			g_storage_reserved_mb);
+			g_groups.store_max_share, g_storage_reserved_mb, \
+			g_tracker_peer_count, g_tracker_peer_sync_interval);
 		break;
 	}
 
@@ -14,3 +14,7 @@ FDFSGroups g_groups;
 int g_storage_stat_chg_count = 0;
 int g_storage_reserved_mb = 0;
 
+int g_tracker_peer_count = 0;
+TrackerServerInfo *g_tracker_peers = NULL;
+int g_tracker_peer_sync_interval = 0;
+
@@ -25,6 +25,10 @@ extern int g_storage_stat_chg_count;
 extern int g_max_connections;
 extern int g_storage_reserved_mb;
 
+extern int g_tracker_peer_count;
+extern TrackerServerInfo *g_tracker_peers;
+extern int g_tracker_peer_sync_interval;
+
 #ifdef __cplusplus
 }
 #endif
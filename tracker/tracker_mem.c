@@ -23,6 +23,7 @@
 #include "tracker_global.h"
 #include "tracker_mem.h"
 #include "shared_func.h"
+#include "hash.h"
 
 static pthread_mutex_t mem_thread_lock;
 
@@ -1221,6 +1222,8 @@ int tracker_mem_add_storage(TrackerClientInfo *pClientInfo, \
 				pClientInfo->pGroup->count);
 			pClientInfo->pGroup->count++;
 			pClientInfo->pGroup->version++;
+			pStorageServer->chg_version = \
+				pClientInfo->pGroup->version;
 			break;
 		}
 
@@ -1376,6 +1379,8 @@ int tracker_mem_sync_storages(TrackerClientInfo *pClientInfo, \
 				{
 					(*ppFound)->status = pServer->status;
 					pClientInfo->pGroup->version++;
+					(*ppFound)->chg_version = \
+						pClientInfo->pGroup->version;
 				}
 
 				continue;
@@ -1390,6 +1395,9 @@ int tracker_mem_sync_storages(TrackerClientInfo *pClientInfo, \
 				pClientInfo->pGroup->sorted_servers, \
 				pClientInfo->pGroup->count);
 
+			pClientInfo->pGroup->version++;
+			pStorageServer->chg_version = \
+				pClientInfo->pGroup->version;
 			pStorageServer++;
 			pClientInfo->pGroup->count++;
 		}
@@ -1441,6 +1449,7 @@ int tracker_mem_deactive_store_server(FDFSGroupInfo *pGroup,
 
 		pGroup->active_count--;
 		pGroup->version++;
+		pTargetServer->chg_version = pGroup->version;
 		if (pGroup->current_write_server >= pGroup->active_count)
 		{
 			pGroup->current_write_server = 0;
@@ -1508,6 +1517,7 @@ int tracker_mem_active_store_server(FDFSGroupInfo *pGroup, \
 			pGroup->active_count);
 		pGroup->active_count++;
 		pGroup->version++;
+		pTargetServer->chg_version = pGroup->version;
 	}
 
 	if (pthread_mutex_unlock(&mem_thread_lock) != 0)
@@ -1544,6 +1554,44 @@ int tracker_mem_offline_store_server(TrackerClientInfo *pClientInfo)
 				pClientInfo->pStorage);
 }
 
+/*
+the topology version is a checksum of the group names, storage ports
+and active servers, so it is the same on all trackers which have the
+same view of the cluster, and keeps unchanged after tracker restart
+*/
+int tracker_mem_get_topology_version()
+{
+	FDFSGroupInfo **ppGroup;
+	FDFSGroupInfo **ppGroupEnd;
+	FDFSStorageDetail **ppServer;
+	FDFSStorageDetail **ppServerEnd;
+	unsigned int version;
+
+	tracker_mem_pthread_lock();
+	version = g_groups.count;
+	ppGroupEnd = g_groups.sorted_groups + g_groups.count;
+	for (ppGroup=g_groups.sorted_groups; ppGroup<ppGroupEnd; ppGroup++)
+	{
+		version = version * 31 + Time33Hash((*ppGroup)->group_name, \
+				strlen((*ppGroup)->group_name));
+		version = version * 31 + (*ppGroup)->storage_port;
+		version = version * 31 + (*ppGroup)->active_count;
+
+		ppServerEnd = (*ppGroup)->active_servers + \
+				(*ppGroup)->active_count;
+		for (ppServer=(*ppGroup)->active_servers; \
+			ppServer<ppServerEnd; ppServer++)
+		{
+			version = version * 31 + Time33Hash( \
+				(*ppServer)->ip_addr, \
+				strlen((*ppServer)->ip_addr));
+		}
+	}
+	tracker_mem_pthread_unlock();
+
+	return (int)version;
+}
+
 int tracker_mem_pthread_lock()
 {
 	if (pthread_mutex_lock(&mem_thread_lock) != 0)
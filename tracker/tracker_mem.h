@@ -38,12 +38,15 @@ int tracker_mem_add_group_and_storage(TrackerClientInfo *pClientInfo, \
 int tracker_mem_offline_store_server(TrackerClientInfo *pClientInfo);
 int tracker_mem_active_store_server(FDFSGroupInfo *pGroup, \
 			FDFSStorageDetail *pTargetServer);
+int tracker_mem_deactive_store_server(FDFSGroupInfo *pGroup, \
+			FDFSStorageDetail *pTargetServer);
 
 int tracker_mem_sync_storages(TrackerClientInfo *pClientInfo, \
                 FDFSStorageBrief *briefServers, const int server_count);
 int tracker_save_storages();
 int tracker_get_group_file_count(FDFSGroupInfo *pGroup);
 int tracker_get_group_success_upload_count(FDFSGroupInfo *pGroup);
+int tracker_mem_get_topology_version();
 FDFSStorageDetail *tracker_get_group_sync_src_server(FDFSGroupInfo *pGroup, \
 			FDFSStorageDetail *pDestServer);
 
@@ -0,0 +1,688 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//tracker_peer.c
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "fdfs_define.h"
+#include "logger.h"
+#include "fdfs_global.h"
+#include "sockopt.h"
+#include "shared_func.h"
+#include "tracker_types.h"
+#include "tracker_proto.h"
+#include "tracker_global.h"
+#include "tracker_mem.h"
+#include "tracker_peer.h"
+
+int g_tracker_peer_thread_count = 0;
+
+static pthread_mutex_t leader_lock;
+static TrackerServerInfo leader_server;  //connection to forward queries
+static char self_ip_addr[FDFS_IPADDR_SIZE];
+static int leader_index = -1;  //index of g_tracker_peers, -1 for self
+static time_t leader_down_until = 0;  //the leader failed, select locally
+static int self_index = -1;    //index of g_tracker_peers, -1 for not listed
+
+static void leader_lock_acquire()
+{
+	if (pthread_mutex_lock(&leader_lock) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call pthread_mutex_lock fail, " \
+			"errno: %d, error info:%s.", \
+			__LINE__, errno, strerror(errno));
+	}
+}
+
+static void leader_lock_release()
+{
+	if (pthread_mutex_unlock(&leader_lock) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call pthread_mutex_unlock fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, errno, strerror(errno));
+	}
+}
+
+static int tracker_peer_connect(TrackerServerInfo *pServer)
+{
+	if (pServer->sock >= 0)
+	{
+		close(pServer->sock);
+	}
+	pServer->sock = socket(AF_INET, SOCK_STREAM, 0);
+	if(pServer->sock < 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"socket create failed, errno: %d, " \
+			"error info: %s.", \
+			__LINE__, errno, strerror(errno));
+		return errno != 0 ? errno : EPERM;
+	}
+
+	if (connectserverbyip(pServer->sock, \
+		pServer->ip_addr, pServer->port) != 1)
+	{
+		close(pServer->sock);
+		pServer->sock = -1;
+		return errno != 0 ? errno : ECONNREFUSED;
+	}
+
+	return 0;
+}
+
+static void tracker_peer_disconnect(TrackerServerInfo *pServer)
+{
+	if (pServer->sock >= 0)
+	{
+		close(pServer->sock);
+		pServer->sock = -1;
+	}
+}
+
+static int tracker_peer_request(TrackerServerInfo *pServer, const char cmd, \
+		char *body, const int body_len, char **ppInBuff, \
+		const int in_buff_size, int *in_bytes)
+{
+	TrackerHeader header;
+	int result;
+
+	if (pServer->sock < 0)
+	{
+		if ((result=tracker_peer_connect(pServer)) != 0)
+		{
+			return result;
+		}
+	}
+
+	memset(&header, 0, sizeof(header));
+	sprintf(header.pkg_len, "%x", body_len);
+	header.cmd = cmd;
+	if (tcpsenddata(pServer->sock, &header, sizeof(header), \
+			g_network_timeout) != 1 || (body_len > 0 && \
+		tcpsenddata(pServer->sock, body, body_len, \
+			g_network_timeout) != 1))
+	{
+		result = errno != 0 ? errno : EPIPE;
+		tracker_peer_disconnect(pServer);
+		return result;
+	}
+
+	result = tracker_recv_response(pServer, ppInBuff, \
+			in_buff_size, in_bytes);
+	if (result != 0 && result != ENOENT && result != ENOSPC)
+	{
+		tracker_peer_disconnect(pServer);
+	}
+
+	return result;
+}
+
+static int tracker_peer_cmp(const char *ip_addr1, const int port1, \
+		const char *ip_addr2, const int port2)
+{
+	int result;
+
+	result = strcmp(ip_addr1, ip_addr2);
+	if (result != 0)
+	{
+		return result;
+	}
+
+	return port1 - port2;
+}
+
+/*
+the alive tracker with the smallest ip and port is the leader
+*/
+static void tracker_peer_elect_leader()
+{
+	TrackerServerInfo *pServer;
+	char *pInBuff;
+	int in_bytes;
+	int new_leader;
+	int i;
+
+	new_leader = -1;
+	for (i=0; i<g_tracker_peer_count; i++)
+	{
+		if (i == self_index)
+		{
+			continue;
+		}
+
+		pServer = g_tracker_peers + i;
+		pInBuff = NULL;
+		if (tracker_peer_request(pServer, \
+			TRACKER_PROTO_CMD_TRACKER_PING, NULL, 0, \
+			&pInBuff, 0, &in_bytes) != 0)
+		{
+			continue;
+		}
+		if (pInBuff != NULL)
+		{
+			free(pInBuff);
+		}
+
+		if (*self_ip_addr == '\0')
+		{
+			getSockIpaddr(pServer->sock, self_ip_addr, \
+				sizeof(self_ip_addr));
+		}
+
+		if (tracker_peer_cmp(pServer->ip_addr, pServer->port, \
+			self_ip_addr, g_server_port) == 0)
+		{
+			tracker_peer_disconnect(pServer);  //myself
+			self_index = i;
+			continue;
+		}
+
+		if (tracker_peer_cmp(pServer->ip_addr, pServer->port, \
+			self_ip_addr, g_server_port) < 0 && (new_leader < 0 || \
+			tracker_peer_cmp(pServer->ip_addr, pServer->port, \
+				g_tracker_peers[new_leader].ip_addr, \
+				g_tracker_peers[new_leader].port) < 0))
+		{
+			new_leader = i;
+		}
+	}
+
+	if (new_leader == leader_index)
+	{
+		return;
+	}
+
+	leader_lock_acquire();
+	tracker_peer_disconnect(&leader_server);
+	if (new_leader >= 0)
+	{
+		memcpy(&leader_server, g_tracker_peers + new_leader, \
+			sizeof(TrackerServerInfo));
+		leader_server.sock = -1;
+	}
+	leader_index = new_leader;
+	leader_down_until = 0;
+	leader_lock_release();
+
+	if (new_leader < 0)
+	{
+		logInfo(TRACKER_ERROR_LOG_FILENAME, \
+			"file: "__FILE__", line: %d, " \
+			"I am the leader tracker", __LINE__);
+	}
+	else
+	{
+		logInfo(TRACKER_ERROR_LOG_FILENAME, \
+			"file: "__FILE__", line: %d, " \
+			"the leader tracker is %s:%d", __LINE__, \
+			g_tracker_peers[new_leader].ip_addr, \
+			g_tracker_peers[new_leader].port);
+	}
+}
+
+static int tracker_peer_merge_storage(TrackerPeerStorageStat *pStat, \
+		bool *bChanged)
+{
+	TrackerClientInfo clientInfo;
+	FDFSGroupInfo *pGroup;
+	FDFSStorageDetail *pStorage;
+	char status;
+	int result;
+	bool bInserted;
+
+	pStat->group_name[FDFS_GROUP_NAME_MAX_LEN] = '\0';
+	pStat->ip_addr[FDFS_IPADDR_SIZE - 1] = '\0';
+	pStat->src_ip_addr[FDFS_IPADDR_SIZE - 1] = '\0';
+	if (tracker_validate_group_name(pStat->group_name) != 0)
+	{
+		return EINVAL;
+	}
+
+	pStorage = NULL;
+	pGroup = tracker_mem_get_group(pStat->group_name);
+	if (pGroup != NULL)
+	{
+		pStorage = tracker_mem_get_storage(pGroup, pStat->ip_addr);
+	}
+
+	bInserted = pStorage == NULL;
+	if (bInserted)
+	{
+		memset(&clientInfo, 0, sizeof(TrackerClientInfo));
+		strcpy(clientInfo.group_name, pStat->group_name);
+		strcpy(clientInfo.ip_addr, pStat->ip_addr);
+		clientInfo.storage_port = buff2int( \
+				(unsigned char *)pStat->sz_storage_port);
+		if ((result=tracker_mem_add_group_and_storage(&clientInfo, \
+				false)) != 0)
+		{
+			return result;
+		}
+
+		pGroup = clientInfo.pGroup;
+		pStorage = clientInfo.pStorage;
+		*bChanged = true;
+	}
+
+	/*
+	only take the first hand status from the tracker which the storage
+	server reports to, unless the storage server reports to me
+	*/
+	if ((result=tracker_mem_pthread_lock()) != 0)
+	{
+		return result;
+	}
+
+	if (!bInserted && (!pStat->connected || \
+		pStorage->connection_count > 0))
+	{
+		tracker_mem_pthread_unlock();
+		return 0;
+	}
+
+	pStorage->peer_report_time = time(NULL);
+	pStorage->total_mb = buff2int((unsigned char *)pStat->sz_total_mb);
+	pStorage->free_mb = buff2int((unsigned char *)pStat->sz_free_mb);
+	if (pGroup->free_mb == 0 || pStorage->free_mb < pGroup->free_mb)
+	{
+		pGroup->free_mb = pStorage->free_mb;
+	}
+
+	if (pStorage->psync_src_server == NULL && *(pStat->src_ip_addr) != '\0')
+	{
+		pStorage->psync_src_server = tracker_mem_get_storage(pGroup, \
+						pStat->src_ip_addr);
+		pStorage->sync_until_timestamp = buff2int( \
+			(unsigned char *)pStat->sz_sync_until_timestamp);
+		*bChanged = true;
+	}
+
+	status = pStat->status;
+	if (status == pStorage->status)
+	{
+		tracker_mem_pthread_unlock();
+		return 0;
+	}
+
+	*bChanged = true;
+	if (status == FDFS_STORAGE_STATUS_ACTIVE)
+	{
+		pStorage->status = FDFS_STORAGE_STATUS_ONLINE;
+		tracker_mem_pthread_unlock();
+		return tracker_mem_active_store_server(pGroup, pStorage);
+	}
+
+	pStorage->status = status;
+	pGroup->version++;
+	pStorage->chg_version = pGroup->version;
+	tracker_mem_pthread_unlock();
+	return tracker_mem_deactive_store_server(pGroup, pStorage);
+}
+
+/*
+the status merged from a peer is kept only while the peer keeps reporting
+the storage server connected, so the view of a dead peer lapses
+*/
+static int tracker_peer_expire_storages()
+{
+	FDFSGroupInfo *pGroup;
+	FDFSGroupInfo *pGroupEnd;
+	FDFSStorageDetail *pStorage;
+	FDFSStorageDetail *pStorageEnd;
+	FDFSGroupInfo **expiredGroups;
+	FDFSStorageDetail **expiredStorages;
+	time_t expire_time;
+	int storage_count;
+	int expired_count;
+	int result;
+	int i;
+
+	if ((result=tracker_mem_pthread_lock()) != 0)
+	{
+		return result;
+	}
+
+	storage_count = 0;
+	pGroupEnd = g_groups.groups + g_groups.count;
+	for (pGroup=g_groups.groups; pGroup<pGroupEnd; pGroup++)
+	{
+		storage_count += pGroup->count;
+	}
+
+	if (storage_count == 0)
+	{
+		tracker_mem_pthread_unlock();
+		return 0;
+	}
+
+	expiredGroups = (FDFSGroupInfo **)malloc((sizeof(FDFSGroupInfo *) + \
+			sizeof(FDFSStorageDetail *)) * storage_count);
+	if (expiredGroups == NULL)
+	{
+		tracker_mem_pthread_unlock();
+		return errno != 0 ? errno : ENOMEM;
+	}
+	expiredStorages = (FDFSStorageDetail **)(expiredGroups + \
+				storage_count);
+
+	expired_count = 0;
+	expire_time = time(NULL) - 3 * g_tracker_peer_sync_interval;
+	for (pGroup=g_groups.groups; pGroup<pGroupEnd; pGroup++)
+	{
+		pStorageEnd = pGroup->all_servers + pGroup->count;
+		for (pStorage=pGroup->all_servers; pStorage<pStorageEnd; \
+			pStorage++)
+		{
+			if (pStorage->peer_report_time == 0 || \
+				pStorage->peer_report_time >= expire_time)
+			{
+				continue;
+			}
+
+			pStorage->peer_report_time = 0;
+			if (pStorage->connection_count > 0 || \
+				!(pStorage->status == FDFS_STORAGE_STATUS_ACTIVE \
+				|| pStorage->status == FDFS_STORAGE_STATUS_ONLINE))
+			{
+				continue;
+			}
+
+			pStorage->status = FDFS_STORAGE_STATUS_OFFLINE;
+			expiredGroups[expired_count] = pGroup;
+			expiredStorages[expired_count] = pStorage;
+			expired_count++;
+		}
+	}
+	tracker_mem_pthread_unlock();
+
+	for (i=0; i<expired_count; i++)
+	{
+		logInfo(TRACKER_ERROR_LOG_FILENAME, \
+			"file: "__FILE__", line: %d, " \
+			"storage server %s of group %s is not reported " \
+			"by any peer tracker, set it offline", __LINE__, \
+			expiredStorages[i]->ip_addr, \
+			expiredGroups[i]->group_name);
+		tracker_mem_deactive_store_server(expiredGroups[i], \
+			expiredStorages[i]);
+	}
+
+	free(expiredGroups);
+	return expired_count > 0 ? tracker_save_storages() : 0;
+}
+
+static int tracker_peer_sync_from_peer(TrackerServerInfo *pServer)
+{
+	TrackerPeerStorageStat *pStat;
+	TrackerPeerStorageStat *pEnd;
+	char *pInBuff;
+	int in_bytes;
+	int result;
+	bool bChanged;
+
+	pInBuff = NULL;
+	if ((result=tracker_peer_request(pServer, \
+		TRACKER_PROTO_CMD_TRACKER_GET_STATUS, NULL, 0, \
+		&pInBuff, 0, &in_bytes)) != 0)
+	{
+		return result;
+	}
+
+	if (in_bytes % sizeof(TrackerPeerStorageStat) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"tracker server %s:%d response data " \
+			"length: %d is invalid.", __LINE__, \
+			pServer->ip_addr, pServer->port, in_bytes);
+		free(pInBuff);
+		return EINVAL;
+	}
+
+	bChanged = false;
+	pEnd = (TrackerPeerStorageStat *)(pInBuff + in_bytes);
+	for (pStat=(TrackerPeerStorageStat *)pInBuff; pStat<pEnd; pStat++)
+	{
+		if ((result=tracker_peer_merge_storage(pStat, &bChanged)) != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"merge storage server %s of group %s " \
+				"from tracker server %s:%d fail, " \
+				"errno: %d, error info: %s", __LINE__, \
+				pStat->ip_addr, pStat->group_name, \
+				pServer->ip_addr, pServer->port, \
+				result, strerror(result));
+		}
+	}
+
+	if (pInBuff != NULL)
+	{
+		free(pInBuff);
+	}
+
+	return bChanged ? tracker_save_storages() : 0;
+}
+
+/*
+pull the storage servers status from all alive peer trackers
+*/
+static int tracker_peer_sync_from_peers()
+{
+	TrackerServerInfo *pServer;
+	TrackerServerInfo *pEnd;
+	int result;
+	int success_count;
+
+	result = 0;
+	success_count = 0;
+	pEnd = g_tracker_peers + g_tracker_peer_count;
+	for (pServer=g_tracker_peers; pServer<pEnd; pServer++)
+	{
+		if (pServer->sock < 0)  //not alive or myself
+		{
+			continue;
+		}
+
+		if ((result=tracker_peer_sync_from_peer(pServer)) == 0)
+		{
+			success_count++;
+		}
+	}
+
+	return success_count > 0 ? 0 : result;
+}
+
+static void *tracker_peer_thread_entrance(void* arg)
+{
+	time_t last_sync_time;
+
+	last_sync_time = time(NULL);
+	while (g_continue_flag)
+	{
+		sleep(1);
+		if (time(NULL) - last_sync_time < g_tracker_peer_sync_interval)
+		{
+			continue;
+		}
+
+		tracker_peer_elect_leader();
+		tracker_peer_sync_from_peers();
+		tracker_peer_expire_storages();
+		last_sync_time = time(NULL);
+	}
+
+	g_tracker_peer_thread_count--;
+	return NULL;
+}
+
+int tracker_peer_init()
+{
+	int result;
+
+	if ((result=init_pthread_lock(&leader_lock)) != 0)
+	{
+		return result;
+	}
+
+	memset(&leader_server, 0, sizeof(leader_server));
+	leader_server.sock = -1;
+	*self_ip_addr = '\0';
+	leader_index = -1;
+	self_index = -1;
+	if (g_tracker_peer_count == 0)
+	{
+		return 0;
+	}
+
+	tracker_peer_elect_leader();
+	if ((result=tracker_peer_sync_from_peers()) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"warm up from the peer trackers fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, result, strerror(result));
+	}
+
+	return 0;
+}
+
+int tracker_peer_destroy()
+{
+	int i;
+
+	for (i=0; i<g_tracker_peer_count; i++)
+	{
+		tracker_peer_disconnect(g_tracker_peers + i);
+	}
+	tracker_peer_disconnect(&leader_server);
+
+	if (pthread_mutex_destroy(&leader_lock) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call pthread_mutex_destroy fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, errno, strerror(errno));
+		return errno != 0 ? errno : EAGAIN;
+	}
+
+	return 0;
+}
+
+int tracker_peer_thread_start()
+{
+	pthread_attr_t pattr;
+	pthread_t tid;
+
+	if (g_tracker_peer_count == 0)
+	{
+		return 0;
+	}
+
+	pthread_attr_init(&pattr);
+	pthread_attr_setdetachstate(&pattr, PTHREAD_CREATE_DETACHED);
+	g_tracker_peer_thread_count++;
+	if (pthread_create(&tid, &pattr, tracker_peer_thread_entrance, \
+			NULL) != 0)
+	{
+		g_tracker_peer_thread_count--;
+		logError("file: "__FILE__", line: %d, " \
+			"create thread failed, errno: %d, " \
+			"error info: %s.", \
+			__LINE__, errno, strerror(errno));
+		pthread_attr_destroy(&pattr);
+		return errno != 0 ? errno : EAGAIN;
+	}
+
+	pthread_attr_destroy(&pattr);
+	return 0;
+}
+
+bool tracker_peer_is_leader()
+{
+	return leader_index < 0;
+}
+
+int tracker_peer_query_store(const int count, char *buff, \
+		const int buff_size, int *body_len)
+{
+	TrackerServerInfo server;
+	char sz_count[TRACKER_PROTO_PKG_LEN_SIZE];
+	int index;
+	int result;
+
+	*body_len = 0;
+	if (leader_index < 0 || time(NULL) < leader_down_until)
+	{
+		return EAGAIN;
+	}
+
+	/* take the idle connection, the request is sent without the lock */
+	leader_lock_acquire();
+	index = leader_index;
+	if (index >= 0)
+	{
+		memcpy(&server, &leader_server, sizeof(TrackerServerInfo));
+		leader_server.sock = -1;
+	}
+	leader_lock_release();
+	if (index < 0)
+	{
+		return EAGAIN;
+	}
+
+	memset(sz_count, 0, sizeof(sz_count));
+	sprintf(sz_count, "%x", count);
+	result = tracker_peer_request(&server, \
+			TRACKER_PROTO_CMD_TRACKER_QUERY_STORE, \
+			sz_count, sizeof(sz_count), &buff, buff_size, \
+			body_len);
+
+	leader_lock_acquire();
+	if (server.sock < 0)  //select locally until the leader recovers
+	{
+		if (index == leader_index)
+		{
+			leader_down_until = time(NULL) + \
+					g_tracker_peer_sync_interval;
+		}
+	}
+	else if (index == leader_index && leader_server.sock < 0)
+	{
+		leader_server.sock = server.sock;
+		server.sock = -1;
+	}
+	leader_lock_release();
+
+	if (server.sock >= 0)  //the leader changed or other one cached
+	{
+		tracker_peer_disconnect(&server);
+	}
+	else if (result != 0 && result != ENOENT && result != ENOSPC)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"query the leader tracker %s:%d fail, " \
+			"errno: %d, error info: %s, select the storage " \
+			"locally in %d seconds", __LINE__, \
+			server.ip_addr, server.port, result, \
+			strerror(result), g_tracker_peer_sync_interval);
+	}
+
+	return result;
+}
@@ -0,0 +1,54 @@
+/**
+* Copyright (C) 2008 Happy Fish / YuQing
+*
+* FastDFS may be copied only under the terms of the GNU General
+* Public License V3, which may be found in the FastDFS source kit.
+* Please visit the FastDFS Home Page http://www.csource.org/ for more detail.
+**/
+
+//tracker_peer.h
+
+#ifndef _TRACKER_PEER_H_
+#define _TRACKER_PEER_H_
+
+#include "tracker_types.h"
+
+#define FDFS_DEF_PEER_SYNC_INTERVAL	10
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int g_tracker_peer_thread_count;
+
+/*
+connect to the peer trackers, elect the leader and warm up the
+groups and storage servers from the alive peer trackers
+*/
+int tracker_peer_init();
+int tracker_peer_destroy();
+int tracker_peer_thread_start();
+
+/*
+is this tracker the leader which owns the write cursors
+*/
+bool tracker_peer_is_leader();
+
+/*
+forward the store query to the leader tracker
+params:
+	count: placement count
+	buff: return the placement records
+	buff_size: the buff size
+	body_len: return the body length
+return: 0 for success, != 0 when this tracker is the leader or
+	the leader can't be accessed
+*/
+int tracker_peer_query_store(const int count, char *buff, \
+		const int buff_size, int *body_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
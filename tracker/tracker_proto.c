@@ -15,6 +15,7 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <limits.h>
 #include "fdfs_define.h"
 #include "shared_func.h"
 #include "logger.h"
@@ -23,15 +24,104 @@
 #include "tracker_types.h"
 #include "tracker_proto.h"
 
-int tracker_recv_response(TrackerServerInfo *pTrackerServer, \
-		char **buff, const int buff_size, \
-		int *in_bytes)
+int fdfs_parse_header(int sock, char *buff, FDFSProtoHeader *pHeader)
 {
-	TrackerHeader resp;
-	bool bMalloced;
+	TrackerHeader *pHeaderV1;
+	TrackerHeaderV2 *pHeaderV2;
+	char pkg_len[TRACKER_PROTO_PKG_LEN_SIZE];
 
-	if (tcprecvdata(pTrackerServer->sock, &resp, \
-		sizeof(resp), g_network_timeout) != 1)
+	if (*buff != FDFS_PROTO_V2_MAGIC)
+	{
+		pHeaderV1 = (TrackerHeader *)buff;
+		memcpy(pkg_len, pHeaderV1->pkg_len, sizeof(pkg_len));
+		pkg_len[sizeof(pkg_len) - 1] = '\0';
+		pHeader->pkg_len = strtol(pkg_len, NULL, 16);
+		pHeader->request_id = 0;
+		pHeader->cmd = pHeaderV1->cmd;
+		pHeader->status = pHeaderV1->status;
+		pHeader->flags = 0;
+		pHeader->version = FDFS_PROTO_VERSION_1;
+		return 0;
+	}
+
+	if (tcprecvdata(sock, buff + sizeof(TrackerHeader), \
+		sizeof(TrackerHeaderV2) - sizeof(TrackerHeader), \
+		g_network_timeout) != 1)
+	{
+		return errno != 0 ? errno : EPIPE;
+	}
+
+	pHeaderV2 = (TrackerHeaderV2 *)buff;
+	pHeader->pkg_len = buff2long((unsigned char *)pHeaderV2->pkg_len);
+	pHeader->request_id = buff2int((unsigned char *) \
+				pHeaderV2->request_id);
+	pHeader->cmd = pHeaderV2->cmd;
+	pHeader->status = pHeaderV2->status;
+	pHeader->flags = pHeaderV2->flags;
+	pHeader->version = FDFS_PROTO_VERSION_2;
+	return 0;
+}
+
+int fdfs_pack_header(const FDFSProtoHeader *pHeader, char *buff)
+{
+	TrackerHeader *pHeaderV1;
+	TrackerHeaderV2 *pHeaderV2;
+
+	if (pHeader->version != FDFS_PROTO_VERSION_2)
+	{
+		pHeaderV1 = (TrackerHeader *)buff;
+		sprintf(pHeaderV1->pkg_len, "%x", (int)pHeader->pkg_len);
+		pHeaderV1->cmd = pHeader->cmd;
+		pHeaderV1->status = pHeader->status;
+		return sizeof(TrackerHeader);
+	}
+
+	pHeaderV2 = (TrackerHeaderV2 *)buff;
+	pHeaderV2->magic = FDFS_PROTO_V2_MAGIC;
+	pHeaderV2->cmd = pHeader->cmd;
+	pHeaderV2->status = pHeader->status;
+	pHeaderV2->flags = pHeader->flags;
+	int2buff(pHeader->request_id, pHeaderV2->request_id);
+	long2buff(pHeader->pkg_len, pHeaderV2->pkg_len);
+	return sizeof(TrackerHeaderV2);
+}
+
+void fdfs_pack_size_field(const char version, const int64_t n, char *buff)
+{
+	if (version == FDFS_PROTO_VERSION_2)
+	{
+		long2buff(n, buff);
+	}
+	else
+	{
+		sprintf(buff, "%x", (int)n);
+	}
+}
+
+int64_t fdfs_unpack_size_field(const char version, const char *buff)
+{
+	char field[TRACKER_PROTO_PKG_LEN_SIZE + 1];
+
+	if (version == FDFS_PROTO_VERSION_2)
+	{
+		return buff2long((unsigned char *)buff);
+	}
+
+	memcpy(field, buff, TRACKER_PROTO_PKG_LEN_SIZE);
+	field[TRACKER_PROTO_PKG_LEN_SIZE] = '\0';
+	return strtol(field, NULL, 16);
+}
+
+int tracker_recv_header(TrackerServerInfo *pTrackerServer, int64_t *in_bytes)
+{
+	char header_buff[FDFS_PROTO_MAX_HEADER_SIZE];
+	FDFSProtoHeader resp;
+	int result;
+
+	if (tcprecvdata(pTrackerServer->sock, header_buff, \
+		sizeof(TrackerHeader), g_network_timeout) != 1 || \
+		(result=fdfs_parse_header(pTrackerServer->sock, \
+			header_buff, &resp)) != 0)
 	{
 		logError("file: "__FILE__", line: %d, " \
 			"server: %s:%d, recv data fail, " \
@@ -49,21 +139,49 @@ int tracker_recv_response(TrackerServerInfo *pTrackerServer, \
 		return resp.status;
 	}
 
-	resp.pkg_len[TRACKER_PROTO_PKG_LEN_SIZE-1] = '\0';
-	*in_bytes = strtol(resp.pkg_len, NULL, 16);
-	if (*in_bytes < 0)
+	if (resp.pkg_len < 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"server: %s:%d, recv package size "INT64_PRINTF_FORMAT \
+			" is not correct", \
+			__LINE__, pTrackerServer->ip_addr, \
+			pTrackerServer->port, resp.pkg_len);
+		*in_bytes = 0;
+		return EINVAL;
+	}
+
+	*in_bytes = resp.pkg_len;
+	return 0;
+}
+
+int tracker_recv_response(TrackerServerInfo *pTrackerServer, \
+		char **buff, const int buff_size, \
+		int *in_bytes)
+{
+	int64_t pkg_len;
+	bool bMalloced;
+	int result;
+
+	if ((result=tracker_recv_header(pTrackerServer, &pkg_len)) != 0)
+	{
+		*in_bytes = 0;
+		return result;
+	}
+
+	if (pkg_len > INT_MAX)
 	{
 		logError("file: "__FILE__", line: %d, " \
-			"server: %s:%d, recv package size %d " \
-			"is not correct", \
+			"server: %s:%d, recv package size "INT64_PRINTF_FORMAT \
+			" is too large", \
 			__LINE__, pTrackerServer->ip_addr, \
-			pTrackerServer->port, *in_bytes);
+			pTrackerServer->port, pkg_len);
 		*in_bytes = 0;
-		return errno != 0 ? errno : EINVAL;
+		return EFBIG;
 	}
+	*in_bytes = (int)pkg_len;
 	if (*in_bytes == 0)
 	{
-		return resp.status;
+		return 0;
 	}
 
 	if (*buff == NULL)
@@ -111,7 +229,7 @@ int tracker_recv_response(TrackerServerInfo *pTrackerServer, \
 		return errno != 0 ? errno : EPIPE;
 	}
 
-	return resp.status;
+	return 0;
 }
 
 int tracker_quit(TrackerServerInfo *pTrackerServer)
@@ -299,3 +417,281 @@ char *fdfs_pack_metadata(const FDFSMetaData *meta_list, const int meta_count, \
 	return meta_buff;
 }
 
+int metadata_slice_cmp_by_name(const void *p1, const void *p2)
+{
+	const FDFSMetaSlice *pSlice1;
+	const FDFSMetaSlice *pSlice2;
+	int result;
+
+	pSlice1 = (const FDFSMetaSlice *)p1;
+	pSlice2 = (const FDFSMetaSlice *)p2;
+	result = memcmp(pSlice1->name, pSlice2->name, \
+			pSlice1->name_len < pSlice2->name_len ? \
+			pSlice1->name_len : pSlice2->name_len);
+	if (result != 0)
+	{
+		return result;
+	}
+
+	return pSlice1->name_len - pSlice2->name_len;
+}
+
+int fdfs_get_metadata_count(const char *meta_buff, const int meta_bytes)
+{
+	const char *p;
+	const char *pEnd;
+	int count;
+
+	count = 1;
+	pEnd = meta_buff + meta_bytes;
+	for (p=meta_buff; p<pEnd; p++)
+	{
+		if (*p == FDFS_RECORD_SEPERATOR)
+		{
+			count++;
+		}
+	}
+
+	return count;
+}
+
+int fdfs_split_metadata_slices(const char *meta_buff, const int meta_bytes, \
+		FDFSMetaSlice *slices, const int max_count)
+{
+	FDFSMetaSlice *pSlice;
+	FDFSMetaSlice *pSliceEnd;
+	const char *pRecord;
+	const char *pRecordEnd;
+	const char *pBuffEnd;
+	const char *pSeperator;
+
+	pSlice = slices;
+	pSliceEnd = slices + max_count;
+	pBuffEnd = meta_buff + meta_bytes;
+	pRecord = meta_buff;
+	while (pRecord < pBuffEnd && pSlice < pSliceEnd)
+	{
+		pRecordEnd = (const char *)memchr(pRecord, \
+				FDFS_RECORD_SEPERATOR, pBuffEnd - pRecord);
+		if (pRecordEnd == NULL)
+		{
+			pRecordEnd = pBuffEnd;
+		}
+
+		pSeperator = (const char *)memchr(pRecord, \
+				FDFS_FIELD_SEPERATOR, pRecordEnd - pRecord);
+		if (pSeperator != NULL)
+		{
+			pSlice->name = pRecord;
+			pSlice->name_len = pSeperator - pRecord;
+			pSlice->value = pSeperator + 1;
+			pSlice->value_len = pRecordEnd - pSlice->value;
+			if (pSlice->name_len > FDFS_MAX_META_NAME_LEN)
+			{
+				pSlice->name_len = FDFS_MAX_META_NAME_LEN;
+			}
+			if (pSlice->value_len > FDFS_MAX_META_VALUE_LEN)
+			{
+				pSlice->value_len = FDFS_MAX_META_VALUE_LEN;
+			}
+			pSlice++;
+		}
+
+		pRecord = pRecordEnd + 1;
+	}
+
+	return pSlice - slices;
+}
+
+int fdfs_split_metadata_keys(const char *keys_buff, const int keys_bytes, \
+		FDFSMetaSlice *keys, const int max_count)
+{
+	const char *pKey;
+	const char *pKeyEnd;
+	const char *pBuffEnd;
+	int count;
+
+	count = 0;
+	pBuffEnd = keys_buff + keys_bytes;
+	pKey = keys_buff;
+	while (pKey < pBuffEnd)
+	{
+		pKeyEnd = (const char *)memchr(pKey, \
+				FDFS_RECORD_SEPERATOR, pBuffEnd - pKey);
+		if (pKeyEnd == NULL)
+		{
+			pKeyEnd = pBuffEnd;
+		}
+
+		if (pKeyEnd > pKey)
+		{
+			if (count >= max_count)
+			{
+				return -1;
+			}
+
+			keys[count].name = pKey;
+			keys[count].name_len = pKeyEnd - pKey;
+			keys[count].value = pKeyEnd;
+			keys[count].value_len = 0;
+			count++;
+		}
+
+		pKey = pKeyEnd + 1;
+	}
+
+	return count;
+}
+
+static bool fdfs_metadata_key_exists(const char *name, const int name_len, \
+		const FDFSMetaSlice *keys, const int key_count)
+{
+	const FDFSMetaSlice *pKey;
+	const FDFSMetaSlice *pKeyEnd;
+
+	pKeyEnd = keys + key_count;
+	for (pKey=keys; pKey<pKeyEnd; pKey++)
+	{
+		if (pKey->name_len == name_len && \
+			memcmp(pKey->name, name, name_len) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int fdfs_filter_metadata(char *meta_buff, const int meta_bytes, \
+		const FDFSMetaSlice *keys, const int key_count)
+{
+	char *pDest;
+	char *pRecord;
+	char *pRecordEnd;
+	char *pBuffEnd;
+	char *pSeperator;
+	int record_len;
+
+	pDest = meta_buff;
+	pBuffEnd = meta_buff + meta_bytes;
+	pRecord = meta_buff;
+	while (pRecord < pBuffEnd)
+	{
+		pRecordEnd = (char *)memchr(pRecord, \
+				FDFS_RECORD_SEPERATOR, pBuffEnd - pRecord);
+		if (pRecordEnd == NULL)
+		{
+			pRecordEnd = pBuffEnd;
+		}
+
+		pSeperator = (char *)memchr(pRecord, \
+				FDFS_FIELD_SEPERATOR, pRecordEnd - pRecord);
+		if (pSeperator != NULL && fdfs_metadata_key_exists(pRecord, \
+				pSeperator - pRecord, keys, key_count))
+		{
+			if (pDest > meta_buff)
+			{
+				*pDest++ = FDFS_RECORD_SEPERATOR;
+			}
+
+			record_len = pRecordEnd - pRecord;
+			memmove(pDest, pRecord, record_len);
+			pDest += record_len;
+		}
+
+		pRecord = pRecordEnd + 1;
+	}
+
+	*pDest = '\0';
+	return pDest - meta_buff;
+}
+
+static char *fdfs_pack_metadata_slice(const FDFSMetaSlice *pSlice, char *p)
+{
+	memcpy(p, pSlice->name, pSlice->name_len);
+	p += pSlice->name_len;
+	*p++ = FDFS_FIELD_SEPERATOR;
+	memcpy(p, pSlice->value, pSlice->value_len);
+	p += pSlice->value_len;
+	*p++ = FDFS_RECORD_SEPERATOR;
+	return p;
+}
+
+int fdfs_pack_metadata_slices(const FDFSMetaSlice *slices, \
+		const int count, char *meta_buff)
+{
+	const FDFSMetaSlice *pSlice;
+	const FDFSMetaSlice *pSliceEnd;
+	char *p;
+
+	p = meta_buff;
+	pSliceEnd = slices + count;
+	for (pSlice=slices; pSlice<pSliceEnd; pSlice++)
+	{
+		p = fdfs_pack_metadata_slice(pSlice, p);
+	}
+
+	if (p > meta_buff)
+	{
+		p--;  //omit the last record seperator
+	}
+	*p = '\0';
+	return p - meta_buff;
+}
+
+int fdfs_merge_metadata_slices(const FDFSMetaSlice *old_slices, \
+		const int old_count, const FDFSMetaSlice *new_slices, \
+		const int new_count, char *meta_buff)
+{
+	const FDFSMetaSlice *pOld;
+	const FDFSMetaSlice *pNew;
+	const FDFSMetaSlice *pOldEnd;
+	const FDFSMetaSlice *pNewEnd;
+	char *p;
+	int result;
+
+	p = meta_buff;
+	pOld = old_slices;
+	pNew = new_slices;
+	pOldEnd = old_slices + old_count;
+	pNewEnd = new_slices + new_count;
+	while (pOld < pOldEnd && pNew < pNewEnd)
+	{
+		result = metadata_slice_cmp_by_name(pOld, pNew);
+		if (result < 0)
+		{
+			p = fdfs_pack_metadata_slice(pOld, p);
+			pOld++;
+		}
+		else if (result == 0)
+		{
+			p = fdfs_pack_metadata_slice(pNew, p);
+			pOld++;
+			pNew++;
+		}
+		else  //result > 0
+		{
+			p = fdfs_pack_metadata_slice(pNew, p);
+			pNew++;
+		}
+	}
+
+	while (pOld < pOldEnd)
+	{
+		p = fdfs_pack_metadata_slice(pOld, p);
+		pOld++;
+	}
+
+	while (pNew < pNewEnd)
+	{
+		p = fdfs_pack_metadata_slice(pNew, p);
+		pNew++;
+	}
+
+	if (p > meta_buff)
+	{
+		p--;  //omit the last record seperator
+	}
+	*p = '\0';
+	return p - meta_buff;
+}
@@ -21,13 +21,22 @@
 #define TRACKER_PROTO_CMD_STORAGE_SYNC_SRC_REQ  86  //src storage require sync
 #define TRACKER_PROTO_CMD_STORAGE_SYNC_DEST_REQ 87  //dest storage require sync
 #define TRACKER_PROTO_CMD_STORAGE_SYNC_NOTIFY   88  //sync notify
+#define TRACKER_PROTO_CMD_STORAGE_DELTA_BEAT    89  //heart beat with deltas
 #define TRACKER_PROTO_CMD_STORAGE_RESP          80
 
+#define TRACKER_PROTO_CMD_TRACKER_GET_STATUS    71  //storage servers status
+#define TRACKER_PROTO_CMD_TRACKER_QUERY_STORE   72  //forwarded to the leader
+#define TRACKER_PROTO_CMD_TRACKER_PING          73
+#define TRACKER_PROTO_CMD_TRACKER_RESP          70
+
 #define TRACKER_PROTO_CMD_SERVER_LIST_GROUP	91
 #define TRACKER_PROTO_CMD_SERVER_LIST_STORAGE	92
+#define TRACKER_PROTO_CMD_SERVER_TOPOLOGY_VERSION	94
 #define TRACKER_PROTO_CMD_SERVER_RESP      	93
 #define TRACKER_PROTO_CMD_SERVICE_QUERY_STORE	101
 #define TRACKER_PROTO_CMD_SERVICE_QUERY_FETCH	102
+#define TRACKER_PROTO_CMD_SERVICE_QUERY_STORE_BATCH	103
+#define TRACKER_PROTO_CMD_SERVICE_QUERY_FETCH_BATCH	104
 #define TRACKER_PROTO_CMD_SERVICE_RESP		100
 
 #define STORAGE_PROTO_CMD_UPLOAD_FILE		11
@@ -38,6 +47,18 @@
 #define STORAGE_PROTO_CMD_SYNC_CREATE_FILE	16
 #define STORAGE_PROTO_CMD_SYNC_DELETE_FILE	17
 #define STORAGE_PROTO_CMD_SYNC_UPDATE_FILE	18
+#define STORAGE_PROTO_CMD_SYNC_LINK_FILE	19
+#define STORAGE_PROTO_CMD_BATCH_GET_METADATA	20
+#define STORAGE_PROTO_CMD_SYNC_CREATE_FILE_META	21
+#define STORAGE_PROTO_CMD_QUERY_BY_METADATA	22
+#define STORAGE_PROTO_CMD_UPLOAD_BEGIN		23
+#define STORAGE_PROTO_CMD_UPLOAD_PART		24
+#define STORAGE_PROTO_CMD_UPLOAD_QUERY		25
+#define STORAGE_PROTO_CMD_UPLOAD_COMMIT		26
+#define STORAGE_PROTO_CMD_UPLOAD_ABORT		27
+#define STORAGE_PROTO_CMD_UPLOAD_APPENDER_FILE	28
+#define STORAGE_PROTO_CMD_APPEND_FILE		29
+#define STORAGE_PROTO_CMD_SYNC_APPEND_FILE	30
 #define STORAGE_PROTO_CMD_RESP			10
 
 //for overwrite all old metadata
@@ -51,6 +72,35 @@
 #define TRACKER_QUERY_STORAGE_BODY_LEN	FDFS_GROUP_NAME_MAX_LEN \
 			+ FDFS_IPADDR_SIZE - 1 + TRACKER_PROTO_PKG_LEN_SIZE
 
+#define TRACKER_MAX_BATCH_QUERY_COUNT	256
+
+/*
+batch query placement record:
+1 byte: status
+FDFS_GROUP_NAME_MAX_LEN bytes: group_name
+FDFS_IPADDR_SIZE - 1 bytes: ip addr of the selected storage server
+TRACKER_PROTO_PKG_LEN_SIZE bytes: storage port (hex string)
+TRACKER_PROTO_PKG_LEN_SIZE bytes: active server count (hex string)
+active server count * (FDFS_IPADDR_SIZE - 1) bytes: active server ip addrs
+*/
+#define TRACKER_BATCH_PLACEMENT_FIXED_LEN  (1 + FDFS_GROUP_NAME_MAX_LEN \
+			+ FDFS_IPADDR_SIZE - 1 + 2 * TRACKER_PROTO_PKG_LEN_SIZE)
+#define TRACKER_BATCH_PLACEMENT_MAX_LEN  (TRACKER_BATCH_PLACEMENT_FIXED_LEN \
+			+ FDFS_MAX_SERVERS_EACH_GROUP * (FDFS_IPADDR_SIZE - 1))
+
+#define STORAGE_MAX_BATCH_META_COUNT	256
+#define STORAGE_MAX_BATCH_META_KEYS	64
+
+#define STORAGE_MAX_META_QUERY_COUNT	1024  //the max filenames of one page
+
+/*
+batch get metadata record:
+1 byte: status, ENOENT for the file not exist
+TRACKER_PROTO_PKG_LEN_SIZE bytes: metadata length (hex string)
+metadata length bytes: the packed metadata
+*/
+#define STORAGE_BATCH_META_FIXED_LEN	(1 + TRACKER_PROTO_PKG_LEN_SIZE)
+
 typedef struct
 {
 	char pkg_len[TRACKER_PROTO_PKG_LEN_SIZE];
@@ -58,6 +108,42 @@ typedef struct
 	char status;
 } TrackerHeader;
 
+/*
+the v2 header starts with the magic byte which is not a hex digit, so the
+server tells it from the v1 header by the first byte, the response of a
+request uses the same version and carries the request id of it
+*/
+#define FDFS_PROTO_VERSION_1	1
+#define FDFS_PROTO_VERSION_2	2
+#define FDFS_PROTO_V2_MAGIC	((char)0xFD)
+#define FDFS_PROTO_V2_INT_SIZE	8   //the binary integer field of v2
+
+typedef struct
+{
+	char magic;
+	char cmd;
+	char status;
+	char flags;  //reserved, should be 0
+	char request_id[4];  //big endian, returned by the response
+	char pkg_len[8];  //big endian
+} TrackerHeaderV2;
+
+#define FDFS_PROTO_MAX_HEADER_SIZE	sizeof(TrackerHeaderV2)
+
+/* the size field in the body, hex string for v1, binary for v2 */
+#define FDFS_PROTO_FIELD_SIZE(version)	((version) == FDFS_PROTO_VERSION_2 \
+			? FDFS_PROTO_V2_INT_SIZE : TRACKER_PROTO_PKG_LEN_SIZE)
+
+typedef struct
+{
+	int64_t pkg_len;
+	int request_id;  //always 0 for v1
+	char cmd;
+	char status;
+	char flags;
+	char version;  //FDFS_PROTO_VERSION_1 or FDFS_PROTO_VERSION_2
+} FDFSProtoHeader;
+
 typedef struct
 {
 	char group_name[FDFS_GROUP_NAME_MAX_LEN+1];
@@ -90,12 +176,50 @@ typedef struct
 	char until_timestamp[TRACKER_PROTO_PKG_LEN_SIZE];
 } TrackerStorageSyncReqBody;
 
+#define FDFS_STORAGE_STAT_FIELD_COUNT	(sizeof(FDFSStorageStatBuff) / 4)
+
+/*
+delta heart beat package:
+TrackerDeltaBeatReqHeader
+4 bytes for each field of FDFSStorageStatBuff set in the stat mask
+*/
+typedef struct
+{
+	char sz_group_version[4];  //the group version last seen, 0 for none
+	char sz_stat_mask[4];  //bit i set when the i-th stat field changed
+} TrackerDeltaBeatReqHeader;
+
+/*
+delta heart beat response, empty when the group version not changed:
+TrackerDeltaBeatRespHeader
+FDFSStorageBrief of the storage servers changed since the last seen
+group version, or of all storage servers when full_list is 1
+*/
+typedef struct
+{
+	char sz_group_version[4];  //current group version
+	char full_list;
+} TrackerDeltaBeatRespHeader;
+
 typedef struct
 {
 	char sz_total_mb[4];
 	char sz_free_mb[4];
 } TrackerStatReportReqBody;
 
+typedef struct
+{
+	char group_name[FDFS_GROUP_NAME_MAX_LEN + 1];
+	char sz_storage_port[4];
+	char ip_addr[FDFS_IPADDR_SIZE];
+	char status;
+	char connected;  //if the storage server reports to the tracker
+	char sz_total_mb[4];
+	char sz_free_mb[4];
+	char src_ip_addr[FDFS_IPADDR_SIZE];  //sync source storage server
+	char sz_sync_until_timestamp[4];
+} TrackerPeerStorageStat;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -108,8 +232,41 @@ const char *get_storage_status_caption(const int status);
 int tracker_recv_response(TrackerServerInfo *pTrackerServer, \
 		char **buff, const int buff_size, \
 		int *in_bytes);
+
+/*
+recv the response header only, the body is left in the socket
+params:
+	pTrackerServer: the server to recv from
+	in_bytes: return the body length
+return: 0 for success, the status of the response or errno for fail
+*/
+int tracker_recv_header(TrackerServerInfo *pTrackerServer, int64_t *in_bytes);
 int tracker_quit(TrackerServerInfo *pTrackerServer);
 
+/*
+decode the header of v1 or v2
+params:
+	sock: the socket to recv the remain bytes of the v2 header
+	buff: the header, the first sizeof(TrackerHeader) bytes have been
+		received, the size should >= FDFS_PROTO_MAX_HEADER_SIZE
+	pHeader: return the decoded header
+return: 0 for success, != 0 for fail
+*/
+int fdfs_parse_header(int sock, char *buff, FDFSProtoHeader *pHeader);
+
+/*
+encode the header as the version of it
+return: the length of the encoded header
+*/
+int fdfs_pack_header(const FDFSProtoHeader *pHeader, char *buff);
+
+/*
+encode and decode the size field of FDFS_PROTO_FIELD_SIZE(version) bytes
+in the body, the v1 field can't hold the sizes larger than 2GB
+*/
+void fdfs_pack_size_field(const char version, const int64_t n, char *buff);
+int64_t fdfs_unpack_size_field(const char version, const char *buff);
+
 #define fdfs_split_metadata(meta_buff, meta_count, err_no) \
 		fdfs_split_metadata_ex(meta_buff, FDFS_RECORD_SEPERATOR, \
 		FDFS_FIELD_SEPERATOR, meta_count, err_no)
@@ -120,6 +277,61 @@ FDFSMetaData *fdfs_split_metadata_ex(char *meta_buff, \
 		const char recordSeperator, const char filedSeperator, \
 		int *meta_count, int *err_no);
 
+/*
+the metadata functions on the slices of the packed metadata buffer,
+the names and the values are not copied, no memory is allocated
+*/
+int metadata_slice_cmp_by_name(const void *p1, const void *p2);
+
+/*
+return the max count of the metadata items in the packed buffer
+*/
+int fdfs_get_metadata_count(const char *meta_buff, const int meta_bytes);
+
+/*
+split the packed metadata buffer to the slices
+params:
+	meta_buff: the packed metadata, need not end with '\0'
+	meta_bytes: the length of the packed metadata
+	slices: return the slices refer to meta_buff
+	max_count: the max count of the slices
+return: the count of the slices
+*/
+int fdfs_split_metadata_slices(const char *meta_buff, const int meta_bytes, \
+		FDFSMetaSlice *slices, const int max_count);
+
+/*
+pack the slices to the buffer, the buffer ends with '\0'
+return: the length of the packed metadata
+*/
+int fdfs_pack_metadata_slices(const FDFSMetaSlice *slices, \
+		const int count, char *meta_buff);
+
+/*
+split the key names seperated by FDFS_RECORD_SEPERATOR to the slices,
+the values of the slices are empty
+return: the count of the keys, -1 for more than max_count keys
+*/
+int fdfs_split_metadata_keys(const char *keys_buff, const int keys_bytes, \
+		FDFSMetaSlice *keys, const int max_count);
+
+/*
+keep the items whose name is one of the keys, filter in place
+return: the length of the filtered metadata
+*/
+int fdfs_filter_metadata(char *meta_buff, const int meta_bytes, \
+		const FDFSMetaSlice *keys, const int key_count);
+
+/*
+merge two slice lists which are sorted by name, the item of the new list
+replaces the one of the old list with the same name, the buffer size
+should >= the length of the two packed buffers + 1
+return: the length of the packed metadata
+*/
+int fdfs_merge_metadata_slices(const FDFSMetaSlice *old_slices, \
+		const int old_count, const FDFSMetaSlice *new_slices, \
+		const int new_count, char *meta_buff);
+
 #ifdef __cplusplus
 }
 #endif
@@ -27,6 +27,7 @@
 #include "tracker_mem.h"
 #include "tracker_proto.h"
 #include "tracker_service.h"
+#include "tracker_peer.h"
 
 pthread_mutex_t g_tracker_thread_lock;
 int g_tracker_thread_count = 0;
@@ -257,6 +258,12 @@ static int tracker_deal_storage_join(TrackerClientInfo *pClientInfo, \
 	}
 
 	status = tracker_mem_add_group_and_storage(pClientInfo, true);
+	if (status == 0 && pClientInfo->pStorage != NULL)
+	{
+		tracker_mem_pthread_lock();
+		pClientInfo->pStorage->connection_count++;
+		tracker_mem_pthread_unlock();
+	}
 	break;
 	}
 
@@ -305,6 +312,8 @@ static int tracker_deal_storage_sync_notify(TrackerClientInfo *pClientInfo, \
 	{
 		pClientInfo->pStorage->status = FDFS_STORAGE_STATUS_ONLINE;
 		pClientInfo->pGroup->version++;
+		pClientInfo->pStorage->chg_version = \
+				pClientInfo->pGroup->version;
 		tracker_save_storages();
 	}
 
@@ -317,6 +326,8 @@ static int tracker_deal_storage_sync_notify(TrackerClientInfo *pClientInfo, \
 	{
 		pClientInfo->pStorage->status = FDFS_STORAGE_STATUS_WAIT_SYNC;
 		pClientInfo->pGroup->version++;
+		pClientInfo->pStorage->chg_version = \
+				pClientInfo->pGroup->version;
 		bSaveStorages = true;
 	}
 
@@ -515,6 +526,38 @@ static int tracker_deal_server_list_group_storages( \
 	return resp.status;
 }
 
+static int tracker_select_fetch_server(const char *group_name, \
+		FDFSGroupInfo **ppGroup, FDFSStorageDetail **ppStorageServer)
+{
+	FDFSGroupInfo *pGroup;
+
+	*ppStorageServer = NULL;
+	*ppGroup = pGroup = tracker_mem_get_group(group_name);
+	if (pGroup == NULL)
+	{
+		return ENOENT;
+	}
+
+	if (pGroup->active_count == 0)
+	{
+		return ENOENT;
+	}
+
+	if (pGroup->current_read_server >= pGroup->active_count)
+	{
+		pGroup->current_read_server = 0;
+	}
+	*ppStorageServer = *(pGroup->active_servers + \
+			   pGroup->current_read_server);
+	pGroup->current_read_server++;
+	if (pGroup->current_read_server >= pGroup->active_count)
+	{
+		pGroup->current_read_server = 0;
+	}
+
+	return 0;
+}
+
 /**
 pkg format:
 Header
@@ -526,7 +569,7 @@ static int tracker_deal_service_query_fetch(TrackerClientInfo *pClientInfo, \
 {
 	TrackerHeader resp;
 	char in_buff[FDFS_GROUP_NAME_MAX_LEN + 32];
-	char group_name[FDFS_GROUP_NAME_MAX_LEN];
+	char group_name[FDFS_GROUP_NAME_MAX_LEN + 1];
 	char *filename;
 	int out_len;
 	FDFSGroupInfo *pGroup;
@@ -581,33 +624,14 @@ static int tracker_deal_service_query_fetch(TrackerClientInfo *pClientInfo, \
 		memcpy(group_name, in_buff, FDFS_GROUP_NAME_MAX_LEN);
 		group_name[FDFS_GROUP_NAME_MAX_LEN] = '\0';
 		filename = in_buff + FDFS_GROUP_NAME_MAX_LEN;
-		pGroup = tracker_mem_get_group(group_name);
+		resp.status = tracker_select_fetch_server(group_name, \
+				&pGroup, &pStorageServer);
 		if (pGroup == NULL)
 		{
 			logError("file: "__FILE__", line: %d, " \
 				"client ip: %s, invalid group_name: %s", \
-				__LINE__, pClientInfo->ip_addr, \
-				pClientInfo->group_name);
-			resp.status = ENOENT;
-			break;
-		}
-
-		if (pGroup->active_count == 0)
-		{
-			resp.status = ENOENT;
-			break;
-		}
-
-		pStorageServer = *(pGroup->active_servers + \
-				   pGroup->current_read_server);
-		pGroup->current_read_server++;
-		if (pGroup->current_read_server >= \
-				pGroup->active_count)
-		{
-			pGroup->current_read_server = 0;
+				__LINE__, pClientInfo->ip_addr, group_name);
 		}
-
-		resp.status = 0;
 		break;
 	}
 
@@ -647,20 +671,302 @@ static int tracker_deal_service_query_fetch(TrackerClientInfo *pClientInfo, \
 	return resp.status;
 }
 
+/*
+select the store group by smooth weighted round robin.
+the weight of a group is its free space above the reserved space,
+reduced by the percent of recent uploads the group has taken,
+and capped to store_max_share percent of the total weight.
+*/
+static int tracker_select_weighted_group(FDFSGroupInfo **ppStoreGroup)
+{
+	FDFSGroupInfo **ppGroup;
+	FDFSGroupInfo **ppGroupEnd;
+	FDFSStorageDetail **ppServer;
+	FDFSStorageDetail **ppServerEnd;
+	int64_t weights[FDFS_MAX_GROUPS];
+	int recent_uploads[FDFS_MAX_GROUPS];
+	int64_t total_weight;
+	int64_t max_weight;
+	int total_uploads;
+	int count;
+	int result;
+	int i;
+	bool bHaveActiveServer;
+
+	*ppStoreGroup = NULL;
+	if (pthread_mutex_lock(&g_tracker_thread_lock) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call pthread_mutex_lock fail, " \
+			"errno: %d, error info:%s.", \
+			__LINE__, errno, strerror(errno));
+	}
+
+	bHaveActiveServer = false;
+	total_uploads = 0;
+	count = g_groups.count < FDFS_MAX_GROUPS ? \
+		g_groups.count : FDFS_MAX_GROUPS;
+	ppGroupEnd = g_groups.sorted_groups + count;
+	for (ppGroup=g_groups.sorted_groups, i=0; \
+		ppGroup<ppGroupEnd; ppGroup++, i++)
+	{
+		weights[i] = 0;
+		recent_uploads[i] = 0;
+		if ((*ppGroup)->active_count == 0)
+		{
+			continue;
+		}
+
+		bHaveActiveServer = true;
+		if ((*ppGroup)->free_mb <= g_storage_reserved_mb)
+		{
+			continue;
+		}
+
+		weights[i] = (*ppGroup)->free_mb - g_storage_reserved_mb;
+		ppServerEnd = (*ppGroup)->active_servers + \
+				(*ppGroup)->active_count;
+		for (ppServer=(*ppGroup)->active_servers; \
+			ppServer<ppServerEnd; ppServer++)
+		{
+			recent_uploads[i] += (*ppServer)->recent_uploads;
+		}
+		total_uploads += recent_uploads[i];
+	}
+
+	total_weight = 0;
+	for (i=0; i<count; i++)
+	{
+		if (weights[i] > 0 && total_uploads > 0)
+		{
+			weights[i] = weights[i] * 100 / (100 + \
+				100 * (int64_t)recent_uploads[i] / total_uploads);
+			if (weights[i] == 0)
+			{
+				weights[i] = 1;
+			}
+		}
+		total_weight += weights[i];
+	}
+
+	if (total_weight == 0)
+	{
+		result = bHaveActiveServer ? ENOSPC : ENOENT;
+	}
+	else
+	{
+		if (g_groups.store_max_share > 0 && \
+			g_groups.store_max_share < 100)
+		{
+			/* share of group = w / (w + others) <= max_share */
+			for (i=0; i<count; i++)
+			{
+				max_weight = (total_weight - weights[i]) * \
+					g_groups.store_max_share / \
+					(100 - g_groups.store_max_share);
+				if (weights[i] > max_weight && max_weight > 0)
+				{
+					weights[i] = max_weight;
+				}
+			}
+
+			total_weight = 0;
+			for (i=0; i<count; i++)
+			{
+				total_weight += weights[i];
+			}
+		}
+
+		for (ppGroup=g_groups.sorted_groups, i=0; \
+			ppGroup<ppGroupEnd; ppGroup++, i++)
+		{
+			if (weights[i] == 0)
+			{
+				(*ppGroup)->current_weight = 0;
+				continue;
+			}
+
+			(*ppGroup)->current_weight += weights[i];
+			if (*ppStoreGroup == NULL || \
+				(*ppGroup)->current_weight > \
+				(*ppStoreGroup)->current_weight)
+			{
+				*ppStoreGroup = *ppGroup;
+			}
+		}
+
+		(*ppStoreGroup)->current_weight -= total_weight;
+		result = 0;
+	}
+
+	if (pthread_mutex_unlock(&g_tracker_thread_lock) != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"call pthread_mutex_unlock fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, errno, strerror(errno));
+	}
+
+	return result;
+}
+
+static int tracker_select_store_server(FDFSGroupInfo **ppStoreGroup, \
+		FDFSStorageDetail **ppStorageServer)
+{
+	FDFSGroupInfo *pStoreGroup;
+	FDFSGroupInfo **ppFoundGroup;
+	FDFSGroupInfo **ppGroup;
+	bool bHaveActiveServer;
+	int result;
+
+	*ppStoreGroup = NULL;
+	*ppStorageServer = NULL;
+	if (g_groups.count == 0)
+	{
+		return ENOENT;
+	}
+
+	pStoreGroup = NULL;
+	if (g_groups.store_lookup == FDFS_STORE_LOOKUP_ROUND_ROBIN || \
+	    g_groups.store_lookup == FDFS_STORE_LOOKUP_LOAD_BALANCE)
+	{
+		bHaveActiveServer = false;
+		ppFoundGroup = g_groups.sorted_groups + \
+				g_groups.current_write_group;
+		if ((*ppFoundGroup)->active_count > 0)
+		{
+			bHaveActiveServer = true;
+			if ((*ppFoundGroup)->free_mb > \
+				g_storage_reserved_mb)
+			{
+				pStoreGroup = *ppFoundGroup;
+			}
+		}
+
+		if (pStoreGroup == NULL)
+		{
+			FDFSGroupInfo **ppGroupEnd;
+			ppGroupEnd = g_groups.sorted_groups + g_groups.count;
+			for (ppGroup=ppFoundGroup+1; \
+				ppGroup<ppGroupEnd; ppGroup++)
+			{
+				if ((*ppGroup)->active_count == 0)
+				{
+					continue;
+				}
+
+				bHaveActiveServer = true;
+				if ((*ppGroup)->free_mb > \
+					g_storage_reserved_mb)
+				{
+				pStoreGroup = *ppGroup;
+				if (g_groups.store_lookup == \
+					FDFS_STORE_LOOKUP_LOAD_BALANCE)
+				{
+					g_groups.current_write_group = \
+					ppGroup-g_groups.sorted_groups;
+				}
+				break;
+				}
+			}
+
+			if (pStoreGroup == NULL)
+			{
+			for (ppGroup=g_groups.sorted_groups; \
+				ppGroup<ppFoundGroup; ppGroup++)
+			{
+				if ((*ppGroup)->active_count == 0)
+				{
+					continue;
+				}
+
+				bHaveActiveServer = true;
+				if ((*ppGroup)->free_mb > \
+					g_storage_reserved_mb)
+				{
+				pStoreGroup = *ppGroup;
+				if (g_groups.store_lookup == \
+					FDFS_STORE_LOOKUP_LOAD_BALANCE)
+				{
+					g_groups.current_write_group = \
+					ppGroup-g_groups.sorted_groups;
+				}
+				break;
+				}
+			}
+			}
+
+			if (pStoreGroup == NULL)
+			{
+				return bHaveActiveServer ? ENOSPC : ENOENT;
+			}
+		}
+
+		if (g_groups.store_lookup == FDFS_STORE_LOOKUP_ROUND_ROBIN)
+		{
+			g_groups.current_write_group++;
+			if (g_groups.current_write_group >= g_groups.count)
+			{
+				g_groups.current_write_group = 0;
+			}
+		}
+	}
+	else if (g_groups.store_lookup == FDFS_STORE_LOOKUP_SPEC_GROUP)
+	{
+		if (g_groups.pStoreGroup == NULL || \
+			g_groups.pStoreGroup->active_count == 0)
+		{
+			return ENOENT;
+		}
+
+		if (g_groups.pStoreGroup->free_mb <= \
+			g_storage_reserved_mb)
+		{
+			return ENOSPC;
+		}
+
+		pStoreGroup = g_groups.pStoreGroup;
+	}
+	else if (g_groups.store_lookup == FDFS_STORE_LOOKUP_WEIGHTED)
+	{
+		if ((result=tracker_select_weighted_group(&pStoreGroup)) != 0)
+		{
+			return result;
+		}
+	}
+	else
+	{
+		return EINVAL;
+	}
+
+	if (pStoreGroup->current_write_server >= \
+			pStoreGroup->active_count)
+	{
+		pStoreGroup->current_write_server = 0;
+	}
+
+	*ppStoreGroup = pStoreGroup;
+	*ppStorageServer = *(pStoreGroup->active_servers + \
+			   pStoreGroup->current_write_server);
+	pStoreGroup->current_write_server++;
+	return 0;
+}
+
 static int tracker_deal_service_query_storage(TrackerClientInfo *pClientInfo, \
 				const int nInPackLen)
 {
 	TrackerHeader resp;
 	int out_len;
 	FDFSGroupInfo *pStoreGroup;
-	FDFSGroupInfo **ppFoundGroup;
-	FDFSGroupInfo **ppGroup;
 	FDFSStorageDetail *pStorageServer;
 	char out_buff[sizeof(TrackerHeader) + TRACKER_QUERY_STORAGE_BODY_LEN];
-	bool bHaveActiveServer;
+	char record[TRACKER_BATCH_PLACEMENT_MAX_LEN];
+	int record_len;
+	bool bForwarded;
 
 	pStoreGroup = NULL;
 	pStorageServer = NULL;
+	bForwarded = false;
 	while (1)
 	{
 		if (nInPackLen != 0)
@@ -677,172 +983,487 @@ static int tracker_deal_service_query_storage(TrackerClientInfo *pClientInfo, \
 			break;
 		}
 
-		if (g_groups.count == 0)
+		//the write cursors belong to the leader tracker
+		if (!tracker_peer_is_leader() && tracker_peer_query_store(1, \
+			record, sizeof(record), &record_len) == 0 && \
+			record_len >= 1 + TRACKER_QUERY_STORAGE_BODY_LEN)
 		{
-			resp.status = ENOENT;
+			resp.status = *record;
+			bForwarded = true;
 			break;
 		}
 
-		if (g_groups.store_lookup == FDFS_STORE_LOOKUP_ROUND_ROBIN || \
-		    g_groups.store_lookup == FDFS_STORE_LOOKUP_LOAD_BALANCE)
+		resp.status = tracker_select_store_server(&pStoreGroup, \
+				&pStorageServer);
+		break;
+	}
+
+	resp.cmd = TRACKER_PROTO_CMD_SERVICE_RESP;
+	if (resp.status == 0 && bForwarded)
+	{
+		out_len = TRACKER_QUERY_STORAGE_BODY_LEN;
+		sprintf(resp.pkg_len, "%x", out_len);
+
+		memcpy(out_buff, &resp, sizeof(resp));
+		memcpy(out_buff + sizeof(resp), record + 1, out_len);
+	}
+	else if (resp.status == 0)
+	{
+		out_len = TRACKER_QUERY_STORAGE_BODY_LEN;
+		sprintf(resp.pkg_len, "%x", out_len);
+
+		memcpy(out_buff, &resp, sizeof(resp));
+		memcpy(out_buff + sizeof(resp), pStoreGroup->group_name, \
+				FDFS_GROUP_NAME_MAX_LEN);
+		memcpy(out_buff + sizeof(resp) + FDFS_GROUP_NAME_MAX_LEN, \
+				pStorageServer->ip_addr, FDFS_IPADDR_SIZE-1);
+		sprintf(out_buff + sizeof(resp) + FDFS_GROUP_NAME_MAX_LEN \
+				+ FDFS_IPADDR_SIZE-1, "%x", \
+				pStoreGroup->storage_port);
+	}
+	else
+	{
+		out_len = 0;
+		sprintf(resp.pkg_len, "%x", out_len);
+		memcpy(out_buff, &resp, sizeof(resp));
+	}
+
+	if (tcpsenddata(pClientInfo->sock, \
+		out_buff, sizeof(resp) + out_len, g_network_timeout) != 1)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, send data fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pClientInfo->ip_addr, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+
+	return resp.status;
+}
+
+/*
+pack one placement record of the batch query response,
+return the record length
+*/
+static int tracker_pack_placement(char *buff, const char status, \
+		FDFSGroupInfo *pGroup, FDFSStorageDetail *pStorageServer)
+{
+	char *p;
+	FDFSStorageDetail **ppServer;
+	FDFSStorageDetail **ppServerEnd;
+	int server_count;
+
+	memset(buff, 0, TRACKER_BATCH_PLACEMENT_FIXED_LEN);
+	p = buff;
+	*p++ = status;
+	if (pGroup != NULL)
+	{
+		memcpy(p, pGroup->group_name, FDFS_GROUP_NAME_MAX_LEN);
+	}
+	p += FDFS_GROUP_NAME_MAX_LEN;
+	if (status != 0)
+	{
+		return TRACKER_BATCH_PLACEMENT_FIXED_LEN;
+	}
+
+	memcpy(p, pStorageServer->ip_addr, FDFS_IPADDR_SIZE - 1);
+	p += FDFS_IPADDR_SIZE - 1;
+	sprintf(p, "%x", pGroup->storage_port);
+	p += TRACKER_PROTO_PKG_LEN_SIZE;
+
+	server_count = pGroup->active_count;
+	if (server_count > FDFS_MAX_SERVERS_EACH_GROUP)
+	{
+		server_count = FDFS_MAX_SERVERS_EACH_GROUP;
+	}
+	sprintf(p, "%x", server_count);
+	p += TRACKER_PROTO_PKG_LEN_SIZE;
+
+	ppServerEnd = pGroup->active_servers + server_count;
+	for (ppServer=pGroup->active_servers; ppServer<ppServerEnd; ppServer++)
+	{
+		memcpy(p, (*ppServer)->ip_addr, FDFS_IPADDR_SIZE - 1);
+		p += FDFS_IPADDR_SIZE - 1;
+	}
+
+	return p - buff;
+}
+
+static int tracker_send_batch_response(TrackerClientInfo *pClientInfo, \
+		TrackerHeader *pResp, char *out_buff, const int out_len)
+{
+	pResp->cmd = TRACKER_PROTO_CMD_SERVICE_RESP;
+	sprintf(pResp->pkg_len, "%x", pResp->status == 0 ? out_len : 0);
+	if (tcpsenddata(pClientInfo->sock, pResp, sizeof(TrackerHeader), \
+		g_network_timeout) != 1 || (pResp->status == 0 && \
+		out_len > 0 && tcpsenddata(pClientInfo->sock, \
+		out_buff, out_len, g_network_timeout) != 1))
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, send data fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pClientInfo->ip_addr, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+
+	return pResp->status;
+}
+
+/**
+pkg format:
+Header
+TRACKER_PROTO_PKG_LEN_SIZE bytes: placement count (hex string)
+response: placement count records, see TRACKER_BATCH_PLACEMENT_FIXED_LEN
+**/
+static int tracker_deal_service_query_store_batch( \
+		TrackerClientInfo *pClientInfo, const int nInPackLen, \
+		const bool bCanForward)
+{
+	TrackerHeader resp;
+	char in_buff[TRACKER_PROTO_PKG_LEN_SIZE + 1];
+	char *out_buff;
+	char *p;
+	FDFSGroupInfo *pStoreGroup;
+	FDFSStorageDetail *pStorageServer;
+	int count;
+	int body_len;
+	int i;
+	int result;
+
+	out_buff = NULL;
+	p = NULL;
+	while (1)
+	{
+		if (nInPackLen != TRACKER_PROTO_PKG_LEN_SIZE)
 		{
-			bHaveActiveServer = false;
-			ppFoundGroup = g_groups.sorted_groups + \
-					g_groups.current_write_group;
-			if ((*ppFoundGroup)->active_count > 0)
-			{
-				bHaveActiveServer = true;
-				if ((*ppFoundGroup)->free_mb > \
-					g_storage_reserved_mb)
-				{
-					pStoreGroup = *ppFoundGroup;
-				}
-			}
+			logError("file: "__FILE__", line: %d, " \
+				"cmd=%d, client ip: %s, package size %d " \
+				"is not correct, " \
+				"expect length: %d", \
+				__LINE__, \
+				TRACKER_PROTO_CMD_SERVICE_QUERY_STORE_BATCH, \
+				pClientInfo->ip_addr,  \
+				nInPackLen, TRACKER_PROTO_PKG_LEN_SIZE);
+			resp.status = EINVAL;
+			break;
+		}
 
-			if (pStoreGroup == NULL)
-			{
-				FDFSGroupInfo **ppGroupEnd;
-				ppGroupEnd = g_groups.sorted_groups + g_groups.count;
-				for (ppGroup=ppFoundGroup+1; \
-					ppGroup<ppGroupEnd; ppGroup++)
-				{
-					if ((*ppGroup)->active_count == 0)
-					{
-						continue;
-					}
-
-					bHaveActiveServer = true;
-					if ((*ppGroup)->free_mb > \
-						g_storage_reserved_mb)
-					{
-					pStoreGroup = *ppGroup;
-					if (g_groups.store_lookup == \
-						FDFS_STORE_LOOKUP_LOAD_BALANCE)
-					{
-						g_groups.current_write_group = \
-						ppGroup-g_groups.sorted_groups;
-					}
-					break;
-					}
-				}
+		if (tcprecvdata(pClientInfo->sock, in_buff, \
+			nInPackLen, g_network_timeout) != 1)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, recv data fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, pClientInfo->ip_addr, \
+				errno, strerror(errno));
+			resp.status = errno != 0 ? errno : EPIPE;
+			break;
+		}
+		in_buff[nInPackLen] = '\0';
 
-				if (pStoreGroup == NULL)
-				{
-				for (ppGroup=g_groups.sorted_groups; \
-					ppGroup<ppFoundGroup; ppGroup++)
-				{
-					if ((*ppGroup)->active_count == 0)
-					{
-						continue;
-					}
-
-					bHaveActiveServer = true;
-					if ((*ppGroup)->free_mb > \
-						g_storage_reserved_mb)
-					{
-					pStoreGroup = *ppGroup;
-					if (g_groups.store_lookup == \
-						FDFS_STORE_LOOKUP_LOAD_BALANCE)
-					{
-						g_groups.current_write_group = \
-						ppGroup-g_groups.sorted_groups;
-					}
-					break;
-					}
-				}
-				}
+		count = strtol(in_buff, NULL, 16);
+		if (count <= 0 || count > TRACKER_MAX_BATCH_QUERY_COUNT)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, invalid placement count: %d", \
+				__LINE__, pClientInfo->ip_addr, count);
+			resp.status = EINVAL;
+			break;
+		}
 
-				if (pStoreGroup == NULL)
-				{
-					if (bHaveActiveServer)
-					{
-						resp.status = ENOSPC;
-					}
-					else
-					{
-						resp.status = ENOENT;
-					}
-					break;
-				}
-			}
+		out_buff = (char *)malloc(TRACKER_BATCH_PLACEMENT_MAX_LEN \
+						* count);
+		if (out_buff == NULL)
+		{
+			resp.status = errno != 0 ? errno : ENOMEM;
+			break;
+		}
+
+		p = out_buff;
+		resp.status = 0;
+		if (bCanForward && !tracker_peer_is_leader() && \
+			tracker_peer_query_store(count, out_buff, \
+				TRACKER_BATCH_PLACEMENT_MAX_LEN * count, \
+				&body_len) == 0)
+		{
+			p = out_buff + body_len;
+			break;
+		}
 
-			if (g_groups.store_lookup == FDFS_STORE_LOOKUP_ROUND_ROBIN)
+		for (i=0; i<count; i++)
+		{
+			if ((result=tracker_select_store_server(&pStoreGroup, \
+					&pStorageServer)) != 0)
 			{
-				g_groups.current_write_group++;
-				if (g_groups.current_write_group >= g_groups.count)
+				if (i == 0)
 				{
-					g_groups.current_write_group = 0;
+					resp.status = result;
 				}
+				break;
 			}
+
+			p += tracker_pack_placement(p, 0, pStoreGroup, \
+						pStorageServer);
+		}
+		break;
+	}
+
+	result = tracker_send_batch_response(pClientInfo, &resp, \
+				out_buff, p - out_buff);
+	if (out_buff != NULL)
+	{
+		free(out_buff);
+	}
+	return result;
+}
+
+/**
+pkg format:
+Header
+TRACKER_PROTO_PKG_LEN_SIZE bytes: file count (hex string)
+file count items:
+	FDFS_GROUP_NAME_MAX_LEN bytes: group_name
+	TRACKER_PROTO_PKG_LEN_SIZE bytes: filename length (hex string)
+	filename length bytes: filename
+response: file count records, see TRACKER_BATCH_PLACEMENT_FIXED_LEN
+**/
+static int tracker_deal_service_query_fetch_batch( \
+		TrackerClientInfo *pClientInfo, const int nInPackLen)
+{
+	TrackerHeader resp;
+	char group_name[FDFS_GROUP_NAME_MAX_LEN + 1];
+	char sz_len[TRACKER_PROTO_PKG_LEN_SIZE + 1];
+	char *in_buff;
+	char *out_buff;
+	char *pIn;
+	char *pInEnd;
+	char *p;
+	FDFSGroupInfo *pGroup;
+	FDFSStorageDetail *pStorageServer;
+	int filename_len;
+	int count;
+	int i;
+	int result;
+
+	in_buff = NULL;
+	out_buff = NULL;
+	p = NULL;
+	while (1)
+	{
+		if (nInPackLen <= TRACKER_PROTO_PKG_LEN_SIZE || nInPackLen > \
+			TRACKER_PROTO_PKG_LEN_SIZE + TRACKER_MAX_BATCH_QUERY_COUNT \
+			* (FDFS_GROUP_NAME_MAX_LEN + TRACKER_PROTO_PKG_LEN_SIZE \
+			+ MAX_PATH_SIZE))
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"cmd=%d, client ip: %s, package size %d " \
+				"is not correct", \
+				__LINE__, \
+				TRACKER_PROTO_CMD_SERVICE_QUERY_FETCH_BATCH, \
+				pClientInfo->ip_addr, nInPackLen);
+			resp.status = EINVAL;
+			break;
+		}
+
+		in_buff = (char *)malloc(nInPackLen);
+		if (in_buff == NULL)
+		{
+			resp.status = errno != 0 ? errno : ENOMEM;
+			break;
+		}
+
+		if (tcprecvdata(pClientInfo->sock, in_buff, \
+			nInPackLen, g_network_timeout) != 1)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, recv data fail, " \
+				"errno: %d, error info: %s", \
+				__LINE__, pClientInfo->ip_addr, \
+				errno, strerror(errno));
+			resp.status = errno != 0 ? errno : EPIPE;
+			break;
 		}
-		else if (g_groups.store_lookup == FDFS_STORE_LOOKUP_SPEC_GROUP)
+
+		memcpy(sz_len, in_buff, TRACKER_PROTO_PKG_LEN_SIZE);
+		sz_len[TRACKER_PROTO_PKG_LEN_SIZE] = '\0';
+		count = strtol(sz_len, NULL, 16);
+		if (count <= 0 || count > TRACKER_MAX_BATCH_QUERY_COUNT)
 		{
-			if (g_groups.pStoreGroup == NULL || \
-				g_groups.pStoreGroup->active_count == 0)
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, invalid file count: %d", \
+				__LINE__, pClientInfo->ip_addr, count);
+			resp.status = EINVAL;
+			break;
+		}
+
+		out_buff = (char *)malloc(TRACKER_BATCH_PLACEMENT_MAX_LEN \
+						* count);
+		if (out_buff == NULL)
+		{
+			resp.status = errno != 0 ? errno : ENOMEM;
+			break;
+		}
+
+		resp.status = 0;
+		p = out_buff;
+		pIn = in_buff + TRACKER_PROTO_PKG_LEN_SIZE;
+		pInEnd = in_buff + nInPackLen;
+		for (i=0; i<count; i++)
+		{
+			if (pInEnd - pIn < FDFS_GROUP_NAME_MAX_LEN + \
+					TRACKER_PROTO_PKG_LEN_SIZE)
 			{
-				resp.status = ENOENT;
+				resp.status = EINVAL;
 				break;
 			}
 
-			if (g_groups.pStoreGroup->free_mb <= \
-				g_storage_reserved_mb)
+			memcpy(group_name, pIn, FDFS_GROUP_NAME_MAX_LEN);
+			group_name[FDFS_GROUP_NAME_MAX_LEN] = '\0';
+			pIn += FDFS_GROUP_NAME_MAX_LEN;
+			memcpy(sz_len, pIn, TRACKER_PROTO_PKG_LEN_SIZE);
+			sz_len[TRACKER_PROTO_PKG_LEN_SIZE] = '\0';
+			pIn += TRACKER_PROTO_PKG_LEN_SIZE;
+			filename_len = strtol(sz_len, NULL, 16);
+			if (filename_len < 0 || filename_len > pInEnd - pIn)
 			{
-				resp.status = ENOSPC;
+				resp.status = EINVAL;
 				break;
 			}
+			pIn += filename_len;  //filename not used yet
 
-			pStoreGroup = g_groups.pStoreGroup;
+			result = tracker_select_fetch_server(group_name, \
+					&pGroup, &pStorageServer);
+			p += tracker_pack_placement(p, result, pGroup, \
+						pStorageServer);
 		}
-		else
+
+		if (resp.status != 0)
 		{
+			logError("file: "__FILE__", line: %d, " \
+				"cmd=%d, client ip: %s, package " \
+				"is not correct", __LINE__, \
+				TRACKER_PROTO_CMD_SERVICE_QUERY_FETCH_BATCH, \
+				pClientInfo->ip_addr);
+		}
+		break;
+	}
+
+	result = tracker_send_batch_response(pClientInfo, &resp, \
+				out_buff, p - out_buff);
+	if (in_buff != NULL)
+	{
+		free(in_buff);
+	}
+	if (out_buff != NULL)
+	{
+		free(out_buff);
+	}
+	return result;
+}
+
+static int tracker_deal_server_list_groups(TrackerClientInfo *pClientInfo, \
+				const int nInPackLen)
+{
+	TrackerHeader resp;
+	FDFSGroupInfo **ppGroup;
+	FDFSGroupInfo **ppEnd;
+	TrackerGroupStat groupStats[FDFS_MAX_GROUPS];
+	TrackerGroupStat *pDest;
+	int out_len;
+
+	pDest = groupStats;
+	while (1)
+	{
+		if (nInPackLen != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"cmd=%d, client ip: %s, package size %d " \
+				"is not correct, " \
+				"expect length: 0", \
+				__LINE__, \
+				TRACKER_PROTO_CMD_SERVER_LIST_GROUP, \
+				pClientInfo->ip_addr,  \
+				nInPackLen);
 			resp.status = EINVAL;
 			break;
 		}
 
-		if (pStoreGroup->current_write_server >= \
-				pStoreGroup->active_count)
+		ppEnd = g_groups.sorted_groups + g_groups.count;
+		for (ppGroup=g_groups.sorted_groups; ppGroup<ppEnd; ppGroup++)
 		{
-			pStoreGroup->current_write_server = 0;
+			memcpy(pDest->group_name, (*ppGroup)->group_name, \
+				FDFS_GROUP_NAME_MAX_LEN + 1);
+			sprintf(pDest->sz_free_mb, "%x", (*ppGroup)->free_mb);
+			sprintf(pDest->sz_count, "%x", (*ppGroup)->count);
+			sprintf(pDest->sz_storage_port, "%x", \
+					(*ppGroup)->storage_port);
+			sprintf(pDest->sz_active_count, "%x", \
+					(*ppGroup)->active_count);
+			sprintf(pDest->sz_current_write_server, "%x", \
+					(*ppGroup)->current_write_server);
+			pDest++;
 		}
 
-		/*
-		//printf("pStoreGroup->current_write_server: %d, " \
-			"pStoreGroup->active_count=%d\n", \
-			pStoreGroup->current_write_server, \
-			pStoreGroup->active_count);
-		*/
-
-		pStorageServer = *(pStoreGroup->active_servers + \
-				   pStoreGroup->current_write_server);
-		pStoreGroup->current_write_server++;
 		resp.status = 0;
 		break;
 	}
 
-	resp.cmd = TRACKER_PROTO_CMD_SERVICE_RESP;
-	if (resp.status == 0)
+	out_len = (pDest - groupStats) * sizeof(TrackerGroupStat);
+	sprintf(resp.pkg_len, "%x", out_len);
+	resp.cmd = TRACKER_PROTO_CMD_SERVER_RESP;
+	if (tcpsenddata(pClientInfo->sock, \
+		&resp, sizeof(resp), g_network_timeout) != 1)
 	{
-		out_len = TRACKER_QUERY_STORAGE_BODY_LEN;
-		sprintf(resp.pkg_len, "%x", out_len);
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, send data fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pClientInfo->ip_addr, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
 
-		memcpy(out_buff, &resp, sizeof(resp));
-		memcpy(out_buff + sizeof(resp), pStoreGroup->group_name, \
-				FDFS_GROUP_NAME_MAX_LEN);
-		memcpy(out_buff + sizeof(resp) + FDFS_GROUP_NAME_MAX_LEN, \
-				pStorageServer->ip_addr, FDFS_IPADDR_SIZE-1);
-		sprintf(out_buff + sizeof(resp) + FDFS_GROUP_NAME_MAX_LEN \
-				+ FDFS_IPADDR_SIZE-1, "%x", \
-				pStoreGroup->storage_port);
+	if (out_len == 0)
+	{
+		return resp.status;
 	}
-	else
+
+	if (tcpsenddata(pClientInfo->sock, \
+		groupStats, out_len, g_network_timeout) != 1)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, send data fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pClientInfo->ip_addr, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+
+	return resp.status;
+}
+
+static int tracker_deal_tracker_ping(TrackerClientInfo *pClientInfo, \
+				const int nInPackLen)
+{
+	TrackerHeader resp;
+
+	memset(&resp, 0, sizeof(resp));
+	if (nInPackLen != 0)
 	{
-		out_len = 0;
-		sprintf(resp.pkg_len, "%x", out_len);
-		memcpy(out_buff, &resp, sizeof(resp));
+		logError("file: "__FILE__", line: %d, " \
+			"cmd=%d, client ip: %s, package size %d " \
+			"is not correct, " \
+			"expect length: 0", \
+			__LINE__, TRACKER_PROTO_CMD_TRACKER_PING, \
+			pClientInfo->ip_addr, nInPackLen);
+		resp.status = EINVAL;
 	}
 
+	resp.pkg_len[0] = '0';
+	resp.cmd = TRACKER_PROTO_CMD_TRACKER_RESP;
 	if (tcpsenddata(pClientInfo->sock, \
-		out_buff, sizeof(resp) + out_len, g_network_timeout) != 1)
+		&resp, sizeof(resp), g_network_timeout) != 1)
 	{
 		logError("file: "__FILE__", line: %d, " \
 			"client ip: %s, send data fail, " \
@@ -855,17 +1476,27 @@ static int tracker_deal_service_query_storage(TrackerClientInfo *pClientInfo, \
 	return resp.status;
 }
 
-static int tracker_deal_server_list_groups(TrackerClientInfo *pClientInfo, \
+/**
+pkg format:
+Header
+response: TrackerPeerStorageStat of every storage server
+**/
+static int tracker_deal_tracker_get_status(TrackerClientInfo *pClientInfo, \
 				const int nInPackLen)
 {
 	TrackerHeader resp;
-	FDFSGroupInfo **ppGroup;
-	FDFSGroupInfo **ppEnd;
-	TrackerGroupStat groupStats[FDFS_MAX_GROUPS];
-	TrackerGroupStat *pDest;
+	TrackerPeerStorageStat *pStatBuff;
+	TrackerPeerStorageStat *pStat;
+	FDFSGroupInfo *pGroup;
+	FDFSGroupInfo *pGroupEnd;
+	FDFSStorageDetail *pStorage;
+	FDFSStorageDetail *pStorageEnd;
+	int storage_count;
 	int out_len;
 
-	pDest = groupStats;
+	memset(&resp, 0, sizeof(resp));
+	pStatBuff = NULL;
+	out_len = 0;
 	while (1)
 	{
 		if (nInPackLen != 0)
@@ -875,54 +1506,123 @@ static int tracker_deal_server_list_groups(TrackerClientInfo *pClientInfo, \
 				"is not correct, " \
 				"expect length: 0", \
 				__LINE__, \
-				TRACKER_PROTO_CMD_SERVER_LIST_GROUP, \
-				pClientInfo->ip_addr,  \
-				nInPackLen);
+				TRACKER_PROTO_CMD_TRACKER_GET_STATUS, \
+				pClientInfo->ip_addr, nInPackLen);
 			resp.status = EINVAL;
 			break;
 		}
 
-		ppEnd = g_groups.sorted_groups + g_groups.count;
-		for (ppGroup=g_groups.sorted_groups; ppGroup<ppEnd; ppGroup++)
+		tracker_mem_pthread_lock();
+		storage_count = 0;
+		pGroupEnd = g_groups.groups + g_groups.count;
+		for (pGroup=g_groups.groups; pGroup<pGroupEnd; pGroup++)
 		{
-			memcpy(pDest->group_name, (*ppGroup)->group_name, \
-				FDFS_GROUP_NAME_MAX_LEN + 1);
-			sprintf(pDest->sz_free_mb, "%x", (*ppGroup)->free_mb);
-			sprintf(pDest->sz_count, "%x", (*ppGroup)->count);
-			sprintf(pDest->sz_storage_port, "%x", \
-					(*ppGroup)->storage_port);
-			sprintf(pDest->sz_active_count, "%x", \
-					(*ppGroup)->active_count);
-			sprintf(pDest->sz_current_write_server, "%x", \
-					(*ppGroup)->current_write_server);
-			pDest++;
+			storage_count += pGroup->count;
 		}
 
-		resp.status = 0;
+		if (storage_count > 0)
+		{
+			pStatBuff = (TrackerPeerStorageStat *)malloc( \
+				sizeof(TrackerPeerStorageStat) * storage_count);
+			if (pStatBuff == NULL)
+			{
+				resp.status = errno != 0 ? errno : ENOMEM;
+				tracker_mem_pthread_unlock();
+				break;
+			}
+			memset(pStatBuff, 0, sizeof(TrackerPeerStorageStat) \
+				* storage_count);
+		}
+
+		pStat = pStatBuff;
+		for (pGroup=g_groups.groups; pGroup<pGroupEnd; pGroup++)
+		{
+		pStorageEnd = pGroup->all_servers + pGroup->count;
+		for (pStorage=pGroup->all_servers; pStorage<pStorageEnd; \
+			pStorage++)
+		{
+			strcpy(pStat->group_name, pGroup->group_name);
+			int2buff(pGroup->storage_port, pStat->sz_storage_port);
+			strcpy(pStat->ip_addr, pStorage->ip_addr);
+			pStat->status = pStorage->status;
+			pStat->connected = pStorage->connection_count > 0;
+			int2buff(pStorage->total_mb, pStat->sz_total_mb);
+			int2buff(pStorage->free_mb, pStat->sz_free_mb);
+			if (pStorage->psync_src_server != NULL)
+			{
+				strcpy(pStat->src_ip_addr, \
+					pStorage->psync_src_server->ip_addr);
+			}
+			int2buff(pStorage->sync_until_timestamp, \
+				pStat->sz_sync_until_timestamp);
+			pStat++;
+		}
+		}
+		tracker_mem_pthread_unlock();
+
+		out_len = (char *)pStat - (char *)pStatBuff;
 		break;
 	}
 
-	out_len = (pDest - groupStats) * sizeof(TrackerGroupStat);
 	sprintf(resp.pkg_len, "%x", out_len);
-	resp.cmd = TRACKER_PROTO_CMD_SERVER_RESP;
-	if (tcpsenddata(pClientInfo->sock, \
-		&resp, sizeof(resp), g_network_timeout) != 1)
+	resp.cmd = TRACKER_PROTO_CMD_TRACKER_RESP;
+	if (tcpsenddata(pClientInfo->sock, &resp, sizeof(resp), \
+		g_network_timeout) != 1 || (out_len > 0 && \
+		tcpsenddata(pClientInfo->sock, pStatBuff, out_len, \
+		g_network_timeout) != 1))
 	{
 		logError("file: "__FILE__", line: %d, " \
 			"client ip: %s, send data fail, " \
 			"errno: %d, error info: %s", \
 			__LINE__, pClientInfo->ip_addr, \
 			errno, strerror(errno));
+		if (pStatBuff != NULL)
+		{
+			free(pStatBuff);
+		}
 		return errno != 0 ? errno : EPIPE;
 	}
 
-	if (out_len == 0)
+	if (pStatBuff != NULL)
 	{
-		return resp.status;
+		free(pStatBuff);
+	}
+	return resp.status;
+}
+
+static int tracker_deal_server_topology_version( \
+		TrackerClientInfo *pClientInfo, const int nInPackLen)
+{
+	TrackerHeader resp;
+	char out_buff[sizeof(TrackerHeader) + 4];
+	int out_len;
+
+	if (nInPackLen != 0)
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"cmd=%d, client ip: %s, package size %d " \
+			"is not correct, " \
+			"expect length: 0", \
+			__LINE__, \
+			TRACKER_PROTO_CMD_SERVER_TOPOLOGY_VERSION, \
+			pClientInfo->ip_addr,  \
+			nInPackLen);
+		resp.status = EINVAL;
+		out_len = 0;
+	}
+	else
+	{
+		resp.status = 0;
+		out_len = 4;
+		int2buff(tracker_mem_get_topology_version(), \
+			out_buff + sizeof(TrackerHeader));
 	}
 
+	sprintf(resp.pkg_len, "%x", out_len);
+	resp.cmd = TRACKER_PROTO_CMD_SERVER_RESP;
+	memcpy(out_buff, &resp, sizeof(resp));
 	if (tcpsenddata(pClientInfo->sock, \
-		groupStats, out_len, g_network_timeout) != 1)
+		out_buff, sizeof(resp) + out_len, g_network_timeout) != 1)
 	{
 		logError("file: "__FILE__", line: %d, " \
 			"client ip: %s, send data fail, " \
@@ -1101,6 +1801,8 @@ static int tracker_deal_storage_sync_dest_req(TrackerClientInfo *pClientInfo, \
 			pClientInfo->pStorage->status = \
 				FDFS_STORAGE_STATUS_ONLINE;
 			pClientInfo->pGroup->version++;
+			pClientInfo->pStorage->chg_version = \
+					pClientInfo->pGroup->version;
 			tracker_save_storages();
 		}
 
@@ -1145,6 +1847,8 @@ static int tracker_deal_storage_sync_dest_req(TrackerClientInfo *pClientInfo, \
 	pClientInfo->pStorage->sync_until_timestamp = sync_until_timestamp;
 	pClientInfo->pStorage->status = FDFS_STORAGE_STATUS_WAIT_SYNC;
 	pClientInfo->pGroup->version++;
+	pClientInfo->pStorage->chg_version = \
+			pClientInfo->pGroup->version;
 
 	tracker_save_storages();
 	return 0;
@@ -1272,13 +1976,96 @@ static int tracker_deal_storage_report(TrackerClientInfo *pClientInfo, \
 	return tracker_check_and_sync(pClientInfo, status);
 }
 
+static int tracker_update_storage_stat(TrackerClientInfo *pClientInfo, \
+			FDFSStorageStatBuff *pStatBuff)
+{
+	FDFSStorageStat *pStat;
+	int upload_count;
+
+	pStat = &(pClientInfo->pStorage->stat);
+
+	pStat->total_upload_count = \
+		buff2int(pStatBuff->sz_total_upload_count);
+	upload_count = buff2int(pStatBuff->sz_success_upload_count);
+
+	/* the count is cumulative, the uploads before the tracker started
+	   are not recent */
+	if (!pClientInfo->pStorage->upload_count_inited)
+	{
+		pClientInfo->pStorage->upload_count_inited = true;
+	}
+	else if (upload_count > pStat->success_upload_count)
+	{
+		pClientInfo->pStorage->recent_uploads += \
+			upload_count - pStat->success_upload_count;
+	}
+	pStat->success_upload_count = upload_count;
+	pStat->total_download_count = \
+		buff2int(pStatBuff->sz_total_download_count);
+	pStat->success_download_count = \
+		buff2int(pStatBuff->sz_success_download_count);
+	pStat->total_set_meta_count = \
+		buff2int(pStatBuff->sz_total_set_meta_count);
+	pStat->success_set_meta_count = \
+		buff2int(pStatBuff->sz_success_set_meta_count);
+	pStat->total_delete_count = \
+		buff2int(pStatBuff->sz_total_delete_count);
+	pStat->success_delete_count = \
+		buff2int(pStatBuff->sz_success_delete_count);
+	pStat->total_get_meta_count = \
+		buff2int(pStatBuff->sz_total_get_meta_count);
+	pStat->success_get_meta_count = \
+		buff2int(pStatBuff->sz_success_get_meta_count);
+	pStat->last_source_update = \
+		buff2int(pStatBuff->sz_last_source_update);
+	pStat->last_sync_update = \
+		buff2int(pStatBuff->sz_last_sync_update);
+
+	if (++g_storage_stat_chg_count % TRACKER_SYNC_TO_FILE_FREQ == 0)
+	{
+		return tracker_save_storages();
+	}
+
+	//printf("g_storage_stat_chg_count=%d\n", g_storage_stat_chg_count);
+
+	return 0;
+}
+
+static void tracker_pack_storage_stat(FDFSStorageStat *pStat, \
+			FDFSStorageStatBuff *pStatBuff)
+{
+	int2buff(pStat->total_upload_count, pStatBuff->sz_total_upload_count);
+	int2buff(pStat->success_upload_count, \
+		pStatBuff->sz_success_upload_count);
+	int2buff(pStat->total_set_meta_count, \
+		pStatBuff->sz_total_set_meta_count);
+	int2buff(pStat->success_set_meta_count, \
+		pStatBuff->sz_success_set_meta_count);
+	int2buff(pStat->total_delete_count, pStatBuff->sz_total_delete_count);
+	int2buff(pStat->success_delete_count, \
+		pStatBuff->sz_success_delete_count);
+	int2buff(pStat->total_download_count, \
+		pStatBuff->sz_total_download_count);
+	int2buff(pStat->success_download_count, \
+		pStatBuff->sz_success_download_count);
+	int2buff(pStat->total_get_meta_count, \
+		pStatBuff->sz_total_get_meta_count);
+	int2buff(pStat->success_get_meta_count, \
+		pStatBuff->sz_success_get_meta_count);
+	int2buff((int)pStat->last_source_update, \
+		pStatBuff->sz_last_source_update);
+	int2buff((int)pStat->last_sync_update, \
+		pStatBuff->sz_last_sync_update);
+}
+
 static int tracker_deal_storage_beat(TrackerClientInfo *pClientInfo, \
 				const int nInPackLen)
 {
 	int status;
 	FDFSStorageStatBuff statBuff;
-	FDFSStorageStat *pStat;
  
+	pClientInfo->pStorage->recent_uploads = \
+			pClientInfo->pStorage->recent_uploads * 3 / 4;
 	while (1)
 	{
 		if (nInPackLen == 0)
@@ -1315,44 +2102,189 @@ static int tracker_deal_storage_beat(TrackerClientInfo *pClientInfo, \
 			break;
 		}
 
-		pStat = &(pClientInfo->pStorage->stat);
-
-		pStat->total_upload_count = \
-			buff2int(statBuff.sz_total_upload_count);
-		pStat->success_upload_count = \
-			buff2int(statBuff.sz_success_upload_count);
-		pStat->total_download_count = \
-			buff2int(statBuff.sz_total_download_count);
-		pStat->success_download_count = \
-			buff2int(statBuff.sz_success_download_count);
-		pStat->total_set_meta_count = \
-			buff2int(statBuff.sz_total_set_meta_count);
-		pStat->success_set_meta_count = \
-			buff2int(statBuff.sz_success_set_meta_count);
-		pStat->total_delete_count = \
-			buff2int(statBuff.sz_total_delete_count);
-		pStat->success_delete_count = \
-			buff2int(statBuff.sz_success_delete_count);
-		pStat->total_get_meta_count = \
-			buff2int(statBuff.sz_total_get_meta_count);
-		pStat->success_get_meta_count = \
-			buff2int(statBuff.sz_success_get_meta_count);
-		pStat->last_source_update = \
-			buff2int(statBuff.sz_last_source_update);
-		pStat->last_sync_update = \
-			buff2int(statBuff.sz_last_sync_update);
-
-		if (++g_storage_stat_chg_count % TRACKER_SYNC_TO_FILE_FREQ == 0)
-		{
-			status = tracker_save_storages();
+		status = tracker_update_storage_stat(pClientInfo, &statBuff);
+		break;
+	}
+
+	if (status == 0)
+	{
+		tracker_check_dirty(pClientInfo);
+		tracker_mem_active_store_server(pClientInfo->pGroup, \
+				pClientInfo->pStorage);
+	}
+
+	//printf("deal heart beat, status=%d\n", status);
+	return tracker_check_and_sync(pClientInfo, status);
+}
+
+/*
+send the storage servers changed since the group version last seen
+by the storage server, the full list when it has seen nothing or the
+version is from a former run of the tracker
+*/
+static int tracker_check_and_sync_delta(TrackerClientInfo *pClientInfo, \
+			const int status, const int seen_version)
+{
+	TrackerHeader resp;
+	TrackerDeltaBeatRespHeader *pRespHeader;
+	FDFSStorageDetail **ppServer;
+	FDFSStorageDetail **ppEnd;
+	FDFSStorageBrief *pDestServer;
+	FDFSGroupInfo *pGroup;
+	char out_buff[sizeof(TrackerDeltaBeatRespHeader) + \
+		sizeof(FDFSStorageBrief) * FDFS_MAX_SERVERS_EACH_GROUP];
+	int group_version;
+	int out_len;
+	bool bFullList;
+
+	resp.cmd = TRACKER_PROTO_CMD_STORAGE_RESP;
+	resp.status = status;
+
+	pGroup = pClientInfo->pGroup;
+	group_version = pGroup != NULL ? pGroup->version : 0;
+	out_len = 0;
+	if (status == 0 && pGroup != NULL && seen_version != group_version)
+	{
+		bFullList = seen_version <= 0 || seen_version > group_version;
+		pRespHeader = (TrackerDeltaBeatRespHeader *)out_buff;
+		int2buff(group_version, pRespHeader->sz_group_version);
+		pRespHeader->full_list = bFullList;
+
+		pDestServer = (FDFSStorageBrief *)(out_buff + \
+				sizeof(TrackerDeltaBeatRespHeader));
+		ppEnd = pGroup->sorted_servers + pGroup->count;
+		for (ppServer=pGroup->sorted_servers; ppServer<ppEnd; \
+			ppServer++)
+		{
+			if (!bFullList && (*ppServer)->chg_version <= \
+				seen_version)
+			{
+				continue;
+			}
+
+			pDestServer->status = (*ppServer)->status;
+			memcpy(pDestServer->ip_addr, (*ppServer)->ip_addr, \
+				FDFS_IPADDR_SIZE);
+			pDestServer++;
+		}
+
+		out_len = (char *)pDestServer - out_buff;
+		pClientInfo->pStorage->version = group_version;
+	}
+
+	sprintf(resp.pkg_len, "%x", out_len);
+	if (tcpsenddata(pClientInfo->sock, \
+		&resp, sizeof(resp), g_network_timeout) != 1 || \
+		(out_len > 0 && tcpsenddata(pClientInfo->sock, \
+		out_buff, out_len, g_network_timeout) != 1))
+	{
+		logError("file: "__FILE__", line: %d, " \
+			"client ip: %s, send data fail, " \
+			"errno: %d, error info: %s", \
+			__LINE__, pClientInfo->ip_addr, \
+			errno, strerror(errno));
+		return errno != 0 ? errno : EPIPE;
+	}
+
+	return status;
+}
+
+/**
+pkg format:
+Header
+TrackerDeltaBeatReqHeader
+4 bytes for each changed stat field
+**/
+static int tracker_deal_storage_delta_beat(TrackerClientInfo *pClientInfo, \
+				const int nInPackLen)
+{
+	TrackerDeltaBeatReqHeader *pReqHeader;
+	FDFSStorageStatBuff statBuff;
+	char in_buff[sizeof(TrackerDeltaBeatReqHeader) + \
+			sizeof(FDFSStorageStatBuff)];
+	char *pField;
+	int stat_mask;
+	int seen_version;
+	int field_count;
+	int status;
+	int i;
+
+	pClientInfo->pStorage->recent_uploads = \
+			pClientInfo->pStorage->recent_uploads * 3 / 4;
+	seen_version = 0;
+	while (1)
+	{
+		if (nInPackLen < sizeof(TrackerDeltaBeatReqHeader) || \
+			nInPackLen > sizeof(in_buff) || \
+			(nInPackLen - sizeof(TrackerDeltaBeatReqHeader)) % 4 != 0)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"cmd=%d, client ip: %s, package size %d " \
+				"is not correct", __LINE__, \
+				TRACKER_PROTO_CMD_STORAGE_DELTA_BEAT, \
+				pClientInfo->ip_addr, nInPackLen);
+			status = EINVAL;
+			break;
+		}
+
+		if(tcprecvdata(pClientInfo->sock, in_buff, \
+			nInPackLen, g_network_timeout) != 1)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"cmd=%d, client ip addr: %s, recv data fail, " \
+				"errno: %d, error info: %s.", \
+				__LINE__, \
+				TRACKER_PROTO_CMD_STORAGE_DELTA_BEAT, \
+				pClientInfo->ip_addr, \
+				errno, strerror(errno));
+			status = errno != 0 ? errno : EPIPE;
+			break;
 		}
-		else
+
+		pReqHeader = (TrackerDeltaBeatReqHeader *)in_buff;
+		seen_version = buff2int((unsigned char *) \
+					pReqHeader->sz_group_version);
+		stat_mask = buff2int((unsigned char *) \
+					pReqHeader->sz_stat_mask);
+		if (stat_mask == 0)
 		{
 			status = 0;
+			break;
+		}
+
+		field_count = 0;
+		for (i=0; i<FDFS_STORAGE_STAT_FIELD_COUNT; i++)
+		{
+			if (stat_mask & (1 << i))
+			{
+				field_count++;
+			}
+		}
+		if (nInPackLen != sizeof(TrackerDeltaBeatReqHeader) + \
+				4 * field_count)
+		{
+			logError("file: "__FILE__", line: %d, " \
+				"client ip: %s, package size %d is not " \
+				"correct, stat mask: %x", __LINE__, \
+				pClientInfo->ip_addr, nInPackLen, stat_mask);
+			status = EINVAL;
+			break;
 		}
 
-		//printf("g_storage_stat_chg_count=%d\n", g_storage_stat_chg_count);
+		//only the changed fields are sent, others keep unchanged
+		tracker_pack_storage_stat(&(pClientInfo->pStorage->stat), \
+					&statBuff);
+		pField = in_buff + sizeof(TrackerDeltaBeatReqHeader);
+		for (i=0; i<FDFS_STORAGE_STAT_FIELD_COUNT; i++)
+		{
+			if (stat_mask & (1 << i))
+			{
+				memcpy((char *)&statBuff + 4 * i, pField, 4);
+				pField += 4;
+			}
+		}
 
+		status = tracker_update_storage_stat(pClientInfo, &statBuff);
 		break;
 	}
 
@@ -1363,8 +2295,7 @@ static int tracker_deal_storage_beat(TrackerClientInfo *pClientInfo, \
 				pClientInfo->pStorage);
 	}
 
-	//printf("deal heart beat, status=%d\n", status);
-	return tracker_check_and_sync(pClientInfo, status);
+	return tracker_check_and_sync_delta(pClientInfo, status, seen_version);
 }
 
 void* tracker_thread_entrance(void* arg)
@@ -1425,6 +2356,19 @@ data buff (struct)
 				break;
 			}
 		}
+		else if (header.cmd == TRACKER_PROTO_CMD_STORAGE_DELTA_BEAT)
+		{
+			if (tracker_check_logined(&client_info) != 0)
+			{
+				break;
+			}
+
+			if (tracker_deal_storage_delta_beat(&client_info, \
+				nInPackLen) != 0)
+			{
+				break;
+			}
+		}
 		else if (header.cmd == TRACKER_PROTO_CMD_STORAGE_REPORT)
 		{
 			if (tracker_check_logined(&client_info) != 0)
@@ -1475,6 +2419,24 @@ data buff (struct)
 				break;
 			}
 		}
+		else if (header.cmd == \
+			TRACKER_PROTO_CMD_SERVICE_QUERY_STORE_BATCH)
+		{
+			if (tracker_deal_service_query_store_batch( \
+				&client_info, nInPackLen, true) != 0)
+			{
+				break;
+			}
+		}
+		else if (header.cmd == \
+			TRACKER_PROTO_CMD_SERVICE_QUERY_FETCH_BATCH)
+		{
+			if (tracker_deal_service_query_fetch_batch( \
+				&client_info, nInPackLen) != 0)
+			{
+				break;
+			}
+		}
 		else if (header.cmd == TRACKER_PROTO_CMD_SERVER_LIST_GROUP)
 		{
 			if (tracker_deal_server_list_groups(&client_info, \
@@ -1483,6 +2445,15 @@ data buff (struct)
 				break;
 			}
 		}
+		else if (header.cmd == \
+			TRACKER_PROTO_CMD_SERVER_TOPOLOGY_VERSION)
+		{
+			if (tracker_deal_server_topology_version( \
+				&client_info, nInPackLen) != 0)
+			{
+				break;
+			}
+		}
 		else if (header.cmd == TRACKER_PROTO_CMD_SERVER_LIST_STORAGE)
 		{
 			if (tracker_deal_server_list_group_storages( \
@@ -1515,6 +2486,31 @@ data buff (struct)
 				break;
 			}
 		}
+		else if (header.cmd == TRACKER_PROTO_CMD_TRACKER_PING)
+		{
+			if (tracker_deal_tracker_ping(&client_info, \
+				nInPackLen) != 0)
+			{
+				break;
+			}
+		}
+		else if (header.cmd == TRACKER_PROTO_CMD_TRACKER_GET_STATUS)
+		{
+			if (tracker_deal_tracker_get_status(&client_info, \
+				nInPackLen) != 0)
+			{
+				break;
+			}
+		}
+		else if (header.cmd == TRACKER_PROTO_CMD_TRACKER_QUERY_STORE)
+		{
+			//never forward again to avoid loop
+			if (tracker_deal_service_query_store_batch( \
+				&client_info, nInPackLen, false) != 0)
+			{
+				break;
+			}
+		}
 		else if (header.cmd == TRACKER_PROTO_CMD_STORAGE_QUIT)
 		{
 			break;
@@ -1546,6 +2542,12 @@ data buff (struct)
 	if (client_info.pStorage != NULL)
 	{
 		--(*(client_info.pStorage->ref_count));
+		tracker_mem_pthread_lock();
+		if (client_info.pStorage->connection_count > 0)
+		{
+			client_info.pStorage->connection_count--;
+		}
+		tracker_mem_pthread_unlock();
 	}
 
 	if (pthread_mutex_lock(&g_tracker_thread_lock) != 0)
@@ -16,6 +16,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <time.h>
+#include <stdint.h>
 #include "fdfs_define.h"
 
 #define FDFS_ONE_MB	(1024 * 1024)
@@ -40,6 +41,9 @@
 #define FDFS_STORE_LOOKUP_ROUND_ROBIN	0  //round robin
 #define FDFS_STORE_LOOKUP_SPEC_GROUP	1  //specify group
 #define FDFS_STORE_LOOKUP_LOAD_BALANCE	2  //load balance
+#define FDFS_STORE_LOOKUP_WEIGHTED	3  //weighted by free space and load
+
+#define FDFS_DEF_STORE_MAX_SHARE	50  //percent, for the weighted lookup
 
 typedef struct
 {
@@ -108,6 +112,11 @@ typedef struct StructFDFSStorageDetail
 
 	int *ref_count;   //group/storage servers referer count
 	int version;      //current server version
+	int chg_version;  //group version when the status changed
+	int recent_uploads;  //decayed upload count, updated by heart beat
+	bool upload_count_inited;  //the first beat is the baseline
+	int connection_count;  //connections from the storage server
+	time_t peer_report_time;  //the last time a peer reported it connected
 	FDFSStorageStat stat;
 } FDFSStorageDetail;
 
@@ -125,6 +134,7 @@ typedef struct
 	FDFSStorageDetail **active_servers;  //order by addr
 	int current_read_server;
 	int current_write_server;
+	int64_t current_weight;  //for weighted store lookup
 	int *ref_count;  //groups referer count
 	int version;     //current group version
 	time_t last_source_update;
@@ -140,6 +150,7 @@ typedef struct
 	FDFSGroupInfo *pStoreGroup;
 	int current_write_group;
 	byte store_lookup;
+	byte store_max_share; //max percent of uploads to one group, 0 for no limit
 	char store_group[FDFS_GROUP_NAME_MAX_LEN + 1];
 } FDFSGroups;
 
@@ -167,6 +178,12 @@ typedef struct
 {
 	int sock;
 	char ip_addr[FDFS_IPADDR_SIZE];
+	char *meta_buff;     //the buffer to merge metadata, reused by requests
+	int meta_buff_size;
+	char *in_buff;       //the buffer to recv the request, reused by requests
+	int in_buff_size;
+	char proto_version;  //the protocol version of the current request
+	int request_id;      //the request id of the current request
 } StorageClientInfo;
 
 typedef struct
@@ -175,6 +192,15 @@ typedef struct
 	char value[FDFS_MAX_META_VALUE_LEN + 1];
 } FDFSMetaData;
 
+/* one metadata item refers to the packed metadata buffer, no copy */
+typedef struct
+{
+	const char *name;
+	const char *value;
+	int name_len;
+	int value_len;
+} FDFSMetaSlice;
+
 typedef struct
 {
 	FDFSGroupInfo *pGroup;